@@ -0,0 +1,198 @@
+//
+// Created by PingZi on 2020/9/14.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include "DecoderThreads.h"
+
+/**
+ * 解码线程数的基准测试: 用不同的 thread_count 解码同一个文件的视频流, 比较每秒解码的帧数.
+ * 解码器通过 open_decoder_context (Common/DecoderThreads.h) 打开, 和三个工具使用的是同一套设置.
+ *
+ * 用法: DecodeBenchmark <input> [-threads 1,2,4,8] [-decode-thread-type <frame|slice|auto>] [-frames N]
+ * 不给 -threads 的时候测试 1, 2, 4... 直到核数, 以及自动选择的线程数.
+ */
+
+typedef struct DecodeResult {
+    int threads;
+    int64_t frames;
+    double seconds;
+} DecodeResult;
+
+static int decode_file(const char *input, const DecoderThreading *threading, int64_t max_frames,
+                       DecodeResult *result) {
+    AVFormatContext *format_context = nullptr;
+    AVCodecContext *decoder = nullptr;
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int stream_index = -1;
+    int response = 0;
+    bool flushing = false;
+    auto begin = std::chrono::steady_clock::now();
+
+    if (packet == nullptr || frame == nullptr) {
+        response = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    response = avformat_open_input(&format_context, input, nullptr, nullptr);
+    if (response < 0) {
+        goto end;
+    }
+    response = avformat_find_stream_info(format_context, nullptr);
+    if (response < 0) {
+        goto end;
+    }
+    stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (stream_index < 0) {
+        response = stream_index;
+        goto end;
+    }
+    for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+        if (static_cast<int>(i) != stream_index) {
+            format_context->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    response = open_decoder_context(format_context->streams[stream_index]->codecpar, threading, nullptr, &decoder);
+    if (response < 0) {
+        goto end;
+    }
+    result->threads = decoder->thread_count;
+
+    // 打开文件和解码器不计入时间
+    begin = std::chrono::steady_clock::now();
+    while (max_frames <= 0 || result->frames < max_frames) {
+        if (!flushing) {
+            response = av_read_frame(format_context, packet);
+            if (response == AVERROR_EOF) {
+                flushing = true;
+                response = avcodec_send_packet(decoder, nullptr);
+            } else if (response >= 0) {
+                if (packet->stream_index != stream_index) {
+                    av_packet_unref(packet);
+                    continue;
+                }
+                response = avcodec_send_packet(decoder, packet);
+                av_packet_unref(packet);
+            }
+            if (response < 0 && response != AVERROR(EAGAIN)) {
+                goto end;
+            }
+        }
+
+        while ((response = avcodec_receive_frame(decoder, frame)) >= 0) {
+            result->frames++;
+            av_frame_unref(frame);
+        }
+        if (response == AVERROR_EOF) {
+            response = 0;
+            break;
+        }
+        if (response != AVERROR(EAGAIN)) {
+            goto end;
+        }
+        response = 0;
+    }
+
+    end:
+    result->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    avcodec_free_context(&decoder);
+    if (format_context != nullptr) {
+        avformat_close_input(&format_context);
+    }
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    return response;
+}
+
+static std::vector<int> parse_thread_list(const char *text) {
+    std::vector<int> counts;
+    const char *current = text;
+    while (*current != '\0') {
+        char *next = nullptr;
+        long count = strtol(current, &next, 10);
+        if (next == current) {
+            break;
+        }
+        if (count > 0) {
+            counts.push_back(static_cast<int>(count));
+        }
+        current = *next == ',' ? next + 1 : next;
+    }
+    return counts;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: DecodeBenchmark <input> [-threads 1,2,4,8] [-decode-thread-type <frame|slice|auto>] "
+                        "[-frames N]\n");
+        return -1;
+    }
+
+    const char *input = argv[1];
+    DecoderThreading threading = {};
+    std::vector<int> counts;
+    int64_t max_frames = 0;
+    for (int i = 2; i < argc; i++) {
+        int consumed = parse_decoder_threading_option(argc, argv, i, &threading);
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            counts = parse_thread_list(argv[++i]);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            max_frames = atoll(argv[++i]);
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (counts.empty()) {
+        int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        for (int count = 1; count <= cores; count *= 2) {
+            counts.push_back(count);
+        }
+        // 最后再测一次自动选择的线程数
+        counts.push_back(0);
+    }
+
+    printf("input: %s, thread type: %s\n", input,
+           threading.thread_type == FF_THREAD_FRAME ? "frame" :
+           threading.thread_type == FF_THREAD_SLICE ? "slice" : "frame+slice");
+    printf("%-8s %8s %10s %10s %8s\n", "threads", "frames", "seconds", "fps", "speedup");
+
+    double baseline = 0;
+    for (int count : counts) {
+        threading.thread_count = count;
+        DecodeResult result = {};
+        int response = decode_file(input, &threading, max_frames, &result);
+        if (response < 0) {
+            char message[AV_ERROR_MAX_STRING_SIZE] = {};
+            av_strerror(response, message, sizeof(message));
+            fprintf(stderr, "decode with %d threads failed: %s\n", count, message);
+            return -1;
+        }
+
+        double fps = result.seconds > 0 ? result.frames / result.seconds : 0;
+        if (baseline == 0) {
+            baseline = fps;
+        }
+        char label[16];
+        snprintf(label, sizeof(label), count == 0 ? "auto(%d)" : "%d", result.threads);
+        printf("%-8s %8lld %10.3f %10.1f %7.2fx\n", label, (long long) result.frames, result.seconds, fps,
+               baseline > 0 ? fps / baseline : 0.0);
+        fflush(stdout);
+    }
+    return 0;
+}
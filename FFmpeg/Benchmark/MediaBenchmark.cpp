@@ -0,0 +1,641 @@
+//
+// Created by PingZi on 2020/9/10.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libavutil/channel_layout.h"
+#include "libavutil/mathematics.h"
+}
+
+/**
+ * 三个工具 (Remuxing, SimpleGrayImage, Transcoding) 的端到端基准测试.
+ *
+ * 测试素材用链接进来的 libavcodec 在本地生成 (mpeg4 视频 + aac 音频, 画面和声音都由帧号算出来),
+ * 同样的参数每次生成的内容一样, 不需要网络, 也不依赖外部文件. 生成过的素材按名字缓存在工作目录里.
+ *
+ * 每个工具用 fork/exec 在单独的目录里运行, 这样 wait4 拿到的 ru_maxrss 就是这一次运行的峰值内存;
+ * 分阶段计时由工具自己的 -profile-json 输出 (Common/Profiler.h), 原样嵌进结果里.
+ *
+ * 用法: MediaBenchmark [--remuxing <path>] [--gray <path>] [--transcoding <path>] [--vcodec <encoder>]
+ *                      [--work <dir>] [--out <results.json>] [--repeat N]
+ *
+ * 只在 Linux 上使用 (fork, wait4).
+ */
+
+typedef struct MediaSpec {
+    const char *name;
+    int width;
+    int height;
+    int seconds;
+} MediaSpec;
+
+static const MediaSpec media_specs[] = {
+        {"bench-320x240-5s",   320,  240, 5},
+        {"bench-640x360-10s",  640,  360, 10},
+        {"bench-1280x720-10s", 1280, 720, 10},
+};
+
+#define BENCH_FRAME_RATE 25
+#define BENCH_SAMPLE_RATE 48000
+
+typedef struct Media {
+    const MediaSpec *spec;
+    std::string path;
+    int64_t bytes;
+    int frames;
+} Media;
+
+typedef struct ToolRun {
+    int exit_code;
+    // 被信号结束时的信号, 否则是 0
+    int signal;
+    double seconds;
+    long peak_rss_kb;
+    int images;
+    int64_t output_bytes;
+    std::string stages;
+} ToolRun;
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t file_size(const std::string &path) {
+    struct stat st = {};
+    if (stat(path.c_str(), &st) != 0) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+static bool read_file(const std::string &path, std::string *content) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    char buffer[4096];
+    size_t length;
+    content->clear();
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        content->append(buffer, length);
+    }
+    fclose(file);
+    return true;
+}
+
+// 画面: 斜向移动的灰度渐变, 加一个水平移动的方块, 色度随位置变化
+static void fill_video_frame(AVFrame *frame, int index) {
+    for (int y = 0; y < frame->height; y++) {
+        uint8_t *row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++) {
+            row[x] = static_cast<uint8_t>(x + y + index * 3);
+        }
+    }
+    int box = frame->height / 4;
+    int left = (index * 8) % std::max(1, frame->width - box);
+    for (int y = box; y < box * 2; y++) {
+        memset(frame->data[0] + y * frame->linesize[0] + left, 235, box);
+    }
+    for (int y = 0; y < frame->height / 2; y++) {
+        uint8_t *u = frame->data[1] + y * frame->linesize[1];
+        uint8_t *v = frame->data[2] + y * frame->linesize[2];
+        for (int x = 0; x < frame->width / 2; x++) {
+            u[x] = static_cast<uint8_t>(128 + y + index * 2);
+            v[x] = static_cast<uint8_t>(64 + x + index * 5);
+        }
+    }
+}
+
+// 声音: 左声道 440Hz, 右声道 660Hz 的正弦波
+static void fill_audio_frame(AVFrame *frame, int64_t first_sample) {
+    float *left = reinterpret_cast<float *>(frame->data[0]);
+    float *right = reinterpret_cast<float *>(frame->data[1]);
+    for (int i = 0; i < frame->nb_samples; i++) {
+        double t = static_cast<double>(first_sample + i) / BENCH_SAMPLE_RATE;
+        left[i] = static_cast<float>(0.3 * sin(2 * M_PI * 440 * t));
+        right[i] = static_cast<float>(0.3 * sin(2 * M_PI * 660 * t));
+    }
+}
+
+static int open_encoder(AVFormatContext *format_context, AVCodecID codec_id, const MediaSpec *spec,
+                        AVCodecContext **codec_context, AVStream **stream) {
+    AVCodec *codec = avcodec_find_encoder(codec_id);
+    if (codec == nullptr) {
+        fprintf(stderr, "cannot find encoder: %s\n", avcodec_get_name(codec_id));
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    *stream = avformat_new_stream(format_context, nullptr);
+    *codec_context = avcodec_alloc_context3(codec);
+    if (*stream == nullptr || *codec_context == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    AVCodecContext *context = *codec_context;
+    if (codec->type == AVMEDIA_TYPE_VIDEO) {
+        context->width = spec->width;
+        context->height = spec->height;
+        context->pix_fmt = AV_PIX_FMT_YUV420P;
+        context->time_base = AVRational{1, BENCH_FRAME_RATE};
+        context->framerate = AVRational{BENCH_FRAME_RATE, 1};
+        context->gop_size = BENCH_FRAME_RATE;
+        context->bit_rate = static_cast<int64_t>(spec->width) * spec->height * 4;
+    } else {
+        context->sample_fmt = AV_SAMPLE_FMT_FLTP;
+        context->sample_rate = BENCH_SAMPLE_RATE;
+        context->channel_layout = AV_CH_LAYOUT_STEREO;
+        context->channels = 2;
+        context->time_base = AVRational{1, BENCH_SAMPLE_RATE};
+        context->bit_rate = 128 * 1000;
+    }
+    if (format_context->oformat->flags & AVFMT_GLOBALHEADER) {
+        context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    // 单线程编码, 保证同样的参数生成同样的文件
+    context->thread_count = 1;
+
+    int response = avcodec_open2(context, codec, nullptr);
+    if (response < 0) {
+        return response;
+    }
+    (*stream)->time_base = context->time_base;
+    return avcodec_parameters_from_context((*stream)->codecpar, context);
+}
+
+// 把编码器里能拿到的 packet 都写出去, frame 为 nullptr 时冲刷编码器
+static int encode_frame(AVFormatContext *format_context, AVCodecContext *codec_context, AVStream *stream,
+                        AVFrame *frame, AVPacket *packet) {
+    int response = avcodec_send_frame(codec_context, frame);
+    if (response < 0) {
+        return response;
+    }
+    while ((response = avcodec_receive_packet(codec_context, packet)) >= 0) {
+        av_packet_rescale_ts(packet, codec_context->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+        response = av_interleaved_write_frame(format_context, packet);
+        if (response < 0) {
+            return response;
+        }
+    }
+    return response == AVERROR(EAGAIN) || response == AVERROR_EOF ? 0 : response;
+}
+
+static int generate_media(const MediaSpec *spec, const char *filename) {
+    int ret = 0;
+    int response = 0;
+    AVFormatContext *format_context = nullptr;
+    AVCodecContext *video_context = nullptr;
+    AVCodecContext *audio_context = nullptr;
+    AVStream *video_stream = nullptr;
+    AVStream *audio_stream = nullptr;
+    AVFrame *video_frame = av_frame_alloc();
+    AVFrame *audio_frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    int total_frames = spec->seconds * BENCH_FRAME_RATE;
+    int64_t total_samples = static_cast<int64_t>(spec->seconds) * BENCH_SAMPLE_RATE;
+    int video_index = 0;
+    int64_t audio_samples = 0;
+
+    if (video_frame == nullptr || audio_frame == nullptr || packet == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    response = avformat_alloc_output_context2(&format_context, nullptr, "mp4", filename);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = open_encoder(format_context, AV_CODEC_ID_MPEG4, spec, &video_context, &video_stream);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = open_encoder(format_context, AV_CODEC_ID_AAC, spec, &audio_context, &audio_stream);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    video_frame->format = video_context->pix_fmt;
+    video_frame->width = video_context->width;
+    video_frame->height = video_context->height;
+    audio_frame->format = audio_context->sample_fmt;
+    audio_frame->channel_layout = audio_context->channel_layout;
+    audio_frame->sample_rate = audio_context->sample_rate;
+    audio_frame->nb_samples = audio_context->frame_size > 0 ? audio_context->frame_size : 1024;
+    response = av_frame_get_buffer(video_frame, 0);
+    if (response >= 0) {
+        response = av_frame_get_buffer(audio_frame, 0);
+    }
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    response = avio_open(&format_context->pb, filename, AVIO_FLAG_WRITE);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = avformat_write_header(format_context, nullptr);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    // 按时间先后交替送视频帧和音频帧, 让 muxer 的交织缓冲保持很小
+    while (video_index < total_frames || audio_samples < total_samples) {
+        bool write_video = audio_samples >= total_samples ||
+                           (video_index < total_frames &&
+                            av_compare_ts(video_index, video_context->time_base,
+                                          audio_samples, audio_context->time_base) <= 0);
+        if (write_video) {
+            response = av_frame_make_writable(video_frame);
+            if (response < 0) {
+                ret = response;
+                goto end;
+            }
+            fill_video_frame(video_frame, video_index);
+            video_frame->pts = video_index++;
+            response = encode_frame(format_context, video_context, video_stream, video_frame, packet);
+        } else {
+            response = av_frame_make_writable(audio_frame);
+            if (response < 0) {
+                ret = response;
+                goto end;
+            }
+            fill_audio_frame(audio_frame, audio_samples);
+            audio_frame->pts = audio_samples;
+            audio_samples += audio_frame->nb_samples;
+            response = encode_frame(format_context, audio_context, audio_stream, audio_frame, packet);
+        }
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    }
+
+    response = encode_frame(format_context, video_context, video_stream, nullptr, packet);
+    if (response >= 0) {
+        response = encode_frame(format_context, audio_context, audio_stream, nullptr, packet);
+    }
+    if (response >= 0) {
+        response = av_write_trailer(format_context);
+    }
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    end:
+    if (format_context != nullptr) {
+        if (format_context->pb != nullptr) {
+            avio_closep(&format_context->pb);
+        }
+        avformat_free_context(format_context);
+    }
+    avcodec_free_context(&video_context);
+    avcodec_free_context(&audio_context);
+    av_frame_free(&video_frame);
+    av_frame_free(&audio_frame);
+    av_packet_free(&packet);
+    if (ret < 0) {
+        unlink(filename);
+    }
+    return ret;
+}
+
+static int prepare_media(const std::string &work_dir, const MediaSpec *spec, Media *media) {
+    media->spec = spec;
+    media->path = work_dir + "/" + spec->name + ".mp4";
+    media->frames = spec->seconds * BENCH_FRAME_RATE;
+
+    if (file_size(media->path) <= 0) {
+        fprintf(stderr, "generating %s...\n", media->path.c_str());
+        // 先写临时文件再改名, 中途中断不会留下半个文件被当成缓存
+        std::string temp = media->path + ".tmp.mp4";
+        int response = generate_media(spec, temp.c_str());
+        if (response < 0) {
+            char message[AV_ERROR_MAX_STRING_SIZE] = {};
+            av_strerror(response, message, sizeof(message));
+            fprintf(stderr, "cannot generate %s: %s\n", media->path.c_str(), message);
+            return response;
+        }
+        rename(temp.c_str(), media->path.c_str());
+    }
+    media->bytes = file_size(media->path);
+    return 0;
+}
+
+// 清空运行目录, 并统计上一次运行留下的输出
+static void scan_run_dir(const std::string &dir, bool remove_files, int *images, int64_t *output_bytes) {
+    DIR *handle = opendir(dir.c_str());
+    if (handle == nullptr) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string path = dir + "/" + name;
+        if (remove_files) {
+            unlink(path.c_str());
+            continue;
+        }
+        if (name == "log.txt" || name == "stages.json") {
+            continue;
+        }
+        *output_bytes += std::max<int64_t>(0, file_size(path));
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".pgm") == 0) {
+            (*images)++;
+        }
+    }
+    closedir(handle);
+}
+
+static ToolRun run_tool(const std::string &run_dir, const std::vector<std::string> &args) {
+    ToolRun run = {};
+    run.exit_code = -1;
+    scan_run_dir(run_dir, true, nullptr, nullptr);
+
+    std::vector<char *> argv;
+    for (const std::string &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    int64_t begin = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return run;
+    }
+    if (pid == 0) {
+        // 子进程: 在运行目录里执行, 输出都写进 log.txt
+        if (chdir(run_dir.c_str()) != 0) {
+            _exit(126);
+        }
+        int log = open("log.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage = {};
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return run;
+    }
+    run.seconds = (now_ns() - begin) / 1e9;
+    // Linux 上 ru_maxrss 的单位是 KB
+    run.peak_rss_kb = usage.ru_maxrss;
+    if (WIFEXITED(status)) {
+        run.exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        run.signal = WTERMSIG(status);
+    }
+
+    scan_run_dir(run_dir, false, &run.images, &run.output_bytes);
+    if (!read_file(run_dir + "/stages.json", &run.stages)) {
+        run.stages.clear();
+    }
+    return run;
+}
+
+static std::string json_string(const std::string &value) {
+    std::string result = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            result += escaped;
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+// 嵌进结果的时候去掉 stages.json 末尾的换行, 再加一层缩进
+static std::string indent_json(const std::string &json, const char *indent) {
+    std::string result;
+    size_t end = json.find_last_not_of(" \n\r\t");
+    for (size_t i = 0; end != std::string::npos && i <= end; i++) {
+        result += json[i];
+        if (json[i] == '\n') {
+            result += indent;
+        }
+    }
+    return result.empty() ? "null" : result;
+}
+
+typedef struct ToolSpec {
+    // 结果里的名字
+    const char *name;
+    // remuxing / gray / transcoding, 同一个工具可以带不同的参数测多次
+    const char *kind;
+    std::string path;
+    std::vector<std::string> extra;
+} ToolSpec;
+
+static std::vector<std::string> tool_arguments(const ToolSpec &tool, const Media &media, const char *vcodec) {
+    std::vector<std::string> args = {tool.path, media.path};
+    if (strcmp(tool.kind, "gray") == 0) {
+        // 解码整个文件, 每一帧都保存
+        args = {tool.path, "-extract", media.path, "-o", "."};
+    } else if (strcmp(tool.kind, "remuxing") == 0) {
+        args.emplace_back("output.mkv");
+    } else if (strcmp(tool.kind, "transcoding") == 0) {
+        args.emplace_back("output.mp4");
+        if (vcodec != nullptr) {
+            args.emplace_back("-vcodec");
+            args.emplace_back(vcodec);
+        }
+    }
+    args.insert(args.end(), tool.extra.begin(), tool.extra.end());
+    args.emplace_back("-profile-json");
+    args.emplace_back("stages.json");
+    return args;
+}
+
+static void write_run(FILE *file, const ToolSpec &tool, const Media &media, std::vector<ToolRun> &runs, bool first) {
+    // 取耗时的中位数那一次, 峰值内存取所有次里最大的
+    std::sort(runs.begin(), runs.end(), [](const ToolRun &a, const ToolRun &b) { return a.seconds < b.seconds; });
+    const ToolRun &median = runs[runs.size() / 2];
+    long peak_rss_kb = 0;
+    const ToolRun *failed = nullptr;
+    for (const ToolRun &run : runs) {
+        peak_rss_kb = std::max(peak_rss_kb, run.peak_rss_kb);
+        if (failed == nullptr && (run.exit_code != 0 || run.signal != 0)) {
+            failed = &run;
+        }
+    }
+    bool ok = failed == nullptr;
+
+    char status[64];
+    if (failed == nullptr) {
+        snprintf(status, sizeof(status), "ok");
+    } else if (failed->signal != 0) {
+        snprintf(status, sizeof(status), "signal %d", failed->signal);
+    } else {
+        snprintf(status, sizeof(status), "exit %d", failed->exit_code);
+    }
+
+    // gray 按写出的图片数计算, 其他两个工具按输入的视频帧数
+    int frames = strcmp(tool.kind, "gray") == 0 ? median.images : media.frames;
+    double seconds = median.seconds > 0 ? median.seconds : 1e-9;
+
+    fprintf(file, "%s\n    {\n", first ? "" : ",");
+    fprintf(file, "      \"tool\": \"%s\",\n", tool.name);
+    fprintf(file, "      \"media\": \"%s\",\n", media.spec->name);
+    fprintf(file, "      \"status\": \"%s\",\n", status);
+    fprintf(file, "      \"repeat\": %d,\n", static_cast<int>(runs.size()));
+    fprintf(file, "      \"seconds\": %.6f,\n", median.seconds);
+    fprintf(file, "      \"frames\": %d,\n", frames);
+    fprintf(file, "      \"frames_per_second\": %.3f,\n", ok ? frames / seconds : 0.0);
+    fprintf(file, "      \"input_mb_per_second\": %.3f,\n", ok ? media.bytes / 1e6 / seconds : 0.0);
+    fprintf(file, "      \"output_bytes\": %lld,\n", (long long) median.output_bytes);
+    fprintf(file, "      \"mb_per_second\": %.3f,\n", ok ? median.output_bytes / 1e6 / seconds : 0.0);
+    fprintf(file, "      \"peak_rss_kb\": %ld,\n", peak_rss_kb);
+    fprintf(file, "      \"stages\": %s\n", indent_json(median.stages, "      ").c_str());
+    fprintf(file, "    }");
+}
+
+static std::string absolute_path(const char *path) {
+    char *resolved = realpath(path, nullptr);
+    if (resolved == nullptr) {
+        return path;
+    }
+    std::string result = resolved;
+    free(resolved);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    // gray 除了原始分辨率, 再测两种缩略图宽度, 和原始分辨率的写出速度对比
+    std::vector<ToolSpec> tools = {
+            {"remuxing",      "remuxing",    "", {}},
+            {"gray",          "gray",        "", {}},
+            {"gray-320",      "gray",        "", {"-width", "320"}},
+            {"gray-160-area", "gray",        "", {"-width", "160", "-scaler", "area"}},
+            {"transcoding",   "transcoding", "", {}},
+    };
+    std::string remuxing_path;
+    std::string gray_path;
+    std::string transcoding_path;
+    std::string work_dir = "media-benchmark";
+    const char *output = nullptr;
+    const char *vcodec = nullptr;
+    int repeat = 3;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--remuxing") == 0 && i + 1 < argc) {
+            remuxing_path = absolute_path(argv[++i]);
+        } else if (strcmp(argv[i], "--gray") == 0 && i + 1 < argc) {
+            gray_path = absolute_path(argv[++i]);
+        } else if (strcmp(argv[i], "--transcoding") == 0 && i + 1 < argc) {
+            transcoding_path = absolute_path(argv[++i]);
+        } else if (strcmp(argv[i], "--vcodec") == 0 && i + 1 < argc) {
+            vcodec = argv[++i];
+        } else if (strcmp(argv[i], "--work") == 0 && i + 1 < argc) {
+            work_dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "usage: MediaBenchmark [--remuxing <path>] [--gray <path>] [--transcoding <path>] "
+                            "[--vcodec <encoder>] [--work <dir>] [--out <results.json>] [--repeat N]\n");
+            return -1;
+        }
+    }
+
+    for (ToolSpec &tool : tools) {
+        tool.path = strcmp(tool.kind, "remuxing") == 0 ? remuxing_path :
+                    strcmp(tool.kind, "gray") == 0 ? gray_path : transcoding_path;
+    }
+
+    mkdir(work_dir.c_str(), 0755);
+    work_dir = absolute_path(work_dir.c_str());
+
+    std::vector<Media> medias;
+    for (const MediaSpec &spec : media_specs) {
+        Media media = {};
+        if (prepare_media(work_dir, &spec, &media) < 0) {
+            return -1;
+        }
+        medias.push_back(media);
+    }
+
+    FILE *file = output != nullptr ? fopen(output, "w") : stdout;
+    if (file == nullptr) {
+        perror(output);
+        return -1;
+    }
+
+    fprintf(file, "{\n  \"cpus\": %u,\n  \"media\": [", std::thread::hardware_concurrency());
+    for (size_t i = 0; i < medias.size(); i++) {
+        const Media &media = medias[i];
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"path\": %s, \"width\": %d, \"height\": %d, "
+                      "\"seconds\": %d, \"frames\": %d, \"bytes\": %lld}",
+                i == 0 ? "" : ",", media.spec->name, json_string(media.path).c_str(), media.spec->width,
+                media.spec->height, media.spec->seconds, media.frames, (long long) media.bytes);
+    }
+    fprintf(file, "\n  ],\n  \"runs\": [");
+
+    bool first = true;
+    for (const ToolSpec &tool : tools) {
+        if (tool.path.empty()) {
+            continue;
+        }
+        for (const Media &media : medias) {
+            std::string run_dir = work_dir + "/run-" + tool.name + "-" + media.spec->name;
+            mkdir(run_dir.c_str(), 0755);
+
+            std::vector<ToolRun> runs;
+            for (int i = 0; i < repeat; i++) {
+                runs.push_back(run_tool(run_dir, tool_arguments(tool, media, vcodec)));
+                fprintf(stderr, "%-14s %-20s run %d: %.3f s, exit %d\n", tool.name, media.spec->name, i + 1,
+                        runs.back().seconds, runs.back().exit_code);
+            }
+            write_run(file, tool, media, runs, first);
+            first = false;
+        }
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+//
+// Created by PingZi on 2020/9/2.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "MediaQueue.h"
+
+/**
+ * 队列的微基准测试: 多个生产者往队列里 push AVPacket, 多个消费者 pop 出来.
+ * 生产者把 push 时刻写进 packet->pts, 消费者用 pop 时刻减掉它得到交接延迟.
+ *
+ * 对比对象 (baseline) 是 mutex + condition_variable 的 BoundedQueue<AVPacket>, packet 按值放进队列,
+ * 和无锁队列的槽位一样只移动引用, 不 alloc, 这样比较的只是加锁的开销.
+ * mutex+alloc 一行是之前流水线的做法 (BoundedQueue<AVPacket *>, 每个元素 av_packet_alloc/av_packet_free),
+ * 单独列出来, 它和 mutex+condvar 的差就是每个元素分配内存的开销.
+ *
+ * 用法: QueueBenchmark [items per producer] [capacity]
+ */
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct BenchmarkResult {
+    double seconds;
+    int64_t items;
+    std::vector<int64_t> latencies;
+} BenchmarkResult;
+
+// 生产者: 返回 push 的结果; 消费者: 返回 pop 的结果, 拿到的 packet 放在参数里
+typedef std::function<int(AVPacket *)> QueueOperation;
+
+static BenchmarkResult run_benchmark(int producers, int consumers, int64_t items_per_producer,
+                                     const QueueOperation &push, const QueueOperation &pop,
+                                     const std::function<void()> &close) {
+    BenchmarkResult result = {};
+    result.items = items_per_producer * producers;
+
+    std::vector<std::vector<int64_t>> latencies(consumers);
+    std::atomic<int> running_producers(producers);
+    std::atomic<bool> start(false);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < producers; i++) {
+        threads.emplace_back([&] {
+            AVPacket *packet = av_packet_alloc();
+            while (!start.load()) {
+                std::this_thread::yield();
+            }
+            for (int64_t n = 0; n < items_per_producer; n++) {
+                packet->pts = now_ns();
+                if (push(packet) < 0) {
+                    break;
+                }
+            }
+            av_packet_free(&packet);
+            if (running_producers.fetch_sub(1) == 1) {
+                close();
+            }
+        });
+    }
+
+    for (int i = 0; i < consumers; i++) {
+        std::vector<int64_t> *samples = &latencies[i];
+        samples->reserve(result.items / consumers + 1);
+        threads.emplace_back([&, samples] {
+            AVPacket *packet = av_packet_alloc();
+            while (!start.load()) {
+                std::this_thread::yield();
+            }
+            while (pop(packet) == 0) {
+                samples->push_back(now_ns() - packet->pts);
+                av_packet_unref(packet);
+            }
+            av_packet_free(&packet);
+        });
+    }
+
+    int64_t begin = now_ns();
+    start.store(true);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    result.seconds = (now_ns() - begin) / 1e9;
+
+    for (std::vector<int64_t> &samples : latencies) {
+        result.latencies.insert(result.latencies.end(), samples.begin(), samples.end());
+    }
+    return result;
+}
+
+static int64_t percentile(std::vector<int64_t> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void report(const char *name, int producers, int consumers, BenchmarkResult result) {
+    int64_t p50 = percentile(result.latencies, 0.50);
+    int64_t p99 = percentile(result.latencies, 0.99);
+    printf("%-16s %dp/%dc  items: %8lld  ops/s: %12.0f  p50: %8lld ns  p99: %8lld ns\n",
+           name, producers, consumers, (long long) result.latencies.size(),
+           result.latencies.size() / result.seconds, (long long) p50, (long long) p99);
+    fflush(stdout);
+}
+
+static void bench_baseline(int producers, int consumers, int64_t items, int capacity) {
+    BoundedQueue<AVPacket> queue(capacity);
+    BenchmarkResult result = run_benchmark(
+            producers, consumers, items,
+            [&](AVPacket *packet) {
+                // packet 的内容 (包括 buf 的引用) 按值移进队列, 和 MediaQueue 的槽位一样
+                AVPacket item;
+                av_packet_move_ref(&item, packet);
+                int response = queue.push(item);
+                if (response < 0) {
+                    av_packet_unref(&item);
+                }
+                return response;
+            },
+            [&](AVPacket *packet) {
+                AVPacket item;
+                int response = queue.pop(&item);
+                if (response == 0) {
+                    av_packet_move_ref(packet, &item);
+                }
+                return response;
+            },
+            [&] { queue.close(); });
+    report("mutex+condvar", producers, consumers, result);
+}
+
+static void bench_baseline_alloc(int producers, int consumers, int64_t items, int capacity) {
+    BoundedQueue<AVPacket *> queue(capacity);
+    BenchmarkResult result = run_benchmark(
+            producers, consumers, items,
+            [&](AVPacket *packet) {
+                AVPacket *item = av_packet_alloc();
+                av_packet_move_ref(item, packet);
+                int response = queue.push(item);
+                if (response < 0) {
+                    av_packet_free(&item);
+                }
+                return response;
+            },
+            [&](AVPacket *packet) {
+                AVPacket *item = nullptr;
+                int response = queue.pop(&item);
+                if (response == 0) {
+                    av_packet_move_ref(packet, item);
+                    av_packet_free(&item);
+                }
+                return response;
+            },
+            [&] { queue.close(); });
+    report("mutex+alloc", producers, consumers, result);
+}
+
+static void bench_spsc(int64_t items, int capacity) {
+    SpscPacketQueue queue(capacity);
+    BenchmarkResult result = run_benchmark(
+            1, 1, items,
+            [&](AVPacket *packet) { return queue.push(packet); },
+            [&](AVPacket *packet) { return queue.pop(packet); },
+            [&] { queue.close(); });
+    report("spsc lock-free", 1, 1, result);
+}
+
+static void bench_mpmc(int producers, int consumers, int64_t items, int capacity) {
+    MpmcPacketQueue queue(capacity);
+    BenchmarkResult result = run_benchmark(
+            producers, consumers, items,
+            [&](AVPacket *packet) { return queue.push(packet); },
+            [&](AVPacket *packet) { return queue.pop(packet); },
+            [&] { queue.close(); });
+    report("mpmc lock-free", producers, consumers, result);
+}
+
+int main(int argc, char *argv[]) {
+    int64_t items = argc > 1 ? atoll(argv[1]) : 1000000;
+    int capacity = argc > 2 ? atoi(argv[2]) : 64;
+
+    printf("items per producer: %lld, capacity: %d\n", (long long) items, capacity);
+
+    bench_baseline_alloc(1, 1, items, capacity);
+    bench_baseline(1, 1, items, capacity);
+    bench_spsc(items, capacity);
+    bench_mpmc(1, 1, items, capacity);
+
+    // 多个 encode 线程往一个 mux 线程写的情况
+    bench_baseline_alloc(4, 1, items / 4, capacity);
+    bench_baseline(4, 1, items / 4, capacity);
+    bench_mpmc(4, 1, items / 4, capacity);
+
+    bench_baseline_alloc(4, 4, items / 4, capacity);
+    bench_baseline(4, 4, items / 4, capacity);
+    bench_mpmc(4, 4, items / 4, capacity);
+
+    return 0;
+}
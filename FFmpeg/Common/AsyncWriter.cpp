@@ -0,0 +1,392 @@
+//
+// Created by PingZi on 2020/9/7.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "AsyncWriter.h"
+#include "BoundedQueue.h"
+
+// O_DIRECT 要求缓冲区地址, 文件偏移和长度都对齐到块大小
+#define ASYNC_WRITER_ALIGNMENT 4096
+#define ASYNC_WRITER_DEFAULT_BUFFER_SIZE (4 * 1024 * 1024)
+#define ASYNC_WRITER_DEFAULT_QUEUE_DEPTH 4
+// AVIOContext 自己的缓冲区, 写满之后回调 write_packet 拷贝进大缓冲区
+#define ASYNC_WRITER_AVIO_BUFFER_SIZE (64 * 1024)
+
+typedef struct WriteBuffer {
+    uint8_t *data;
+    int capacity;
+    int size;
+    // 这块数据在文件中的起始位置
+    int64_t offset;
+} WriteBuffer;
+
+typedef std::chrono::duration<double> Seconds;
+
+class AsyncWriter {
+public:
+    AsyncWriter(int depth) : free_buffers(depth), filled_buffers(depth) {}
+
+    int fd = -1;
+    int direct_fd = -1;
+    std::vector<WriteBuffer> buffers;
+    BoundedQueue<WriteBuffer *> free_buffers;
+    BoundedQueue<WriteBuffer *> filled_buffers;
+    // 正在被填充的缓冲区, 只有生产者线程访问
+    WriteBuffer *current = nullptr;
+    int64_t position = 0;
+    int64_t file_size = 0;
+    std::thread thread;
+    std::atomic<int> error{0};
+    // bytes/buffers/write_seconds 只在写线程里修改, 其它的只在生产者线程里修改, close 的时候 join 之后再汇总
+    AsyncWriterStats stats = {};
+};
+
+static uint8_t *aligned_alloc_buffer(int size) {
+#ifdef _WIN32
+    return static_cast<uint8_t *>(_aligned_malloc(size, ASYNC_WRITER_ALIGNMENT));
+#else
+    void *data = nullptr;
+    if (posix_memalign(&data, ASYNC_WRITER_ALIGNMENT, size) != 0) {
+        return nullptr;
+    }
+    return static_cast<uint8_t *>(data);
+#endif
+}
+
+static void aligned_free_buffer(uint8_t *data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+static int write_at(int fd, const uint8_t *data, int size, int64_t offset) {
+#ifdef _WIN32
+    // 只有写线程在写这个 fd, seek + write 不会被打断
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+        return AVERROR(errno);
+    }
+#endif
+    while (size > 0) {
+#ifdef _WIN32
+        int written = _write(fd, data, size);
+#else
+        ssize_t written = pwrite(fd, data, size, offset);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return AVERROR(errno);
+        }
+        data += written;
+        size -= static_cast<int>(written);
+        offset += written;
+    }
+    return 0;
+}
+
+static void write_buffer(AsyncWriter *writer, WriteBuffer *buffer) {
+    bool aligned = buffer->offset % ASYNC_WRITER_ALIGNMENT == 0 && buffer->size % ASYNC_WRITER_ALIGNMENT == 0;
+    int fd = writer->direct_fd >= 0 && aligned ? writer->direct_fd : writer->fd;
+
+    auto begin = std::chrono::steady_clock::now();
+    int response = write_at(fd, buffer->data, buffer->size, buffer->offset);
+    writer->stats.write_seconds += Seconds(std::chrono::steady_clock::now() - begin).count();
+
+    if (response < 0) {
+        int expected = 0;
+        writer->error.compare_exchange_strong(expected, response);
+        // 唤醒等待空闲缓冲区的生产者, 让它尽快拿到错误码
+        writer->free_buffers.abort(response);
+        return;
+    }
+    writer->stats.bytes += buffer->size;
+    writer->stats.buffers++;
+    if (fd == writer->direct_fd) {
+        writer->stats.direct_buffers++;
+    }
+}
+
+static void writer_thread(AsyncWriter *writer) {
+    WriteBuffer *buffer;
+    while (writer->filled_buffers.pop(&buffer) == 0) {
+        if (writer->error.load() >= 0) {
+            write_buffer(writer, buffer);
+        }
+        buffer->size = 0;
+        writer->free_buffers.push(buffer);
+    }
+}
+
+static int acquire_buffer(AsyncWriter *writer) {
+    auto begin = std::chrono::steady_clock::now();
+    int response = writer->free_buffers.pop(&writer->current);
+    writer->stats.blocked_seconds += Seconds(std::chrono::steady_clock::now() - begin).count();
+    if (response < 0) {
+        writer->current = nullptr;
+        return writer->error.load() < 0 ? writer->error.load() : response;
+    }
+    writer->current->size = 0;
+    writer->current->offset = writer->position;
+    return 0;
+}
+
+static int submit_buffer(AsyncWriter *writer) {
+    WriteBuffer *buffer = writer->current;
+    writer->current = nullptr;
+    if (buffer->size == 0) {
+        // 空缓冲区直接还回去, 空闲队列的容量等于缓冲区总数, 不会阻塞
+        writer->free_buffers.push(buffer);
+        return 0;
+    }
+    return writer->filled_buffers.push(buffer);
+}
+
+static int write_packet(void *opaque, uint8_t *data, int size) {
+    AsyncWriter *writer = static_cast<AsyncWriter *>(opaque);
+    int total = size;
+
+    while (size > 0) {
+        if (writer->error.load() < 0) {
+            return writer->error.load();
+        }
+
+        int response;
+        if (writer->current == nullptr) {
+            response = acquire_buffer(writer);
+            if (response < 0) {
+                return response;
+            }
+        } else if (writer->current->offset + writer->current->size != writer->position) {
+            // seek 过了, 当前缓冲区和新的数据不连续, 先交出去
+            response = submit_buffer(writer);
+            if (response < 0) {
+                return response;
+            }
+            continue;
+        }
+
+        WriteBuffer *buffer = writer->current;
+        int count = FFMIN(size, buffer->capacity - buffer->size);
+        memcpy(buffer->data + buffer->size, data, count);
+        buffer->size += count;
+        writer->position += count;
+        data += count;
+        size -= count;
+
+        if (buffer->size == buffer->capacity) {
+            response = submit_buffer(writer);
+            if (response < 0) {
+                return response;
+            }
+        }
+    }
+
+    writer->file_size = FFMAX(writer->file_size, writer->position);
+    return total;
+}
+
+static int64_t seek_packet(void *opaque, int64_t offset, int whence) {
+    AsyncWriter *writer = static_cast<AsyncWriter *>(opaque);
+    int64_t position;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return writer->file_size;
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = writer->position + offset;
+            break;
+        case SEEK_END:
+            position = writer->file_size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (position < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    // 不需要等待写线程, 新位置上的数据会放进新的缓冲区, 按顺序写在旧数据之后
+    writer->position = position;
+    return position;
+}
+
+static int open_output_file(AsyncWriter *writer, const char *filename, const AsyncWriterOptions *options) {
+#ifdef _WIN32
+    writer->fd = _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (writer->fd < 0) {
+        return AVERROR(errno);
+    }
+
+#ifdef __linux__
+    if (options->preallocate > 0) {
+        // KEEP_SIZE: 只分配空间不改变文件大小, 结束的时候文件大小就是实际写入的大小
+        fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, 0, options->preallocate);
+    }
+    if (options->direct_io) {
+        // 文件系统不支持 O_DIRECT 的时候打开会失败, 这时候全部走普通写
+        writer->direct_fd = open(filename, O_WRONLY | O_DIRECT);
+    }
+#endif
+    return 0;
+}
+
+int async_writer_open(AVIOContext **pb, const char *filename, const AsyncWriterOptions *options) {
+    AsyncWriterOptions default_options = {};
+    if (options == nullptr) {
+        options = &default_options;
+    }
+
+    int buffer_size = options->buffer_size > 0 ? options->buffer_size : ASYNC_WRITER_DEFAULT_BUFFER_SIZE;
+    buffer_size = FFALIGN(buffer_size, ASYNC_WRITER_ALIGNMENT);
+    int depth = options->queue_depth > 0 ? options->queue_depth : ASYNC_WRITER_DEFAULT_QUEUE_DEPTH;
+
+    AsyncWriter *writer = new AsyncWriter(depth);
+    uint8_t *avio_buffer = nullptr;
+
+    int response = open_output_file(writer, filename, options);
+    if (response < 0) {
+        goto fail;
+    }
+
+    writer->buffers.resize(depth);
+    for (WriteBuffer &buffer : writer->buffers) {
+        buffer.data = aligned_alloc_buffer(buffer_size);
+        buffer.capacity = buffer_size;
+        if (buffer.data == nullptr) {
+            response = AVERROR(ENOMEM);
+            goto fail;
+        }
+        writer->free_buffers.push(&buffer);
+    }
+
+    avio_buffer = static_cast<uint8_t *>(av_malloc(ASYNC_WRITER_AVIO_BUFFER_SIZE));
+    if (avio_buffer == nullptr) {
+        response = AVERROR(ENOMEM);
+        goto fail;
+    }
+    *pb = avio_alloc_context(avio_buffer, ASYNC_WRITER_AVIO_BUFFER_SIZE, 1, writer, nullptr, write_packet,
+                             seek_packet);
+    if (*pb == nullptr) {
+        av_free(avio_buffer);
+        response = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    writer->thread = std::thread(writer_thread, writer);
+    return 0;
+
+    fail:
+    for (WriteBuffer &buffer : writer->buffers) {
+        aligned_free_buffer(buffer.data);
+    }
+    if (writer->direct_fd >= 0) {
+        close(writer->direct_fd);
+    }
+    if (writer->fd >= 0) {
+        close(writer->fd);
+    }
+    delete writer;
+    return response;
+}
+
+int async_writer_close(AVIOContext **pb, AsyncWriterStats *stats) {
+    if (*pb == nullptr) {
+        return 0;
+    }
+
+    AVIOContext *context = *pb;
+    AsyncWriter *writer = static_cast<AsyncWriter *>(context->opaque);
+
+    // 先把 AVIOContext 自己缓冲区里的数据交给 write_packet
+    avio_flush(context);
+
+    auto begin = std::chrono::steady_clock::now();
+    if (writer->current != nullptr) {
+        int response = submit_buffer(writer);
+        if (response < 0 && writer->error.load() >= 0) {
+            writer->error.store(response);
+        }
+    }
+    writer->filled_buffers.close();
+    writer->thread.join();
+    writer->stats.drain_seconds = Seconds(std::chrono::steady_clock::now() - begin).count();
+
+    int ret = writer->error.load();
+    if (ret >= 0 && context->error < 0) {
+        ret = context->error;
+    }
+
+    if (writer->direct_fd >= 0) {
+        close(writer->direct_fd);
+    }
+    if (close(writer->fd) < 0 && ret >= 0) {
+        ret = AVERROR(errno);
+    }
+    for (WriteBuffer &buffer : writer->buffers) {
+        aligned_free_buffer(buffer.data);
+    }
+    if (stats != nullptr) {
+        *stats = writer->stats;
+    }
+    delete writer;
+
+    av_freep(&context->buffer);
+    avio_context_free(pb);
+    return ret;
+}
+
+int parse_async_writer_option(int argc, char *argv[], int index, bool *enabled, AsyncWriterOptions *options) {
+    const char *name = argv[index];
+    bool has_value = index + 1 < argc;
+
+    if (strcmp(name, "-async-write") == 0) {
+        *enabled = true;
+        return 1;
+    }
+    if (strcmp(name, "-direct-io") == 0) {
+        *enabled = true;
+        options->direct_io = true;
+        return 1;
+    }
+    if (strcmp(name, "-write-buffer") == 0 && has_value) {
+        *enabled = true;
+        options->buffer_size = atoi(argv[index + 1]) * 1024;
+        return 2;
+    }
+    if (strcmp(name, "-write-queue") == 0 && has_value) {
+        *enabled = true;
+        options->queue_depth = atoi(argv[index + 1]);
+        return 2;
+    }
+    if (strcmp(name, "-prealloc") == 0 && has_value) {
+        *enabled = true;
+        options->preallocate = strtoll(argv[index + 1], nullptr, 10) * 1024 * 1024;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+//
+// Created by PingZi on 2020/9/7.
+//
+
+#ifndef COMMON_ASYNCWRITER_H
+#define COMMON_ASYNCWRITER_H
+
+#include <cstdint>
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+typedef struct AsyncWriterOptions {
+    // 每个缓冲区的大小 (字节), 向上对齐到 4096, 0 表示默认 4MB
+    int buffer_size;
+    // 缓冲区的个数, 也就是最多有多少块数据排队等待写盘, 0 表示默认 4
+    int queue_depth;
+    // 使用 O_DIRECT 绕过页缓存, 只在 Linux 上有效. 没有对齐到 4096 的写 (比如 moov 回填) 仍然走普通写
+    bool direct_io;
+    // 打开文件之后用 fallocate 预分配的字节数, 0 表示不预分配, 只在 Linux 上有效
+    int64_t preallocate;
+} AsyncWriterOptions;
+
+typedef struct AsyncWriterStats {
+    int64_t bytes;
+    int64_t buffers;
+    int64_t direct_buffers;
+    // 生产者 (demux/编码线程) 等待空闲缓冲区的时间, 也就是被磁盘拖住的时间
+    double blocked_seconds;
+    // close 的时候等待剩余数据写完的时间
+    double drain_seconds;
+    // 写线程花在 write 上的时间
+    double write_seconds;
+} AsyncWriterStats;
+
+/**
+ * 打开一个写后台化的输出 AVIOContext, 用来代替 avio_open(pb, filename, AVIO_FLAG_WRITE).
+ *
+ * 写进来的数据先拷贝进对齐的大缓冲区, 写满一块就交给专门的写线程落盘, 调用
+ * av_interleaved_write_frame 的线程只有在所有缓冲区都在排队的时候才会阻塞.
+ * 每块缓冲区带着自己在文件中的位置, 写线程按顺序 pwrite, 所以 muxer 回头 seek 改写 (mp4 的 mdat 大小等) 也没问题.
+ * 只支持写, 不能读.
+ *
+ * 必须用 async_writer_close 关闭, 不能用 avio_closep.
+ */
+int async_writer_open(AVIOContext **pb, const char *filename, const AsyncWriterOptions *options);
+
+/**
+ * 等待所有数据写完, 关闭文件并释放 *pb. stats 可以为 nullptr.
+ * 返回写线程遇到的第一个错误.
+ */
+int async_writer_close(AVIOContext **pb, AsyncWriterStats *stats);
+
+/**
+ * 解析 argv[index] 处的异步写选项:
+ * -async-write, -write-buffer <KB>, -write-queue <N>, -direct-io, -prealloc <MB>.
+ * 返回消耗的参数个数, 不是异步写选项返回 0.
+ */
+int parse_async_writer_option(int argc, char *argv[], int index, bool *enabled, AsyncWriterOptions *options);
+
+#endif //COMMON_ASYNCWRITER_H
@@ -0,0 +1,99 @@
+//
+// Created by PingZi on 2020/9/1.
+//
+
+#ifndef COMMON_BOUNDEDQUEUE_H
+#define COMMON_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+extern "C" {
+#include "libavutil/avutil.h"
+}
+
+/**
+ * 有界阻塞队列, 流水线各个线程之间用它来传递 AVPacket* / AVFrame*.
+ *
+ * push: 队列满的时候阻塞 (背压), 返回 0 表示成功.
+ * pop:  队列空的时候阻塞, 返回 0 表示取到了元素;
+ *       队列被 close 并且已经取空的时候返回 AVERROR_EOF.
+ * abort 之后所有的 push/pop 立刻返回 abort 时给的错误码.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    int push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return items.size() < capacity || closed || error < 0; });
+        if (error < 0) {
+            return error;
+        }
+        if (closed) {
+            return AVERROR_EOF;
+        }
+
+        items.push_back(item);
+        not_empty.notify_one();
+        return 0;
+    }
+
+    int pop(T *item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return !items.empty() || closed || error < 0; });
+        if (error < 0) {
+            return error;
+        }
+        if (items.empty()) {
+            return AVERROR_EOF;
+        }
+
+        *item = items.front();
+        items.pop_front();
+        not_full.notify_one();
+        return 0;
+    }
+
+    // 生产者不会再 push 了, 剩下的元素仍然可以 pop 出来
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    // 出错了, 唤醒所有在等待的线程. 队列里剩下的元素通过 drain 取出释放
+    void abort(int error_code) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error >= 0) {
+            error = error_code < 0 ? error_code : AVERROR_UNKNOWN;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    // 不管状态如何, 取出一个剩余的元素, 用于结束时释放资源
+    bool drain(T *item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) {
+            return false;
+        }
+        *item = items.front();
+        items.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    int error = 0;
+};
+
+#endif //COMMON_BOUNDEDQUEUE_H
@@ -0,0 +1,78 @@
+//
+// Created by PingZi on 2020/9/14.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "DecoderThreads.h"
+
+// FFmpeg 自动选择线程数时的上限, 再多对解码基本没有收益
+#define DECODER_MAX_AUTO_THREADS 16
+
+int decoder_thread_count(const DecoderThreading *threading) {
+    if (threading != nullptr && threading->thread_count > 0) {
+        return threading->thread_count;
+    }
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    int jobs = threading != nullptr && threading->jobs > 0 ? threading->jobs : 1;
+    return std::max(1, std::min(DECODER_MAX_AUTO_THREADS, std::max(cores, 1) / jobs));
+}
+
+int open_decoder_context(const AVCodecParameters *parameters, const DecoderThreading *threading,
+                         AVCodec **codec, AVCodecContext **codec_context) {
+    AVCodec *decoder = avcodec_find_decoder(parameters->codec_id);
+    if (decoder == nullptr) {
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    *codec_context = avcodec_alloc_context3(decoder);
+    if (*codec_context == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    int response = avcodec_parameters_to_context(*codec_context, parameters);
+    if (response < 0) {
+        avcodec_free_context(codec_context);
+        return response;
+    }
+
+    if (parameters->codec_type == AVMEDIA_TYPE_VIDEO) {
+        // 解码器不支持的线程方式会被 avcodec_open2 自动忽略, 回退到单线程
+        (*codec_context)->thread_count = decoder_thread_count(threading);
+        int thread_type = threading != nullptr ? threading->thread_type : 0;
+        (*codec_context)->thread_type = thread_type != 0 ? thread_type : FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+
+    response = avcodec_open2(*codec_context, decoder, nullptr);
+    if (response < 0) {
+        avcodec_free_context(codec_context);
+        return response;
+    }
+
+    if (codec != nullptr) {
+        *codec = decoder;
+    }
+    return 0;
+}
+
+int parse_decoder_threading_option(int argc, char *argv[], int index, DecoderThreading *threading) {
+    if (strcmp(argv[index], "-decode-threads") == 0 && index + 1 < argc) {
+        threading->thread_count = atoi(argv[index + 1]);
+        return 2;
+    }
+    if (strcmp(argv[index], "-decode-thread-type") == 0 && index + 1 < argc) {
+        const char *type = argv[index + 1];
+        if (strcmp(type, "frame") == 0) {
+            threading->thread_type = FF_THREAD_FRAME;
+        } else if (strcmp(type, "slice") == 0) {
+            threading->thread_type = FF_THREAD_SLICE;
+        } else {
+            threading->thread_type = 0;
+        }
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+//
+// Created by PingZi on 2020/9/14.
+//
+
+#ifndef COMMON_DECODERTHREADS_H
+#define COMMON_DECODERTHREADS_H
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+/**
+ * 解码器的线程设置. 全部为 0 的时候按 CPU 核数自动选择, 同时允许帧级和片级多线程.
+ */
+typedef struct DecoderThreading {
+    // 解码线程数, 0 表示自动: 可用核数 / jobs, 最多 16 (和 FFmpeg 自动选择的上限一致)
+    int thread_count;
+    // FF_THREAD_FRAME / FF_THREAD_SLICE 的组合, 0 表示两种都允许.
+    // 帧级多线程吞吐最高, 但是会多出 thread_count 帧的延迟, 频繁 seek + flush 的场景 (缩略图) 用片级更合适
+    int thread_type;
+    // 同时运行的解码器个数 (并行分段, 批量任务...), 自动线程数的时候用来平分核数, 0 当作 1
+    int jobs;
+} DecoderThreading;
+
+// 按 threading 算出实际使用的线程数
+int decoder_thread_count(const DecoderThreading *threading);
+
+/**
+ * 用 parameters 找到解码器, 设置好线程之后打开, 代替
+ * avcodec_find_decoder + avcodec_alloc_context3 + avcodec_parameters_to_context + avcodec_open2.
+ * 只有视频流使用多线程, 音频解码器保持单线程. threading 可以为 nullptr, 表示自动.
+ * 失败的时候 *codec_context 已经被释放, codec 可以为 nullptr.
+ */
+int open_decoder_context(const AVCodecParameters *parameters, const DecoderThreading *threading,
+                         AVCodec **codec, AVCodecContext **codec_context);
+
+/**
+ * 解析 argv[index] 处的解码线程选项: -decode-threads <N>, -decode-thread-type <frame|slice|auto>.
+ * 返回消耗的参数个数, 不是解码线程选项返回 0.
+ */
+int parse_decoder_threading_option(int argc, char *argv[], int index, DecoderThreading *threading);
+
+#endif //COMMON_DECODERTHREADS_H
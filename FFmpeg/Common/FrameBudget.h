@@ -0,0 +1,59 @@
+//
+// Created by PingZi on 2020/9/20.
+//
+
+#ifndef COMMON_FRAMEBUDGET_H
+#define COMMON_FRAMEBUDGET_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * 多个线程共享的解码帧额度, 用来限制同时存在的解码帧数量 (也就是内存上限).
+ *
+ * 线程在解码之前 acquire 自己最多会占用的帧数, 用完之后 release. 额度不够的时候 acquire 阻塞,
+ * 一次要的比总额度还多的时候按总额度算, 不会永远等下去.
+ */
+class FrameBudget {
+public:
+    explicit FrameBudget(int64_t capacity) : capacity(capacity > 0 ? capacity : 1), available(this->capacity) {}
+
+    // 返回实际占用的额度, release 的时候原样还回来
+    int64_t acquire(int64_t count) {
+        count = std::min(std::max<int64_t>(count, 1), capacity);
+        std::unique_lock<std::mutex> lock(mutex);
+        enough.wait(lock, [this, count] { return available >= count; });
+        available -= count;
+        peak = std::max(peak, capacity - available);
+        return count;
+    }
+
+    void release(int64_t count) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            available += count;
+        }
+        enough.notify_all();
+    }
+
+    int64_t limit() const {
+        return capacity;
+    }
+
+    // 同时占用的最大额度
+    int64_t peak_usage() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return peak;
+    }
+
+private:
+    const int64_t capacity;
+    int64_t available;
+    int64_t peak = 0;
+    std::mutex mutex;
+    std::condition_variable enough;
+};
+
+#endif //COMMON_FRAMEBUDGET_H
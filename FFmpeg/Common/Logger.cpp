@@ -0,0 +1,227 @@
+//
+// Created by PingZi on 2020/9/9.
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Logger.h"
+
+// 一条日志最长的长度, 超出的部分被截掉
+#define LOG_SLOT_SIZE 512
+// 每个线程缓冲的日志条数
+#define LOG_SLOTS 256
+// 后台线程没有被唤醒时的轮询间隔
+#define LOG_DRAIN_INTERVAL std::chrono::milliseconds(10)
+
+typedef struct LogSlot {
+    int level;
+    int length;
+    char text[LOG_SLOT_SIZE];
+} LogSlot;
+
+/**
+ * 一个线程的日志缓冲区, 单生产者 (所属线程) 单消费者 (后台线程).
+ * 线程退出之后标记为 retired, 由后台线程输出完剩余日志之后释放.
+ */
+class LogRing {
+public:
+    LogSlot slots[LOG_SLOTS];
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<bool> retired{false};
+};
+
+class LogDrain {
+public:
+    ~LogDrain() {
+        stop();
+    }
+
+    LogRing *register_ring() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!started) {
+            started = true;
+            thread = std::thread(&LogDrain::run, this);
+        }
+        LogRing *ring = new LogRing();
+        rings.push_back(ring);
+        return ring;
+    }
+
+    void wake() {
+        condition.notify_one();
+    }
+
+    void flush() {
+        size_t target = requested.fetch_add(1) + 1;
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!started || stopped) {
+            return;
+        }
+        condition.notify_one();
+        flushed_condition.wait(lock, [this, target] { return flushed >= target || stopped; });
+    }
+
+    bool is_stopped() {
+        return stopped.load();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            size_t target = requested.load();
+            drain_all();
+            if (target > flushed) {
+                flushed = target;
+                flushed_condition.notify_all();
+            }
+            condition.wait_for(lock, LOG_DRAIN_INTERVAL);
+        }
+        drain_all();
+        stopped = true;
+        flushed_condition.notify_all();
+    }
+
+    // 持有 mutex 的时候调用, 注册新的缓冲区需要等这一轮输出完
+    void drain_all() {
+        bool wrote_out = false;
+        bool wrote_err = false;
+        for (size_t i = 0; i < rings.size();) {
+            LogRing *ring = rings[i];
+            // 先读 retired 再读 head, 保证 retired 之前提交的日志都能看到
+            bool retired = ring->retired.load(std::memory_order_acquire);
+            size_t tail = ring->tail.load(std::memory_order_relaxed);
+            size_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail != head; tail++) {
+                LogSlot &slot = ring->slots[tail % LOG_SLOTS];
+                write_slot(slot);
+                wrote_err |= slot.level >= LOG_LEVEL_ERROR;
+                wrote_out |= slot.level < LOG_LEVEL_ERROR;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            if (retired) {
+                delete ring;
+                rings[i] = rings.back();
+                rings.pop_back();
+                continue;
+            }
+            i++;
+        }
+        if (wrote_out) {
+            fflush(stdout);
+        }
+        if (wrote_err) {
+            fflush(stderr);
+        }
+    }
+
+    static void write_slot(const LogSlot &slot) {
+        FILE *file = slot.level >= LOG_LEVEL_ERROR ? stderr : stdout;
+        const char *prefix = slot.level >= LOG_LEVEL_ERROR ? "ERROR: " : slot.level == LOG_LEVEL_INFO ? "INFO: " : "DEBUG: ";
+        fputs(prefix, file);
+        fwrite(slot.text, 1, slot.length, file);
+        fputc('\n', file);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!started) {
+                stopped = true;
+                return;
+            }
+            stopping = true;
+        }
+        condition.notify_one();
+        thread.join();
+    }
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::condition_variable flushed_condition;
+    std::vector<LogRing *> rings;
+    std::thread thread;
+    bool started = false;
+    bool stopping = false;
+    std::atomic<bool> stopped{false};
+    std::atomic<size_t> requested{0};
+    size_t flushed = 0;
+};
+
+static LogDrain &drain() {
+    static LogDrain instance;
+    return instance;
+}
+
+// 线程退出的时候把自己的缓冲区交给后台线程释放
+class LogRingHolder {
+public:
+    ~LogRingHolder() {
+        if (ring != nullptr) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+
+    LogRing *ring = nullptr;
+};
+
+static thread_local LogRingHolder ring_holder;
+
+static void log_direct(int level, const char *format, va_list args) {
+    FILE *file = level >= LOG_LEVEL_ERROR ? stderr : stdout;
+    fputs(level >= LOG_LEVEL_ERROR ? "ERROR: " : level == LOG_LEVEL_INFO ? "INFO: " : "DEBUG: ", file);
+    vfprintf(file, format, args);
+    fputc('\n', file);
+}
+
+void log_message(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    LogDrain &log_drain = drain();
+    if (log_drain.is_stopped()) {
+        // 进程退出阶段, 后台线程已经结束了, 直接输出
+        log_direct(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    LogRing *ring = ring_holder.ring;
+    if (ring == nullptr) {
+        ring = log_drain.register_ring();
+        ring_holder.ring = ring;
+    }
+
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    while (head - ring->tail.load(std::memory_order_acquire) >= LOG_SLOTS) {
+        // 缓冲区满了, 叫醒后台线程并等它腾出位置
+        log_drain.wake();
+        std::this_thread::yield();
+    }
+
+    LogSlot &slot = ring->slots[head % LOG_SLOTS];
+    int length = vsnprintf(slot.text, LOG_SLOT_SIZE, format, args);
+    va_end(args);
+
+    slot.level = level;
+    slot.length = length < 0 ? 0 : length < LOG_SLOT_SIZE ? length : LOG_SLOT_SIZE - 1;
+    ring->head.store(head + 1, std::memory_order_release);
+
+    if (level >= LOG_LEVEL_ERROR) {
+        // 错误尽快输出, 不等下一次轮询
+        log_drain.wake();
+    }
+}
+
+void log_flush() {
+    drain().flush();
+}
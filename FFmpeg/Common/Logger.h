@@ -0,0 +1,50 @@
+//
+// Created by PingZi on 2020/9/9.
+//
+
+#ifndef COMMON_LOGGER_H
+#define COMMON_LOGGER_H
+
+/**
+ * 三个项目共用的日志.
+ *
+ * 1. 编译期过滤: info/error/debug 都是宏, 级别低于 LOG_LEVEL 的调用连同参数一起被编译器去掉, 没有任何开销.
+ *    默认 LOG_LEVEL_INFO, 需要逐包/逐帧的调试日志时用 -DLOG_LEVEL=0 重新编译.
+ * 2. 异步输出: 每个线程把格式化好的日志写进自己的环形缓冲区, 由后台线程统一 fwrite 到 stdout/stderr,
+ *    调用线程只做一次 vsnprintf, 不会因为终端或者管道变慢而卡住. 缓冲区满的时候调用线程等待, 不会丢日志.
+ *
+ * 进程正常退出的时候会自动输出剩余的日志, 提前退出 (abort 之类) 之前可以调用 log_flush.
+ */
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_ERROR 2
+#define LOG_LEVEL_NONE 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if defined(__GNUC__)
+#define LOG_PRINTF_FORMAT(format_index, args_index) __attribute__((format(printf, format_index, args_index)))
+#else
+#define LOG_PRINTF_FORMAT(format_index, args_index)
+#endif
+
+void log_message(int level, const char *format, ...) LOG_PRINTF_FORMAT(2, 3);
+
+// 等待所有线程已经提交的日志都输出完
+void log_flush();
+
+#define LOG_AT(level, ...) \
+    do { \
+        if ((level) >= LOG_LEVEL) { \
+            log_message((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif //COMMON_LOGGER_H
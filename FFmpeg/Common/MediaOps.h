@@ -0,0 +1,39 @@
+//
+// Created by PingZi on 2020/9/3.
+//
+
+#ifndef COMMON_MEDIAOPS_H
+#define COMMON_MEDIAOPS_H
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+}
+
+// AVPacket / AVFrame 的 alloc/free/move/unref, 给 MediaQueue 和 MediaPool 这样的模板用
+
+struct PacketOps {
+    typedef AVPacket Type;
+
+    static AVPacket *alloc() { return av_packet_alloc(); }
+
+    static void free(AVPacket **packet) { av_packet_free(packet); }
+
+    static void move(AVPacket *dst, AVPacket *src) { av_packet_move_ref(dst, src); }
+
+    static void unref(AVPacket *packet) { av_packet_unref(packet); }
+};
+
+struct FrameOps {
+    typedef AVFrame Type;
+
+    static AVFrame *alloc() { return av_frame_alloc(); }
+
+    static void free(AVFrame **frame) { av_frame_free(frame); }
+
+    static void move(AVFrame *dst, AVFrame *src) { av_frame_move_ref(dst, src); }
+
+    static void unref(AVFrame *frame) { av_frame_unref(frame); }
+};
+
+#endif //COMMON_MEDIAOPS_H
@@ -0,0 +1,126 @@
+//
+// Created by PingZi on 2020/9/3.
+//
+
+#ifndef COMMON_MEDIAPOOL_H
+#define COMMON_MEDIAPOOL_H
+
+#include <cstdint>
+#include <vector>
+
+#include "MediaOps.h"
+#include "Logger.h"
+
+// 对象池的计数, 用来确认稳定之后不再有 alloc
+typedef struct MediaPoolStats {
+    int64_t allocations; // 调用 av_packet_alloc/av_frame_alloc 的次数
+    int64_t acquires;
+    int64_t releases;
+    int64_t in_use;
+    int64_t peak_in_use;
+    // 预热结束 (第 warmup 次 acquire) 的时候的 allocations, 还没到的时候是 -1
+    int64_t warm_allocations;
+} MediaPoolStats;
+
+// 预热用的 acquire 次数, 之后 allocations 不能再增长
+#define MEDIA_POOL_WARMUP 64
+
+/**
+ * AVPacket / AVFrame 的对象池.
+ *
+ * acquire 拿到一个空的 packet/frame, 用完之后 release 回来 (release 会先 unref).
+ * 池子里没有空闲对象的时候才会真正 alloc. 前 warmup 次 acquire 之后记下当时的 allocations,
+ * 之后再有 alloc 说明使用方在持有越来越多的对象 (泄漏或者每帧多拿一个), 见 check_media_pool.
+ *
+ * 一个池子属于一个流, 只在一个线程里使用, 不加锁.
+ */
+template<typename Ops>
+class MediaPool {
+public:
+    typedef typename Ops::Type Type;
+
+    explicit MediaPool(size_t reserve = 4, int64_t warmup = MEDIA_POOL_WARMUP) : warmup(warmup), stats() {
+        stats.warm_allocations = -1;
+        free_list.reserve(reserve);
+    }
+
+    ~MediaPool() {
+        for (Type *item : free_list) {
+            Ops::free(&item);
+        }
+    }
+
+    MediaPool(const MediaPool &) = delete;
+
+    MediaPool &operator=(const MediaPool &) = delete;
+
+    // 内存不够的时候返回 nullptr
+    Type *acquire() {
+        Type *item = nullptr;
+        if (!free_list.empty()) {
+            item = free_list.back();
+            free_list.pop_back();
+        } else {
+            item = Ops::alloc();
+            if (item == nullptr) {
+                return nullptr;
+            }
+            stats.allocations++;
+        }
+
+        stats.acquires++;
+        if (stats.acquires == warmup) {
+            stats.warm_allocations = stats.allocations;
+        }
+        stats.in_use++;
+        if (stats.in_use > stats.peak_in_use) {
+            stats.peak_in_use = stats.in_use;
+        }
+        return item;
+    }
+
+    void release(Type *item) {
+        if (item == nullptr) {
+            return;
+        }
+        Ops::unref(item);
+        free_list.push_back(item);
+        stats.releases++;
+        stats.in_use--;
+    }
+
+    MediaPoolStats get_stats() const { return stats; }
+
+private:
+    std::vector<Type *> free_list;
+    int64_t warmup;
+    MediaPoolStats stats;
+};
+
+typedef MediaPool<PacketOps> PacketPool;
+
+/**
+ * 输出池子的计数并检查: 预热之后 allocations 没有增长, 结束的时候所有对象都还回来了.
+ * acquire 次数还没超过预热的时候没法判断, 只输出计数. 检查失败返回 false.
+ */
+template<typename Ops>
+bool check_media_pool(const char *name, const MediaPool<Ops> &pool) {
+    MediaPoolStats stats = pool.get_stats();
+    info("%s: %lld acquires, %lld allocations (%lld after warm-up), peak in use: %lld.", name,
+         (long long) stats.acquires, (long long) stats.allocations,
+         (long long) (stats.warm_allocations < 0 ? 0 : stats.allocations - stats.warm_allocations),
+         (long long) stats.peak_in_use);
+    bool ok = true;
+    if (stats.in_use != 0) {
+        error("%s: %lld object(s) not released.", name, (long long) stats.in_use);
+        ok = false;
+    }
+    if (stats.warm_allocations >= 0 && stats.allocations > stats.warm_allocations) {
+        error("%s: %lld allocation(s) after %lld warm-up acquires, objects are allocated per frame.", name,
+              (long long) (stats.allocations - stats.warm_allocations), (long long) MEDIA_POOL_WARMUP);
+        ok = false;
+    }
+    return ok;
+}
+
+#endif //COMMON_MEDIAPOOL_H
@@ -0,0 +1,409 @@
+//
+// Created by PingZi on 2020/9/2.
+//
+
+#ifndef COMMON_MEDIAQUEUE_H
+#define COMMON_MEDIAQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define MEDIA_QUEUE_CPU_RELAX() _mm_pause()
+#else
+#define MEDIA_QUEUE_CPU_RELAX() ((void) 0)
+#endif
+
+#include "MediaOps.h"
+
+/**
+ * 无锁的有界队列, 用来在线程之间传递 AVPacket / AVFrame.
+ *
+ * 队列里的每个槽位都预先分配好了一个 AVPacket / AVFrame, push 的时候用 av_packet_move_ref /
+ * av_frame_move_ref 把引用移进槽位, pop 的时候再移出来. 整个过程不拷贝数据, 也不会 alloc/free.
+ * push 之后调用方手里的 packet/frame 变成空的, 可以直接拿去装下一个.
+ *
+ * 返回值和 FFmpeg 的习惯一致:
+ *   0               成功
+ *   AVERROR(EAGAIN) try_push 时队列满 / try_pop 时队列空
+ *   AVERROR_EOF     队列已经 close, 并且 (对 pop 来说) 已经取空
+ *   其它负数        abort 时传入的错误码
+ *
+ * push/pop 是阻塞版本, 满/空的时候先自旋, 再 yield, 最后睡在条件变量上 (背压).
+ *
+ * SpscMediaQueue 只能有一个生产者线程和一个消费者线程.
+ * MpmcMediaQueue 可以有多个生产者和多个消费者, 多个生产者的时候要等所有生产者都结束之后再 close.
+ */
+
+#define MEDIA_QUEUE_CACHE_LINE 64
+
+// 等待队列状态变化: 先自旋, 再 yield, 最后在条件变量上睡眠. 没有人睡眠的时候 notify 不加锁.
+class QueueWaiter {
+public:
+    template<typename Ready>
+    void wait(Ready ready) {
+        for (int i = 0; i < 128; i++) {
+            if (ready()) {
+                return;
+            }
+            MEDIA_QUEUE_CPU_RELAX();
+        }
+        for (int i = 0; i < 16; i++) {
+            if (ready()) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        waiters.fetch_add(1);
+        while (!ready()) {
+            // 超时只是保险, 正常情况由 notify 唤醒
+            condition.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        waiters.fetch_sub(1);
+    }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            condition.notify_all();
+        }
+    }
+
+    void notify_all() {
+        std::lock_guard<std::mutex> lock(mutex);
+        condition.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<int> waiters{0};
+};
+
+// close/abort 状态和等待逻辑, 两种队列共用
+class MediaQueueState {
+public:
+    void close() {
+        closed.store(true, std::memory_order_release);
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    void abort(int error_code) {
+        int expected = 0;
+        error.compare_exchange_strong(expected, error_code < 0 ? error_code : AVERROR_UNKNOWN);
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    bool is_closed() const { return closed.load(std::memory_order_acquire); }
+
+    int error_code() const { return error.load(std::memory_order_acquire); }
+
+protected:
+    std::atomic<bool> closed{false};
+    std::atomic<int> error{0};
+    QueueWaiter not_empty;
+    QueueWaiter not_full;
+};
+
+static inline size_t media_queue_round_capacity(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    return size;
+}
+
+template<typename Ops>
+class SpscMediaQueue : public MediaQueueState {
+public:
+    typedef typename Ops::Type Type;
+
+    explicit SpscMediaQueue(size_t capacity) : capacity(media_queue_round_capacity(capacity)), mask(this->capacity - 1) {
+        slots = new Type *[this->capacity];
+        allocated = true;
+        for (size_t i = 0; i < this->capacity; i++) {
+            slots[i] = Ops::alloc();
+            allocated = allocated && slots[i] != nullptr;
+        }
+    }
+
+    ~SpscMediaQueue() {
+        for (size_t i = 0; i < capacity; i++) {
+            Ops::free(&slots[i]);
+        }
+        delete[] slots;
+    }
+
+    SpscMediaQueue(const SpscMediaQueue &) = delete;
+
+    SpscMediaQueue &operator=(const SpscMediaQueue &) = delete;
+
+    // 构造的时候所有槽位都分配成功了
+    bool valid() const { return allocated; }
+
+    size_t size() const { return capacity; }
+
+    int try_push(Type *item) {
+        int status = push_status();
+        if (status < 0) {
+            return status;
+        }
+
+        size_t current_tail = tail.load(std::memory_order_relaxed);
+        if (current_tail - head_cache == capacity) {
+            head_cache = head.load(std::memory_order_acquire);
+            if (current_tail - head_cache == capacity) {
+                return AVERROR(EAGAIN);
+            }
+        }
+
+        Ops::move(slots[current_tail & mask], item);
+        tail.store(current_tail + 1, std::memory_order_release);
+        not_empty.notify();
+        return 0;
+    }
+
+    int try_pop(Type *item) {
+        int status = error_code();
+        if (status < 0) {
+            return status;
+        }
+
+        size_t current_head = head.load(std::memory_order_relaxed);
+        if (current_head == tail_cache) {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (current_head == tail_cache) {
+                if (!is_closed()) {
+                    return AVERROR(EAGAIN);
+                }
+                // close 之前 push 的数据一定能看到, 再确认一次
+                tail_cache = tail.load(std::memory_order_acquire);
+                if (current_head == tail_cache) {
+                    return AVERROR_EOF;
+                }
+            }
+        }
+
+        Ops::move(item, slots[current_head & mask]);
+        head.store(current_head + 1, std::memory_order_release);
+        not_full.notify();
+        return 0;
+    }
+
+    int push(Type *item) {
+        int response;
+        while ((response = try_push(item)) == AVERROR(EAGAIN)) {
+            not_full.wait([this] {
+                return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) < capacity ||
+                       push_status() < 0;
+            });
+        }
+        return response;
+    }
+
+    int pop(Type *item) {
+        int response;
+        while ((response = try_pop(item)) == AVERROR(EAGAIN)) {
+            not_empty.wait([this] {
+                return tail.load(std::memory_order_acquire) != head.load(std::memory_order_relaxed) ||
+                       is_closed() || error_code() < 0;
+            });
+        }
+        return response;
+    }
+
+private:
+    int push_status() const {
+        int status = error_code();
+        if (status < 0) {
+            return status;
+        }
+        return is_closed() ? AVERROR_EOF : 0;
+    }
+
+    const size_t capacity;
+    const size_t mask;
+    Type **slots;
+    bool allocated;
+
+    // 生产者和消费者各自的索引中间隔开一个 cache line, 避免 false sharing.
+    // C++14 的 new 不支持 alignas 超过默认对齐, 所以这里用填充
+    char padding0[MEDIA_QUEUE_CACHE_LINE];
+    std::atomic<size_t> tail{0};
+    size_t head_cache = 0; // 生产者看到的 head
+    char padding1[MEDIA_QUEUE_CACHE_LINE];
+    std::atomic<size_t> head{0};
+    size_t tail_cache = 0; // 消费者看到的 tail
+    char padding2[MEDIA_QUEUE_CACHE_LINE];
+};
+
+/**
+ * 多生产者多消费者版本, 实现参考 Dmitry Vyukov 的 bounded MPMC queue:
+ * 每个槽位带一个序号, 生产者/消费者用 CAS 抢占位置, 然后用序号通知对方槽位已经可用.
+ */
+template<typename Ops>
+class MpmcMediaQueue : public MediaQueueState {
+public:
+    typedef typename Ops::Type Type;
+
+    explicit MpmcMediaQueue(size_t capacity) : capacity(media_queue_round_capacity(capacity)), mask(this->capacity - 1) {
+        cells = new Cell[this->capacity];
+        allocated = true;
+        for (size_t i = 0; i < this->capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+            cells[i].item = Ops::alloc();
+            allocated = allocated && cells[i].item != nullptr;
+        }
+    }
+
+    ~MpmcMediaQueue() {
+        for (size_t i = 0; i < capacity; i++) {
+            Ops::free(&cells[i].item);
+        }
+        delete[] cells;
+    }
+
+    MpmcMediaQueue(const MpmcMediaQueue &) = delete;
+
+    MpmcMediaQueue &operator=(const MpmcMediaQueue &) = delete;
+
+    bool valid() const { return allocated; }
+
+    size_t size() const { return capacity; }
+
+    int try_push(Type *item) {
+        int status = push_status();
+        if (status < 0) {
+            return status;
+        }
+
+        Cell *cell;
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return AVERROR(EAGAIN);
+            } else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        Ops::move(cell->item, item);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        not_empty.notify();
+        return 0;
+    }
+
+    int try_pop(Type *item) {
+        int status = error_code();
+        if (status < 0) {
+            return status;
+        }
+
+        Cell *cell;
+        size_t position = dequeue_position.load(std::memory_order_relaxed);
+        bool checked_closed = false;
+        while (true) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+            if (difference == 0) {
+                if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                if (!is_closed()) {
+                    return AVERROR(EAGAIN);
+                }
+                // 所有生产者都结束之后才会 close, 再确认一次是不是真的空了
+                if (checked_closed) {
+                    return AVERROR_EOF;
+                }
+                checked_closed = true;
+                position = dequeue_position.load(std::memory_order_relaxed);
+            } else {
+                position = dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        Ops::move(item, cell->item);
+        cell->sequence.store(position + mask + 1, std::memory_order_release);
+        not_full.notify();
+        return 0;
+    }
+
+    int push(Type *item) {
+        int response;
+        while ((response = try_push(item)) == AVERROR(EAGAIN)) {
+            not_full.wait([this] { return !full() || push_status() < 0; });
+        }
+        return response;
+    }
+
+    int pop(Type *item) {
+        int response;
+        while ((response = try_pop(item)) == AVERROR(EAGAIN)) {
+            not_empty.wait([this] { return !empty() || is_closed() || error_code() < 0; });
+        }
+        return response;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Type *item;
+    };
+
+    int push_status() const {
+        int status = error_code();
+        if (status < 0) {
+            return status;
+        }
+        return is_closed() ? AVERROR_EOF : 0;
+    }
+
+    bool full() const {
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        return cells[position & mask].sequence.load(std::memory_order_acquire) < position;
+    }
+
+    bool empty() const {
+        size_t position = dequeue_position.load(std::memory_order_relaxed);
+        return cells[position & mask].sequence.load(std::memory_order_acquire) < position + 1;
+    }
+
+    const size_t capacity;
+    const size_t mask;
+    Cell *cells;
+    bool allocated;
+
+    char padding0[MEDIA_QUEUE_CACHE_LINE];
+    std::atomic<size_t> enqueue_position{0};
+    char padding1[MEDIA_QUEUE_CACHE_LINE];
+    std::atomic<size_t> dequeue_position{0};
+    char padding2[MEDIA_QUEUE_CACHE_LINE];
+};
+
+typedef SpscMediaQueue<PacketOps> SpscPacketQueue;
+typedef SpscMediaQueue<FrameOps> SpscFrameQueue;
+typedef MpmcMediaQueue<PacketOps> MpmcPacketQueue;
+typedef MpmcMediaQueue<FrameOps> MpmcFrameQueue;
+
+#endif //COMMON_MEDIAQUEUE_H
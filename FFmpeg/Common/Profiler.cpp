@@ -0,0 +1,277 @@
+//
+// Created by PingZi on 2020/9/8.
+//
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Profiler.h"
+#include "Logger.h"
+
+// 直方图按 2 的幂分段, 每段再平分成 8 个桶, 分位数的误差不超过 1/8
+#define PROFILE_SUB_BUCKET_BITS 3
+#define PROFILE_SUB_BUCKETS (1 << PROFILE_SUB_BUCKET_BITS)
+#define PROFILE_BUCKETS (64 * PROFILE_SUB_BUCKETS)
+
+std::atomic<bool> profiler_active(false);
+
+static const char *stage_names[PROFILE_STAGE_COUNT] = {
+        "demux", "send_packet", "receive_frame", "send_frame", "receive_packet", "mux", "write", "analyze", "scale"
+};
+
+/**
+ * 一个线程的计数. 只有所属线程写, 所以用 load + store 而不是 fetch_add, 省掉 lock 前缀;
+ * 报告线程用 relaxed 读, 读到的可能差几次调用, 不影响统计.
+ */
+class ThreadProfile {
+public:
+    ThreadProfile() {
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+            calls[stage].store(0, std::memory_order_relaxed);
+            total[stage].store(0, std::memory_order_relaxed);
+            for (int i = 0; i < PROFILE_BUCKETS; i++) {
+                buckets[stage][i].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::atomic<int64_t> calls[PROFILE_STAGE_COUNT];
+    std::atomic<int64_t> total[PROFILE_STAGE_COUNT];
+    std::atomic<int64_t> buckets[PROFILE_STAGE_COUNT][PROFILE_BUCKETS];
+};
+
+static std::mutex registry_mutex;
+// 线程结束之后数据还要参与最后的报告, 所以注册之后就一直保留到进程退出
+static std::vector<ThreadProfile *> registry;
+static thread_local ThreadProfile *current_profile = nullptr;
+
+static std::mutex periodic_mutex;
+static std::condition_variable periodic_condition;
+static std::thread periodic_thread;
+static bool periodic_stop = false;
+
+static std::string json_path;
+
+static inline void increase(std::atomic<int64_t> &counter, int64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static inline int highest_bit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+static inline int bucket_index(int64_t nanoseconds) {
+    if (nanoseconds < PROFILE_SUB_BUCKETS) {
+        return nanoseconds < 0 ? 0 : static_cast<int>(nanoseconds);
+    }
+    int bit = highest_bit(static_cast<uint64_t>(nanoseconds));
+    int sub = static_cast<int>(nanoseconds >> (bit - PROFILE_SUB_BUCKET_BITS)) & (PROFILE_SUB_BUCKETS - 1);
+    return (bit - PROFILE_SUB_BUCKET_BITS + 1) * PROFILE_SUB_BUCKETS + sub;
+}
+
+// 桶的中间值
+static double bucket_value(int index) {
+    if (index < PROFILE_SUB_BUCKETS) {
+        return index;
+    }
+    int bit = index / PROFILE_SUB_BUCKETS + PROFILE_SUB_BUCKET_BITS - 1;
+    int sub = index % PROFILE_SUB_BUCKETS;
+    double low = static_cast<double>((int64_t) (PROFILE_SUB_BUCKETS + sub) << (bit - PROFILE_SUB_BUCKET_BITS));
+    double width = static_cast<double>((int64_t) 1 << (bit - PROFILE_SUB_BUCKET_BITS));
+    return low + width / 2;
+}
+
+static double percentile(const std::vector<int64_t> &buckets, int64_t calls, double ratio) {
+    int64_t target = static_cast<int64_t>(calls * ratio);
+    int64_t seen = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > target) {
+            return bucket_value(i);
+        }
+    }
+    return bucket_value(PROFILE_BUCKETS - 1);
+}
+
+void profiler_enable(bool enable) {
+    profiler_active.store(enable, std::memory_order_relaxed);
+}
+
+void profiler_record(ProfileStage stage, int64_t nanoseconds) {
+    ThreadProfile *profile = current_profile;
+    if (profile == nullptr) {
+        profile = new ThreadProfile();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(profile);
+        current_profile = profile;
+    }
+
+    increase(profile->calls[stage], 1);
+    increase(profile->total[stage], nanoseconds);
+    increase(profile->buckets[stage][bucket_index(nanoseconds)], 1);
+}
+
+typedef struct ProfileSnapshot {
+    int threads;
+    int64_t calls[PROFILE_STAGE_COUNT];
+    int64_t total[PROFILE_STAGE_COUNT];
+    std::vector<std::vector<int64_t>> buckets;
+} ProfileSnapshot;
+
+static void take_snapshot(ProfileSnapshot *snapshot) {
+    snapshot->buckets.assign(PROFILE_STAGE_COUNT, std::vector<int64_t>(PROFILE_BUCKETS, 0));
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        snapshot->calls[stage] = 0;
+        snapshot->total[stage] = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    snapshot->threads = static_cast<int>(registry.size());
+    for (ThreadProfile *profile : registry) {
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+            snapshot->calls[stage] += profile->calls[stage].load(std::memory_order_relaxed);
+            snapshot->total[stage] += profile->total[stage].load(std::memory_order_relaxed);
+            for (int i = 0; i < PROFILE_BUCKETS; i++) {
+                snapshot->buckets[stage][i] += profile->buckets[stage][i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// -profile-json 给的文件, 每次报告的时候整体覆盖, 给基准测试之类的程序读取
+static void write_json(const ProfileSnapshot &snapshot, const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (file == nullptr) {
+        return;
+    }
+    fprintf(file, "{\n  \"threads\": %d,\n  \"stages\": {", snapshot.threads);
+    bool first = true;
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        int64_t calls = snapshot.calls[stage];
+        if (calls == 0) {
+            continue;
+        }
+        fprintf(file, "%s\n    \"%s\": {\"calls\": %lld, \"total_seconds\": %.6f, \"mean_us\": %.3f, "
+                      "\"p50_us\": %.3f, \"p99_us\": %.3f}",
+                first ? "" : ",", stage_names[stage], (long long) calls, snapshot.total[stage] / 1e9,
+                snapshot.total[stage] / 1e3 / calls,
+                percentile(snapshot.buckets[stage], calls, 0.50) / 1e3,
+                percentile(snapshot.buckets[stage], calls, 0.99) / 1e3);
+        first = false;
+    }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+}
+
+void profiler_report(ProfileOutput output) {
+    ProfileSnapshot snapshot;
+    take_snapshot(&snapshot);
+
+    int64_t all = 0;
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        all += snapshot.total[stage];
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "stage breakdown (%d threads):", snapshot.threads);
+    output(line);
+    snprintf(line, sizeof(line), "%-15s %10s %10s %10s %10s %10s %7s",
+             "stage", "calls", "total(s)", "mean(us)", "p50(us)", "p99(us)", "share");
+    output(line);
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        int64_t calls = snapshot.calls[stage];
+        if (calls == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%-15s %10lld %10.3f %10.1f %10.1f %10.1f %6.1f%%",
+                 stage_names[stage], (long long) calls, snapshot.total[stage] / 1e9,
+                 snapshot.total[stage] / 1e3 / calls,
+                 percentile(snapshot.buckets[stage], calls, 0.50) / 1e3,
+                 percentile(snapshot.buckets[stage], calls, 0.99) / 1e3,
+                 all > 0 ? 100.0 * snapshot.total[stage] / all : 0.0);
+        output(line);
+    }
+
+    if (!json_path.empty()) {
+        write_json(snapshot, json_path.c_str());
+    }
+}
+
+void profiler_start_periodic(double interval_seconds, ProfileOutput output) {
+    if (interval_seconds <= 0) {
+        return;
+    }
+    profiler_stop_periodic();
+
+    periodic_stop = false;
+    periodic_thread = std::thread([interval_seconds, output] {
+        std::unique_lock<std::mutex> lock(periodic_mutex);
+        std::chrono::duration<double> interval(interval_seconds);
+        while (!periodic_condition.wait_for(lock, interval, [] { return periodic_stop; })) {
+            lock.unlock();
+            profiler_report(output);
+            lock.lock();
+        }
+    });
+}
+
+void profiler_stop_periodic() {
+    if (!periodic_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(periodic_mutex);
+        periodic_stop = true;
+    }
+    periodic_condition.notify_all();
+    periodic_thread.join();
+}
+
+void profiler_log_line(const char *line) {
+    info("%s", line);
+}
+
+void profiler_run_start(double interval_seconds) {
+    profiler_start_periodic(interval_seconds, profiler_log_line);
+}
+
+void profiler_run_report() {
+    profiler_stop_periodic();
+    if (profiler_enabled()) {
+        profiler_report(profiler_log_line);
+    }
+}
+
+int parse_profiler_option(int argc, char *argv[], int index, double *interval_seconds) {
+    if (strcmp(argv[index], "-profile") == 0) {
+        profiler_enable(true);
+        return 1;
+    }
+    if (strcmp(argv[index], "-profile-interval") == 0 && index + 1 < argc) {
+        profiler_enable(true);
+        *interval_seconds = atof(argv[index + 1]);
+        return 2;
+    }
+    if (strcmp(argv[index], "-profile-json") == 0 && index + 1 < argc) {
+        profiler_enable(true);
+        json_path = argv[index + 1];
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+//
+// Created by PingZi on 2020/9/8.
+//
+
+#ifndef COMMON_PROFILER_H
+#define COMMON_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * 转码/复用热路径的轻量计时.
+ *
+ * 每个线程有自己的计数和直方图 (第一次记录时注册, 不加锁, 不分配内存), 报告的时候再把所有线程的数据合起来.
+ * 没有 profiler_enable 的时候每次调用只多一次 relaxed 的原子读, 打开之后每次调用是两次 steady_clock::now,
+ * 相对于一帧的编解码时间可以忽略.
+ *
+ *     while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {...}
+ */
+typedef enum ProfileStage {
+    PROFILE_DEMUX = 0,
+    PROFILE_SEND_PACKET,
+    PROFILE_RECEIVE_FRAME,
+    PROFILE_SEND_FRAME,
+    PROFILE_RECEIVE_PACKET,
+    PROFILE_MUX,
+    // 不经过 muxer 的输出, 比如直接写图片文件
+    PROFILE_WRITE,
+    // 对解码出来的帧做的计算, 比如算指纹
+    PROFILE_ANALYZE,
+    // 缩放 / 像素格式转换
+    PROFILE_SCALE,
+    PROFILE_STAGE_COUNT
+} ProfileStage;
+
+// 报告按行输出, 由调用方决定写到哪里 (info, 文件...)
+typedef void (*ProfileOutput)(const char *line);
+
+extern std::atomic<bool> profiler_active;
+
+inline bool profiler_enabled() {
+    return profiler_active.load(std::memory_order_relaxed);
+}
+
+inline int64_t profiler_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profiler_enable(bool enable);
+
+// 记录当前线程的一次调用
+void profiler_record(ProfileStage stage, int64_t nanoseconds);
+
+// 输出所有线程到目前为止的累计数据: 调用次数, 总时间, 平均, p50/p99, 占比.
+// 给了 -profile-json 的时候同时把这些数据以 JSON 写进那个文件
+void profiler_report(ProfileOutput output);
+
+// 启动一个后台线程每隔 interval_seconds 输出一次报告
+void profiler_start_periodic(double interval_seconds, ProfileOutput output);
+
+void profiler_stop_periodic();
+
+// 用 info() 输出报告的一行, 各个工具的报告都走这里
+void profiler_log_line(const char *line);
+
+// run_* 开始处理之前调用: 按 -profile-interval 的间隔启动周期报告, 输出到 profiler_log_line
+void profiler_run_start(double interval_seconds);
+
+// run_* 处理完之后调用: 停掉周期报告, 打开了计时的时候输出最终的分阶段耗时
+void profiler_run_report();
+
+/**
+ * 解析 argv[index] 处的计时选项: -profile, -profile-interval <秒>, -profile-json <文件>, 解析到就打开计时.
+ * 返回消耗的参数个数, 不是计时选项返回 0.
+ */
+int parse_profiler_option(int argc, char *argv[], int index, double *interval_seconds);
+
+template<typename F>
+inline auto profile_call(ProfileStage stage, F function) -> decltype(function()) {
+    if (!profiler_enabled()) {
+        return function();
+    }
+    int64_t begin = profiler_now();
+    auto result = function();
+    profiler_record(stage, profiler_now() - begin);
+    return result;
+}
+
+#define PROFILE(stage, expression) profile_call(stage, [&]() { return (expression); })
+
+#endif //COMMON_PROFILER_H
@@ -0,0 +1,329 @@
+//
+// Created by PingZi on 2020/9/5.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "InputBenchmark.h"
+#include "MappedInput.h"
+#include "RemuxRoute.h"
+#include "Logger.h"
+
+#define out &
+
+// 把整个输入 demux 一遍, 返回读到的字节数, 失败返回负数
+static int64_t demux_all(const char *filename, bool use_mmap) {
+    AVFormatContext *context = nullptr;
+    MappedFile *mapped = nullptr;
+    AVPacket *packet = nullptr;
+    int64_t bytes = 0;
+
+    int response;
+    if (use_mmap) {
+        response = open_mapped_input(filename, out context, out mapped);
+    } else {
+        response = avformat_open_input(out context, filename, nullptr, nullptr);
+    }
+    if (response < 0) {
+        error("cannot open input file(%s).", filename);
+        return response;
+    }
+
+    packet = av_packet_alloc();
+    if (packet == nullptr) {
+        bytes = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while ((response = av_read_frame(context, packet)) >= 0) {
+        av_packet_unref(packet);
+    }
+    if (response != AVERROR_EOF) {
+        error("error while reading %s: %d.", filename, response);
+        bytes = response;
+        goto end;
+    }
+    bytes = avio_size(context->pb);
+
+    end:
+    av_packet_free(&packet);
+    if (mapped != nullptr) {
+        close_mapped_input(out context, out mapped);
+    } else {
+        avformat_close_input(out context);
+    }
+    return bytes;
+}
+
+int run_input_benchmark(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: Remuxing -bench-io <input> [-repeat N]");
+        return -1;
+    }
+
+    const char *input = argv[2];
+    int repeat = 5;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (repeat <= 0) {
+        repeat = 1;
+    }
+
+    // 先完整读一遍, 让两种方式都从热的页缓存开始
+    int64_t warmup = demux_all(input, false);
+    if (warmup < 0) {
+        return static_cast<int>(warmup);
+    }
+
+    const char *names[2] = {"avio file", "mmap"};
+    double seconds[2] = {0, 0};
+    int64_t bytes[2] = {0, 0};
+
+    for (int round = 0; round < repeat; round++) {
+        for (int mode = 0; mode < 2; mode++) {
+            auto begin = std::chrono::steady_clock::now();
+            int64_t result = demux_all(input, mode == 1);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+            if (result < 0) {
+                return static_cast<int>(result);
+            }
+            seconds[mode] += elapsed.count();
+            bytes[mode] += result;
+        }
+    }
+
+    info("input %s, %.1f MB, %d rounds.", input, warmup / (1024.0 * 1024), repeat);
+    for (int mode = 0; mode < 2; mode++) {
+        double total = seconds[mode] > 0 ? seconds[mode] : 1e-9;
+        info("%-10s %8.3f s  %10.1f MB/s", names[mode], seconds[mode], bytes[mode] / total / (1024 * 1024));
+    }
+    if (seconds[1] > 0) {
+        info("mmap speedup: %.2fx", seconds[0] / seconds[1]);
+    }
+    return 0;
+}
+
+// 路由只用到 packet 的这几个字段, 数据本身不需要留在内存里
+typedef struct PacketHeader {
+    int stream_index;
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+} PacketHeader;
+
+// 原来 Remuxing0826 里每个 packet 的做法: 查 stream_list, 取两个 AVStream, 三次 av_rescale_q
+static inline void legacy_route_packet(const AVFormatContext *input_context, const AVFormatContext *output_context,
+                                       const int *stream_list, AVPacket *packet) {
+    int stream_index = packet->stream_index;
+    AVStream *input_stream = input_context->streams[stream_index];
+    AVStream *output_stream = output_context->streams[stream_list[stream_index]];
+
+    packet->stream_index = stream_list[stream_index];
+    packet->pts = av_rescale_q_rnd(packet->pts, input_stream->time_base, output_stream->time_base,
+                                   static_cast<AVRounding>(AV_ROUND_PASS_MINMAX | AV_ROUND_NEAR_INF));
+    packet->dts = av_rescale_q_rnd(packet->dts, input_stream->time_base, output_stream->time_base,
+                                   static_cast<AVRounding>(AV_ROUND_PASS_MINMAX | AV_ROUND_NEAR_INF));
+    packet->duration = av_rescale_q(packet->duration, input_stream->time_base, output_stream->time_base);
+    packet->pos = -1;
+}
+
+static inline void load_header(AVPacket *packet, const PacketHeader *header) {
+    packet->stream_index = header->stream_index;
+    packet->pts = header->pts;
+    packet->dts = header->dts;
+    packet->duration = header->duration;
+}
+
+int run_route_benchmark(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: Remuxing -bench-route <input> [-f format] [-map spec]... [-repeat N]");
+        return -1;
+    }
+
+    const char *input = argv[2];
+    const char *format = "mp4";
+    int repeat = 20;
+    StreamMap map = {};
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            format = argv[++i];
+        } else if (strcmp(argv[i], "-map") == 0 && i + 1 < argc) {
+            if (stream_map_add(&map, argv[++i]) < 0) {
+                error("invalid -map: %s", argv[i]);
+                return AVERROR(EINVAL);
+            }
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (repeat <= 0) {
+        repeat = 1;
+    }
+
+    AVFormatContext *input_context = nullptr;
+    AVFormatContext *output_context = nullptr;
+    AVPacket *packet = nullptr;
+    StreamRoute *routes = nullptr;
+    int *order = nullptr;
+    int *stream_list = nullptr;
+    uint8_t *header_buffer = nullptr;
+    std::vector<PacketHeader> headers;
+    const char *names[2] = {"lookup+rescale", "route table"};
+    double seconds[2] = {0, 0};
+    int64_t checksum[2] = {0, 0};
+    int64_t mismatches = 0;
+    int output_count;
+    int ret = 0;
+
+    int response = avformat_open_input(out input_context, input, nullptr, nullptr);
+    if (response < 0) {
+        error("cannot open input file(%s).", input);
+        return response;
+    }
+    response = avformat_find_stream_info(input_context, nullptr);
+    if (response < 0) {
+        error("cannot find stream info.");
+        ret = response;
+        goto end;
+    }
+
+    routes = static_cast<StreamRoute *>(av_mallocz_array(input_context->nb_streams, sizeof(*routes)));
+    order = static_cast<int *>(av_mallocz_array(input_context->nb_streams, sizeof(*order)));
+    stream_list = static_cast<int *>(av_mallocz_array(input_context->nb_streams, sizeof(*stream_list)));
+    packet = av_packet_alloc();
+    if (routes == nullptr || order == nullptr || stream_list == nullptr || packet == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    output_count = build_stream_routes(input_context, &map, routes, order);
+    if (output_count <= 0) {
+        error("no stream selected.");
+        ret = output_count < 0 ? output_count : AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+
+    // 输出写进内存, 只是为了让 muxer 在 avformat_write_header 里定下输出流的 time_base
+    response = avformat_alloc_output_context2(out output_context, nullptr, format, nullptr);
+    if (response < 0) {
+        error("cannot alloc output context for format %s.", format);
+        ret = response;
+        goto end;
+    }
+    for (int i = 0; i < output_count; i++) {
+        AVStream *output_stream = avformat_new_stream(output_context, nullptr);
+        if (output_stream == nullptr) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        response = avcodec_parameters_copy(output_stream->codecpar, input_context->streams[order[i]]->codecpar);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+        output_stream->codecpar->codec_tag = 0;
+    }
+    response = avio_open_dyn_buf(out output_context->pb);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = avformat_write_header(output_context, nullptr);
+    if (response < 0) {
+        error("cannot write header for format %s.", format);
+        ret = response;
+        goto end;
+    }
+    finalize_stream_routes(input_context, output_context, routes);
+    for (unsigned int i = 0; i < input_context->nb_streams; i++) {
+        stream_list[i] = routes[i].output_index;
+    }
+
+    while ((response = av_read_frame(input_context, packet)) >= 0) {
+        if (routes[packet->stream_index].output_index >= 0) {
+            headers.push_back({packet->stream_index, packet->pts, packet->dts, packet->duration});
+        }
+        av_packet_unref(packet);
+    }
+    if (response != AVERROR_EOF) {
+        error("error while reading %s: %d.", input, response);
+        ret = response;
+        goto end;
+    }
+    if (headers.empty()) {
+        error("no packet in selected streams.");
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    // 先确认两种做法的结果一致, 再计时
+    for (const PacketHeader &header : headers) {
+        load_header(packet, &header);
+        legacy_route_packet(input_context, output_context, stream_list, packet);
+        int64_t pts = packet->pts, dts = packet->dts, duration = packet->duration;
+        load_header(packet, &header);
+        route_packet(&routes[header.stream_index], packet);
+        if (packet->pts != pts || packet->dts != dts || packet->duration != duration) {
+            mismatches++;
+        }
+    }
+
+    for (int round = 0; round < repeat; round++) {
+        for (int mode = 0; mode < 2; mode++) {
+            int64_t sum = 0;
+            auto begin = std::chrono::steady_clock::now();
+            for (const PacketHeader &header : headers) {
+                load_header(packet, &header);
+                if (mode == 0) {
+                    legacy_route_packet(input_context, output_context, stream_list, packet);
+                } else {
+                    route_packet(&routes[header.stream_index], packet);
+                }
+                // 累加结果, 不让编译器把循环优化掉
+                sum += packet->stream_index + packet->pts + packet->dts + packet->duration;
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+            seconds[mode] += elapsed.count();
+            checksum[mode] += sum;
+        }
+    }
+
+    info("input %s -> %s, %zu packets, %d rounds.", input, format, headers.size(), repeat);
+    for (int mode = 0; mode < 2; mode++) {
+        double total_packets = static_cast<double>(headers.size()) * repeat;
+        info("%-15s %8.3f s  %8.2f ns/packet", names[mode], seconds[mode], seconds[mode] * 1e9 / total_packets);
+    }
+    if (seconds[1] > 0) {
+        info("route table speedup: %.2fx", seconds[0] / seconds[1]);
+    }
+    if (mismatches > 0 || checksum[0] != checksum[1]) {
+        error("%" PRId64 " packets routed differently.", mismatches);
+        ret = AVERROR_BUG;
+    }
+
+    end:
+    if (output_context != nullptr) {
+        if (output_context->pb != nullptr) {
+            avio_close_dyn_buf(output_context->pb, &header_buffer);
+            av_free(header_buffer);
+        }
+        avformat_free_context(output_context);
+    }
+    av_packet_free(&packet);
+    av_freep(&routes);
+    av_freep(&order);
+    av_freep(&stream_list);
+    avformat_close_input(out input_context);
+    return ret;
+}
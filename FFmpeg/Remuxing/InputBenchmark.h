@@ -0,0 +1,26 @@
+//
+// Created by PingZi on 2020/9/5.
+//
+
+#ifndef REMUXING_INPUTBENCHMARK_H
+#define REMUXING_INPUTBENCHMARK_H
+
+/**
+ * 比较两种打开输入文件方式的读取速度: Remuxing -bench-io <input> [-repeat N]
+ *
+ * 每一轮分别用默认的 file 协议和 mmap 把整个文件 demux 一遍 (只 av_read_frame, 不写输出),
+ * 两种方式交替进行, 避免页缓存只对其中一种有利. 最后输出各自的 MB/s.
+ * 想测冷缓存的情况需要在每轮之间自己清掉页缓存.
+ */
+int run_input_benchmark(int argc, char *argv[]);
+
+/**
+ * 比较每个 packet 改写 stream_index 和时间戳的开销: Remuxing -bench-route <input> [-f format] [-repeat N]
+ *
+ * 先把输入所有 packet 的 stream_index/pts/dts/duration 读进内存 (不保留数据), 输出流按 format (默认 mp4)
+ * 建好并写完头, 拿到 muxer 真正使用的 time_base. 然后每一轮分别用原来的 stream_list 查找 + av_rescale_q_rnd
+ * 和 StreamRoute 表把所有 packet 改写一遍, 输出各自的 ns/packet. 小 packet 很多的文件 (比如音频多的 ts) 最能看出差别.
+ */
+int run_route_benchmark(int argc, char *argv[]);
+
+#endif //REMUXING_INPUTBENCHMARK_H
@@ -0,0 +1,205 @@
+//
+// Created by PingZi on 2020/9/5.
+//
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "MappedInput.h"
+#include "Logger.h"
+
+// avio 的缓冲区大小. 数据已经在内存里了, 缓冲区大一点可以减少回调次数
+#define MAPPED_INPUT_BUFFER_SIZE (256 * 1024)
+
+static int map_file(const char *filename, MappedFile *mapped) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return AVERROR(ENOENT);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return AVERROR_INVALIDDATA;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return AVERROR(ENOMEM);
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return AVERROR(ENOMEM);
+    }
+
+    mapped->file_handle = file;
+    mapped->mapping_handle = mapping;
+    mapped->data = static_cast<const uint8_t *>(data);
+    mapped->size = size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return AVERROR(errno);
+    }
+
+    struct stat st = {};
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return AVERROR_INVALIDDATA;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // 映射建立之后就不再需要 fd 了
+    close(fd);
+    if (data == MAP_FAILED) {
+        return AVERROR(errno);
+    }
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    mapped->data = static_cast<const uint8_t *>(data);
+    mapped->size = st.st_size;
+#endif
+    mapped->position = 0;
+    return 0;
+}
+
+static void unmap_file(MappedFile *mapped) {
+    if (mapped->data == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapped->data);
+    CloseHandle(mapped->mapping_handle);
+    CloseHandle(mapped->file_handle);
+#else
+    munmap(const_cast<uint8_t *>(mapped->data), mapped->size);
+#endif
+    mapped->data = nullptr;
+}
+
+static int read_mapped(void *opaque, uint8_t *buffer, int buffer_size) {
+    MappedFile *mapped = static_cast<MappedFile *>(opaque);
+    int64_t remaining = mapped->size - mapped->position;
+    if (remaining <= 0) {
+        return AVERROR_EOF;
+    }
+
+    int size = remaining < buffer_size ? static_cast<int>(remaining) : buffer_size;
+    memcpy(buffer, mapped->data + mapped->position, size);
+    mapped->position += size;
+    return size;
+}
+
+static int64_t seek_mapped(void *opaque, int64_t offset, int whence) {
+    MappedFile *mapped = static_cast<MappedFile *>(opaque);
+    int64_t position;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return mapped->size;
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = mapped->position + offset;
+            break;
+        case SEEK_END:
+            position = mapped->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    if (position < 0 || position > mapped->size) {
+        return AVERROR(EINVAL);
+    }
+    mapped->position = position;
+    return position;
+}
+
+int open_mapped_input(const char *filename, AVFormatContext **format_context, MappedFile **mapped) {
+    uint8_t *buffer = nullptr;
+    AVIOContext *io_context = nullptr;
+
+    *mapped = static_cast<MappedFile *>(av_mallocz(sizeof(MappedFile)));
+    if (*mapped == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    int response = map_file(filename, *mapped);
+    if (response < 0) {
+        error("cannot map input file(%s): %d.", filename, response);
+        goto fail;
+    }
+
+    buffer = static_cast<uint8_t *>(av_malloc(MAPPED_INPUT_BUFFER_SIZE));
+    if (buffer == nullptr) {
+        response = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    io_context = avio_alloc_context(buffer, MAPPED_INPUT_BUFFER_SIZE, 0, *mapped, read_mapped, nullptr, seek_mapped);
+    if (io_context == nullptr) {
+        av_free(buffer);
+        response = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    *format_context = avformat_alloc_context();
+    if (*format_context == nullptr) {
+        response = AVERROR(ENOMEM);
+        goto fail;
+    }
+    (*format_context)->pb = io_context;
+    (*format_context)->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    // 文件名仍然传进去, 探测格式的时候会参考扩展名
+    response = avformat_open_input(format_context, filename, nullptr, nullptr);
+    if (response < 0) {
+        // 失败的时候 avformat_open_input 已经释放了 format_context
+        goto fail;
+    }
+    return 0;
+
+    fail:
+    if (io_context != nullptr) {
+        av_freep(&io_context->buffer);
+        avio_context_free(&io_context);
+    }
+    unmap_file(*mapped);
+    av_freep(mapped);
+    return response;
+}
+
+void close_mapped_input(AVFormatContext **format_context, MappedFile **mapped) {
+    AVIOContext *io_context = nullptr;
+    if (*format_context != nullptr) {
+        // 自定义的 AVIOContext 不会被 avformat_close_input 释放
+        io_context = (*format_context)->pb;
+        avformat_close_input(format_context);
+    }
+    if (io_context != nullptr) {
+        av_freep(&io_context->buffer);
+        avio_context_free(&io_context);
+    }
+
+    if (*mapped != nullptr) {
+        unmap_file(*mapped);
+        av_freep(mapped);
+    }
+}
@@ -0,0 +1,38 @@
+//
+// Created by PingZi on 2020/9/5.
+//
+
+#ifndef REMUXING_MAPPEDINPUT_H
+#define REMUXING_MAPPEDINPUT_H
+
+#include <cstdint>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+// 被 mmap 到内存里的输入文件, 作为自定义 AVIOContext 的 opaque
+typedef struct MappedFile {
+    const uint8_t *data;
+    int64_t size;
+    int64_t position;
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#endif
+} MappedFile;
+
+/**
+ * 使用 mmap 打开输入文件.
+ *
+ * 默认的 file 协议每次 avio 填充缓冲区都是一次 read() 系统调用. 这里把整个文件映射到内存里,
+ * 自定义 AVIOContext 的 read/seek 回调直接从映射里 memcpy, 没有系统调用, 并且用 madvise
+ * 告诉内核是顺序读取, 让它尽早预读.
+ *
+ * 成功之后 *format_context 和 avformat_open_input 打开的一样使用, 但是必须用 close_mapped_input 关闭.
+ */
+int open_mapped_input(const char *filename, AVFormatContext **format_context, MappedFile **mapped);
+
+void close_mapped_input(AVFormatContext **format_context, MappedFile **mapped);
+
+#endif //REMUXING_MAPPEDINPUT_H
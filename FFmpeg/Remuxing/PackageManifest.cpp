@@ -0,0 +1,180 @@
+//
+// Created by PingZi on 2020/9/22.
+//
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "PackageManifest.h"
+#include "Logger.h"
+
+// avcC 或者 Annex B 的 extradata 里找到 SPS, 取出 profile_idc, constraint_flags, level_idc
+static bool find_avc_profile(const uint8_t *data, int size, const uint8_t **profile) {
+    if (size >= 4 && data[0] == 1) {
+        *profile = data + 1;
+        return true;
+    }
+    for (int i = 0; i + 6 < size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 7) {
+            *profile = data + i + 4;
+            return true;
+        }
+    }
+    return false;
+}
+
+void make_codec_string(const AVCodecParameters *parameters, char *buffer, size_t size) {
+    const uint8_t *profile = nullptr;
+    if (parameters->codec_id == AV_CODEC_ID_H264 &&
+        find_avc_profile(parameters->extradata, parameters->extradata_size, &profile)) {
+        snprintf(buffer, size, "avc1.%02x%02x%02x", profile[0], profile[1], profile[2]);
+    } else if (parameters->codec_id == AV_CODEC_ID_AAC) {
+        // audio object type = profile + 1, 没有 profile 的时候从 AudioSpecificConfig 的前 5 位取
+        int object_type = 2;
+        if (parameters->profile >= 0) {
+            object_type = parameters->profile + 1;
+        } else if (parameters->extradata_size > 0) {
+            object_type = parameters->extradata[0] >> 3;
+        }
+        snprintf(buffer, size, "mp4a.40.%d", object_type);
+    } else if (parameters->codec_id == AV_CODEC_ID_MP3) {
+        snprintf(buffer, size, "mp4a.40.34");
+    } else if (parameters->codec_tag != 0) {
+        char tag[AV_FOURCC_MAX_STRING_SIZE] = {};
+        av_fourcc_make_string(tag, parameters->codec_tag);
+        snprintf(buffer, size, "%s", tag);
+    } else {
+        snprintf(buffer, size, "%s", avcodec_get_name(parameters->codec_id));
+    }
+}
+
+static FILE *open_manifest(const char *path, char *temporary, size_t size) {
+    snprintf(temporary, size, "%s.tmp", path);
+    FILE *file = fopen(temporary, "wb");
+    if (file == nullptr) {
+        error("cannot open %s to write.", temporary);
+    }
+    return file;
+}
+
+static int commit_manifest(FILE *file, const char *temporary, const char *path) {
+    bool failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed) {
+        error("cannot write %s.", temporary);
+        remove(temporary);
+        return AVERROR(EIO);
+    }
+#if defined(_WIN32)
+    // Windows 的 rename 不会覆盖已经存在的文件
+    remove(path);
+#endif
+    if (rename(temporary, path) != 0) {
+        int code = errno;
+        error("cannot rename %s to %s.", temporary, path);
+        return AVERROR(code);
+    }
+    return 0;
+}
+
+int write_hls_playlist(const char *path, const ManifestInfo *info, const PackagedSegment *segments, size_t count) {
+    char temporary[1024];
+    FILE *file = open_manifest(path, temporary, sizeof(temporary));
+    if (file == nullptr) {
+        return AVERROR(EIO);
+    }
+
+    // EXTINF 四舍五入之后不能超过 TARGETDURATION
+    long target = lround(info->target_duration);
+    fprintf(file, "#EXTM3U\n#EXT-X-VERSION:7\n");
+    fprintf(file, "#EXT-X-TARGETDURATION:%ld\n", target > 0 ? target : 1);
+    fprintf(file, "#EXT-X-MEDIA-SEQUENCE:%lld\n", count > 0 ? (long long) segments[0].number : 0LL);
+    fprintf(file, "#EXT-X-INDEPENDENT-SEGMENTS\n");
+    fprintf(file, "#EXT-X-MAP:URI=\"%s\"\n", PACKAGER_INIT_NAME);
+    for (size_t i = 0; i < count; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), PACKAGER_SEGMENT_FORMAT, (long long) segments[i].number);
+        fprintf(file, "#EXTINF:%.6f,\n%s\n", segments[i].duration * av_q2d(info->time_base), name);
+    }
+    if (info->finished) {
+        fprintf(file, "#EXT-X-ENDLIST\n");
+    }
+    return commit_manifest(file, temporary, path);
+}
+
+static void format_utc(time_t time, char *buffer, size_t size) {
+    struct tm utc = {};
+#if defined(_WIN32)
+    gmtime_s(&utc, &time);
+#else
+    gmtime_r(&time, &utc);
+#endif
+    strftime(buffer, size, "%Y-%m-%dT%H:%M:%SZ", &utc);
+}
+
+int write_dash_manifest(const char *path, const ManifestInfo *info, const PackagedSegment *segments, size_t count) {
+    char temporary[1024];
+    FILE *file = open_manifest(path, temporary, sizeof(temporary));
+    if (file == nullptr) {
+        return AVERROR(EIO);
+    }
+
+    // SegmentTemplate 的 timescale 只能是整数, time_base 的分子不是 1 的时候把时间戳乘上分子
+    int64_t numerator = info->time_base.num;
+    double window = 0;
+    for (size_t i = 0; i < count; i++) {
+        window += segments[i].duration * av_q2d(info->time_base);
+    }
+
+    fprintf(file, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+    fprintf(file, "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" "
+                  "profiles=\"urn:mpeg:dash:profile:isoff-live:2011\"");
+    if (info->finished) {
+        double total = 0;
+        if (count > 0) {
+            total = (segments[count - 1].start + segments[count - 1].duration - info->presentation_offset) *
+                    av_q2d(info->time_base);
+        }
+        fprintf(file, " type=\"static\" mediaPresentationDuration=\"PT%.3fS\"", total);
+    } else {
+        char available[32];
+        char published[32];
+        format_utc(info->availability_start, available, sizeof(available));
+        format_utc(time(nullptr), published, sizeof(published));
+        fprintf(file, " type=\"dynamic\" availabilityStartTime=\"%s\" publishTime=\"%s\" "
+                      "minimumUpdatePeriod=\"PT%.3fS\" timeShiftBufferDepth=\"PT%.3fS\"",
+                available, published, info->target_duration, window);
+    }
+    fprintf(file, " minBufferTime=\"PT%.3fS\">\n", info->target_duration);
+
+    fprintf(file, "  <Period id=\"0\" start=\"PT0S\">\n");
+    fprintf(file, "    <AdaptationSet id=\"0\" mimeType=\"%s\" segmentAlignment=\"true\" startWithSAP=\"1\">\n",
+            info->has_video ? "video/mp4" : "audio/mp4");
+    fprintf(file, "      <Representation id=\"0\" codecs=\"%s\" bandwidth=\"%lld\"", info->codecs,
+            (long long) info->bandwidth);
+    if (info->has_video) {
+        fprintf(file, " width=\"%d\" height=\"%d\"", info->width, info->height);
+    }
+    fprintf(file, ">\n");
+    fprintf(file, "        <SegmentTemplate timescale=\"%d\" initialization=\"%s\" media=\"%s\" startNumber=\"%lld\" "
+                  "presentationTimeOffset=\"%lld\">\n", info->time_base.den, PACKAGER_INIT_NAME, PACKAGER_DASH_MEDIA,
+            count > 0 ? (long long) segments[0].number : 1LL, (long long) (info->presentation_offset * numerator));
+    fprintf(file, "          <SegmentTimeline>\n");
+    for (size_t i = 0; i < count; i++) {
+        // 和上一段首尾相接的时候省略 t
+        if (i == 0 || segments[i].start != segments[i - 1].start + segments[i - 1].duration) {
+            fprintf(file, "            <S t=\"%lld\" d=\"%lld\"/>\n", (long long) (segments[i].start * numerator),
+                    (long long) (segments[i].duration * numerator));
+        } else {
+            fprintf(file, "            <S d=\"%lld\"/>\n", (long long) (segments[i].duration * numerator));
+        }
+    }
+    fprintf(file, "          </SegmentTimeline>\n");
+    fprintf(file, "        </SegmentTemplate>\n");
+    fprintf(file, "      </Representation>\n");
+    fprintf(file, "    </AdaptationSet>\n");
+    fprintf(file, "  </Period>\n");
+    fprintf(file, "</MPD>\n");
+    return commit_manifest(file, temporary, path);
+}
@@ -0,0 +1,61 @@
+//
+// Created by PingZi on 2020/9/22.
+//
+
+#ifndef REMUXING_PACKAGEMANIFEST_H
+#define REMUXING_PACKAGEMANIFEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#define PACKAGER_INIT_NAME "init.mp4"
+// 分段文件名, 序号从 1 开始. 两种写法必须对应同一个名字
+#define PACKAGER_SEGMENT_FORMAT "seg-%06lld.m4s"
+#define PACKAGER_DASH_MEDIA "seg-$Number%06d$.m4s"
+#define PACKAGER_HLS_NAME "index.m3u8"
+#define PACKAGER_DASH_NAME "manifest.mpd"
+
+typedef struct PackagedSegment {
+    int64_t number;
+    // 参考流 (有视频的时候是第一个视频流) time_base 下的起点和时长
+    int64_t start;
+    int64_t duration;
+    int64_t bytes;
+} PackagedSegment;
+
+typedef struct ManifestInfo {
+    AVRational time_base;
+    // RFC 6381 的 codecs, 多个流用逗号分隔
+    char codecs[128];
+    bool has_video;
+    int width;
+    int height;
+    // 目前为止最长的分段 (秒), 至少是设置的分段时长
+    double target_duration;
+    // 目前为止分段的最高码率 (bit/s)
+    int64_t bandwidth;
+    // 第一个分段的起点 (已经减掉了所有流共同的起始偏移), DASH 的 presentationTimeOffset
+    int64_t presentation_offset;
+    // DASH 直播的 availabilityStartTime
+    time_t availability_start;
+    // 输入已经结束: HLS 加上 ENDLIST, DASH 变成 static
+    bool finished;
+} ManifestInfo;
+
+// 按 RFC 6381 写出一个流的 codecs 字符串, 认不出细节的编码格式退回到 mp4 里的 fourcc
+void make_codec_string(const AVCodecParameters *parameters, char *buffer, size_t size);
+
+/**
+ * 把 segments (按序号从小到大的窗口) 写成 HLS 播放列表 / DASH MPD.
+ * 先写到 path.tmp 再改名, 播放器任何时候读到的都是完整的文件.
+ */
+int write_hls_playlist(const char *path, const ManifestInfo *info, const PackagedSegment *segments, size_t count);
+
+int write_dash_manifest(const char *path, const ManifestInfo *info, const PackagedSegment *segments, size_t count);
+
+#endif //REMUXING_PACKAGEMANIFEST_H
@@ -0,0 +1,568 @@
+//
+// Created by PingZi on 2020/9/22.
+//
+
+#define out &
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Packager.h"
+#include "PackageManifest.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+typedef std::chrono::steady_clock Clock;
+
+typedef struct PackagerState {
+    const PackagerOptions *options;
+    PackagerStats *stats;
+    ManifestInfo manifest;
+    // 还留在磁盘上的分段, 最后 window 个在播放列表里
+    std::vector<PackagedSegment> segments;
+    int64_t next_number;
+} PackagerState;
+
+static void output_path(const PackagerOptions *options, const char *name, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", options->output_dir, name);
+}
+
+static void segment_path(const PackagerOptions *options, int64_t number, char *path, size_t size) {
+    char name[64];
+    snprintf(name, sizeof(name), PACKAGER_SEGMENT_FORMAT, (long long) number);
+    output_path(options, name, path, size);
+}
+
+static int write_file(const char *path, const uint8_t *data, int size) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        error("cannot open %s to write.", path);
+        return AVERROR(EIO);
+    }
+    size_t written = fwrite(data, 1, static_cast<size_t>(size), file);
+    if (fclose(file) != 0 || written != static_cast<size_t>(size)) {
+        error("cannot write %s.", path);
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+/**
+ * muxer 的输出先写进内存 (dyn buf), 一段结束的时候整段写成一个文件.
+ * path 为 nullptr 的时候丢掉缓冲区里的内容.
+ */
+static int close_segment_buffer(AVFormatContext *output_context, const char *path, int64_t *bytes) {
+    uint8_t *buffer = nullptr;
+    int size = avio_close_dyn_buf(output_context->pb, &buffer);
+    output_context->pb = nullptr;
+    int response = 0;
+    if (path != nullptr) {
+        response = PROFILE(PROFILE_WRITE, write_file(path, buffer, size));
+    }
+    if (bytes != nullptr) {
+        *bytes = size;
+    }
+    av_free(buffer);
+    return response;
+}
+
+static int write_manifests(PackagerState *state) {
+    const PackagerOptions *options = state->options;
+    size_t count = state->segments.size();
+    size_t first = 0;
+    if (options->window > 0 && count > static_cast<size_t>(options->window)) {
+        first = count - options->window;
+    }
+    const PackagedSegment *segments = state->segments.data() + first;
+
+    char path[1024];
+    int response = 0;
+    if (options->manifests & PACKAGE_HLS) {
+        output_path(options, PACKAGER_HLS_NAME, path, sizeof(path));
+        response = PROFILE(PROFILE_WRITE, write_hls_playlist(path, &state->manifest, segments, count - first));
+    }
+    if (response >= 0 && (options->manifests & PACKAGE_DASH)) {
+        output_path(options, PACKAGER_DASH_NAME, path, sizeof(path));
+        response = PROFILE(PROFILE_WRITE, write_dash_manifest(path, &state->manifest, segments, count - first));
+    }
+    return response;
+}
+
+/**
+ * 结束当前分段: 让 muxer 把缓存的 packet 输出成一个 moof + mdat, 写成分段文件, 再更新播放列表.
+ * 调用之后 output_context->pb 为 nullptr, 由调用方决定是否开始下一段.
+ */
+static int finish_segment(AVFormatContext *output_context, PackagerState *state, int64_t start, int64_t duration,
+                          Clock::time_point begin) {
+    const PackagerOptions *options = state->options;
+    // frag_custom 的时候写一个空 packet 就是输出一个分片
+    int response = PROFILE(PROFILE_MUX, av_write_frame(output_context, nullptr));
+    if (response < 0) {
+        error("cannot flush fragment %lld.", (long long) state->next_number);
+        return response;
+    }
+
+    PackagedSegment segment = {};
+    segment.number = state->next_number++;
+    segment.start = start;
+    segment.duration = duration;
+    char path[1024];
+    segment_path(options, segment.number, path, sizeof(path));
+    response = close_segment_buffer(output_context, path, &segment.bytes);
+    if (response < 0) {
+        return response;
+    }
+
+    ManifestInfo *manifest = &state->manifest;
+    double seconds = duration * av_q2d(manifest->time_base);
+    double latency = std::chrono::duration<double>(Clock::now() - begin).count();
+    PackagerStats *stats = state->stats;
+    stats->segments++;
+    stats->segment_bytes += segment.bytes;
+    stats->max_segment_duration = std::max(stats->max_segment_duration, seconds);
+    stats->max_segment_latency = std::max(stats->max_segment_latency, latency);
+    stats->total_segment_latency += latency;
+    manifest->target_duration = std::max(manifest->target_duration, seconds);
+    if (seconds > 0) {
+        manifest->bandwidth = std::max(manifest->bandwidth, static_cast<int64_t>(segment.bytes * 8 / seconds));
+    }
+    debug("segment %lld: %.3f s, %lld bytes.", (long long) segment.number, seconds, (long long) segment.bytes);
+
+    // 滚动窗口: 移出播放列表的分段在 -delete 的时候多留几段再删
+    state->segments.push_back(segment);
+    if (options->window > 0) {
+        size_t keep = options->window + (options->delete_segments ? PACKAGER_DELETE_DELAY : 0);
+        while (state->segments.size() > keep) {
+            if (options->delete_segments) {
+                segment_path(options, state->segments.front().number, path, sizeof(path));
+                remove(path);
+            }
+            state->segments.erase(state->segments.begin());
+        }
+    }
+    return write_manifests(state);
+}
+
+static int64_t packet_order_key(const AVPacket *packet, const StreamRoute *route) {
+    int64_t timestamp = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    return timestamp == AV_NOPTS_VALUE ? INT64_MAX : av_rescale_q(timestamp, route->from, AV_TIME_BASE_Q);
+}
+
+/**
+ * empty_moov 的时候 moov 里没有样本, movenc 不能用 edit list 表示各个 track 的起点, 只能让时间戳从 0 开始.
+ * 这里先读进开头的一些 packet, 直到每个输出流都有了 dts, 取其中最小的作为所有流共同的偏移写进 route->offset,
+ * 写进 muxer 的时间戳和播放列表里的时间都用减掉偏移之后的值, 音视频之间原来的先后关系也保留下来.
+ * 读进来的 packet 按 dts 稳定排序放在 probed 里, 保证写进 muxer 的第一个 packet 的 dts 正好是 0,
+ * 不会再被 muxer 的 avoid_negative_ts 平移一次.
+ */
+static int probe_start_offset(AVFormatContext *input_context, StreamRoute *routes, int output_streams,
+                              std::vector<AVPacket *> *probed) {
+    int response = 0;
+    int pending = output_streams;
+    std::vector<bool> seen(input_context->nb_streams, false);
+    int64_t start = AV_NOPTS_VALUE;
+    AVRational start_time_base = AV_TIME_BASE_Q;
+
+    while (pending > 0 && probed->size() < PACKAGER_PROBE_PACKETS) {
+        AVPacket *packet = av_packet_alloc();
+        if (packet == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+        response = PROFILE(PROFILE_DEMUX, av_read_frame(input_context, packet));
+        if (response < 0) {
+            av_packet_free(&packet);
+            break;
+        }
+        unsigned int stream_index = static_cast<unsigned int>(packet->stream_index);
+        if (stream_index >= input_context->nb_streams || routes[stream_index].output_index < 0) {
+            av_packet_free(&packet);
+            continue;
+        }
+        probed->push_back(packet);
+        if (packet->dts == AV_NOPTS_VALUE) {
+            continue;
+        }
+        const StreamRoute *route = &routes[stream_index];
+        if (start == AV_NOPTS_VALUE || av_compare_ts(packet->dts, route->from, start, start_time_base) < 0) {
+            start = packet->dts;
+            start_time_base = route->from;
+        }
+        if (!seen[stream_index]) {
+            seen[stream_index] = true;
+            pending--;
+        }
+    }
+    if (response < 0 && response != AVERROR_EOF) {
+        return response;
+    }
+    if (pending > 0) {
+        debug("%d stream(s) have no dts in the first %zu packets.", pending, probed->size());
+    }
+
+    std::stable_sort(probed->begin(), probed->end(), [routes](const AVPacket *a, const AVPacket *b) {
+        return packet_order_key(a, &routes[a->stream_index]) < packet_order_key(b, &routes[b->stream_index]);
+    });
+    if (start != AV_NOPTS_VALUE) {
+        for (unsigned int i = 0; i < input_context->nb_streams; i++) {
+            if (routes[i].output_index >= 0) {
+                // 和 route_rescale 用一样的舍入, 起始 dts 所在的流减掉偏移之后正好是 0
+                routes[i].offset = av_rescale_q_rnd(start, start_time_base, routes[i].to,
+                                                    static_cast<AVRounding>(AV_ROUND_PASS_MINMAX | AV_ROUND_NEAR_INF));
+            }
+        }
+        debug("start offset: %.6f s.", start * av_q2d(start_time_base));
+    }
+    return 0;
+}
+
+// 先取 probe_start_offset 读进来的 packet, 取完之后再从输入读
+static int next_packet(AVFormatContext *input_context, std::vector<AVPacket *> *probed, size_t *next,
+                       AVPacket *packet) {
+    if (*next < probed->size()) {
+        AVPacket *buffered = (*probed)[(*next)++];
+        av_packet_move_ref(packet, buffered);
+        av_packet_free(&buffered);
+        return 0;
+    }
+    return PROFILE(PROFILE_DEMUX, av_read_frame(input_context, packet));
+}
+
+// -realtime: 等到墙上时间追上 packet 的时间戳再处理它
+static void wait_realtime(int64_t position, int64_t *origin, Clock::time_point start) {
+    if (position == AV_NOPTS_VALUE) {
+        return;
+    }
+    if (*origin == AV_NOPTS_VALUE) {
+        *origin = position;
+    }
+    std::this_thread::sleep_until(start + std::chrono::microseconds(position - *origin));
+}
+
+int package_file(const char *input, const PackagerOptions *options, PackagerStats *stats) {
+    int ret = 0;
+    int response = 0;
+    AVFormatContext *input_context = nullptr;
+    AVFormatContext *output_context = nullptr;
+    AVDictionary *muxer_options = nullptr;
+    AVPacket *packet = nullptr;
+    StreamRoute *routes = nullptr;
+    int *order = nullptr;
+    int output_streams = 0;
+    std::vector<AVPacket *> probed;
+    size_t next_probed = 0;
+    // 参考流在输出里的下标: 分段在它的关键帧上切, 播放列表里的时间也按它的 time_base
+    int reference = -1;
+    int64_t segment_ticks = 0;
+    int64_t first_start = AV_NOPTS_VALUE;
+    int64_t segment_start = AV_NOPTS_VALUE;
+    int64_t segment_end = AV_NOPTS_VALUE;
+    int64_t segment_packets = 0;
+    int64_t realtime_origin = AV_NOPTS_VALUE;
+    Clock::time_point started = Clock::now();
+    Clock::time_point segment_begin = started;
+    char path[1024];
+    PackagerState state;
+    state.options = options;
+    state.stats = stats;
+    state.manifest = {};
+    state.next_number = 1;
+
+    response = avformat_open_input(out input_context, input, nullptr, nullptr);
+    if (response < 0) {
+        error("cannot open input file(%s).", input);
+        ret = response;
+        goto end;
+    }
+
+    response = avformat_find_stream_info(input_context, nullptr);
+    if (response < 0) {
+        error("cannot find stream info for input file.");
+        ret = response;
+        goto end;
+    }
+
+    routes = static_cast<StreamRoute *>(av_mallocz_array(input_context->nb_streams, sizeof(*routes)));
+    order = static_cast<int *>(av_mallocz_array(input_context->nb_streams, sizeof(*order)));
+    if (routes == nullptr || order == nullptr) {
+        error("cannot alloc memory for stream routes.");
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    output_streams = build_stream_routes(input_context, &options->stream_map, routes, order);
+    if (output_streams <= 0) {
+        error("no stream selected for packaging.");
+        ret = output_streams < 0 ? output_streams : AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+
+    // 输出总是分片 mp4, 不需要文件名来猜格式
+    response = avformat_alloc_output_context2(out output_context, nullptr, "mp4", nullptr);
+    if (response < 0) {
+        error("cannot alloc memory for output context.");
+        ret = response;
+        goto end;
+    }
+    for (int i = 0; i < output_streams; i++) {
+        AVCodecParameters *input_parameters = input_context->streams[order[i]]->codecpar;
+        AVStream *output_stream = avformat_new_stream(output_context, nullptr);
+        if (output_stream == nullptr) {
+            error("cannot create output stream.");
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        response = avcodec_parameters_copy(output_stream->codecpar, input_parameters);
+        if (response < 0) {
+            error("cannot copy codec parameters to output stream.");
+            ret = response;
+            goto end;
+        }
+        // 输入可能是 ts/mkv, 它们的 codec_tag 在 mp4 里不一定合法, 让 mp4 muxer 自己选
+        output_stream->codecpar->codec_tag = 0;
+        if (reference < 0 && input_parameters->codec_type == AVMEDIA_TYPE_VIDEO) {
+            reference = i;
+        }
+    }
+    state.manifest.has_video = reference >= 0;
+    if (reference < 0) {
+        // 只有音频的时候每个 packet 都可以切
+        reference = 0;
+    }
+
+    // frag_custom: 什么时候输出一个分片完全由这里决定 (av_write_frame(nullptr)),
+    // empty_moov: init segment 里只有 ftyp + moov, 不带任何样本
+    av_dict_set(&muxer_options, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+    response = avio_open_dyn_buf(&output_context->pb);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = avformat_write_header(output_context, &muxer_options);
+    if (response < 0) {
+        error("cannot write header for output context.");
+        ret = response;
+        goto end;
+    }
+    finalize_stream_routes(input_context, output_context, routes);
+    response = probe_start_offset(input_context, routes, output_streams, &probed);
+    if (response < 0) {
+        error("cannot read the start of input file.");
+        ret = response;
+        goto end;
+    }
+
+    output_path(options, PACKAGER_INIT_NAME, path, sizeof(path));
+    response = close_segment_buffer(output_context, path, nullptr);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    {
+        ManifestInfo *manifest = &state.manifest;
+        AVStream *stream = output_context->streams[reference];
+        manifest->time_base = stream->time_base;
+        manifest->width = stream->codecpar->width;
+        manifest->height = stream->codecpar->height;
+        manifest->target_duration = options->segment_duration;
+        manifest->availability_start = time(nullptr);
+        for (int i = 0; i < output_streams; i++) {
+            char codec[32];
+            size_t length = strlen(manifest->codecs);
+            make_codec_string(output_context->streams[i]->codecpar, codec, sizeof(codec));
+            snprintf(manifest->codecs + length, sizeof(manifest->codecs) - length, "%s%s", length > 0 ? "," : "",
+                     codec);
+        }
+        segment_ticks = av_rescale_q(llround(options->segment_duration * AV_TIME_BASE), AV_TIME_BASE_Q,
+                                     stream->time_base);
+        info("packaging %s into %s: %d stream(s) [%s], %.3f s segments.", input, options->output_dir,
+             output_streams, manifest->codecs, options->segment_duration);
+    }
+
+    packet = av_packet_alloc();
+    if (packet == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    response = avio_open_dyn_buf(&output_context->pb);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    started = Clock::now();
+    while (next_packet(input_context, &probed, &next_probed, packet) >= 0) {
+        unsigned int stream_index = static_cast<unsigned int>(packet->stream_index);
+        StreamRoute *route = stream_index < input_context->nb_streams ? &routes[stream_index] : nullptr;
+        if (route == nullptr || route->output_index < 0) {
+            av_packet_unref(packet);
+            continue;
+        }
+        if (options->realtime) {
+            int64_t timestamp = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+            wait_realtime(timestamp == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+                          av_rescale_q(timestamp, route->from, AV_TIME_BASE_Q), &realtime_origin, started);
+        }
+        // 减掉所有流共同的起始偏移, 下面分段和播放列表里的时间都和 muxer 写进 tfdt 的一致
+        route_packet(route, packet);
+
+        if (route->output_index == reference && packet->pts != AV_NOPTS_VALUE) {
+            if (first_start == AV_NOPTS_VALUE) {
+                first_start = segment_start = packet->pts;
+                state.manifest.presentation_offset = first_start;
+            }
+            // 切点按 first_start + n * 分段时长 算, 某一段因为关键帧晚到变长之后, 后面的分段不会跟着整体推后
+            int64_t boundary = first_start + (state.next_number) * segment_ticks;
+            bool keyframe = !state.manifest.has_video || (packet->flags & AV_PKT_FLAG_KEY);
+            if (keyframe && segment_packets > 0 && packet->pts >= boundary) {
+                response = finish_segment(output_context, &state, segment_start, packet->pts - segment_start,
+                                          segment_begin);
+                if (response >= 0) {
+                    response = avio_open_dyn_buf(&output_context->pb);
+                }
+                if (response < 0) {
+                    av_packet_unref(packet);
+                    ret = response;
+                    goto end;
+                }
+                segment_start = packet->pts;
+                segment_packets = 0;
+            }
+            int64_t packet_end = packet->pts + packet->duration;
+            segment_end = segment_end == AV_NOPTS_VALUE ? packet_end : std::max(segment_end, packet_end);
+        }
+
+        if (segment_packets == 0) {
+            segment_begin = Clock::now();
+        }
+        segment_packets++;
+        stats->packets++;
+        // 不用 av_interleaved_write_frame: 它会把切点之后的 packet 留在交织队列里, 分片的边界就不对了.
+        // 分片 mp4 每个 track 的样本各自存放, 输入本身的交织顺序就够了
+        response = PROFILE(PROFILE_MUX, av_write_frame(output_context, packet));
+        av_packet_unref(packet);
+        if (response < 0) {
+            error("cannot write packet to segment %lld.", (long long) state.next_number);
+            ret = response;
+            goto end;
+        }
+    }
+
+    if (segment_packets > 0) {
+        int64_t duration = segment_end == AV_NOPTS_VALUE ? 0 : segment_end - segment_start;
+        response = finish_segment(output_context, &state, segment_start, duration, segment_begin);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    } else {
+        close_segment_buffer(output_context, nullptr, nullptr);
+    }
+
+    // trailer (mfra) 对分段没有用, 写进内存直接丢掉
+    response = avio_open_dyn_buf(&output_context->pb);
+    if (response >= 0) {
+        response = av_write_trailer(output_context);
+        close_segment_buffer(output_context, nullptr, nullptr);
+    }
+    if (response < 0) {
+        error("cannot write trailer for output context.");
+        ret = response;
+        goto end;
+    }
+
+    state.manifest.finished = true;
+    ret = write_manifests(&state);
+
+    end:
+    av_packet_free(&packet);
+    for (size_t i = next_probed; i < probed.size(); i++) {
+        av_packet_free(&probed[i]);
+    }
+    if (input_context != nullptr) {
+        avformat_close_input(out input_context);
+    }
+    if (output_context != nullptr) {
+        if (output_context->pb != nullptr) {
+            close_segment_buffer(output_context, nullptr, nullptr);
+        }
+        avformat_free_context(output_context);
+        output_context = nullptr;
+    }
+    av_free(routes);
+    av_free(order);
+    av_dict_free(&muxer_options);
+    return ret;
+}
+
+int run_package(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: Remuxing -package <input> [-o <dir>] [-segment-duration <seconds>] [-window N] [-delete] "
+              "[-hls] [-dash] [-realtime] [-map <spec>] [-profile] [-profile-interval <seconds>] "
+              "[-profile-json <file>]");
+        return -1;
+    }
+
+    const char *input = argv[2];
+    PackagerOptions options = {};
+    options.output_dir = ".";
+    options.segment_duration = 4;
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &options.profile_interval);
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-segment-duration") == 0 && i + 1 < argc) {
+            options.segment_duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-window") == 0 && i + 1 < argc) {
+            options.window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-delete") == 0) {
+            options.delete_segments = true;
+        } else if (strcmp(argv[i], "-hls") == 0) {
+            options.manifests |= PACKAGE_HLS;
+        } else if (strcmp(argv[i], "-dash") == 0) {
+            options.manifests |= PACKAGE_DASH;
+        } else if (strcmp(argv[i], "-realtime") == 0) {
+            options.realtime = true;
+        } else if (strcmp(argv[i], "-map") == 0 && i + 1 < argc) {
+            if (stream_map_add(&options.stream_map, argv[++i]) < 0) {
+                return -1;
+            }
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (options.segment_duration <= 0) {
+        error("segment duration must be positive.");
+        return -1;
+    }
+    if (options.window < 0) {
+        options.window = 0;
+    }
+    if (options.manifests == 0) {
+        options.manifests = PACKAGE_HLS | PACKAGE_DASH;
+    }
+
+    profiler_run_start(options.profile_interval);
+    PackagerStats stats = {};
+    auto begin = Clock::now();
+    int ret = package_file(input, &options, &stats);
+    stats.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    profiler_run_report();
+
+    info("%lld packet(s) in %lld segment(s), %lld bytes in %.3f s; longest segment %.3f s.",
+         (long long) stats.packets, (long long) stats.segments, (long long) stats.segment_bytes, stats.seconds,
+         stats.max_segment_duration);
+    if (stats.segments > 0) {
+        info("segment latency (first packet to file written): avg %.1f ms, max %.1f ms.",
+             stats.total_segment_latency / stats.segments * 1e3, stats.max_segment_latency * 1e3);
+    }
+    return ret;
+}
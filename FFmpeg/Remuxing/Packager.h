@@ -0,0 +1,65 @@
+//
+// Created by PingZi on 2020/9/22.
+//
+
+#ifndef REMUXING_PACKAGER_H
+#define REMUXING_PACKAGER_H
+
+#include <cstdint>
+
+#include "RemuxRoute.h"
+
+#define PACKAGE_HLS 1
+#define PACKAGE_DASH 2
+
+// 开了 -delete 的时候, 分段移出播放列表之后再保留这么多段才删除, 正在下载的播放器不会读到一半文件没了
+#define PACKAGER_DELETE_DELAY 2
+
+// 开始写之前最多先读这么多个 packet, 找出所有输出流里最小的起始 dts 作为整体的时间偏移
+#define PACKAGER_PROBE_PACKETS 1024
+
+typedef struct PackagerOptions {
+    // 输出目录 (必须已经存在), 里面写 init.mp4, seg-000001.m4s ... 和播放列表
+    const char *output_dir;
+    // 目标分段时长 (秒). 只在参考流的关键帧上切, 关键帧间隔比这个长的时候分段也会变长
+    double segment_duration;
+    // 播放列表里保留最近多少段, 0 表示保留全部
+    int window;
+    // 删除移出播放列表的分段文件
+    bool delete_segments;
+    // PACKAGE_HLS | PACKAGE_DASH
+    unsigned manifests;
+    // 按时间戳的速度读输入 (相当于 ffmpeg -re), 用文件模拟直播源
+    bool realtime;
+    // 选择打包哪些流, 所有选中的流复用在同一组分段里
+    StreamMap stream_map;
+    double profile_interval;
+} PackagerOptions;
+
+typedef struct PackagerStats {
+    int64_t packets;
+    int64_t segments;
+    int64_t segment_bytes;
+    double max_segment_duration;
+    // 一个分段的第一个 packet 写进 muxer 到这个分段文件写完的时间
+    double max_segment_latency;
+    double total_segment_latency;
+    double seconds;
+} PackagerStats;
+
+/**
+ * 把 input 打包成 CMAF 风格的分片 mp4: 一个 init segment (ftyp + moov) 加上一串固定时长的 media segment
+ * (moof + mdat), 同时维护一个滚动的 HLS 播放列表和/或 DASH MPD.
+ * packet 一边读一边写, 每凑够一段 (遇到参考流的关键帧) 就写出分段文件并更新播放列表,
+ * 所以打包的延迟是一个分段, 而不是整个文件.
+ */
+int package_file(const char *input, const PackagerOptions *options, PackagerStats *stats);
+
+/**
+ * Remuxing -package <input> [-o <dir>] [-segment-duration <seconds>] [-window N] [-delete] [-hls] [-dash]
+ *                   [-realtime] [-map <spec>] [profile options]
+ * 没有 -hls 和 -dash 的时候两种都写.
+ */
+int run_package(int argc, char *argv[]);
+
+#endif //REMUXING_PACKAGER_H
@@ -0,0 +1,162 @@
+//
+// Created by PingZi on 2020/9/4.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RemuxBatch.h"
+#include "Remuxing0826.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+typedef struct RemuxJob {
+    std::string input;
+    std::string output;
+    int result;
+    RemuxStats stats;
+} RemuxJob;
+
+static std::string trim(const std::string &text) {
+    const char *blank = " \t\r\n";
+    size_t begin = text.find_first_not_of(blank);
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(blank);
+    return text.substr(begin, end - begin + 1);
+}
+
+static int read_manifest(const char *filename, std::vector<RemuxJob> *jobs) {
+    FILE *file = fopen(filename, "r");
+    if (file == nullptr) {
+        error("cannot open manifest file: %s.", filename);
+        return AVERROR(ENOENT);
+    }
+
+    char buffer[4096];
+    int line_number = 0;
+    while (fgets(buffer, sizeof(buffer), file) != nullptr) {
+        line_number++;
+        std::string line = trim(buffer);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t separator = line.find('\t');
+        if (separator == std::string::npos) {
+            separator = line.find_last_of(' ');
+        }
+        if (separator == std::string::npos) {
+            error("manifest line %d has no output file, skipped.", line_number);
+            continue;
+        }
+
+        RemuxJob job = {};
+        job.input = trim(line.substr(0, separator));
+        job.output = trim(line.substr(separator + 1));
+        if (job.input.empty() || job.output.empty()) {
+            error("manifest line %d is malformed, skipped.", line_number);
+            continue;
+        }
+        jobs->push_back(job);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+int run_batch(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: Remuxing -batch <manifest> [-jobs N] [remux options]");
+        return -1;
+    }
+
+    const char *manifest = argv[2];
+    int jobs_count = static_cast<int>(std::thread::hardware_concurrency());
+    RemuxOptions options = {};
+    for (int i = 3; i < argc; i++) {
+        int next = parse_remux_option(argc, argv, i, &options);
+        if (next > i) {
+            i = next - 1;
+        } else if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) {
+            jobs_count = atoi(argv[++i]);
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (jobs_count <= 0) {
+        jobs_count = 1;
+    }
+
+    std::vector<RemuxJob> jobs;
+    int response = read_manifest(manifest, &jobs);
+    if (response < 0) {
+        return response;
+    }
+    if (jobs.empty()) {
+        error("manifest %s has no jobs.", manifest);
+        return -1;
+    }
+    if (jobs_count > static_cast<int>(jobs.size())) {
+        jobs_count = static_cast<int>(jobs.size());
+    }
+
+    info("remuxing %d files with %d threads.", static_cast<int>(jobs.size()), jobs_count);
+
+    // 线程池: 每个线程不断地领取下一个任务, 直到领完
+    std::atomic<size_t> next_job(0);
+    profiler_run_start(options.profile_interval);
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs_count; i++) {
+        workers.emplace_back([&jobs, &next_job, &options] {
+            size_t index;
+            while ((index = next_job.fetch_add(1)) < jobs.size()) {
+                RemuxJob &job = jobs[index];
+                job.result = remux_file(job.input.c_str(), job.output.c_str(), &options, &job.stats);
+                if (job.result < 0) {
+                    error("failed to remux %s: %d.", job.input.c_str(), job.result);
+                }
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    profiler_run_report();
+
+    int succeeded = 0;
+    int64_t input_bytes = 0;
+    int64_t packets = 0;
+    double write_blocked = 0;
+    for (const RemuxJob &job : jobs) {
+        if (job.result >= 0) {
+            succeeded++;
+            input_bytes += job.stats.input_bytes;
+            packets += job.stats.packets;
+            write_blocked += job.stats.write_blocked_seconds;
+        }
+    }
+
+    double seconds = elapsed.count() > 0 ? elapsed.count() : 1e-9;
+    info("batch finished: %d succeeded, %d failed, %.3f s.",
+         succeeded, static_cast<int>(jobs.size()) - succeeded, elapsed.count());
+    info("throughput: %.1f files/s, %.1f MB/s, %.0f packets/s.",
+         succeeded / seconds, input_bytes / seconds / (1024 * 1024), packets / seconds);
+    if (options.async_output) {
+        info("threads blocked on output for %.3f s in total.", write_blocked);
+    }
+
+    return succeeded == static_cast<int>(jobs.size()) ? 0 : -1;
+}
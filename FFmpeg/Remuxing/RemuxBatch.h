@@ -0,0 +1,18 @@
+//
+// Created by PingZi on 2020/9/4.
+//
+
+#ifndef REMUXING_REMUXBATCH_H
+#define REMUXING_REMUXBATCH_H
+
+/**
+ * 批量 remux: Remuxing -batch <manifest> [-jobs N] [remux options]
+ *
+ * manifest 每行一个任务, 格式是 "输入文件<TAB>输出文件" (没有 TAB 的时候用最后一段空白分隔),
+ * 空行和 # 开头的行会被忽略.
+ * 所有任务在一个进程里, 由固定数量的线程并发处理. 每个任务使用自己的 format context,
+ * 一个任务失败不会影响其它任务.
+ */
+int run_batch(int argc, char *argv[]);
+
+#endif //REMUXING_REMUXBATCH_H
@@ -0,0 +1,183 @@
+//
+// Created by PingZi on 2020/9/21.
+//
+
+#include <cstdlib>
+#include <cstring>
+
+#include "RemuxRoute.h"
+#include "Logger.h"
+
+static bool parse_media_type(char c, AVMediaType *type) {
+    switch (c) {
+        case 'v':
+            *type = AVMEDIA_TYPE_VIDEO;
+            return true;
+        case 'a':
+            *type = AVMEDIA_TYPE_AUDIO;
+            return true;
+        case 's':
+            *type = AVMEDIA_TYPE_SUBTITLE;
+            return true;
+        case 'd':
+            *type = AVMEDIA_TYPE_DATA;
+            return true;
+        case 't':
+            *type = AVMEDIA_TYPE_ATTACHMENT;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool parse_index(const char *text, int *index) {
+    char *end = nullptr;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 0) {
+        return false;
+    }
+    *index = static_cast<int>(value);
+    return true;
+}
+
+int stream_map_add(StreamMap *map, const char *spec) {
+    if (map->count >= REMUX_MAX_MAPS) {
+        error("too many -map rules (at most %d).", REMUX_MAX_MAPS);
+        return AVERROR(EINVAL);
+    }
+
+    StreamMapRule rule = {};
+    rule.type = AVMEDIA_TYPE_UNKNOWN;
+    rule.index = -1;
+    const char *current = spec;
+    if (*current == '-') {
+        rule.negative = true;
+        current++;
+    }
+    // 只有一个输入文件, 输入编号只能是 0
+    if (current[0] == '0' && (current[1] == '\0' || current[1] == ':')) {
+        current += current[1] == ':' ? 2 : 1;
+    }
+
+    bool valid = true;
+    if (*current != '\0') {
+        if (parse_media_type(*current, &rule.type)) {
+            if (current[1] == ':') {
+                valid = parse_index(current + 2, &rule.index);
+            } else {
+                valid = current[1] == '\0';
+            }
+        } else {
+            valid = parse_index(current, &rule.index);
+        }
+    }
+    if (!valid) {
+        error("invalid -map rule: %s", spec);
+        return AVERROR(EINVAL);
+    }
+
+    map->rules[map->count++] = rule;
+    return 0;
+}
+
+static bool rule_matches(const StreamMapRule *rule, const AVStream *stream, int type_index) {
+    if (rule->type == AVMEDIA_TYPE_UNKNOWN) {
+        return rule->index < 0 || rule->index == stream->index;
+    }
+    return stream->codecpar->codec_type == rule->type && (rule->index < 0 || rule->index == type_index);
+}
+
+int build_stream_routes(const AVFormatContext *input_context, const StreamMap *map, StreamRoute *routes, int *order) {
+    int nb_streams = static_cast<int>(input_context->nb_streams);
+    // 每个流在同类型的流里是第几个, 给 0:a:1 这种规则用
+    int *type_indices = static_cast<int *>(av_malloc_array(nb_streams > 0 ? nb_streams : 1, sizeof(int)));
+    if (type_indices == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+    int type_counts[AVMEDIA_TYPE_NB] = {};
+    for (int i = 0; i < nb_streams; i++) {
+        routes[i] = {};
+        routes[i].output_index = -1;
+        AVMediaType type = input_context->streams[i]->codecpar->codec_type;
+        type_indices[i] = type >= 0 && type < AVMEDIA_TYPE_NB ? type_counts[type]++ : 0;
+    }
+
+    // 先用 output_index 标记选中的顺序, 最后再编号, 这样负规则去掉的流不会留下空位
+    int selected = 0;
+    if (map == nullptr || map->count == 0) {
+        for (int i = 0; i < nb_streams; i++) {
+            AVMediaType type = input_context->streams[i]->codecpar->codec_type;
+            if (type == AVMEDIA_TYPE_AUDIO || type == AVMEDIA_TYPE_VIDEO || type == AVMEDIA_TYPE_SUBTITLE) {
+                routes[i].output_index = selected++;
+            } else {
+                info("Ignore codec type other than (audio, video, subtitle).");
+            }
+        }
+    } else {
+        for (int r = 0; r < map->count; r++) {
+            const StreamMapRule *rule = &map->rules[r];
+            bool matched = false;
+            for (int i = 0; i < nb_streams; i++) {
+                if (!rule_matches(rule, input_context->streams[i], type_indices[i])) {
+                    continue;
+                }
+                matched = true;
+                if (rule->negative) {
+                    routes[i].output_index = -1;
+                } else if (routes[i].output_index < 0) {
+                    routes[i].output_index = selected++;
+                }
+            }
+            if (!matched && !rule->negative) {
+                // 多半是写错了, 不能悄悄少输出一个流
+                error("-map rule %d matches no stream.", r);
+                av_free(type_indices);
+                return AVERROR_STREAM_NOT_FOUND;
+            }
+        }
+    }
+    av_free(type_indices);
+
+    // 按选中的先后排好, 重新编号成连续的输出下标
+    int count = 0;
+    for (int rank = 0; rank < selected; rank++) {
+        for (int i = 0; i < nb_streams; i++) {
+            if (routes[i].output_index == rank) {
+                order[count++] = i;
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        routes[order[i]].output_index = i;
+    }
+    return count;
+}
+
+void finalize_stream_routes(const AVFormatContext *input_context, const AVFormatContext *output_context,
+                            StreamRoute *routes) {
+    for (unsigned int i = 0; i < input_context->nb_streams; i++) {
+        StreamRoute *route = &routes[i];
+        if (route->output_index < 0) {
+            continue;
+        }
+        route->from = input_context->streams[i]->time_base;
+        route->to = output_context->streams[route->output_index]->time_base;
+
+        // from / to = (a / b) / (c / d) = (a * d) / (b * c)
+        int64_t numerator = static_cast<int64_t>(route->from.num) * route->to.den;
+        int64_t denominator = static_cast<int64_t>(route->from.den) * route->to.num;
+        if (numerator == denominator) {
+            route->kind = RESCALE_COPY;
+            route->factor = 1;
+        } else if (denominator > 0 && numerator > 0 && numerator % denominator == 0) {
+            route->kind = RESCALE_MULTIPLY;
+            route->factor = numerator / denominator;
+        } else {
+            route->kind = RESCALE_GENERIC;
+            route->factor = 0;
+        }
+        debug("stream %u -> %d: %d/%d -> %d/%d, %s.", i, route->output_index, route->from.num, route->from.den,
+              route->to.num, route->to.den,
+              route->kind == RESCALE_COPY ? "copy" : route->kind == RESCALE_MULTIPLY ? "multiply" : "rescale");
+    }
+}
@@ -0,0 +1,104 @@
+//
+// Created by PingZi on 2020/9/21.
+//
+
+#ifndef REMUXING_REMUXROUTE_H
+#define REMUXING_REMUXROUTE_H
+
+#include <cstdint>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#define REMUX_MAX_MAPS 32
+
+/**
+ * -map 规则, 写法和 ffmpeg 一样 (只有一个输入, 开头的 "0:" 可以省略):
+ *   0          所有流
+ *   0:v / 0:a  所有视频 / 音频流 (v a s d t)
+ *   0:a:1      第二个音频流
+ *   0:3        下标为 3 的流
+ *   -0:s       去掉前面选中的字幕流
+ * 按顺序处理, 输出流的顺序就是被选中的顺序. 没有任何 -map 的时候选中所有 audio/video/subtitle 流.
+ */
+typedef struct StreamMapRule {
+    bool negative;
+    // AVMEDIA_TYPE_UNKNOWN 表示任意类型
+    AVMediaType type;
+    // 有 type 的时候是这种类型里的第几个, 没有 type 的时候是流的下标, -1 表示全部
+    int index;
+} StreamMapRule;
+
+typedef struct StreamMap {
+    StreamMapRule rules[REMUX_MAX_MAPS];
+    int count;
+} StreamMap;
+
+// 解析一条 -map 规则追加到 map 里, 写法不对或者规则太多返回 AVERROR(EINVAL)
+int stream_map_add(StreamMap *map, const char *spec);
+
+typedef enum RescaleKind {
+    // 输入输出 time_base 相同, 时间戳原样使用
+    RESCALE_COPY = 0,
+    // 输出 time_base 是输入的整数分之一 (比如 1/1000 -> 1/90000), 乘一个整数
+    RESCALE_MULTIPLY,
+    // 其它情况仍然用 av_rescale_q_rnd
+    RESCALE_GENERIC,
+} RescaleKind;
+
+/**
+ * 每个输入流一项, 按输入流的下标直接索引, 每个 packet 只需要查一次表.
+ * 时间戳的换算方式在 avformat_write_header 之后 (muxer 可能会改输出流的 time_base) 算好.
+ */
+typedef struct StreamRoute {
+    // -1 表示这个流不输出
+    int output_index;
+    RescaleKind kind;
+    int64_t factor;
+    AVRational from;
+    AVRational to;
+    // 裁剪的时候从输出时间戳里减去的偏移 (输出流的 time_base), 让片段从 0 开始
+    int64_t offset;
+    // 裁剪的时候这个流已经读到了终点
+    bool finished;
+} StreamRoute;
+
+/**
+ * 按 map 选出要输出的流, routes[i].output_index 是输入流 i 在输出里的下标, 输出下标按选中的顺序从 0 开始.
+ * order 里按输出顺序放输入流的下标, 返回输出流的个数. routes 和 order 的长度都是 nb_streams.
+ * 有一条正规则一个流都没匹配上的时候返回 AVERROR_STREAM_NOT_FOUND.
+ */
+int build_stream_routes(const AVFormatContext *input_context, const StreamMap *map, StreamRoute *routes, int *order);
+
+// 输出流的 time_base 确定之后 (avformat_write_header 之后) 调用
+void finalize_stream_routes(const AVFormatContext *input_context, const AVFormatContext *output_context,
+                            StreamRoute *routes);
+
+static inline int64_t route_rescale(const StreamRoute *route, int64_t timestamp) {
+    if (route->kind == RESCALE_COPY || timestamp == AV_NOPTS_VALUE) {
+        return timestamp;
+    }
+    // 乘法只在不会溢出的范围内使用, 否则和原来一样交给 av_rescale_q_rnd
+    if (route->kind == RESCALE_MULTIPLY && timestamp <= INT64_MAX / route->factor &&
+        timestamp >= -(INT64_MAX / route->factor)) {
+        return timestamp * route->factor;
+    }
+    return av_rescale_q_rnd(timestamp, route->from, route->to,
+                            static_cast<AVRounding>(AV_ROUND_PASS_MINMAX | AV_ROUND_NEAR_INF));
+}
+
+// 改写 packet 的 stream_index 和时间戳, 准备写进输出
+static inline void route_packet(const StreamRoute *route, AVPacket *packet) {
+    packet->stream_index = route->output_index;
+    packet->pts = route_rescale(route, packet->pts);
+    packet->dts = route_rescale(route, packet->dts);
+    if (route->offset != 0) {
+        packet->pts = packet->pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : packet->pts - route->offset;
+        packet->dts = packet->dts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : packet->dts - route->offset;
+    }
+    packet->duration = route_rescale(route, packet->duration);
+    packet->pos = -1;
+}
+
+#endif //REMUXING_REMUXROUTE_H
@@ -5,7 +5,7 @@
 #define out &
 
 #include "Remuxing0821.h"
-#include "logger.h"
+#include "Logger.h"
 
 extern "C"{
 #include "libavformat/avformat.h"
@@ -4,26 +4,46 @@
 
 #define out &
 
-#include "Remuxing0826.h"
-#include "logger.h"
+// 裁剪的时候某个流超过终点这么多 (AV_TIME_BASE) 还有流没结束, 就认为那些流后面没有 packet 了
+#define REMUX_TRIM_TAIL (2 * AV_TIME_BASE)
+
+#include <cstring>
 
 extern "C" {
-#include "libavformat/avformat.h"
+#include "libavutil/parseutils.h"
 }
 
-int run_0826(int argc, char *argv[]) {
-    if (argc < 3) {
-        error("must pass at least 2 parameters.");
-        return -1;
+#include "Remuxing0826.h"
+#include "MappedInput.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+int remux_file(const char *input, const char *output, const RemuxOptions *options, RemuxStats *stats) {
+    RemuxOptions default_options = {};
+    if (options == nullptr) {
+        options = &default_options;
     }
 
     int ret = 0;
-
-    const char *input = argv[1];
-    const char *output = argv[2];
-
+    int response = 0;
+    StreamRoute *routes = nullptr;
+    int *order = nullptr;
+    int output_streams = 0;
+    AVPacket *packet = nullptr;
     AVFormatContext *input_context = nullptr;
-    int response = avformat_open_input(out input_context, input, nullptr, nullptr);
+    AVFormatContext *output_context = nullptr;
+    MappedFile *mapped_input = nullptr;
+    AVDictionary *muxer_options = nullptr;
+    int64_t input_start = 0;
+    int64_t end_time = AV_NOPTS_VALUE;
+    int remaining_streams = 0;
+    bool rebased = true;
+
+    if (options->mmap_input) {
+        response = open_mapped_input(input, out input_context, out mapped_input);
+    } else {
+        response = avformat_open_input(out input_context, input, nullptr, nullptr);
+    }
     if (response < 0) {
         error("cannot open input file(%s).", input);
         ret = response;
@@ -37,8 +57,28 @@ int run_0826(int argc, char *argv[]) {
         goto end;
     }
 
+    // 裁剪的起点和终点都相对于输入的开头, 换算成 AV_TIME_BASE 的绝对时间
+    if (input_context->start_time != AV_NOPTS_VALUE) {
+        input_start = input_context->start_time;
+    }
+    if (options->end_time > 0) {
+        end_time = input_start + options->end_time;
+    } else if (options->duration > 0) {
+        end_time = input_start + options->start_time + options->duration;
+    }
+    if (options->start_time > 0) {
+        // 用索引直接跳到起点之前最近的关键帧, 起点之前的数据不读
+        int64_t target = input_start + options->start_time;
+        response = avformat_seek_file(input_context, -1, INT64_MIN, target, target, 0);
+        if (response < 0) {
+            error("cannot seek input file to %.3f s.", options->start_time / (double) AV_TIME_BASE);
+            ret = response;
+            goto end;
+        }
+        rebased = false;
+    }
+
     // initialize output
-    AVFormatContext *output_context = nullptr;
     response = avformat_alloc_output_context2(out output_context, nullptr, nullptr, output);
     if (response < 0) {
         error("cannot alloc memory for output context.");
@@ -48,9 +88,12 @@ int run_0826(int argc, char *argv[]) {
 
     // TODO 这里记错了, 使用 oformat->flags 而不是 avio_flag
     //  avio_flag 应该和 AVIO_FLAG_XXX 的值有关系
-    int no_file = output_context->oformat->flags & AVFMT_NOFILE;
-    if (!no_file) {
-        response = avio_open(out output_context->pb, output, AVIO_FLAG_WRITE);
+    if (!(output_context->oformat->flags & AVFMT_NOFILE)) {
+        if (options->async_output) {
+            response = async_writer_open(out output_context->pb, output, &options->writer_options);
+        } else {
+            response = avio_open(out output_context->pb, output, AVIO_FLAG_WRITE);
+        }
         if (response < 0) {
             error("cannot open output file(%s) to write.", output);
             ret = response;
@@ -58,72 +101,118 @@ int run_0826(int argc, char *argv[]) {
         }
     }
 
-    int *stream_list = static_cast<int *>(av_mallocz_array(input_context->nb_streams, sizeof(*stream_list)));
-    int output_index = 0;
-    // 将 stream list 中需要转换的流的index按照顺序记录下来
-    for (int i = 0; i < input_context->nb_streams; i++) {
-        AVStream *input_stream = input_context->streams[i];
-        AVCodecParameters *input_parameters = input_stream->codecpar;
-
-        if (input_parameters->codec_type == AVMEDIA_TYPE_AUDIO ||
-            input_parameters->codec_type == AVMEDIA_TYPE_VIDEO ||
-            input_parameters->codec_type == AVMEDIA_TYPE_SUBTITLE) {
-            AVStream *output_stream = avformat_new_stream(output_context,
-                                                          avcodec_find_decoder(input_parameters->codec_id));
-            // TODO 这里忘记了拷贝 codec_parameters
-            //  虽然 codec_parameters 听起来是一个参数的概念, 我还以为要转换成 codec context 才行.
-            //  看来不用
-            response = avcodec_parameters_copy(output_stream->codecpar, input_parameters);
-            if (response < 0) {
-                ret = response;
-                error("error when copying parameters");
-                goto end;
-            }
-            stream_list[i] = output_stream->index;
-            continue;
+    routes = static_cast<StreamRoute *>(av_mallocz_array(input_context->nb_streams, sizeof(*routes)));
+    order = static_cast<int *>(av_mallocz_array(input_context->nb_streams, sizeof(*order)));
+    if (routes == nullptr || order == nullptr) {
+        error("cannot alloc memory for stream routes.");
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    // 每个输入流对应的输出流下标预先算好放进表里, 读 packet 的时候只查一次表
+    output_streams = build_stream_routes(input_context, &options->stream_map, routes, order);
+    if (output_streams <= 0) {
+        error("no stream selected for output.");
+        ret = output_streams < 0 ? output_streams : AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    for (int i = 0; i < output_streams; i++) {
+        AVCodecParameters *input_parameters = input_context->streams[order[i]]->codecpar;
+        AVStream *output_stream = avformat_new_stream(output_context,
+                                                      avcodec_find_decoder(input_parameters->codec_id));
+        if (output_stream == nullptr) {
+            ret = AVERROR(ENOMEM);
+            error("cannot create output stream.");
+            goto end;
+        }
+        // TODO 这里忘记了拷贝 codec_parameters
+        //  虽然 codec_parameters 听起来是一个参数的概念, 我还以为要转换成 codec context 才行.
+        //  看来不用
+        response = avcodec_parameters_copy(output_stream->codecpar, input_parameters);
+        if (response < 0) {
+            ret = response;
+            error("error when copying parameters");
+            goto end;
         }
-
-        stream_list[i] = -1;
-        info("Ignore codec type other than (audio, video, subtitle).");
     }
 
     // TODO 这里有点忘了, 是需要将 input 的 packet 读取出来, 然后写入输出文件. 不能直接将 stream 强塞给输出文件
-    AVPacket *packet = av_packet_alloc();
+    packet = av_packet_alloc();
     if (packet == nullptr) {
         error("cannot alloc memory for av packet.");
         ret = AVERROR(ENOMEM);
         goto end;
     }
 
-    response = avformat_write_header(output_context, nullptr);
+    if (!rebased) {
+        // 片段第一个 packet 的时间戳变成 0, 其它流稍早一点的 packet 由 muxer 整体平移成非负
+        output_context->avoid_negative_ts = AVFMT_AVOID_NEG_TS_MAKE_ZERO;
+    }
+    if (options->movflags != nullptr) {
+        av_dict_set(&muxer_options, "movflags", options->movflags, 0);
+    }
+    response = avformat_write_header(output_context, &muxer_options);
     if (response < 0) {
         error("cannot write header for output context.");
         ret = response;
         goto end;
     }
-    while (av_read_frame(input_context, packet) >= 0) {
-        int stream_index = packet->stream_index;
-        if (stream_list[stream_index] < 0) {
-            // ignore types other than ...
+    // muxer 在 write_header 里可能改了输出流的 time_base, 这之后才能确定时间戳怎么换算
+    finalize_stream_routes(input_context, output_context, routes);
+
+    remaining_streams = output_streams;
+
+    while (PROFILE(PROFILE_DEMUX, av_read_frame(input_context, packet)) >= 0) {
+        // 有的格式 (比如 mpeg-ts) 读的过程中还会出现新的流, 不在表里的一律丢掉
+        unsigned int stream_index = static_cast<unsigned int>(packet->stream_index);
+        StreamRoute *route = stream_index < input_context->nb_streams ? &routes[stream_index] : nullptr;
+        if (route == nullptr || route->output_index < 0) {
             av_packet_unref(packet);
             continue;
         }
 
-        AVStream *input_stream = input_context->streams[stream_index];
-        AVStream *output_stream = output_context->streams[stream_list[stream_index]];
+        if (end_time != AV_NOPTS_VALUE || !rebased) {
+            int64_t timestamp = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+            int64_t position = timestamp == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+                               av_rescale_q(timestamp, route->from, AV_TIME_BASE_Q);
+            if (end_time != AV_NOPTS_VALUE && position != AV_NOPTS_VALUE && position >= end_time) {
+                // 这个流到终点了. 所有流都到了, 或者已经超过终点很多 (有的流后面可能再也没有 packet) 就停止读取
+                if (!route->finished) {
+                    route->finished = true;
+                    remaining_streams--;
+                }
+                if (stats != nullptr) {
+                    stats->skipped_packets++;
+                }
+                av_packet_unref(packet);
+                if (remaining_streams == 0 || position >= end_time + REMUX_TRIM_TAIL) {
+                    break;
+                }
+                continue;
+            }
+            if (!rebased && position != AV_NOPTS_VALUE) {
+                // seek 之后的第一个 packet (起点之前的关键帧) 作为片段的 0 点
+                for (unsigned int i = 0; i < input_context->nb_streams; i++) {
+                    if (routes[i].output_index >= 0) {
+                        routes[i].offset = av_rescale_q(position, AV_TIME_BASE_Q, routes[i].to);
+                    }
+                }
+                rebased = true;
+            }
+        }
 
-        // packet to output
-        packet->stream_index = stream_list[stream_index];
-        packet->pts = av_rescale_q_rnd(packet->pts, input_stream->time_base, output_stream->time_base,
-                                       static_cast<AVRounding>(AV_ROUND_PASS_MINMAX | AV_ROUND_NEAR_INF));
-        packet->dts = av_rescale_q_rnd(packet->dts, input_stream->time_base, output_stream->time_base,
-                                       static_cast<AVRounding>(AV_ROUND_PASS_MINMAX | AV_ROUND_NEAR_INF));
-        packet->duration = av_rescale_q(packet->duration, input_stream->time_base,
-                                        output_stream->time_base); // TODO 为什么不用缩放
-        packet->pos = /*UNKNOW*/-1;
+        if (stats != nullptr) {
+            stats->packets++;
+            stats->packet_bytes += packet->size;
+        }
 
-        av_interleaved_write_frame(output_context, packet);
+        route_packet(route, packet);
+        response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output_context, packet));
         av_packet_unref(packet);
+        if (response < 0) {
+            error("cannot write packet to output file(%s).", output);
+            ret = response;
+            goto end;
+        }
     }
     response = av_write_trailer(output_context);
     if (response < 0) {
@@ -131,20 +220,116 @@ int run_0826(int argc, char *argv[]) {
         ret = response;
         goto end;
     }
+
+    if (stats != nullptr) {
+        stats->input_bytes += avio_size(input_context->pb);
+    }
     end:
-    if (input_context != nullptr) {
+    av_packet_free(&packet);
+
+    if (mapped_input != nullptr) {
+        close_mapped_input(out input_context, out mapped_input);
+    } else if (input_context != nullptr) {
         avformat_close_input(out input_context);
         input_context = nullptr;
     }
 
     if (output_context != nullptr) {
-        if (!(output_context->oformat->flags & AVFMT_NOFILE)) {
-            avio_close(output_context->pb);
+        if (options->async_output && output_context->pb != nullptr) {
+            AsyncWriterStats writer_stats = {};
+            response = async_writer_close(&output_context->pb, &writer_stats);
+            if (response < 0 && ret == 0) {
+                error("error while writing output file(%s).", output);
+                ret = response;
+            }
+            if (stats != nullptr) {
+                stats->write_blocked_seconds += writer_stats.blocked_seconds + writer_stats.drain_seconds;
+            }
+        } else if (!(output_context->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&output_context->pb);
         }
         avformat_free_context(output_context);
         output_context = nullptr;
-        av_free(stream_list);
     }
+    av_free(routes);
+    av_free(order);
+    av_dict_free(&muxer_options);
+
+    return ret;
+}
+
+int parse_remux_option(int argc, char *argv[], int first, RemuxOptions *options) {
+    int i = first;
+    while (i < argc) {
+        int consumed = parse_async_writer_option(argc, argv, i, &options->async_output, &options->writer_options);
+        if (consumed == 0) {
+            consumed = parse_profiler_option(argc, argv, i, &options->profile_interval);
+        }
+        if (consumed > 0) {
+            i += consumed;
+        } else if (strcmp(argv[i], "-mmap") == 0) {
+            options->mmap_input = true;
+            i++;
+        } else if ((strcmp(argv[i], "-ss") == 0 || strcmp(argv[i], "-to") == 0 || strcmp(argv[i], "-t") == 0) &&
+                   i + 1 < argc) {
+            int64_t value = 0;
+            if (av_parse_time(&value, argv[i + 1], 1) < 0 || value < 0) {
+                error("invalid time for %s: %s", argv[i], argv[i + 1]);
+                break;
+            }
+            int64_t *target = strcmp(argv[i], "-ss") == 0 ? &options->start_time :
+                              strcmp(argv[i], "-to") == 0 ? &options->end_time : &options->duration;
+            *target = value;
+            i += 2;
+        } else if (strcmp(argv[i], "-fragment") == 0) {
+            options->movflags = "frag_keyframe+empty_moov+default_base_moof";
+            i++;
+        } else if (strcmp(argv[i], "-movflags") == 0 && i + 1 < argc) {
+            options->movflags = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-map") == 0 && i + 1 < argc) {
+            if (stream_map_add(&options->stream_map, argv[i + 1]) < 0) {
+                break;
+            }
+            i += 2;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
 
+int run_0826(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("must pass at least 2 parameters.");
+        return -1;
+    }
+
+    const char *input = argv[1];
+    const char *output = argv[2];
+
+    RemuxOptions options = {};
+    int next = parse_remux_option(argc, argv, 3, &options);
+    if (next < argc) {
+        error("unknown option: %s", argv[next]);
+        return -1;
+    }
+
+    if (options.end_time > 0 && options.end_time <= options.start_time) {
+        error("-to must be after -ss.");
+        return -1;
+    }
+
+    RemuxStats stats = {};
+    profiler_run_start(options.profile_interval);
+    int ret = remux_file(input, output, &options, &stats);
+    profiler_run_report();
+    if (options.async_output) {
+        info("remux thread blocked on output for %.3f s.", stats.write_blocked_seconds);
+    }
+    if (options.start_time > 0 || options.end_time > 0 || options.duration > 0) {
+        info("trimmed: wrote %lld packet(s), dropped %lld past the end.", (long long) stats.packets,
+             (long long) stats.skipped_packets);
+    }
     return ret;
-}
\ No newline at end of file
+}
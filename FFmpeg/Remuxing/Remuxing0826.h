@@ -5,6 +5,57 @@
 #ifndef REMUXING_REMUXING0826_H
 #define REMUXING_REMUXING0826_H
 
-#endif //REMUXING_REMUXING0826_H
+#include <cstdint>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include "AsyncWriter.h"
+#include "RemuxRoute.h"
+
+typedef struct RemuxOptions {
+    // 使用 mmap + 自定义 AVIOContext 读取输入文件 (见 MappedInput.h)
+    bool mmap_input;
+    // 输出文件使用后台写线程 (见 AsyncWriter.h)
+    bool async_output;
+    AsyncWriterOptions writer_options;
+    // -profile-interval 给的周期报告间隔 (秒), 0 表示只在结束的时候报告
+    double profile_interval;
+    // -map 选择输出哪些流 (见 RemuxRoute.h), 没有规则的时候输出所有 audio/video/subtitle 流
+    StreamMap stream_map;
+    // -ss/-to/-t 裁剪 (AV_TIME_BASE, 相对于输入的开头), 0 表示不裁剪. 有起点的时候直接 seek 到起点之前的关键帧,
+    // 不从头读文件, 输出的时间戳从 0 开始
+    int64_t start_time;
+    int64_t end_time;
+    int64_t duration;
+    // 输出是 mp4/mov 的时候传给 muxer 的 movflags, -fragment 相当于 frag_keyframe+empty_moov+default_base_moof
+    const char *movflags;
+} RemuxOptions;
+
+// 一次 remux 的统计数据, 由调用方清零, remux_file 累加
+typedef struct RemuxStats {
+    int64_t input_bytes;
+    int64_t packet_bytes;
+    int64_t packets;
+    // 裁剪的时候读到了但是没有写出的 packet
+    int64_t skipped_packets;
+    // 异步写的时候 remux 线程等待磁盘的时间
+    double write_blocked_seconds;
+} RemuxStats;
 
-int run_0826(int argc, char *argv[]);
\ No newline at end of file
+/**
+ * 把 input 的 audio/video/subtitle 流 (或者 -map 选中的流) 原样拷贝到 output, 只改变封装格式.
+ * 所有资源都在函数内部申请和释放, 可以在多个线程里同时调用 (每个线程处理不同的文件).
+ * options 和 stats 都可以为 nullptr.
+ */
+int remux_file(const char *input, const char *output, const RemuxOptions *options, RemuxStats *stats);
+
+/**
+ * 解析 argv[first] 开始的 remux 选项, 遇到不认识的参数返回它的下标, 全部解析完返回 argc.
+ */
+int parse_remux_option(int argc, char *argv[], int first, RemuxOptions *options);
+
+int run_0826(int argc, char *argv[]);
+
+#endif //REMUXING_REMUXING0826_H
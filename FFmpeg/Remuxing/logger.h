@@ -1,13 +0,0 @@
-//
-// Created by PingZi on 2020/8/21.
-//
-
-#ifndef REMUXING_LOGGER_H
-#define REMUXING_LOGGER_H
-
-#endif //REMUXING_LOGGER_H
-
-void info(const char *format, ...);
-
-void error(const char *format, ...);
-
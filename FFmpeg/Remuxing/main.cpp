@@ -1,7 +1,23 @@
 #include <iostream>
+#include <cstring>
 
 #include "Remuxing0826.h"
+#include "RemuxBatch.h"
+#include "InputBenchmark.h"
+#include "Packager.h"
 
 int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-batch") == 0) {
+        return run_batch(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-bench-io") == 0) {
+        return run_input_benchmark(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-bench-route") == 0) {
+        return run_route_benchmark(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-package") == 0) {
+        return run_package(argc, argv);
+    }
     return run_0826(argc, argv);
 }
@@ -0,0 +1,288 @@
+//
+// Created by PingZi on 2020/9/20.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "BatchThumbnails.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+// 默认所有线程加起来最多 64 个解码帧, 1080p yuv420p 大约 200 MB, 和工作线程数无关
+#define BATCH_DEFAULT_FRAMES_IN_FLIGHT 64
+
+static const char *video_extensions[] = {
+        ".mp4", ".m4v", ".mov", ".mkv", ".webm", ".avi", ".flv", ".ts", ".mts", ".mpg", ".mpeg", ".wmv", ".3gp"
+};
+
+static bool is_video_file(const std::filesystem::path &path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    for (const char *candidate : video_extensions) {
+        if (extension == candidate) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int list_batch_files(const char *source, std::vector<std::string> *files) {
+    std::error_code code;
+    std::filesystem::path path(source);
+    if (std::filesystem::is_directory(path, code)) {
+        for (const auto &entry : std::filesystem::directory_iterator(path, code)) {
+            if (entry.is_regular_file(code) && is_video_file(entry.path())) {
+                files->push_back(entry.path().string());
+            }
+        }
+        if (code) {
+            error("cannot list directory %s: %s.", source, code.message().c_str());
+            return AVERROR(EIO);
+        }
+        std::sort(files->begin(), files->end());
+        return 0;
+    }
+
+    std::ifstream manifest(source);
+    if (!manifest) {
+        error("cannot open manifest: %s.", source);
+        return AVERROR(ENOENT);
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        size_t last = line.find_last_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        files->push_back(line.substr(first, last - first + 1));
+    }
+    return 0;
+}
+
+// 把当前线程绑定到 core 上, 解码器的缓存和分配器的线程缓存都留在同一个核上
+static int pin_current_thread(int core) {
+#if defined(_WIN32)
+    if (SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << core) == 0) {
+        return AVERROR(EINVAL);
+    }
+    return 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return AVERROR(pthread_setaffinity_np(pthread_self(), sizeof(set), &set));
+#else
+    (void) core;
+    return AVERROR(ENOSYS);
+#endif
+}
+
+typedef struct BatchContext {
+    const BatchOptions *options;
+    const std::vector<std::string> *files;
+    FrameBudget *budget;
+    std::atomic<size_t> next_file{0};
+    std::mutex mutex;
+    BatchStats *stats;
+} BatchContext;
+
+static void batch_worker(BatchContext *context, int worker) {
+    const BatchOptions *options = context->options;
+    if (options->pin_threads) {
+        int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        int response = pin_current_thread(worker % cores);
+        if (response < 0) {
+            debug("cannot pin worker %d to core %d: %d.", worker, worker % cores, response);
+        }
+    }
+
+    ThumbnailSession session = {};
+    session.budget = context->budget;
+    std::vector<double> latencies;
+    int64_t files = 0;
+    int64_t failed = 0;
+    int64_t thumbnails = 0;
+
+    size_t index;
+    while ((index = context->next_file.fetch_add(1)) < context->files->size()) {
+        const std::string &input = (*context->files)[index];
+        // 不同目录里可能有同名的文件, 前缀带上它在列表里的序号
+        char number[32];
+        snprintf(number, sizeof(number), "%04zu-", index);
+        std::string prefix = number + std::filesystem::path(input).filename().string() + "-";
+
+        ThumbnailOptions thumbnail = options->thumbnail;
+        thumbnail.input = input.c_str();
+        thumbnail.name_prefix = prefix.c_str();
+        ThumbnailStats stats = {};
+
+        auto begin = std::chrono::steady_clock::now();
+        int response = thumbnail_file(&session, &thumbnail, &stats);
+        latencies.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+
+        files++;
+        thumbnails += stats.thumbnails;
+        if (response < 0) {
+            failed++;
+            error("thumbnails failed for %s: %d.", input.c_str(), response);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(context->mutex);
+    BatchStats *stats = context->stats;
+    stats->files += files;
+    stats->failed_files += failed;
+    stats->thumbnails += thumbnails;
+    stats->decoder_opens += session.decoder_opens;
+    stats->decoder_reuses += session.decoder_reuses;
+    stats->latencies.insert(stats->latencies.end(), latencies.begin(), latencies.end());
+    thumbnail_session_free(&session);
+}
+
+int batch_thumbnails(const BatchOptions *options, BatchStats *stats) {
+    std::vector<std::string> files;
+    int response = list_batch_files(options->source, &files);
+    if (response < 0) {
+        return response;
+    }
+    if (files.empty()) {
+        error("no video files in %s.", options->source);
+        return AVERROR(ENOENT);
+    }
+
+    int workers = std::min(options->workers, static_cast<int>(files.size()));
+    FrameBudget budget(options->max_frames_in_flight);
+    BatchContext context;
+    context.options = options;
+    context.files = &files;
+    context.budget = &budget;
+    context.stats = stats;
+
+    info("thumbnailing %zu file(s) from %s with %d worker(s)%s, at most %d frame(s) in flight.", files.size(),
+         options->source, workers, options->pin_threads ? " pinned to cores" : "", options->max_frames_in_flight);
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(batch_worker, &context, i);
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    stats->peak_frames_in_flight = budget.peak_usage();
+    return stats->failed_files == stats->files ? AVERROR_INVALIDDATA : 0;
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int run_batch(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: SimpleGrayImage -batch <dir|manifest> [-o <dir>] [-workers N] [-max-frames-in-flight N] "
+              "[-no-pin] [-interval <seconds>] [-max N] [-accurate] [-decode-threads N] "
+              "[-decode-thread-type <frame|slice|auto>] [-width N] [-scaler <swscale|area>] [-profile] "
+              "[-profile-interval <seconds>] [-profile-json <file>]");
+        return -1;
+    }
+
+    BatchOptions options = {};
+    options.source = argv[2];
+    options.workers = static_cast<int>(std::thread::hardware_concurrency());
+    options.max_frames_in_flight = 0;
+    options.pin_threads = true;
+    options.thumbnail.output_dir = ".";
+    options.thumbnail.interval = 10;
+    options.thumbnail.decoder_threading.thread_type = FF_THREAD_SLICE;
+    double profile_interval = 0;
+
+    ThumbnailOptions &thumbnail = options.thumbnail;
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &thumbnail.decoder_threading);
+        }
+        if (consumed == 0) {
+            consumed = parse_gray_scaler_option(argc, argv, i, &thumbnail.scale_width, &thumbnail.scale_method);
+        }
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            thumbnail.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc) {
+            options.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-max-frames-in-flight") == 0 && i + 1 < argc) {
+            options.max_frames_in_flight = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-no-pin") == 0) {
+            options.pin_threads = false;
+        } else if (strcmp(argv[i], "-interval") == 0 && i + 1 < argc) {
+            thumbnail.interval = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+            thumbnail.max_thumbnails = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-accurate") == 0) {
+            thumbnail.accurate = true;
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (thumbnail.interval <= 0) {
+        error("interval must be positive.");
+        return -1;
+    }
+    if (options.workers <= 0) {
+        options.workers = 1;
+    }
+    // 并行度来自同时处理多个文件, 每个解码器默认只用一个线程, 不和其它工作线程抢核
+    if (thumbnail.decoder_threading.thread_count <= 0) {
+        thumbnail.decoder_threading.thread_count = 1;
+    }
+    if (options.max_frames_in_flight <= 0) {
+        options.max_frames_in_flight = BATCH_DEFAULT_FRAMES_IN_FLIGHT;
+    }
+
+    profiler_run_start(profile_interval);
+    BatchStats stats = {};
+    int ret = batch_thumbnails(&options, &stats);
+    profiler_run_report();
+    if (stats.files == 0) {
+        return ret;
+    }
+
+    std::sort(stats.latencies.begin(), stats.latencies.end());
+    double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+    info("%lld file(s) (%lld failed), %lld thumbnails in %.3f s: %.2f files/s, %.1f thumbnails/s.",
+         (long long) stats.files, (long long) stats.failed_files, (long long) stats.thumbnails, stats.seconds,
+         stats.files / seconds, stats.thumbnails / seconds);
+    info("per-file latency: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms.",
+         percentile(stats.latencies, 0.50) * 1e3, percentile(stats.latencies, 0.90) * 1e3,
+         percentile(stats.latencies, 0.99) * 1e3, stats.latencies.back() * 1e3);
+    info("decoders opened %lld time(s), reused %lld time(s); peak %lld of %d frame(s) in flight.",
+         (long long) stats.decoder_opens, (long long) stats.decoder_reuses, (long long) stats.peak_frames_in_flight,
+         options.max_frames_in_flight);
+    return ret;
+}
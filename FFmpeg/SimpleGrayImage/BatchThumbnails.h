@@ -0,0 +1,55 @@
+//
+// Created by PingZi on 2020/9/20.
+//
+
+#ifndef SIMPLEGRAYIMAGE_BATCHTHUMBNAILS_H
+#define SIMPLEGRAYIMAGE_BATCHTHUMBNAILS_H
+
+#include <string>
+#include <vector>
+
+#include "Thumbnails.h"
+
+typedef struct BatchOptions {
+    // 目录 (只看这一层里视频扩展名的文件) 或者清单文件 (每行一个路径, # 开头的是注释)
+    const char *source;
+    // 每个文件的缩略图设置, input 和 name_prefix 由批处理填写
+    ThumbnailOptions thumbnail;
+    int workers;
+    // 所有线程加起来最多同时存在多少个解码帧. 每个线程解码之前按解码器的参考帧, 重排序延迟和线程数占用额度,
+    // 额度不够的时候等其它线程写完
+    int max_frames_in_flight;
+    // 每个工作线程绑定到一个核上
+    bool pin_threads;
+} BatchOptions;
+
+typedef struct BatchStats {
+    int64_t files;
+    int64_t failed_files;
+    int64_t thumbnails;
+    int64_t decoder_opens;
+    int64_t decoder_reuses;
+    int64_t peak_frames_in_flight;
+    double seconds;
+    // 每个文件从打开到写完最后一张缩略图的时间
+    std::vector<double> latencies;
+} BatchStats;
+
+// 按 source 列出要处理的文件, 目录里的文件按名字排序
+int list_batch_files(const char *source, std::vector<std::string> *files);
+
+/**
+ * 用 workers 个线程给所有文件生成缩略图, 每个文件的图片以 "<序号>-<文件名>-" 为前缀写进同一个输出目录.
+ * 每个线程持有一个 ThumbnailSession, 同样编码参数的文件之间复用解码器.
+ * 单个文件失败只记录下来, 不影响其它文件.
+ */
+int batch_thumbnails(const BatchOptions *options, BatchStats *stats);
+
+/**
+ * SimpleGrayImage -batch <dir|manifest> [-o <dir>] [-workers N] [-max-frames-in-flight N] [-no-pin]
+ *                 [-interval <seconds>] [-max N] [-accurate] [-decode-threads N] [-width N]
+ *                 [-scaler <swscale|area>] [profile options]
+ */
+int run_batch(int argc, char *argv[]);
+
+#endif //SIMPLEGRAYIMAGE_BATCHTHUMBNAILS_H
@@ -0,0 +1,182 @@
+//
+// Created by PingZi on 2020/9/17.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/error.h"
+}
+
+#include "FrameArchive.h"
+#include "Logger.h"
+
+static uint64_t align_size(uint64_t size) {
+    return (size + FRAME_ARCHIVE_ALIGNMENT - 1) / FRAME_ARCHIVE_ALIGNMENT * FRAME_ARCHIVE_ALIGNMENT;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        int written = _write(fd, data, static_cast<unsigned int>(size));
+#else
+        ssize_t written = write(fd, data, size);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return AVERROR(errno);
+        }
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int write_header(FrameArchive *archive, uint64_t frame_count, uint64_t index_offset) {
+    ArchiveHeader header = {};
+    memcpy(header.magic, FRAME_ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = FRAME_ARCHIVE_VERSION;
+    header.payload = archive->payload;
+    header.time_base_num = archive->time_base.num;
+    header.time_base_den = archive->time_base.den;
+    header.frame_count = frame_count;
+    header.index_offset = index_offset;
+    header.entry_size = sizeof(ArchiveEntry);
+
+#ifdef _WIN32
+    if (_lseeki64(archive->fd, 0, SEEK_SET) < 0) {
+#else
+    if (lseek(archive->fd, 0, SEEK_SET) < 0) {
+#endif
+        return AVERROR(errno);
+    }
+    return write_all(archive->fd, reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+}
+
+int frame_archive_open(FrameArchive **archive, const char *filename, ArchivePayload payload, AVRational time_base) {
+#ifdef _WIN32
+    int fd = _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) {
+        int response = AVERROR(errno);
+        error("cannot open archive: %s.", filename);
+        return response;
+    }
+
+    FrameArchive *result = new FrameArchive;
+    result->fd = fd;
+    result->payload = payload;
+    result->time_base = time_base;
+    result->next_offset = sizeof(ArchiveHeader);
+
+    // 先写一个 index_offset 为 0 的文件头占位, 读的一方由此知道文件还没写完
+    int response = write_header(result, 0, 0);
+    if (response < 0) {
+        error("cannot write archive header: %s.", filename);
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+        delete result;
+        return response;
+    }
+    *archive = result;
+    return 0;
+}
+
+int64_t frame_archive_append(FrameArchive *archive, int64_t number, const AVFrame *frame, PgmBuffer *buffer) {
+    int64_t size = pack_pgm(frame, buffer, archive->payload == ARCHIVE_PAYLOAD_PGM, FRAME_ARCHIVE_ALIGNMENT);
+    if (size < 0) {
+        return size;
+    }
+    // 对齐用的填充一起写出去, 每帧只有一次 write
+    uint64_t padded = align_size(static_cast<uint64_t>(size));
+    memset(buffer->data + size, 0, padded - size);
+
+    ArchiveEntry entry = {};
+    entry.number = number;
+    entry.pts = frame->best_effort_timestamp;
+    entry.size = static_cast<uint32_t>(size);
+    entry.width = frame->width;
+    entry.height = frame->height;
+
+    // 写失败之后文件长度和 next_offset 对不上了, 调用方应该停止追加
+    std::lock_guard<std::mutex> lock(archive->mutex);
+    int response = write_all(archive->fd, buffer->data, padded);
+    if (response < 0) {
+        return response;
+    }
+    entry.offset = archive->next_offset;
+    archive->next_offset += padded;
+    archive->entries.push_back(entry);
+    return static_cast<int64_t>(padded);
+}
+
+int frame_archive_close(FrameArchive **archive) {
+    FrameArchive *current = *archive;
+    if (current == nullptr) {
+        return 0;
+    }
+
+    // 写线程完成的顺序不确定, 索引按帧号排好, 读的时候才能二分查找
+    std::sort(current->entries.begin(), current->entries.end(),
+              [](const ArchiveEntry &a, const ArchiveEntry &b) { return a.number < b.number; });
+    int ret = write_all(current->fd, reinterpret_cast<const uint8_t *>(current->entries.data()),
+                        current->entries.size() * sizeof(ArchiveEntry));
+    if (ret >= 0) {
+        ret = write_header(current, current->entries.size(), current->next_offset);
+    }
+    if (ret < 0) {
+        error("cannot finish archive index: %d.", ret);
+    } else {
+        info("archive has %zu frame(s), index at %llu.", current->entries.size(),
+             (unsigned long long) current->next_offset);
+    }
+
+#ifdef _WIN32
+    _close(current->fd);
+#else
+    close(current->fd);
+#endif
+    delete current;
+    *archive = nullptr;
+    return ret;
+}
+
+const ArchiveEntry *frame_archive_lookup(const uint8_t *data, size_t size, int64_t number) {
+    if (size < sizeof(ArchiveHeader)) {
+        return nullptr;
+    }
+    const ArchiveHeader *header = reinterpret_cast<const ArchiveHeader *>(data);
+    if (memcmp(header->magic, FRAME_ARCHIVE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != FRAME_ARCHIVE_VERSION || header->entry_size != sizeof(ArchiveEntry) ||
+        header->index_offset == 0 || header->index_offset > size ||
+        header->frame_count > (size - header->index_offset) / sizeof(ArchiveEntry)) {
+        return nullptr;
+    }
+
+    // index_offset 按 64 字节对齐, mmap 的起始地址按页对齐, 所以可以直接当成数组用
+    const ArchiveEntry *begin = reinterpret_cast<const ArchiveEntry *>(data + header->index_offset);
+    const ArchiveEntry *end = begin + header->frame_count;
+    const ArchiveEntry *entry = std::lower_bound(begin, end, number,
+                                                 [](const ArchiveEntry &a, int64_t n) { return a.number < n; });
+    if (entry == end || entry->number != number || entry->offset + entry->size > size) {
+        return nullptr;
+    }
+    return entry;
+}
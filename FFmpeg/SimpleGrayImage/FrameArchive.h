@@ -0,0 +1,98 @@
+//
+// Created by PingZi on 2020/9/17.
+//
+
+#ifndef SIMPLEGRAYIMAGE_FRAMEARCHIVE_H
+#define SIMPLEGRAYIMAGE_FRAMEARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/rational.h"
+}
+
+#include "PgmWriter.h"
+
+/**
+ * 把很多帧灰度图写进一个文件, 代替每帧一个 PGM 文件. 文件结构 (小端, 所有数字都是定长的):
+ *
+ *   ArchiveHeader          固定 64 字节
+ *   payload 0, payload 1   每帧一段, 起始位置按 64 字节对齐, 按写完的先后顺序追加
+ *   ArchiveEntry[count]    索引, 按帧号从小到大排好, 起始位置按 64 字节对齐
+ *
+ * 写的过程中只往文件末尾追加, 索引在关闭的时候写到最后, 再回头把 frame_count 和 index_offset 填进文件头.
+ * 没有正常关闭的文件 index_offset 是 0. 读的一方把整个文件 mmap 进来, 用 frame_archive_lookup 按帧号二分查找,
+ * payload 直接就是 height 行, 每行 width 字节的像素 (或者带文件头的完整 PGM), 不需要再拷贝.
+ */
+
+#define FRAME_ARCHIVE_MAGIC "GRAYARC1"
+#define FRAME_ARCHIVE_VERSION 1
+#define FRAME_ARCHIVE_ALIGNMENT 64
+
+typedef enum ArchivePayload {
+    // 紧凑的 8 bit 像素, 没有行填充
+    ARCHIVE_PAYLOAD_RAW = 0,
+    // 完整的 PGM 文件, 拿出来可以直接保存
+    ARCHIVE_PAYLOAD_PGM = 1,
+} ArchivePayload;
+
+typedef struct ArchiveHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t payload;
+    // pts 的 time_base
+    int32_t time_base_num;
+    int32_t time_base_den;
+    uint64_t frame_count;
+    uint64_t index_offset;
+    uint32_t entry_size;
+    uint8_t reserved[20];
+} ArchiveHeader;
+
+typedef struct ArchiveEntry {
+    // 解码顺序的帧号, 从 1 开始, 和 frame-%06d.pgm 的编号一样
+    int64_t number;
+    int64_t pts;
+    uint64_t offset;
+    uint32_t size;
+    int32_t width;
+    int32_t height;
+    uint32_t reserved;
+} ArchiveEntry;
+
+static_assert(sizeof(ArchiveHeader) == 64, "archive header must be 64 bytes");
+static_assert(sizeof(ArchiveEntry) == 40, "archive entry must be 40 bytes");
+
+typedef struct FrameArchive {
+    int fd;
+    ArchivePayload payload;
+    AVRational time_base;
+    // 下一段 payload 的位置, 也就是当前文件的长度
+    uint64_t next_offset;
+    std::vector<ArchiveEntry> entries;
+    // 多个写线程共用一个文件, 打包像素在锁外面做, 只有写文件和记索引在锁里
+    std::mutex mutex;
+} FrameArchive;
+
+int frame_archive_open(FrameArchive **archive, const char *filename, ArchivePayload payload, AVRational time_base);
+
+/**
+ * 追加一帧 (第一个平面是 8 bit 亮度), pts 取 frame->best_effort_timestamp. 可以在多个线程里同时调用,
+ * buffer 是调用线程自己的. 返回写入的字节数, 失败返回 AVERROR.
+ */
+int64_t frame_archive_append(FrameArchive *archive, int64_t number, const AVFrame *frame, PgmBuffer *buffer);
+
+// 写索引, 补全文件头, 关闭文件. 返回负数表示文件不完整
+int frame_archive_close(FrameArchive **archive);
+
+/**
+ * 在 mmap (或者整个读进内存) 的归档里按帧号查找, 找不到或者文件不完整返回 nullptr.
+ * payload 在 data + entry->offset, 长度 entry->size.
+ */
+const ArchiveEntry *frame_archive_lookup(const uint8_t *data, size_t size, int64_t number);
+
+#endif //SIMPLEGRAYIMAGE_FRAMEARCHIVE_H
@@ -0,0 +1,365 @@
+//
+// Created by PingZi on 2020/9/11.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "FrameExtraction.h"
+#include "GrayImage0826.h"
+#include "GrayConverter.h"
+#include "MediaQueue.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+typedef struct Extractor {
+    const ExtractOptions *options;
+    AVCodecContext *decoder;
+    MpmcFrameQueue *queue;
+    ExtractStats *stats;
+    FrameArchive *archive;
+    // 已经交给写线程的图片数, 用来判断是否到了 max_images
+    int64_t queued_images;
+    std::atomic<int64_t> written_images{0};
+    std::atomic<int64_t> written_bytes{0};
+} Extractor;
+
+int open_video_decoder(AVFormatContext *format_context, int stream_index, const DecoderThreading *threading,
+                       AVCodecContext **decoder) {
+    AVCodecParameters *parameters = format_context->streams[stream_index]->codecpar;
+    int response = open_decoder_context(parameters, threading, nullptr, decoder);
+    if (response < 0) {
+        error("cannot open decoder for video stream [index:%d]: %d.", stream_index, response);
+        return response;
+    }
+    info("video decoder %s uses %d thread(s).", (*decoder)->codec->name, (*decoder)->thread_count);
+    return 0;
+}
+
+int open_video_input(const char *input, const DecoderThreading *threading, AVFormatContext **format_context,
+                     int *stream_index, AVCodecContext **decoder) {
+    int response = avformat_open_input(format_context, input, nullptr, nullptr);
+    if (response < 0) {
+        error("cannot open input file: %s.", input);
+        return response;
+    }
+    response = avformat_find_stream_info(*format_context, nullptr);
+    if (response < 0) {
+        error("cannot find stream info for input file.");
+        goto fail;
+    }
+    *stream_index = av_find_best_stream(*format_context, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (*stream_index < 0) {
+        response = *stream_index;
+        error("cannot find video stream for input file.");
+        goto fail;
+    }
+    // 只解码这一个流, 其它流的 packet 由 demuxer 直接丢掉
+    for (unsigned int i = 0; i < (*format_context)->nb_streams; i++) {
+        if (static_cast<int>(i) != *stream_index) {
+            (*format_context)->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    if (decoder != nullptr) {
+        response = open_video_decoder(*format_context, *stream_index, threading, decoder);
+        if (response < 0) {
+            goto fail;
+        }
+    }
+    return 0;
+
+    fail:
+    avformat_close_input(format_context);
+    return response;
+}
+
+int decode_video(AVFormatContext *format_context, int stream_index, AVCodecContext *decoder,
+                 VideoFrameCallback on_frame, void *opaque) {
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    if (packet == nullptr || frame == nullptr) {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        return AVERROR(ENOMEM);
+    }
+
+    int response = 0;
+    bool flushing = false;
+    while (true) {
+        if (!flushing) {
+            response = PROFILE(PROFILE_DEMUX, av_read_frame(format_context, packet));
+            if (response == AVERROR_EOF) {
+                // 冲刷解码器里剩下的帧
+                flushing = true;
+                response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, nullptr));
+            } else if (response < 0) {
+                error("failed to read packet: %d.", response);
+                break;
+            } else if (packet->stream_index != stream_index) {
+                av_packet_unref(packet);
+                continue;
+            } else {
+                response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
+                av_packet_unref(packet);
+            }
+            if (response < 0) {
+                error("cannot send packet to decoder: %d.", response);
+                break;
+            }
+        }
+
+        while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
+            response = on_frame(opaque, frame);
+            av_frame_unref(frame);
+            if (response != 0) {
+                break;
+            }
+        }
+        if (response == DECODE_VIDEO_STOP || response == AVERROR_EOF || (flushing && response == AVERROR(EAGAIN))) {
+            response = 0;
+            break;
+        }
+        if (response < 0 && response != AVERROR(EAGAIN)) {
+            break;
+        }
+    }
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    return response;
+}
+
+// 写线程: 从队列里取帧, 帧号放在 frame->opaque 里
+static void write_images(Extractor *extractor) {
+    AVFrame *frame = av_frame_alloc();
+    if (frame == nullptr) {
+        extractor->queue->abort(AVERROR(ENOMEM));
+        return;
+    }
+
+    GrayConverter converter = {};
+    GrayScaler scaler = {};
+    PgmBuffer buffer = {};
+    scaler.width = extractor->options->scale_width;
+    scaler.method = extractor->options->scale_method;
+
+    char filename[4096];
+    int response;
+    while ((response = extractor->queue->pop(frame)) == 0) {
+        int64_t number = reinterpret_cast<intptr_t>(frame->opaque);
+        // 先转成灰度再缩放, 缩放只需要处理一个 8 bit 平面
+        const AVFrame *image = gray_converter_apply(&converter, frame, &response);
+        if (image != nullptr) {
+            image = gray_scaler_apply(&scaler, image, &response);
+        }
+        int64_t written = response;
+        if (image != nullptr && extractor->archive != nullptr) {
+            written = PROFILE(PROFILE_WRITE, frame_archive_append(extractor->archive, number, image, &buffer));
+        } else if (image != nullptr) {
+            snprintf(filename, sizeof(filename), "%s/frame-%06lld.pgm", extractor->options->output_dir,
+                     (long long) number);
+            written = PROFILE(PROFILE_WRITE, save_gray_image(filename, image));
+        }
+        av_frame_unref(frame);
+        if (written < 0) {
+            extractor->queue->abort(image != nullptr ? AVERROR(EIO) : response);
+            break;
+        }
+        extractor->written_images.fetch_add(1, std::memory_order_relaxed);
+        extractor->written_bytes.fetch_add(written, std::memory_order_relaxed);
+    }
+
+    pgm_buffer_free(&buffer);
+    gray_scaler_free(&scaler);
+    gray_converter_free(&converter);
+    av_frame_free(&frame);
+}
+
+static bool extraction_done(const Extractor *extractor) {
+    return extractor->options->max_images > 0 && extractor->queued_images >= extractor->options->max_images;
+}
+
+// 选中的帧移进队列, 没选中的由 decode_video 释放
+static int queue_frame(void *opaque, AVFrame *frame) {
+    Extractor *extractor = static_cast<Extractor *>(opaque);
+    if (extraction_done(extractor)) {
+        return DECODE_VIDEO_STOP;
+    }
+    int64_t number = ++extractor->stats->decoded_frames;
+    if ((number - 1) % extractor->options->every != 0) {
+        return 0;
+    }
+
+    frame->opaque = reinterpret_cast<void *>(static_cast<intptr_t>(number));
+    auto begin = std::chrono::steady_clock::now();
+    int response = extractor->queue->push(frame);
+    std::chrono::duration<double> blocked = std::chrono::steady_clock::now() - begin;
+    extractor->stats->decode_blocked_seconds += blocked.count();
+    if (response < 0) {
+        return response;
+    }
+    extractor->queued_images++;
+    return extraction_done(extractor) ? DECODE_VIDEO_STOP : 0;
+}
+
+int extract_frames(const ExtractOptions *options, ExtractStats *stats) {
+    int ret = 0;
+    int response = 0;
+    int stream_index = -1;
+    AVFormatContext *format_context = nullptr;
+    AVCodecContext *decoder = nullptr;
+    Extractor extractor;
+    std::vector<std::thread> workers;
+    auto begin = std::chrono::steady_clock::now();
+
+    extractor.options = options;
+    extractor.decoder = nullptr;
+    extractor.stats = stats;
+    extractor.archive = nullptr;
+    extractor.queued_images = 0;
+    extractor.queue = new MpmcFrameQueue(options->queue_size);
+    if (!extractor.queue->valid()) {
+        ret = AVERROR(ENOMEM);
+        error("cannot alloc memory for frame queue.");
+        goto end;
+    }
+
+    response = open_video_input(options->input, &options->decoder_threading, &format_context, &stream_index, &decoder);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    extractor.decoder = decoder;
+
+    if (options->archive != nullptr) {
+        response = frame_archive_open(&extractor.archive, options->archive, options->archive_payload,
+                                      format_context->streams[stream_index]->time_base);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    }
+
+    info("extracting every %d frame(s) of %s with %d writer(s), queue %d, width %d (%s), into %s.",
+         options->every, options->input, options->workers, options->queue_size, options->scale_width,
+         options->scale_width <= 0 ? "original" : options->scale_method == GRAY_SCALE_AREA ? "area" : "swscale",
+         options->archive != nullptr ? options->archive : options->output_dir);
+
+    for (int i = 0; i < options->workers; i++) {
+        workers.emplace_back(write_images, &extractor);
+    }
+
+    response = decode_video(format_context, stream_index, decoder, queue_frame, &extractor);
+    if (response < 0) {
+        ret = response;
+        extractor.queue->abort(response);
+    } else {
+        extractor.queue->close();
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    // 写线程出错的时候队列被 abort, 解码那边会拿到错误码
+    if (ret >= 0 && extractor.queue->error_code() < 0) {
+        ret = extractor.queue->error_code();
+    }
+
+    end:
+    // 写线程都结束了才能写索引
+    response = frame_archive_close(&extractor.archive);
+    if (ret >= 0 && response < 0) {
+        ret = response;
+    }
+    stats->written_images = extractor.written_images.load();
+    stats->written_bytes = extractor.written_bytes.load();
+    stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    delete extractor.queue;
+    avcodec_free_context(&decoder);
+    if (format_context != nullptr) {
+        avformat_close_input(&format_context);
+    }
+    return ret;
+}
+
+int run_extract(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: SimpleGrayImage -extract <input> [-o <dir>] [-every N] [-max N] [-workers N] [-queue N] "
+              "[-decode-threads N] [-width N] [-scaler <swscale|area>] [-archive <file>] [-archive-payload <raw|pgm>] "
+              "[-profile] [-profile-interval <seconds>] [-profile-json <file>]");
+        return -1;
+    }
+
+    ExtractOptions options = {};
+    options.input = argv[2];
+    options.output_dir = ".";
+    options.every = 1;
+    options.max_images = 0;
+    options.workers = static_cast<int>(std::thread::hardware_concurrency());
+    options.queue_size = 0;
+    double profile_interval = 0;
+
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &options.decoder_threading);
+        }
+        if (consumed == 0) {
+            consumed = parse_gray_scaler_option(argc, argv, i, &options.scale_width, &options.scale_method);
+        }
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-archive") == 0 && i + 1 < argc) {
+            options.archive = argv[++i];
+        } else if (strcmp(argv[i], "-archive-payload") == 0 && i + 1 < argc) {
+            const char *payload = argv[++i];
+            if (strcmp(payload, "raw") == 0) {
+                options.archive_payload = ARCHIVE_PAYLOAD_RAW;
+            } else if (strcmp(payload, "pgm") == 0) {
+                options.archive_payload = ARCHIVE_PAYLOAD_PGM;
+            } else {
+                error("unknown archive payload: %s", payload);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-every") == 0 && i + 1 < argc) {
+            options.every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+            options.max_images = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc) {
+            options.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-queue") == 0 && i + 1 < argc) {
+            options.queue_size = atoi(argv[++i]);
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (options.every <= 0) {
+        options.every = 1;
+    }
+    if (options.workers <= 0) {
+        options.workers = 1;
+    }
+    if (options.queue_size <= 0) {
+        options.queue_size = options.workers * 2;
+    }
+
+    profiler_run_start(profile_interval);
+    ExtractStats stats = {};
+    int ret = extract_frames(&options, &stats);
+    profiler_run_report();
+
+    double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+    info("decoded %lld frames, wrote %lld images (%.1f MB) in %.3f s: %.1f frames/s, %.1f images/s.",
+         (long long) stats.decoded_frames, (long long) stats.written_images, stats.written_bytes / 1e6,
+         stats.seconds, stats.decoded_frames / seconds, stats.written_images / seconds);
+    info("decoder blocked on writers for %.3f s.", stats.decode_blocked_seconds);
+    return ret;
+}
@@ -0,0 +1,91 @@
+//
+// Created by PingZi on 2020/9/11.
+//
+
+#ifndef SIMPLEGRAYIMAGE_FRAMEEXTRACTION_H
+#define SIMPLEGRAYIMAGE_FRAMEEXTRACTION_H
+
+#include <cstdint>
+
+#include "DecoderThreads.h"
+#include "FrameArchive.h"
+#include "GrayScaler.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+typedef struct ExtractOptions {
+    const char *input;
+    // 输出目录, 图片命名为 frame-000001.pgm (按解码顺序从 1 开始)
+    const char *output_dir;
+    // 每 every 帧保存一帧, 1 表示每一帧都保存
+    int every;
+    // 最多保存多少张, 0 表示不限制
+    int max_images;
+    // 写图片的线程数
+    int workers;
+    // 解码线程和写线程之间最多排队的帧数, 也就是最多有多少帧解码好了还没有写完
+    int queue_size;
+    DecoderThreading decoder_threading;
+    // 输出图片的宽度, 0 表示原始分辨率. 缩放在写线程里做, 不占用解码线程
+    int scale_width;
+    GrayScaleMethod scale_method;
+    // 不为 nullptr 的时候所有帧写进这一个归档文件 (FrameArchive.h), 不再每帧一个文件, output_dir 不起作用
+    const char *archive;
+    ArchivePayload archive_payload;
+} ExtractOptions;
+
+typedef struct ExtractStats {
+    int64_t decoded_frames;
+    int64_t written_images;
+    int64_t written_bytes;
+    double seconds;
+    // 解码线程因为写线程跟不上而等待的时间
+    double decode_blocked_seconds;
+} ExtractStats;
+
+/**
+ * 打开 stream_index 对应的解码器 (Common/DecoderThreads.h). 成功返回 0, 失败的时候 *decoder 已经被释放.
+ */
+int open_video_decoder(AVFormatContext *format_context, int stream_index, const DecoderThreading *threading,
+                       AVCodecContext **decoder);
+
+/**
+ * 打开 input, 选出最合适的视频流 (av_find_best_stream), 其它流设成 AVDISCARD_ALL 由 demuxer 直接丢掉.
+ * decoder 不为 nullptr 的时候同时打开这个流的解码器 (open_video_decoder).
+ * 失败的时候 *format_context 和 *decoder 都已经被释放.
+ */
+int open_video_input(const char *input, const DecoderThreading *threading, AVFormatContext **format_context,
+                     int *stream_index, AVCodecContext **decoder);
+
+// decode_video 的回调返回这个值表示不再需要更多的帧, decode_video 正常结束
+#define DECODE_VIDEO_STOP 1
+
+/**
+ * decode_video 每解码出一帧调用一次. frame 可以被移走 (av_frame_move_ref), 没移走的在回调之后 unref.
+ * 返回 0 继续, DECODE_VIDEO_STOP 提前结束, 负数是错误码, 作为 decode_video 的返回值.
+ */
+typedef int (*VideoFrameCallback)(void *opaque, AVFrame *frame);
+
+/**
+ * 读 stream_index 的 packet 送进 decoder, 每一帧交给 on_frame, 读到文件结尾之后 flush 解码器取出剩下的帧.
+ */
+int decode_video(AVFormatContext *format_context, int stream_index, AVCodecContext *decoder,
+                 VideoFrameCallback on_frame, void *opaque);
+
+/**
+ * 解码 options->input 的第一个视频流, 把选中的帧保存成灰度图.
+ * 解码在调用线程上进行, 选中的帧 (只是引用, 不拷贝像素) 交给写线程池去生成文件, 所以磁盘速度不会拖慢解码,
+ * 队列满了才会让解码等待.
+ */
+int extract_frames(const ExtractOptions *options, ExtractStats *stats);
+
+/**
+ * SimpleGrayImage -extract <input> [-o <dir>] [-every N] [-max N] [-workers N] [-queue N] [-decode-threads N]
+ *                 [-width N] [-scaler <swscale|area>] [-archive <file>] [-archive-payload <raw|pgm>]
+ *                 [profile options]
+ */
+int run_extract(int argc, char *argv[]);
+
+#endif //SIMPLEGRAYIMAGE_FRAMEEXTRACTION_H
@@ -0,0 +1,351 @@
+//
+// Created by PingZi on 2020/9/18.
+//
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASH_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HASH_NEON 1
+#endif
+
+#include "FrameHash.h"
+#include "FrameExtraction.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+#define DHASH_WIDTH 9
+#define DHASH_HEIGHT 8
+#define PHASH_SIZE 32
+#define PHASH_LOW 8
+
+// sums[x] += row[x], 一行一行累加源图, 是整个哈希里唯一需要遍历所有像素的地方
+static void accumulate_row(uint32_t *sums, const uint8_t *row, int width) {
+    int x = 0;
+#if defined(HASH_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        __m128i low = _mm_unpacklo_epi8(pixels, zero);
+        __m128i high = _mm_unpackhi_epi8(pixels, zero);
+        __m128i *target = reinterpret_cast<__m128i *>(sums + x);
+        _mm_storeu_si128(target, _mm_add_epi32(_mm_loadu_si128(target), _mm_unpacklo_epi16(low, zero)));
+        _mm_storeu_si128(target + 1, _mm_add_epi32(_mm_loadu_si128(target + 1), _mm_unpackhi_epi16(low, zero)));
+        _mm_storeu_si128(target + 2, _mm_add_epi32(_mm_loadu_si128(target + 2), _mm_unpacklo_epi16(high, zero)));
+        _mm_storeu_si128(target + 3, _mm_add_epi32(_mm_loadu_si128(target + 3), _mm_unpackhi_epi16(high, zero)));
+    }
+#elif defined(HASH_NEON)
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t pixels = vld1q_u8(row + x);
+        uint16x8_t low = vmovl_u8(vget_low_u8(pixels));
+        uint16x8_t high = vmovl_u8(vget_high_u8(pixels));
+        vst1q_u32(sums + x, vaddw_u16(vld1q_u32(sums + x), vget_low_u16(low)));
+        vst1q_u32(sums + x + 4, vaddw_u16(vld1q_u32(sums + x + 4), vget_high_u16(low)));
+        vst1q_u32(sums + x + 8, vaddw_u16(vld1q_u32(sums + x + 8), vget_low_u16(high)));
+        vst1q_u32(sums + x + 12, vaddw_u16(vld1q_u32(sums + x + 12), vget_high_u16(high)));
+    }
+#endif
+    for (; x < width; x++) {
+        sums[x] += row[x];
+    }
+}
+
+// 把亮度平面按区域平均缩成 grid_width x grid_height 的浮点网格
+static void reduce_to_grid(FrameHasher *hasher, const AVFrame *gray, int grid_width, int grid_height, float *grid) {
+    int width = gray->width;
+    int height = gray->height;
+    if (hasher->x_starts_width != width || static_cast<int>(hasher->x_starts.size()) != grid_width + 1) {
+        hasher->x_starts.resize(grid_width + 1);
+        for (int x = 0; x <= grid_width; x++) {
+            hasher->x_starts[x] = static_cast<int>(static_cast<int64_t>(x) * width / grid_width);
+        }
+        hasher->x_starts_width = width;
+        hasher->column_sums.resize(width);
+    }
+    uint32_t *sums = hasher->column_sums.data();
+    const int *x_starts = hasher->x_starts.data();
+
+    for (int y = 0; y < grid_height; y++) {
+        int y_begin = static_cast<int>(static_cast<int64_t>(y) * height / grid_height);
+        int y_end = std::max(static_cast<int>(static_cast<int64_t>(y + 1) * height / grid_height), y_begin + 1);
+
+        memset(sums, 0, sizeof(uint32_t) * width);
+        for (int row = y_begin; row < y_end; row++) {
+            accumulate_row(sums, gray->data[0] + static_cast<ptrdiff_t>(row) * gray->linesize[0], width);
+        }
+
+        for (int x = 0; x < grid_width; x++) {
+            // 源图比网格还窄的时候相邻的格子共用同一列
+            int x_end = std::max(x_starts[x + 1], x_starts[x] + 1);
+            uint64_t total = 0;
+            for (int column = x_starts[x]; column < x_end; column++) {
+                total += sums[column];
+            }
+            grid[y * grid_width + x] = static_cast<float>(total) / (static_cast<float>(x_end - x_starts[x]) *
+                                                                     static_cast<float>(y_end - y_begin));
+        }
+    }
+}
+
+static uint64_t difference_hash(const float *grid) {
+    uint64_t hash = 0;
+    for (int y = 0; y < DHASH_HEIGHT; y++) {
+        for (int x = 0; x < DHASH_WIDTH - 1; x++) {
+            hash = (hash << 1) | (grid[y * DHASH_WIDTH + x] > grid[y * DHASH_WIDTH + x + 1] ? 1 : 0);
+        }
+    }
+    return hash;
+}
+
+// DCT-II 的第 1~8 个基 (去掉直流), 每个 32 点
+typedef struct DctTable {
+    float basis[PHASH_LOW][PHASH_SIZE];
+
+    DctTable() : basis() {
+        const double pi = 3.14159265358979323846;
+        for (int u = 0; u < PHASH_LOW; u++) {
+            for (int x = 0; x < PHASH_SIZE; x++) {
+                basis[u][x] = static_cast<float>(std::sqrt(2.0 / PHASH_SIZE) *
+                                                 std::cos((2 * x + 1) * (u + 1) * pi / (2 * PHASH_SIZE)));
+            }
+        }
+    }
+} DctTable;
+
+static uint64_t perceptual_hash(const float *grid) {
+    static const DctTable table;
+
+    // 先对每一列做变换 (8x32), 再对每一行做变换, 只算需要的 8x8 个系数
+    float columns[PHASH_LOW][PHASH_SIZE] = {};
+    for (int u = 0; u < PHASH_LOW; u++) {
+        for (int y = 0; y < PHASH_SIZE; y++) {
+            float weight = table.basis[u][y];
+            const float *row = grid + y * PHASH_SIZE;
+            for (int x = 0; x < PHASH_SIZE; x++) {
+                columns[u][x] += weight * row[x];
+            }
+        }
+    }
+
+    float coefficients[PHASH_LOW * PHASH_LOW];
+    for (int u = 0; u < PHASH_LOW; u++) {
+        for (int v = 0; v < PHASH_LOW; v++) {
+            float sum = 0;
+            for (int x = 0; x < PHASH_SIZE; x++) {
+                sum += columns[u][x] * table.basis[v][x];
+            }
+            coefficients[u * PHASH_LOW + v] = sum;
+        }
+    }
+
+    float sorted[PHASH_LOW * PHASH_LOW];
+    memcpy(sorted, coefficients, sizeof(sorted));
+    std::sort(sorted, sorted + PHASH_LOW * PHASH_LOW);
+    float median = (sorted[PHASH_LOW * PHASH_LOW / 2 - 1] + sorted[PHASH_LOW * PHASH_LOW / 2]) / 2;
+
+    uint64_t hash = 0;
+    for (float coefficient : coefficients) {
+        hash = (hash << 1) | (coefficient > median ? 1 : 0);
+    }
+    return hash;
+}
+
+uint64_t frame_hasher_compute(FrameHasher *hasher, const AVFrame *frame, int *error) {
+    const AVFrame *gray = gray_converter_apply(&hasher->converter, frame, error);
+    if (gray == nullptr) {
+        return 0;
+    }
+
+    if (hasher->method == FRAME_HASH_PHASH) {
+        float grid[PHASH_SIZE * PHASH_SIZE];
+        reduce_to_grid(hasher, gray, PHASH_SIZE, PHASH_SIZE, grid);
+        return perceptual_hash(grid);
+    }
+    float grid[DHASH_WIDTH * DHASH_HEIGHT];
+    reduce_to_grid(hasher, gray, DHASH_WIDTH, DHASH_HEIGHT, grid);
+    return difference_hash(grid);
+}
+
+void frame_hasher_free(FrameHasher *hasher) {
+    gray_converter_free(&hasher->converter);
+    hasher->column_sums.clear();
+    hasher->x_starts.clear();
+    hasher->x_starts_width = 0;
+}
+
+int frame_hash_distance(uint64_t a, uint64_t b) {
+    return static_cast<int>(std::bitset<64>(a ^ b).count());
+}
+
+typedef struct HashContext {
+    const HashOptions *options;
+    FrameHasher hasher;
+    FILE *output;
+    HashStats *stats;
+    uint64_t last_hash;
+} HashContext;
+
+static bool hashing_done(const HashContext *context) {
+    return context->options->max_frames > 0 && context->stats->hashed_frames >= context->options->max_frames;
+}
+
+static int hash_frame(void *opaque, AVFrame *frame) {
+    HashContext *context = static_cast<HashContext *>(opaque);
+    if (hashing_done(context)) {
+        return DECODE_VIDEO_STOP;
+    }
+    int64_t number = ++context->stats->decoded_frames;
+    if ((number - 1) % context->options->every != 0) {
+        return 0;
+    }
+
+    int response = 0;
+    HashRecord record = {};
+    record.number = number;
+    record.pts = frame->best_effort_timestamp;
+    record.hash = PROFILE(PROFILE_ANALYZE, frame_hasher_compute(&context->hasher, frame, &response));
+    if (response < 0) {
+        return response;
+    }
+    if (PROFILE(PROFILE_WRITE, fwrite(&record, sizeof(record), 1, context->output)) != 1) {
+        error("cannot write hash record.");
+        return AVERROR(EIO);
+    }
+
+    if (context->stats->hashed_frames > 0 &&
+        frame_hash_distance(record.hash, context->last_hash) <= context->options->threshold) {
+        context->stats->similar_frames++;
+    }
+    context->last_hash = record.hash;
+    context->stats->hashed_frames++;
+    return hashing_done(context) ? DECODE_VIDEO_STOP : 0;
+}
+
+int hash_frames(const HashOptions *options, HashStats *stats) {
+    int ret = 0;
+    int response = 0;
+    int stream_index = -1;
+    AVFormatContext *format_context = nullptr;
+    AVCodecContext *decoder = nullptr;
+    HashContext context = {};
+    HashStreamHeader header = {};
+    auto begin = std::chrono::steady_clock::now();
+
+    context.options = options;
+    context.stats = stats;
+    context.hasher.method = options->method;
+
+    response = open_video_input(options->input, &options->decoder_threading, &format_context, &stream_index, &decoder);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    context.output = fopen(options->output, "wb");
+    if (context.output == nullptr) {
+        ret = AVERROR(errno);
+        error("cannot open output file: %s.", options->output);
+        goto end;
+    }
+    memcpy(header.magic, HASH_STREAM_MAGIC, sizeof(header.magic));
+    header.version = HASH_STREAM_VERSION;
+    header.method = options->method;
+    header.time_base_num = format_context->streams[stream_index]->time_base.num;
+    header.time_base_den = format_context->streams[stream_index]->time_base.den;
+    if (fwrite(&header, sizeof(header), 1, context.output) != 1) {
+        ret = AVERROR(EIO);
+        goto end;
+    }
+
+    info("hashing every %d frame(s) of %s with %s into %s.", options->every, options->input,
+         options->method == FRAME_HASH_PHASH ? "phash" : "dhash", options->output);
+
+    response = decode_video(format_context, stream_index, decoder, hash_frame, &context);
+    if (response < 0) {
+        ret = response;
+    }
+
+    end:
+    stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (context.output != nullptr && fclose(context.output) != 0 && ret >= 0) {
+        ret = AVERROR(EIO);
+    }
+    frame_hasher_free(&context.hasher);
+    avcodec_free_context(&decoder);
+    if (format_context != nullptr) {
+        avformat_close_input(&format_context);
+    }
+    return ret;
+}
+
+int run_hash(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: SimpleGrayImage -hash <input> [-o <file>] [-method <dhash|phash>] [-every N] [-max N] "
+              "[-threshold N] [-decode-threads N] [-decode-thread-type <frame|slice|auto>] [-profile] "
+              "[-profile-interval <seconds>] [-profile-json <file>]");
+        return -1;
+    }
+
+    HashOptions options = {};
+    options.input = argv[2];
+    options.output = "fingerprints.hash";
+    options.method = FRAME_HASH_PHASH;
+    options.every = 1;
+    options.max_frames = 0;
+    options.threshold = 4;
+    double profile_interval = 0;
+
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &options.decoder_threading);
+        }
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (strcmp(argv[i], "-method") == 0 && i + 1 < argc) {
+            const char *method = argv[++i];
+            if (strcmp(method, "dhash") == 0) {
+                options.method = FRAME_HASH_DHASH;
+            } else if (strcmp(method, "phash") == 0) {
+                options.method = FRAME_HASH_PHASH;
+            } else {
+                error("unknown hash method: %s", method);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-every") == 0 && i + 1 < argc) {
+            options.every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+            options.max_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) {
+            options.threshold = atoi(argv[++i]);
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (options.every <= 0) {
+        options.every = 1;
+    }
+
+    profiler_run_start(profile_interval);
+    HashStats stats = {};
+    int ret = hash_frames(&options, &stats);
+    profiler_run_report();
+
+    double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+    info("decoded %lld frames, hashed %lld (%lld within distance %d of the previous one) in %.3f s: %.1f frames/s.",
+         (long long) stats.decoded_frames, (long long) stats.hashed_frames, (long long) stats.similar_frames,
+         options.threshold, stats.seconds, stats.decoded_frames / seconds);
+    return ret;
+}
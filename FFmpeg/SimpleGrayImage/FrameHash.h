@@ -0,0 +1,106 @@
+//
+// Created by PingZi on 2020/9/18.
+//
+
+#ifndef SIMPLEGRAYIMAGE_FRAMEHASH_H
+#define SIMPLEGRAYIMAGE_FRAMEHASH_H
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include "DecoderThreads.h"
+#include "GrayConverter.h"
+
+typedef enum FrameHashMethod {
+    // 缩成 9x8, 每一行相邻两个像素比较亮度, 最快
+    FRAME_HASH_DHASH = 0,
+    // 缩成 32x32 做 DCT, 取左上角去掉直流分量的 8x8 个低频系数和中位数比较, 对亮度/对比度变化更稳定
+    FRAME_HASH_PHASH = 1,
+} FrameHashMethod;
+
+/**
+ * 直接从解码出来的 AVFrame 计算 64 bit 感知哈希, 不经过图片文件.
+ * 先转成 8 bit 亮度 (GrayConverter.h), 再用按列累加的区域平均缩到很小的网格 (行累加是 SIMD), 最后在网格上算哈希.
+ * 一个 FrameHasher 只能在一个线程里使用.
+ */
+typedef struct FrameHasher {
+    FrameHashMethod method;
+    GrayConverter converter;
+    std::vector<uint32_t> column_sums;
+    // 网格每一列在源图里的起始列, 源图宽度变了才重新计算
+    std::vector<int> x_starts;
+    int x_starts_width;
+} FrameHasher;
+
+// 出错的时候 *error 是错误码, 返回值没有意义
+uint64_t frame_hasher_compute(FrameHasher *hasher, const AVFrame *frame, int *error);
+
+void frame_hasher_free(FrameHasher *hasher);
+
+// 两个哈希不同的 bit 数, 越小越相似, 同一画面一般在 0~5
+int frame_hash_distance(uint64_t a, uint64_t b);
+
+/**
+ * 指纹文件 (小端): 32 字节的 HashStreamHeader, 后面是按解码顺序排列的 HashRecord, 每帧 24 字节.
+ * 文件是流式写的, 没有索引, 记录数就是 (文件长度 - 32) / 24.
+ */
+#define HASH_STREAM_MAGIC "GRAYHSH1"
+#define HASH_STREAM_VERSION 1
+
+typedef struct HashStreamHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t method;
+    int32_t time_base_num;
+    int32_t time_base_den;
+    uint8_t reserved[8];
+} HashStreamHeader;
+
+typedef struct HashRecord {
+    // 解码顺序的帧号, 从 1 开始
+    int64_t number;
+    int64_t pts;
+    uint64_t hash;
+} HashRecord;
+
+static_assert(sizeof(HashStreamHeader) == 32, "hash stream header must be 32 bytes");
+static_assert(sizeof(HashRecord) == 24, "hash record must be 24 bytes");
+
+typedef struct HashOptions {
+    const char *input;
+    // 指纹文件
+    const char *output;
+    FrameHashMethod method;
+    // 每 every 帧算一次
+    int every;
+    // 最多算多少帧, 0 表示不限制
+    int max_frames;
+    // 和上一帧的距离不超过 threshold 的时候算作重复画面, 只用于统计
+    int threshold;
+    DecoderThreading decoder_threading;
+} HashOptions;
+
+typedef struct HashStats {
+    int64_t decoded_frames;
+    int64_t hashed_frames;
+    int64_t similar_frames;
+    double seconds;
+} HashStats;
+
+/**
+ * 解码 options->input 的第一个视频流, 把每一帧的指纹写进 options->output.
+ * 哈希在解码线程上算, 一帧只读一遍亮度平面, 比解码本身便宜得多.
+ */
+int hash_frames(const HashOptions *options, HashStats *stats);
+
+/**
+ * SimpleGrayImage -hash <input> [-o <file>] [-method <dhash|phash>] [-every N] [-max N] [-threshold N]
+ *                 [-decode-threads N] [-decode-thread-type <frame|slice|auto>] [profile options]
+ */
+int run_hash(int argc, char *argv[]);
+
+#endif //SIMPLEGRAYIMAGE_FRAMEHASH_H
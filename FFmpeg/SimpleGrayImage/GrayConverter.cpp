@@ -0,0 +1,407 @@
+//
+// Created by PingZi on 2020/9/16.
+//
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define GRAY_X86 1
+#if defined(__GNUC__)
+#define GRAY_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define GRAY_TARGET_AVX2
+#endif
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GRAY_NEON 1
+#endif
+
+extern "C" {
+#include "libavutil/cpu.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+}
+
+#include "GrayConverter.h"
+#include "Logger.h"
+
+// Q15 的亮度系数, 每组的和都是 32768, 白色正好得到 255
+static const int bt601_coefficients[3] = {9798, 19235, 3735};
+static const int bt709_coefficients[3] = {6966, 23436, 2366};
+
+#define GRAY_ROUND (1 << 14)
+
+static void shift16_c(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    const uint8_t *pixel = src + converter->offsets[0];
+    for (int x = 0; x < width; x++, pixel += converter->step) {
+        uint16_t value;
+        memcpy(&value, pixel, sizeof(value));
+        value >>= converter->shift;
+        dst[x] = static_cast<uint8_t>(value > 255 ? 255 : value);
+    }
+}
+
+static void strided8_c(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    const uint8_t *pixel = src + converter->offsets[0];
+    for (int x = 0; x < width; x++, pixel += converter->step) {
+        dst[x] = *pixel;
+    }
+}
+
+// 打包的 RGB, 每个像素 3 或者 4 字节
+static void rgb_c(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    const int *c = converter->coefficients;
+    const int *offsets = converter->offsets;
+    const uint8_t *pixel = src;
+    for (int x = 0; x < width; x++, pixel += converter->step) {
+        dst[x] = static_cast<uint8_t>(
+                (c[0] * pixel[offsets[0]] + c[1] * pixel[offsets[1]] + c[2] * pixel[offsets[2]] + GRAY_ROUND) >> 15);
+    }
+}
+
+#if defined(GRAY_X86)
+
+// 只用于 step == 2, offset == 0 的平面格式 (YUV420P10, P010, GRAY12...)
+static void shift16_sse2(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    const uint16_t *source = reinterpret_cast<const uint16_t *>(src);
+    __m128i count = _mm_cvtsi32_si128(converter->shift);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + x + 8));
+        a = _mm_srl_epi16(a, count);
+        b = _mm_srl_epi16(b, count);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(a, b));
+    }
+    shift16_c(dst + x, src + x * 2, width - x, converter);
+}
+
+GRAY_TARGET_AVX2
+static void shift16_avx2(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    const uint16_t *source = reinterpret_cast<const uint16_t *>(src);
+    __m128i count = _mm_cvtsi32_si128(converter->shift);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + x));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + x + 16));
+        a = _mm256_srl_epi16(a, count);
+        b = _mm256_srl_epi16(b, count);
+        // packus 在每个 128 位的 lane 里分别打包, 最后把 lane 的顺序换回来
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), packed);
+    }
+    shift16_sse2(dst + x, src + x * 2, width - x, converter);
+}
+
+/**
+ * 4 个像素的加权和: 展开成 16 bit 之后用 madd 把每个像素的 (c0*b0 + c1*b1), (c2*b2 + c3*b3) 算出来,
+ * 再把相邻的两个 32 bit 结果相加.
+ */
+static inline __m128i rgb32_luma_sse2(__m128i pixels, __m128i coefficients, __m128i round) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+    __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+    __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    __m128i sum = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+    return _mm_srli_epi32(_mm_add_epi32(sum, round), 15);
+}
+
+static void rgb32_sse2(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    __m128i coefficients = _mm_loadu_si128(reinterpret_cast<const __m128i *>(converter->packed_coefficients));
+    __m128i round = _mm_set1_epi32(GRAY_ROUND);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i *source = reinterpret_cast<const __m128i *>(src + x * 4);
+        __m128i y0 = rgb32_luma_sse2(_mm_loadu_si128(source), coefficients, round);
+        __m128i y1 = rgb32_luma_sse2(_mm_loadu_si128(source + 1), coefficients, round);
+        __m128i y2 = rgb32_luma_sse2(_mm_loadu_si128(source + 2), coefficients, round);
+        __m128i y3 = rgb32_luma_sse2(_mm_loadu_si128(source + 3), coefficients, round);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), packed);
+    }
+    rgb_c(dst + x, src + x * 4, width - x, converter);
+}
+
+GRAY_TARGET_AVX2
+static inline __m256i rgb32_luma_avx2(__m256i pixels, __m256i coefficients, __m256i round) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i low = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), coefficients);
+    __m256i high = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), coefficients);
+    __m256 even = _mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 odd = _mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    __m256i sum = _mm256_add_epi32(_mm256_castps_si256(even), _mm256_castps_si256(odd));
+    return _mm256_srli_epi32(_mm256_add_epi32(sum, round), 15);
+}
+
+GRAY_TARGET_AVX2
+static void rgb32_avx2(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    __m256i coefficients = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(converter->packed_coefficients)));
+    __m256i round = _mm256_set1_epi32(GRAY_ROUND);
+    // 两次 lane 内的 pack 之后, 每 4 个像素一组的顺序是 0 2 4 6 1 3 5 7
+    __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        const __m256i *source = reinterpret_cast<const __m256i *>(src + x * 4);
+        __m256i y0 = rgb32_luma_avx2(_mm256_loadu_si256(source), coefficients, round);
+        __m256i y1 = rgb32_luma_avx2(_mm256_loadu_si256(source + 1), coefficients, round);
+        __m256i y2 = rgb32_luma_avx2(_mm256_loadu_si256(source + 2), coefficients, round);
+        __m256i y3 = rgb32_luma_avx2(_mm256_loadu_si256(source + 3), coefficients, round);
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    rgb32_sse2(dst + x, src + x * 4, width - x, converter);
+}
+
+#elif defined(GRAY_NEON)
+
+static void shift16_neon(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter) {
+    const uint16_t *source = reinterpret_cast<const uint16_t *>(src);
+    int16x8_t count = vdupq_n_s16(static_cast<int16_t>(-converter->shift));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint16x8_t a = vshlq_u16(vld1q_u16(source + x), count);
+        uint16x8_t b = vshlq_u16(vld1q_u16(source + x + 8), count);
+        vst1q_u8(dst + x, vcombine_u8(vqmovn_u16(a), vqmovn_u16(b)));
+    }
+    shift16_c(dst + x, src + x * 2, width - x, converter);
+}
+
+#endif
+
+// 按 CPU 支持的指令集选 kernel, 每种像素格式只选一次
+static void select_row_kernel(GrayConverter *converter, bool rgb32, bool simple_shift16) {
+    int cpu_flags = av_get_cpu_flags();
+    (void) cpu_flags;
+    if (rgb32) {
+        converter->kernel = rgb_c;
+        converter->kernel_name = "rgb32_c";
+#if defined(GRAY_X86)
+        if (cpu_flags & AV_CPU_FLAG_AVX2) {
+            converter->kernel = rgb32_avx2;
+            converter->kernel_name = "rgb32_avx2";
+        } else if (cpu_flags & AV_CPU_FLAG_SSE2) {
+            converter->kernel = rgb32_sse2;
+            converter->kernel_name = "rgb32_sse2";
+        }
+#endif
+        return;
+    }
+
+    converter->kernel = shift16_c;
+    converter->kernel_name = "shift16_c";
+    if (!simple_shift16) {
+        return;
+    }
+#if defined(GRAY_X86)
+    if (cpu_flags & AV_CPU_FLAG_AVX2) {
+        converter->kernel = shift16_avx2;
+        converter->kernel_name = "shift16_avx2";
+    } else if (cpu_flags & AV_CPU_FLAG_SSE2) {
+        converter->kernel = shift16_sse2;
+        converter->kernel_name = "shift16_sse2";
+    }
+#elif defined(GRAY_NEON)
+    if (cpu_flags & AV_CPU_FLAG_NEON) {
+        converter->kernel = shift16_neon;
+        converter->kernel_name = "shift16_neon";
+    }
+#endif
+}
+
+static void select_conversion(GrayConverter *converter, int format, int colorspace) {
+    converter->ready = true;
+    converter->format = format;
+    converter->colorspace = colorspace;
+    converter->conversion = GRAY_CONVERT_SWSCALE;
+    converter->kernel = nullptr;
+    converter->kernel_name = "swscale";
+
+    const int *coefficients = colorspace == AVCOL_SPC_BT709 ? bt709_coefficients : bt601_coefficients;
+    memcpy(converter->coefficients, coefficients, sizeof(converter->coefficients));
+
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format));
+    if (descriptor == nullptr ||
+        (descriptor->flags & (AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_FLOAT | AV_PIX_FMT_FLAG_BITSTREAM |
+                              AV_PIX_FMT_FLAG_HWACCEL))) {
+        return;
+    }
+
+    if (format == AV_PIX_FMT_PAL8) {
+        converter->conversion = GRAY_CONVERT_PALETTE;
+        converter->kernel_name = "palette";
+        return;
+    }
+
+    const AVComponentDescriptor *components = descriptor->comp;
+    if (descriptor->flags & AV_PIX_FMT_FLAG_RGB) {
+        if (components[0].depth != 8 || components[1].depth != 8 || components[2].depth != 8) {
+            return;
+        }
+        for (int i = 0; i < 3; i++) {
+            converter->offsets[i] = components[i].offset;
+        }
+        if (descriptor->flags & AV_PIX_FMT_FLAG_PLANAR) {
+            converter->conversion = GRAY_CONVERT_PLANAR_RGB;
+            converter->kernel_name = "planar_rgb_c";
+            return;
+        }
+
+        converter->step = components[0].step;
+        if (converter->step == 4) {
+            // 每个像素 4 个字节 (RGBA, BGR0...), 把系数放到 R/G/B 对应的字节位置上, alpha/填充字节的系数是 0
+            memset(converter->packed_coefficients, 0, sizeof(converter->packed_coefficients));
+            for (int i = 0; i < 3; i++) {
+                converter->packed_coefficients[converter->offsets[i]] = static_cast<int16_t>(coefficients[i]);
+                converter->packed_coefficients[converter->offsets[i] + 4] = static_cast<int16_t>(coefficients[i]);
+            }
+            converter->conversion = GRAY_CONVERT_ROW;
+            select_row_kernel(converter, true, false);
+        } else if (converter->step == 3) {
+            converter->conversion = GRAY_CONVERT_ROW;
+            converter->kernel = rgb_c;
+            converter->kernel_name = "rgb24_c";
+        }
+        return;
+    }
+
+    // YUV / GRAY, 只看亮度分量
+    const AVComponentDescriptor &luma = components[0];
+    converter->step = luma.step;
+    converter->offsets[0] = luma.offset;
+    if (luma.depth == 8 && luma.shift == 0) {
+        if (luma.step == 1) {
+            converter->conversion = GRAY_CONVERT_NONE;
+            converter->kernel_name = "none";
+        } else {
+            // YUYV422, UYVY422, YA8...
+            converter->conversion = GRAY_CONVERT_ROW;
+            converter->kernel = strided8_c;
+            converter->kernel_name = "strided8_c";
+        }
+        return;
+    }
+    if (luma.depth > 8 && luma.depth <= 16 && luma.step >= 2) {
+        // P010 的数据在高位 (shift 6), YUV420P10 在低位, 都右移到只剩高 8 位
+        converter->shift = luma.shift + luma.depth - 8;
+        converter->conversion = GRAY_CONVERT_ROW;
+        select_row_kernel(converter, false, luma.step == 2 && luma.offset == 0);
+    }
+}
+
+static int prepare_output(GrayConverter *converter, int width, int height) {
+    if (converter->output == nullptr) {
+        converter->output = av_frame_alloc();
+        if (converter->output == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+    }
+    AVFrame *output = converter->output;
+    if (output->data[0] != nullptr && output->width == width && output->height == height) {
+        return 0;
+    }
+
+    av_frame_unref(output);
+    output->format = AV_PIX_FMT_GRAY8;
+    output->width = width;
+    output->height = height;
+    return av_frame_get_buffer(output, 0);
+}
+
+static void convert_planar_rgb(GrayConverter *converter, const AVFrame *input, AVFrame *output) {
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(input->format));
+    const int *c = converter->coefficients;
+    int planes[3];
+    for (int i = 0; i < 3; i++) {
+        planes[i] = descriptor->comp[i].plane;
+    }
+
+    for (int y = 0; y < input->height; y++) {
+        const uint8_t *r = input->data[planes[0]] + static_cast<ptrdiff_t>(y) * input->linesize[planes[0]];
+        const uint8_t *g = input->data[planes[1]] + static_cast<ptrdiff_t>(y) * input->linesize[planes[1]];
+        const uint8_t *b = input->data[planes[2]] + static_cast<ptrdiff_t>(y) * input->linesize[planes[2]];
+        uint8_t *dst = output->data[0] + static_cast<ptrdiff_t>(y) * output->linesize[0];
+        for (int x = 0; x < input->width; x++) {
+            dst[x] = static_cast<uint8_t>((c[0] * r[x] + c[1] * g[x] + c[2] * b[x] + GRAY_ROUND) >> 15);
+        }
+    }
+}
+
+// 调色板每一帧都可能变, 所以每一帧重新生成查找表, 只有 256 项
+static void convert_palette(GrayConverter *converter, const AVFrame *input, AVFrame *output) {
+    const uint32_t *palette = reinterpret_cast<const uint32_t *>(input->data[1]);
+    const int *c = converter->coefficients;
+    for (int i = 0; i < 256; i++) {
+        uint32_t color = palette[i];
+        int r = (color >> 16) & 0xff;
+        int g = (color >> 8) & 0xff;
+        int b = color & 0xff;
+        converter->palette[i] = static_cast<uint8_t>((c[0] * r + c[1] * g + c[2] * b + GRAY_ROUND) >> 15);
+    }
+
+    for (int y = 0; y < input->height; y++) {
+        const uint8_t *src = input->data[0] + static_cast<ptrdiff_t>(y) * input->linesize[0];
+        uint8_t *dst = output->data[0] + static_cast<ptrdiff_t>(y) * output->linesize[0];
+        for (int x = 0; x < input->width; x++) {
+            dst[x] = converter->palette[src[x]];
+        }
+    }
+}
+
+const AVFrame *gray_converter_apply(GrayConverter *converter, const AVFrame *input, int *error) {
+    *error = 0;
+    if (!converter->ready || converter->format != input->format || converter->colorspace != input->colorspace) {
+        select_conversion(converter, input->format, input->colorspace);
+        debug("gray conversion for %s: %s.", av_get_pix_fmt_name(static_cast<AVPixelFormat>(input->format)),
+              converter->kernel_name);
+    }
+    if (converter->conversion == GRAY_CONVERT_NONE) {
+        return input;
+    }
+
+    int response = prepare_output(converter, input->width, input->height);
+    if (response < 0) {
+        *error = response;
+        return nullptr;
+    }
+    AVFrame *output = converter->output;
+
+    switch (converter->conversion) {
+        case GRAY_CONVERT_ROW:
+            for (int y = 0; y < input->height; y++) {
+                converter->kernel(output->data[0] + static_cast<ptrdiff_t>(y) * output->linesize[0],
+                                  input->data[0] + static_cast<ptrdiff_t>(y) * input->linesize[0],
+                                  input->width, converter);
+            }
+            break;
+        case GRAY_CONVERT_PLANAR_RGB:
+            convert_planar_rgb(converter, input, output);
+            break;
+        case GRAY_CONVERT_PALETTE:
+            convert_palette(converter, input, output);
+            break;
+        default:
+            converter->sws_context = sws_getCachedContext(converter->sws_context,
+                                                          input->width, input->height,
+                                                          static_cast<AVPixelFormat>(input->format),
+                                                          input->width, input->height, AV_PIX_FMT_GRAY8,
+                                                          SWS_POINT, nullptr, nullptr, nullptr);
+            if (converter->sws_context == nullptr) {
+                *error = AVERROR(ENOSYS);
+                return nullptr;
+            }
+            sws_scale(converter->sws_context, input->data, input->linesize, 0, input->height,
+                      output->data, output->linesize);
+            break;
+    }
+    return output;
+}
+
+void gray_converter_free(GrayConverter *converter) {
+    sws_freeContext(converter->sws_context);
+    converter->sws_context = nullptr;
+    av_frame_free(&converter->output);
+    converter->ready = false;
+}
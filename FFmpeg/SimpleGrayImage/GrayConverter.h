@@ -0,0 +1,73 @@
+//
+// Created by PingZi on 2020/9/16.
+//
+
+#ifndef SIMPLEGRAYIMAGE_GRAYCONVERTER_H
+#define SIMPLEGRAYIMAGE_GRAYCONVERTER_H
+
+#include <cstdint>
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+struct SwsContext;
+struct GrayConverter;
+
+// 转换一行: src 是源图一行 (按 converter 的设置解释), dst 是 width 个 8 bit 灰度
+typedef void (*GrayRowKernel)(uint8_t *dst, const uint8_t *src, int width, const GrayConverter *converter);
+
+typedef enum GrayConversion {
+    // 第一个平面已经是 8 bit 亮度 (YUV 平面格式, NV12, GRAY8...), 不需要转换
+    GRAY_CONVERT_NONE = 0,
+    // 对第一个平面逐行调用 kernel: 高位深亮度, 打包的 RGB, 打包的 YUYV
+    GRAY_CONVERT_ROW,
+    // 平面 RGB (GBRP), 三个平面加权
+    GRAY_CONVERT_PLANAR_RGB,
+    // PAL8, 先按调色板生成 256 项的查找表
+    GRAY_CONVERT_PALETTE,
+    // 其它少见的格式 (大端, 浮点...) 交给 swscale
+    GRAY_CONVERT_SWSCALE,
+} GrayConversion;
+
+/**
+ * 把任意像素格式的帧转换成 8 bit 灰度.
+ *
+ * 转换方式和 kernel 在第一次遇到某种像素格式/色彩空间的时候选一次 (按 av_get_cpu_flags 选 AVX2/SSE2/NEON 或者标量),
+ * 之后同一个流的每一帧直接调用, 不再判断格式, 也不经过 swscale.
+ * RGB 按帧的 colorspace 使用 BT.709 或者 BT.601 的亮度系数, 10/12 bit 的亮度右移成 8 bit.
+ *
+ * 一个 GrayConverter 只能在一个线程里使用.
+ */
+typedef struct GrayConverter {
+    bool ready;
+    int format;
+    int colorspace;
+    GrayConversion conversion;
+    GrayRowKernel kernel;
+    const char *kernel_name;
+
+    // 打包格式每个像素的字节数, 以及亮度/R/G/B 在像素里的字节偏移
+    int step;
+    int offsets[3];
+    // 高位深亮度需要右移的位数
+    int shift;
+    // Q15 的 R/G/B 系数, 和为 32768
+    int coefficients[3];
+    // SSE2/AVX2 kernel 用的系数, 按像素内的字节顺序排好, 两个像素一组
+    int16_t packed_coefficients[8];
+    uint8_t palette[256];
+
+    SwsContext *sws_context;
+    AVFrame *output;
+} GrayConverter;
+
+/**
+ * 返回灰度帧 (GRAY8 或者第一个平面是 8 bit 亮度的原帧), 转换出来的帧属于 converter, 下一次调用之前有效.
+ * 出错返回 nullptr, *error 里是错误码.
+ */
+const AVFrame *gray_converter_apply(GrayConverter *converter, const AVFrame *input, int *error);
+
+void gray_converter_free(GrayConverter *converter);
+
+#endif //SIMPLEGRAYIMAGE_GRAYCONVERTER_H
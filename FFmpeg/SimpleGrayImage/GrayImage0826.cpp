@@ -4,6 +4,10 @@
 
 #include "GrayImage0826.h"
 #include "Logger.h"
+#include "Profiler.h"
+#include "PgmWriter.h"
+#include "GrayConverter.h"
+#include "DecoderThreads.h"
 
 extern "C" {
 #include "libavformat/avformat.h"
@@ -25,73 +29,79 @@ int stream_index_first(AVMediaType codec_type, AVFormatContext *format_context)
     return stream_index_first(codec_type, format_context->streams, format_context->nb_streams);
 }
 
-void save_image_header(FILE *file, int image_width, int image_height) {
-    // TODO 这里少记了 \n
-    fprintf(file, "P5\n%d %d\n%d\n", image_width, image_height, 255);
-}
-
-void save_gray_image(FILE *file, AVFrame *frame) {
-    int image_width = frame->width;
-    int image_height = frame->height;
-    save_image_header(file, image_width, image_height);
-
-    for (int line = 0; line < frame->height; line++) {
-        uint8_t *gray_image_data = frame->data[0];
-        int linesize = frame->linesize[0];
-
-        fwrite(gray_image_data + linesize * line, linesize, 1, file);
+// 每个线程一个 PGM 缓冲区和灰度转换器, 线程结束的时候释放
+class ThreadPgmBuffer {
+public:
+    ~ThreadPgmBuffer() {
+        pgm_buffer_free(&buffer);
+        gray_converter_free(&converter);
+    }
+
+    PgmBuffer buffer = {};
+    GrayConverter converter = {};
+};
+
+int64_t save_gray_image(const char *filename, const AVFrame *frame) {
+    static thread_local ThreadPgmBuffer thread_buffer;
+    int response = 0;
+    // 已经是 8 bit 亮度的帧原样返回, 其它格式 (RGB, 10 bit...) 先转成灰度
+    const AVFrame *gray = gray_converter_apply(&thread_buffer.converter, frame, &response);
+    if (gray == nullptr) {
+        error("cannot convert frame to gray: %d.", response);
+        return response;
     }
-}
-
-void save_gray_image(const char *filename, AVFrame *frame) {
-    FILE *file = fopen(filename, "wb+");
-    save_gray_image(file, frame);
-    fclose(file);
+    int64_t written = write_pgm(filename, gray, &thread_buffer.buffer);
+    if (written < 0) {
+        error("cannot write output image: %s.", filename);
+    }
+    return written;
 }
 
 int decode_packet(AVCodecContext *decoder, AVPacket *packet, AVFrame *frame) {
-    int response = avcodec_send_packet(decoder, packet);
+    int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
     if (response < 0 && response != AVERROR(EAGAIN) && response != AVERROR_EOF) {
         error("cannot send packet to decoder.");
         return response;
     }
 
     if (response == AVERROR_EOF) {
-        info("send: EOF");
+        debug("send: EOF");
         return response;
     }
 
     if (response == AVERROR(EAGAIN)) {
-        info("full buffer size, packet will auto send when handler receive frame from buffer.");
+        debug("full buffer size, packet will auto send when handler receive frame from buffer.");
         response = 0;
     }
 
-    info("packet succeed send to decoder.");
+    debug("packet succeed send to decoder.");
 
     while (response >= 0) {
-        response = avcodec_receive_frame(decoder, frame);
+        response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame));
         if (response == AVERROR_EOF) {
-            info("receive: EOF");
+            debug("receive: EOF");
             break;
         }
 
         if (response == AVERROR(EAGAIN)) {
-            info("empty buffer size.");
+            debug("empty buffer size.");
             continue;
         }
 
-        info("--------------------");
-        info("Frame: %d", decoder->frame_number);
-        info("type: %c, size: %d bytes", av_get_picture_type_char(frame->pict_type), frame->pkt_size);
-        info("pts: %" PRId64 ", dts: %" PRId64, frame->pts, frame->pkt_dts);
-        info("key frame: %d", frame->key_frame);
-        info("--------------------");
+        debug("--------------------");
+        debug("Frame: %d", decoder->frame_number);
+        debug("type: %c, size: %d bytes", av_get_picture_type_char(frame->pict_type), frame->pkt_size);
+        debug("pts: %" PRId64 ", dts: %" PRId64, frame->pts, frame->pkt_dts);
+        debug("key frame: %d", frame->key_frame);
+        debug("--------------------");
 
         // 正常接收到了图片
         char filename[1024];
         // TODO 这个 frame number 又记错了, 是 decoder 上面的 frame_number
         sprintf(filename, "frame-%d.pgm", decoder->frame_number);
-        save_gray_image(filename, frame);
+        if (PROFILE(PROFILE_WRITE, save_gray_image(filename, frame)) < 0) {
+            return AVERROR(EIO);
+        }
     }
 
     return 0;
@@ -100,11 +110,21 @@ int decode_packet(AVCodecContext *decoder, AVPacket *packet, AVFrame *frame) {
 int run0826(int argc, char **argv) {
 
     if (argc < 2) {
-        error("filename request.");
+        error("usage: SimpleGrayImage <input> [-profile] [-profile-interval <seconds>] [-profile-json <file>]");
         return -1;
     }
 
     int ret = 0;
+    double profile_interval = 0;
+    for (int i = 2; i < argc;) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+        i += consumed;
+    }
+    profiler_run_start(profile_interval);
 
     const char *filename = argv[1];
     int packet_count = 4; // 输出的灰度图的数量
@@ -143,27 +163,11 @@ int run0826(int argc, char **argv) {
     // open codec
     AVStream *video_stream = format_context->streams[video_stream_index];
     AVCodecParameters *video_codec_par = video_stream->codecpar;
-    AVCodec *video_decoder = avcodec_find_decoder(video_codec_par->codec_id);
-    if (video_decoder == nullptr) {
-        ret = -1;
-        error("cannot find decoder for video stream [index:%d].", video_stream_index);
-        goto end;
-    }
-    AVCodecContext *video_decode_context = avcodec_alloc_context3(video_decoder);
-    if (video_decode_context == nullptr) {
-        ret = AVERROR(ENOMEM);
-        error("cannot alloc memory for decode context.");
-        goto end;
-    }
-    response = avcodec_parameters_to_context(video_decode_context, video_codec_par);
+    AVCodecContext *video_decode_context = nullptr;
+    // 线程数按核数自动选择 (Common/DecoderThreads.h)
+    response = open_decoder_context(video_codec_par, nullptr, nullptr, &video_decode_context);
     if (response < 0) {
-        error("error while copy parameters to context.");
-        ret = -1;
-        goto end;
-    }
-    response = avcodec_open2(video_decode_context, video_decoder, nullptr);
-    if (response < 0) {
-        error("cannot open decoder.");
+        error("cannot open decoder for video stream [index:%d].", video_stream_index);
         ret = response;
         goto end;
     }
@@ -180,7 +184,7 @@ int run0826(int argc, char **argv) {
     }
 
     // TODO 这里的结果应该是 >= 0 写成了 > 0 没有出图片
-    while (av_read_frame(format_context, packet) >= 0) {
+    while (PROFILE(PROFILE_DEMUX, av_read_frame(format_context, packet)) >= 0) {
         if (packet->stream_index != video_stream_index) {
             av_packet_unref(packet);
             continue;
@@ -201,6 +205,14 @@ int run0826(int argc, char **argv) {
         }
     }
 
+    // 帧级多线程的解码器会攒着 thread_count - 1 帧, 只送了几个 packet 的时候不 flush 就一张图都没有
+    response = decode_packet(video_decode_context, nullptr, frame);
+    if (response < 0 && response != AVERROR_EOF) {
+        error("failed to flush video decoder.");
+        ret = response;
+        goto end;
+    }
+
     end:
     if (format_context != nullptr) {
         avformat_close_input(&format_context);
@@ -217,5 +229,7 @@ int run0826(int argc, char **argv) {
         frame = nullptr;
     }
 
+    profiler_run_report();
+
     return ret;
 }
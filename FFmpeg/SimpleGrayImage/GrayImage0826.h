@@ -5,7 +5,15 @@
 #ifndef SIMPLEGRAYIMAGE_GRAYIMAGE0826_H
 #define SIMPLEGRAYIMAGE_GRAYIMAGE0826_H
 
-#endif //SIMPLEGRAYIMAGE_GRAYIMAGE0826_H
+#include <cstdint>
+
+extern "C" {
+#include "libavutil/frame.h"
+}
 
+int run0826(int argc, char *argv[]);
 
-int run0826(int argc, char *argv[]);
\ No newline at end of file
+// 把 frame 的 Y 平面写成 PGM 文件 (PgmWriter.h, 使用当前线程的缓冲区), 返回写入的字节数, 失败返回负数
+int64_t save_gray_image(const char *filename, const AVFrame *frame);
+
+#endif //SIMPLEGRAYIMAGE_GRAYIMAGE0826_H
@@ -0,0 +1,148 @@
+//
+// Created by PingZi on 2020/9/15.
+//
+
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+}
+
+#include "GrayScaler.h"
+
+// 第一个平面是不是连续的 8 bit 亮度 (YUV 平面格式, NV12, GRAY8...), 区域平均只处理这种
+static bool has_luma_plane(int format) {
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format));
+    return descriptor != nullptr && !(descriptor->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL)) &&
+           descriptor->comp[0].plane == 0 && descriptor->comp[0].depth == 8 && descriptor->comp[0].step == 1;
+}
+
+// 输出帧按尺寸缓存, 尺寸变了才重新分配
+static int prepare_output(GrayScaler *scaler, int width, int height) {
+    if (scaler->output == nullptr) {
+        scaler->output = av_frame_alloc();
+        if (scaler->output == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+    }
+    AVFrame *output = scaler->output;
+    if (output->data[0] != nullptr && output->width == width && output->height == height) {
+        return 0;
+    }
+
+    av_frame_unref(output);
+    output->format = AV_PIX_FMT_GRAY8;
+    output->width = width;
+    output->height = height;
+    return av_frame_get_buffer(output, 0);
+}
+
+/**
+ * 亮度平面的区域平均: 先把一个输出行覆盖的源图行按列累加, 再按输出像素覆盖的列求和取平均.
+ * 列累加是连续内存上的加法, 编译器可以直接向量化.
+ */
+static void area_scale(GrayScaler *scaler, const AVFrame *input, AVFrame *output) {
+    int src_width = input->width;
+    int src_height = input->height;
+    int dst_width = output->width;
+    int dst_height = output->height;
+
+    if (scaler->x_starts_width != src_width || static_cast<int>(scaler->x_starts.size()) != dst_width + 1) {
+        scaler->x_starts.resize(dst_width + 1);
+        for (int x = 0; x <= dst_width; x++) {
+            scaler->x_starts[x] = static_cast<int>(static_cast<int64_t>(x) * src_width / dst_width);
+        }
+        scaler->x_starts_width = src_width;
+        scaler->column_sums.resize(src_width);
+    }
+    uint32_t *sums = scaler->column_sums.data();
+    const int *x_starts = scaler->x_starts.data();
+
+    for (int y = 0; y < dst_height; y++) {
+        int y_begin = static_cast<int>(static_cast<int64_t>(y) * src_height / dst_height);
+        int y_end = static_cast<int>(static_cast<int64_t>(y + 1) * src_height / dst_height);
+        if (y_end <= y_begin) {
+            y_end = y_begin + 1;
+        }
+
+        memset(sums, 0, sizeof(uint32_t) * src_width);
+        for (int row = y_begin; row < y_end; row++) {
+            const uint8_t *source = input->data[0] + static_cast<ptrdiff_t>(row) * input->linesize[0];
+            for (int x = 0; x < src_width; x++) {
+                sums[x] += source[x];
+            }
+        }
+
+        uint8_t *destination = output->data[0] + static_cast<ptrdiff_t>(y) * output->linesize[0];
+        int rows = y_end - y_begin;
+        for (int x = 0; x < dst_width; x++) {
+            int x_begin = x_starts[x];
+            int x_end = x_starts[x + 1] > x_begin ? x_starts[x + 1] : x_begin + 1;
+            uint64_t total = 0;
+            for (int column = x_begin; column < x_end; column++) {
+                total += sums[column];
+            }
+            uint64_t area = static_cast<uint64_t>(rows) * (x_end - x_begin);
+            destination[x] = static_cast<uint8_t>((total + area / 2) / area);
+        }
+    }
+}
+
+const AVFrame *gray_scaler_apply(GrayScaler *scaler, const AVFrame *input, int *error) {
+    *error = 0;
+    if (scaler->width <= 0 || input->width <= scaler->width) {
+        return input;
+    }
+
+    int width = scaler->width;
+    int height = static_cast<int>(av_rescale(input->height, width, input->width));
+    if (height <= 0) {
+        height = 1;
+    }
+    int response = prepare_output(scaler, width, height);
+    if (response < 0) {
+        *error = response;
+        return nullptr;
+    }
+
+    if (scaler->method == GRAY_SCALE_AREA && has_luma_plane(input->format)) {
+        area_scale(scaler, input, scaler->output);
+        return scaler->output;
+    }
+
+    // 输入尺寸和格式不变的时候 sws_getCachedContext 直接返回原来的 context
+    scaler->sws_context = sws_getCachedContext(scaler->sws_context,
+                                               input->width, input->height, static_cast<AVPixelFormat>(input->format),
+                                               width, height, AV_PIX_FMT_GRAY8,
+                                               SWS_AREA, nullptr, nullptr, nullptr);
+    if (scaler->sws_context == nullptr) {
+        *error = AVERROR(EINVAL);
+        return nullptr;
+    }
+    sws_scale(scaler->sws_context, input->data, input->linesize, 0, input->height,
+              scaler->output->data, scaler->output->linesize);
+    return scaler->output;
+}
+
+void gray_scaler_free(GrayScaler *scaler) {
+    sws_freeContext(scaler->sws_context);
+    scaler->sws_context = nullptr;
+    av_frame_free(&scaler->output);
+    scaler->column_sums.clear();
+    scaler->x_starts.clear();
+    scaler->x_starts_width = 0;
+}
+
+int parse_gray_scaler_option(int argc, char *argv[], int index, int *width, GrayScaleMethod *method) {
+    if (strcmp(argv[index], "-width") == 0 && index + 1 < argc) {
+        *width = atoi(argv[index + 1]);
+        return 2;
+    }
+    if (strcmp(argv[index], "-scaler") == 0 && index + 1 < argc) {
+        *method = strcmp(argv[index + 1], "area") == 0 ? GRAY_SCALE_AREA : GRAY_SCALE_SWSCALE;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+//
+// Created by PingZi on 2020/9/15.
+//
+
+#ifndef SIMPLEGRAYIMAGE_GRAYSCALER_H
+#define SIMPLEGRAYIMAGE_GRAYSCALER_H
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+struct SwsContext;
+
+typedef enum GrayScaleMethod {
+    // libswscale (SWS_AREA), 支持任意输入格式
+    GRAY_SCALE_SWSCALE = 0,
+    // 只处理亮度平面的区域平均, 完全不碰色度; 输入的第一个平面不是 8 bit 亮度的时候退回 swscale
+    GRAY_SCALE_AREA,
+} GrayScaleMethod;
+
+/**
+ * 把解码出来的帧缩小成指定宽度的 GRAY8 图像, 高度按比例计算. 不放大, 源图不比目标宽的时候原样返回.
+ *
+ * SwsContext 和输出帧都按输入的尺寸/格式缓存, 尺寸不变的时候每一帧都不会重新创建或者分配.
+ * 一个 GrayScaler 只能在一个线程里使用, 多个写线程各自持有一个.
+ */
+typedef struct GrayScaler {
+    // 目标宽度, 0 表示不缩放
+    int width;
+    GrayScaleMethod method;
+
+    SwsContext *sws_context;
+    AVFrame *output;
+    // 区域平均用的列累加和, 长度是源图宽度
+    std::vector<uint32_t> column_sums;
+    // 每个输出像素对应的源图列范围 [x_starts[i], x_starts[i + 1])
+    std::vector<int> x_starts;
+    int x_starts_width;
+} GrayScaler;
+
+/**
+ * 返回缩放之后的帧 (属于 scaler, 下一次调用之前有效), 不需要缩放的时候直接返回 input.
+ * 出错返回 nullptr, *error 里是错误码.
+ */
+const AVFrame *gray_scaler_apply(GrayScaler *scaler, const AVFrame *input, int *error);
+
+void gray_scaler_free(GrayScaler *scaler);
+
+/**
+ * 解析 argv[index] 处的缩放选项: -width <N>, -scaler <swscale|area>.
+ * 返回消耗的参数个数, 不是缩放选项返回 0.
+ */
+int parse_gray_scaler_option(int argc, char *argv[], int index, int *width, GrayScaleMethod *method);
+
+#endif //SIMPLEGRAYIMAGE_GRAYSCALER_H
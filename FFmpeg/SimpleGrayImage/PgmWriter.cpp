@@ -0,0 +1,161 @@
+//
+// Created by PingZi on 2020/9/12.
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PGM_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PGM_NEON 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+extern "C" {
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+}
+
+#include "PgmWriter.h"
+
+// "P5\n" + 宽 + 空格 + 高 + "\n255\n", 宽高最多 10 位数字
+#define PGM_HEADER_MAX 32
+
+void pgm_buffer_free(PgmBuffer *buffer) {
+    av_freep(&buffer->data);
+    buffer->capacity = 0;
+}
+
+// 一次处理 64 字节, 剩下不足一个向量的部分交给 memcpy
+static inline void copy_row(uint8_t *dst, const uint8_t *src, int width) {
+    int x = 0;
+#if defined(__AVX2__)
+    for (; x + 64 <= width; x += 64) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x + 32), b);
+    }
+#elif defined(PGM_SSE2)
+    for (; x + 64 <= width; x += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + 48));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), a);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x + 16), b);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x + 32), c);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x + 48), d);
+    }
+#elif defined(PGM_NEON)
+    for (; x + 64 <= width; x += 64) {
+        uint8x16_t a = vld1q_u8(src + x);
+        uint8x16_t b = vld1q_u8(src + x + 16);
+        uint8x16_t c = vld1q_u8(src + x + 32);
+        uint8x16_t d = vld1q_u8(src + x + 48);
+        vst1q_u8(dst + x, a);
+        vst1q_u8(dst + x + 16, b);
+        vst1q_u8(dst + x + 32, c);
+        vst1q_u8(dst + x + 48, d);
+    }
+#endif
+    if (x < width) {
+        memcpy(dst + x, src + x, width - x);
+    }
+}
+
+void pack_plane(uint8_t *dst, const uint8_t *src, int src_linesize, int width, int height) {
+    if (src_linesize == width) {
+        // 没有填充, 整个平面一次拷贝
+        memcpy(dst, src, static_cast<size_t>(width) * height);
+        return;
+    }
+    for (int y = 0; y < height; y++) {
+        copy_row(dst + static_cast<size_t>(y) * width, src + static_cast<ptrdiff_t>(y) * src_linesize, width);
+    }
+}
+
+static int write_file(const char *filename, const uint8_t *data, size_t size) {
+#ifdef _WIN32
+    int fd = _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) {
+        return AVERROR(errno);
+    }
+
+    int ret = 0;
+    while (size > 0) {
+#ifdef _WIN32
+        int written = _write(fd, data, static_cast<unsigned int>(size));
+#else
+        ssize_t written = write(fd, data, size);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ret = AVERROR(errno);
+            break;
+        }
+        data += written;
+        size -= written;
+    }
+
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+    return ret;
+}
+
+int64_t pack_pgm(const AVFrame *frame, PgmBuffer *buffer, bool with_header, unsigned int padding) {
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+    if (descriptor == nullptr || (descriptor->flags & AV_PIX_FMT_FLAG_RGB) || descriptor->comp[0].depth != 8) {
+        // 只支持第一个平面就是 8 bit 亮度的格式 (YUV/GRAY8)
+        return AVERROR(ENOSYS);
+    }
+
+    size_t payload = static_cast<size_t>(frame->width) * frame->height;
+    av_fast_malloc(&buffer->data, &buffer->capacity, payload + PGM_HEADER_MAX + padding);
+    if (buffer->data == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+
+    int header = 0;
+    if (with_header) {
+        header = snprintf(reinterpret_cast<char *>(buffer->data), PGM_HEADER_MAX, "P5\n%d %d\n255\n",
+                          frame->width, frame->height);
+    }
+    pack_plane(buffer->data + header, frame->data[0], frame->linesize[0], frame->width, frame->height);
+    return static_cast<int64_t>(header + payload);
+}
+
+int64_t write_pgm(const char *filename, const AVFrame *frame, PgmBuffer *buffer) {
+    int64_t size = pack_pgm(frame, buffer, true, 0);
+    if (size < 0) {
+        return size;
+    }
+    int response = write_file(filename, buffer->data, static_cast<size_t>(size));
+    if (response < 0) {
+        return response;
+    }
+    return size;
+}
@@ -0,0 +1,41 @@
+//
+// Created by PingZi on 2020/9/12.
+//
+
+#ifndef SIMPLEGRAYIMAGE_PGMWRITER_H
+#define SIMPLEGRAYIMAGE_PGMWRITER_H
+
+#include <cstdint>
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+/**
+ * 生成 PGM 文件用的缓冲区: 文件头和去掉 linesize 填充之后的像素放在一起, 一次 write 写完.
+ * 缓冲区只会变大, 同一个线程反复使用, 稳定之后不再分配内存. 不能在线程之间共享.
+ */
+typedef struct PgmBuffer {
+    uint8_t *data;
+    unsigned int capacity;
+} PgmBuffer;
+
+void pgm_buffer_free(PgmBuffer *buffer);
+
+/**
+ * 把 height 行, 每行 width 字节的平面紧凑地拷贝到 dst (dst 的行距就是 width), 丢掉源数据每行末尾的填充.
+ */
+void pack_plane(uint8_t *dst, const uint8_t *src, int src_linesize, int width, int height);
+
+/**
+ * 把 frame 的第一个平面 (8 bit 亮度) 放进 buffer: with_header 为 true 的时候前面带 PGM 文件头, 否则只有像素.
+ * 缓冲区末尾至少再留 padding 字节 (内容不确定), 返回有效数据的字节数, 失败返回 AVERROR.
+ */
+int64_t pack_pgm(const AVFrame *frame, PgmBuffer *buffer, bool with_header, unsigned int padding);
+
+/**
+ * 把 frame 的第一个平面 (8 bit 亮度) 写成 filename, 返回写入的字节数, 失败返回 AVERROR.
+ */
+int64_t write_pgm(const char *filename, const AVFrame *frame, PgmBuffer *buffer);
+
+#endif //SIMPLEGRAYIMAGE_PGMWRITER_H
@@ -0,0 +1,321 @@
+//
+// Created by PingZi on 2020/9/19.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCENE_NEON 1
+#endif
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include "SceneDetect.h"
+#include "FrameExtraction.h"
+#include "GrayImage0826.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+// 一行的绝对差之和
+static uint64_t row_sad(const uint8_t *a, const uint8_t *b, int width) {
+    uint64_t total = 0;
+    int x = 0;
+#if defined(SCENE_SSE2)
+    __m128i sum = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16) {
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x));
+        __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x));
+        // psadbw: 每 8 个字节的绝对差加成一个 64 bit 的和
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(current, previous));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum);
+    total = lanes[0] + lanes[1];
+#elif defined(SCENE_NEON)
+    uint32x4_t sum = vdupq_n_u32(0);
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t difference = vabdq_u8(vld1q_u8(a + x), vld1q_u8(b + x));
+        sum = vpadalq_u16(sum, vpaddlq_u8(difference));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, sum);
+    total = static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; x < width; x++) {
+        total += a[x] > b[x] ? a[x] - b[x] : b[x] - a[x];
+    }
+    return total;
+}
+
+// 4 个子直方图交替累加, 相邻像素亮度相同的时候不会连续写同一个计数
+static void luma_histogram(const AVFrame *image, uint32_t *histogram) {
+    uint32_t partial[4][256] = {};
+    for (int y = 0; y < image->height; y++) {
+        const uint8_t *row = image->data[0] + static_cast<ptrdiff_t>(y) * image->linesize[0];
+        int x = 0;
+        for (; x + 4 <= image->width; x += 4) {
+            partial[0][row[x]]++;
+            partial[1][row[x + 1]]++;
+            partial[2][row[x + 2]]++;
+            partial[3][row[x + 3]]++;
+        }
+        for (; x < image->width; x++) {
+            partial[0][row[x]]++;
+        }
+    }
+    for (int i = 0; i < 256; i++) {
+        histogram[i] = partial[0][i] + partial[1][i] + partial[2][i] + partial[3][i];
+    }
+}
+
+void scene_detector_init(SceneDetector *detector, int analysis_width) {
+    detector->scaler.width = analysis_width;
+    detector->scaler.method = GRAY_SCALE_AREA;
+    detector->previous_width = 0;
+    detector->previous_height = 0;
+    detector->frames_since_cut = 0;
+}
+
+int scene_detector_update(SceneDetector *detector, const AVFrame *frame, SceneScore *score) {
+    int response = 0;
+    const AVFrame *gray = gray_converter_apply(&detector->converter, frame, &response);
+    if (gray == nullptr) {
+        return response;
+    }
+    const AVFrame *image = gray_scaler_apply(&detector->scaler, gray, &response);
+    if (image == nullptr) {
+        return response;
+    }
+
+    int width = image->width;
+    int height = image->height;
+    uint32_t histogram[256];
+    luma_histogram(image, histogram);
+
+    score->sad = 0;
+    score->histogram = 0;
+    if (width != detector->previous_width || height != detector->previous_height) {
+        // 第一帧, 或者分辨率变了 (比如拼接的流), 都当作新镜头
+        score->cut = true;
+        detector->previous.resize(static_cast<size_t>(width) * height);
+        detector->previous_width = width;
+        detector->previous_height = height;
+    } else {
+        uint64_t sad = 0;
+        for (int y = 0; y < height; y++) {
+            sad += row_sad(image->data[0] + static_cast<ptrdiff_t>(y) * image->linesize[0],
+                           detector->previous.data() + static_cast<size_t>(y) * width, width);
+        }
+        uint64_t histogram_difference = 0;
+        for (int i = 0; i < 256; i++) {
+            histogram_difference += histogram[i] > detector->previous_histogram[i] ?
+                                    histogram[i] - detector->previous_histogram[i] :
+                                    detector->previous_histogram[i] - histogram[i];
+        }
+
+        double pixels = static_cast<double>(width) * height;
+        score->sad = sad * 100.0 / (pixels * 255.0);
+        score->histogram = histogram_difference / (2.0 * pixels);
+        score->cut = score->sad >= detector->threshold && score->histogram >= detector->histogram_threshold &&
+                     detector->frames_since_cut >= detector->min_scene_frames;
+    }
+
+    for (int y = 0; y < height; y++) {
+        memcpy(detector->previous.data() + static_cast<size_t>(y) * width,
+               image->data[0] + static_cast<ptrdiff_t>(y) * image->linesize[0], width);
+    }
+    memcpy(detector->previous_histogram, histogram, sizeof(histogram));
+    detector->frames_since_cut = score->cut ? 1 : detector->frames_since_cut + 1;
+    return 0;
+}
+
+void scene_detector_free(SceneDetector *detector) {
+    gray_converter_free(&detector->converter);
+    gray_scaler_free(&detector->scaler);
+    detector->previous.clear();
+    detector->previous_width = 0;
+    detector->previous_height = 0;
+}
+
+typedef struct SceneContext {
+    const SceneOptions *options;
+    SceneDetector detector;
+    // 保存镜头第一帧用, 和检测用的缩小图分开
+    GrayConverter converter;
+    GrayScaler scaler;
+    FILE *cuts;
+    AVRational time_base;
+    SceneStats *stats;
+} SceneContext;
+
+static int save_scene(SceneContext *context, const AVFrame *frame, int64_t number, const SceneScore *score) {
+    int response = 0;
+    const AVFrame *image = gray_converter_apply(&context->converter, frame, &response);
+    if (image != nullptr) {
+        image = gray_scaler_apply(&context->scaler, image, &response);
+    }
+    if (image == nullptr) {
+        return response;
+    }
+
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s/scene-%06lld.pgm", context->options->output_dir, (long long) number);
+    if (PROFILE(PROFILE_WRITE, save_gray_image(filename, image)) < 0) {
+        return AVERROR(EIO);
+    }
+
+    int64_t pts = frame->best_effort_timestamp;
+    double seconds = pts == AV_NOPTS_VALUE ? -1 : pts * av_q2d(context->time_base);
+    context->stats->scenes++;
+    fprintf(context->cuts, "%lld,%lld,%lld,%.6f,%.3f,%.4f\n", (long long) context->stats->scenes,
+            (long long) number, (long long) pts, seconds, score->sad, score->histogram);
+    debug("scene %lld starts at frame %lld (%.3f s), sad %.2f%%, histogram %.3f.",
+          (long long) context->stats->scenes, (long long) number, seconds, score->sad, score->histogram);
+    return 0;
+}
+
+static int detect_frame(void *opaque, AVFrame *frame) {
+    SceneContext *context = static_cast<SceneContext *>(opaque);
+    int64_t number = ++context->stats->decoded_frames;
+    SceneScore score = {};
+
+    auto begin = std::chrono::steady_clock::now();
+    int response = PROFILE(PROFILE_ANALYZE, scene_detector_update(&context->detector, frame, &score));
+    context->stats->analyze_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (response >= 0 && score.cut) {
+        response = save_scene(context, frame, number, &score);
+    }
+    return response < 0 ? response : 0;
+}
+
+int detect_scenes(const SceneOptions *options, SceneStats *stats) {
+    int ret = 0;
+    int response = 0;
+    int stream_index = -1;
+    AVFormatContext *format_context = nullptr;
+    AVCodecContext *decoder = nullptr;
+    SceneContext context = {};
+    auto begin = std::chrono::steady_clock::now();
+
+    context.options = options;
+    context.stats = stats;
+    context.detector.threshold = options->threshold;
+    context.detector.histogram_threshold = options->histogram_threshold;
+    context.detector.min_scene_frames = options->min_scene_frames;
+    scene_detector_init(&context.detector, options->analysis_width);
+    context.scaler.width = options->scale_width;
+    context.scaler.method = options->scale_method;
+
+    response = open_video_input(options->input, &options->decoder_threading, &format_context, &stream_index, &decoder);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    context.time_base = format_context->streams[stream_index]->time_base;
+
+    context.cuts = fopen(options->cuts_file, "w");
+    if (context.cuts == nullptr) {
+        ret = AVERROR(errno);
+        error("cannot open cut list: %s.", options->cuts_file);
+        goto end;
+    }
+    fprintf(context.cuts, "scene,frame,pts,seconds,sad,histogram\n");
+
+    info("detecting scenes in %s: sad >= %.1f%%, histogram >= %.2f, at least %d frames apart, analysis width %d.",
+         options->input, options->threshold, options->histogram_threshold, options->min_scene_frames,
+         options->analysis_width);
+
+    response = decode_video(format_context, stream_index, decoder, detect_frame, &context);
+    if (response < 0) {
+        ret = response;
+    }
+
+    end:
+    stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (context.cuts != nullptr && fclose(context.cuts) != 0 && ret >= 0) {
+        ret = AVERROR(EIO);
+    }
+    scene_detector_free(&context.detector);
+    gray_converter_free(&context.converter);
+    gray_scaler_free(&context.scaler);
+    avcodec_free_context(&decoder);
+    if (format_context != nullptr) {
+        avformat_close_input(&format_context);
+    }
+    return ret;
+}
+
+int run_scenes(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: SimpleGrayImage -scenes <input> [-o <dir>] [-cuts <file>] [-threshold <percent>] "
+              "[-histogram-threshold <0~1>] [-min-scene N] [-analysis-width N] [-decode-threads N] "
+              "[-decode-thread-type <frame|slice|auto>] [-width N] [-scaler <swscale|area>] [-profile] "
+              "[-profile-interval <seconds>] [-profile-json <file>]");
+        return -1;
+    }
+
+    SceneOptions options = {};
+    options.input = argv[2];
+    options.output_dir = ".";
+    options.cuts_file = nullptr;
+    options.threshold = 10;
+    options.histogram_threshold = 0.2;
+    options.min_scene_frames = 12;
+    options.analysis_width = 160;
+    double profile_interval = 0;
+
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &options.decoder_threading);
+        }
+        if (consumed == 0) {
+            consumed = parse_gray_scaler_option(argc, argv, i, &options.scale_width, &options.scale_method);
+        }
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-cuts") == 0 && i + 1 < argc) {
+            options.cuts_file = argv[++i];
+        } else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) {
+            options.threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-histogram-threshold") == 0 && i + 1 < argc) {
+            options.histogram_threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-min-scene") == 0 && i + 1 < argc) {
+            options.min_scene_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-analysis-width") == 0 && i + 1 < argc) {
+            options.analysis_width = atoi(argv[++i]);
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+
+    char cuts_file[4096];
+    if (options.cuts_file == nullptr) {
+        snprintf(cuts_file, sizeof(cuts_file), "%s/cuts.csv", options.output_dir);
+        options.cuts_file = cuts_file;
+    }
+
+    profiler_run_start(profile_interval);
+    SceneStats stats = {};
+    int ret = detect_scenes(&options, &stats);
+    profiler_run_report();
+
+    double seconds = stats.seconds > 0 ? stats.seconds : 1e-9;
+    double analyze_seconds = stats.analyze_seconds > 0 ? stats.analyze_seconds : 1e-9;
+    info("decoded %lld frames, found %lld scenes in %.3f s: %.1f frames/s overall, detection alone %.1f frames/s.",
+         (long long) stats.decoded_frames, (long long) stats.scenes, stats.seconds, stats.decoded_frames / seconds,
+         stats.decoded_frames / analyze_seconds);
+    return ret;
+}
@@ -0,0 +1,87 @@
+//
+// Created by PingZi on 2020/9/19.
+//
+
+#ifndef SIMPLEGRAYIMAGE_SCENEDETECT_H
+#define SIMPLEGRAYIMAGE_SCENEDETECT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "DecoderThreads.h"
+#include "GrayConverter.h"
+#include "GrayScaler.h"
+
+/**
+ * 镜头切换检测. 每一帧先转成灰度并按区域平均缩小到 analysis_width (默认 160, 1080p 缩小 12 倍),
+ * 然后和上一帧的缩小图比较两个量:
+ *   - 平均每像素的 SAD (SIMD 的 psadbw / vabd), 换算成 0~100 的百分比
+ *   - 亮度直方图的差异, sum(|h1 - h2|) / (2 * 像素数), 0~1
+ * 两个都超过阈值才算切换: 只有 SAD 大多半是运动, 只有直方图变了多半是淡入淡出/亮度变化.
+ * 距离上一次切换不到 min_scene_frames 帧的不算, 避免闪光灯之类的连续误报.
+ *
+ * 所有计算都在缩小图上做, 每帧除了缩小只处理一万多个像素, 可以直接在解码线程里跑.
+ */
+typedef struct SceneDetector {
+    // SAD 阈值 (百分比) 和直方图差异阈值
+    double threshold;
+    double histogram_threshold;
+    int min_scene_frames;
+
+    GrayConverter converter;
+    // 缩小到分析用的宽度, 固定用区域平均
+    GrayScaler scaler;
+    std::vector<uint8_t> previous;
+    int previous_width;
+    int previous_height;
+    uint32_t previous_histogram[256];
+    int64_t frames_since_cut;
+} SceneDetector;
+
+typedef struct SceneScore {
+    double sad;
+    double histogram;
+    // 这一帧是新镜头的第一帧 (第一帧也算)
+    bool cut;
+} SceneScore;
+
+void scene_detector_init(SceneDetector *detector, int analysis_width);
+
+int scene_detector_update(SceneDetector *detector, const AVFrame *frame, SceneScore *score);
+
+void scene_detector_free(SceneDetector *detector);
+
+typedef struct SceneOptions {
+    const char *input;
+    // 每个镜头第一帧保存成 scene-000001.pgm (数字是帧号)
+    const char *output_dir;
+    // 切换列表, CSV: scene, frame, pts, seconds, sad, histogram
+    const char *cuts_file;
+    double threshold;
+    double histogram_threshold;
+    int min_scene_frames;
+    int analysis_width;
+    DecoderThreading decoder_threading;
+    // 保存的图片宽度, 0 表示原始分辨率
+    int scale_width;
+    GrayScaleMethod scale_method;
+} SceneOptions;
+
+typedef struct SceneStats {
+    int64_t decoded_frames;
+    int64_t scenes;
+    double seconds;
+    // 花在检测上的时间, 用来确认检测跟得上解码
+    double analyze_seconds;
+} SceneStats;
+
+int detect_scenes(const SceneOptions *options, SceneStats *stats);
+
+/**
+ * SimpleGrayImage -scenes <input> [-o <dir>] [-cuts <file>] [-threshold <percent>] [-histogram-threshold <0~1>]
+ *                 [-min-scene N] [-analysis-width N] [-decode-threads N] [-width N] [-scaler <swscale|area>]
+ *                 [profile options]
+ */
+int run_scenes(int argc, char *argv[]);
+
+#endif //SIMPLEGRAYIMAGE_SCENEDETECT_H
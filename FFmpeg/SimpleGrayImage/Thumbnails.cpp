@@ -0,0 +1,375 @@
+//
+// Created by PingZi on 2020/9/13.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include "Thumbnails.h"
+#include "FrameExtraction.h"
+#include "GrayImage0826.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+typedef struct Thumbnailer {
+    const ThumbnailOptions *options;
+    AVFormatContext *format_context;
+    AVCodecContext *decoder;
+    int stream_index;
+    ThumbnailStats *stats;
+    // 上一次 grab_frame 送进解码器的最后一个关键帧 packet 的 pts
+    int64_t last_key_pts;
+    // probe_next_keyframe 找到的下一个关键帧, 同一个关键帧上的重复时间点不用每次都往后读
+    int64_t next_key_pts;
+} Thumbnailer;
+
+/**
+ * seek 到 target (流的 time_base) 之前最近的关键帧, 然后解码出第一帧可用的画面:
+ * 关键帧模式下就是那个关键帧, 精确模式下是第一帧 pts >= target 的帧.
+ * 返回 0 表示 frame 里有画面, AVERROR_EOF 表示 target 之后已经没有帧了.
+ */
+static int grab_frame(Thumbnailer *thumbnailer, int64_t target, AVPacket *packet, AVFrame *frame) {
+    AVCodecContext *decoder = thumbnailer->decoder;
+    bool accurate = thumbnailer->options->accurate;
+
+    int response = avformat_seek_file(thumbnailer->format_context, thumbnailer->stream_index,
+                                      INT64_MIN, target, target, 0);
+    if (response < 0) {
+        error("cannot seek to %lld: %d.", (long long) target, response);
+        return response;
+    }
+    avcodec_flush_buffers(decoder);
+    thumbnailer->stats->seeks++;
+
+    bool flushing = false;
+    while (true) {
+        if (!flushing) {
+            response = PROFILE(PROFILE_DEMUX, av_read_frame(thumbnailer->format_context, packet));
+            if (response == AVERROR_EOF) {
+                flushing = true;
+                response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, nullptr));
+            } else if (response < 0) {
+                return response;
+            } else if (packet->stream_index != thumbnailer->stream_index ||
+                       (!accurate && !(packet->flags & AV_PKT_FLAG_KEY))) {
+                // 关键帧模式下非关键帧的 packet 连解码器都不送
+                av_packet_unref(packet);
+                continue;
+            } else {
+                thumbnailer->stats->packets_read++;
+                if ((packet->flags & AV_PKT_FLAG_KEY) && packet->pts != AV_NOPTS_VALUE) {
+                    thumbnailer->last_key_pts = packet->pts;
+                }
+                response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
+                av_packet_unref(packet);
+            }
+            if (response < 0 && response != AVERROR(EAGAIN)) {
+                return response;
+            }
+        }
+
+        while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
+            thumbnailer->stats->frames_decoded++;
+            if (!accurate || frame->best_effort_timestamp == AV_NOPTS_VALUE ||
+                frame->best_effort_timestamp >= target) {
+                return 0;
+            }
+            av_frame_unref(frame);
+        }
+        if (response != AVERROR(EAGAIN) || flushing) {
+            return response == AVERROR(EAGAIN) ? AVERROR_EOF : response;
+        }
+    }
+}
+
+/**
+ * 关键帧模式下 seek 落到和上一张一样的关键帧的时候, 确认 pts 之后还有没有关键帧.
+ * 没有的话之后的时间点都会落在这个关键帧上, 容器里没有时长的时候 (录制的 webm/mkv) 只能这样结束.
+ * 返回 0 表示还有, AVERROR_EOF 表示没有了.
+ */
+static int probe_next_keyframe(Thumbnailer *thumbnailer, int64_t pts, AVPacket *packet) {
+    // 帧级多线程的时候 grab_frame 可能已经把后面的关键帧送进解码器了
+    if ((thumbnailer->last_key_pts != AV_NOPTS_VALUE && thumbnailer->last_key_pts > pts) ||
+        (thumbnailer->next_key_pts != AV_NOPTS_VALUE && thumbnailer->next_key_pts > pts)) {
+        return 0;
+    }
+    int response;
+    while ((response = PROFILE(PROFILE_DEMUX, av_read_frame(thumbnailer->format_context, packet))) >= 0) {
+        if (packet->stream_index == thumbnailer->stream_index && (packet->flags & AV_PKT_FLAG_KEY) &&
+            (packet->pts == AV_NOPTS_VALUE || packet->pts > pts)) {
+            thumbnailer->next_key_pts = packet->pts;
+            av_packet_unref(packet);
+            return 0;
+        }
+        av_packet_unref(packet);
+    }
+    return response;
+}
+
+static bool same_decoder_parameters(const AVCodecParameters *a, const AVCodecParameters *b) {
+    return a->codec_id == b->codec_id && a->width == b->width && a->height == b->height &&
+           a->format == b->format && a->profile == b->profile && a->extradata_size == b->extradata_size &&
+           (a->extradata_size == 0 || memcmp(a->extradata, b->extradata, a->extradata_size) == 0);
+}
+
+// 参数和上一个文件相同的时候 flush 之后继续用原来的解码器, 否则重新打开
+static int prepare_decoder(ThumbnailSession *session, const AVCodecParameters *parameters,
+                           const ThumbnailOptions *options) {
+    if (session->decoder != nullptr && same_decoder_parameters(session->decoder_parameters, parameters)) {
+        avcodec_flush_buffers(session->decoder);
+        session->decoder->skip_frame = options->accurate ? AVDISCARD_DEFAULT : AVDISCARD_NONKEY;
+        session->decoder_reuses++;
+        return 0;
+    }
+
+    avcodec_free_context(&session->decoder);
+    if (session->decoder_parameters == nullptr) {
+        session->decoder_parameters = avcodec_parameters_alloc();
+        if (session->decoder_parameters == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+    }
+    int response = avcodec_parameters_copy(session->decoder_parameters, parameters);
+    if (response < 0) {
+        return response;
+    }
+    response = open_decoder_context(parameters, &options->decoder_threading, nullptr, &session->decoder);
+    if (response < 0) {
+        error("cannot open decoder for %s: %d.", options->input, response);
+        return response;
+    }
+    // 关键帧模式下就算有非关键帧的 packet 漏进来, 解码器也直接跳过
+    session->decoder->skip_frame = options->accurate ? AVDISCARD_DEFAULT : AVDISCARD_NONKEY;
+    session->decoder_opens++;
+    debug("video decoder %s uses %d thread(s).", session->decoder->codec->name, session->decoder->thread_count);
+    return 0;
+}
+
+/**
+ * 解码一张缩略图的时候解码器最多同时持有的帧: 参考帧 + 重排序延迟 + 帧级多线程每个线程一帧 + 输出的一帧.
+ * 参考帧数在解码第一帧之前还不知道的时候按编码格式的上限算.
+ */
+static int64_t frames_held(const AVCodecContext *decoder, const AVCodecParameters *parameters) {
+    int64_t references = decoder->refs;
+    if (references <= 0) {
+        switch (decoder->codec_id) {
+            case AV_CODEC_ID_H264:
+            case AV_CODEC_ID_HEVC:
+                references = 16;
+                break;
+            case AV_CODEC_ID_VP9:
+            case AV_CODEC_ID_AV1:
+                references = 8;
+                break;
+            default:
+                references = 2;
+                break;
+        }
+    }
+    int64_t delay = std::max(decoder->has_b_frames, parameters->video_delay);
+    int64_t threads = (decoder->active_thread_type & FF_THREAD_FRAME) ? decoder->thread_count - 1 : 0;
+    return references + delay + threads + 1;
+}
+
+int thumbnail_file(ThumbnailSession *session, const ThumbnailOptions *options, ThumbnailStats *stats) {
+    int ret = 0;
+    int response = 0;
+    Thumbnailer thumbnailer = {};
+    AVFormatContext *format_context = nullptr;
+    AVStream *stream = nullptr;
+    int64_t start_time = 0;
+    int64_t duration = AV_NOPTS_VALUE;
+    int64_t last_pts = AV_NOPTS_VALUE;
+    const char *prefix = options->name_prefix != nullptr ? options->name_prefix : "";
+    auto begin = std::chrono::steady_clock::now();
+
+    if (session->packet == nullptr) {
+        session->packet = av_packet_alloc();
+    }
+    if (session->frame == nullptr) {
+        session->frame = av_frame_alloc();
+    }
+    AVPacket *packet = session->packet;
+    AVFrame *frame = session->frame;
+    if (packet == nullptr || frame == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    // 解码器在 session 里复用, 这里只打开输入
+    response = open_video_input(options->input, nullptr, &format_context, &thumbnailer.stream_index, nullptr);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    stream = format_context->streams[thumbnailer.stream_index];
+    response = prepare_decoder(session, stream->codecpar, options);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    if (stream->start_time != AV_NOPTS_VALUE) {
+        start_time = stream->start_time;
+    }
+    if (stream->duration != AV_NOPTS_VALUE) {
+        duration = stream->duration;
+    } else if (format_context->duration != AV_NOPTS_VALUE) {
+        duration = av_rescale_q(format_context->duration, AV_TIME_BASE_Q, stream->time_base);
+    }
+
+    session->scaler.width = options->scale_width;
+    session->scaler.method = options->scale_method;
+
+    thumbnailer.options = options;
+    thumbnailer.format_context = format_context;
+    thumbnailer.decoder = session->decoder;
+    thumbnailer.stats = stats;
+    thumbnailer.last_key_pts = AV_NOPTS_VALUE;
+    thumbnailer.next_key_pts = AV_NOPTS_VALUE;
+
+    debug("thumbnail every %.3f s of %s (%s).", options->interval, options->input,
+          options->accurate ? "accurate" : "keyframes only");
+
+    for (int64_t index = 0; options->max_thumbnails <= 0 || index < options->max_thumbnails; index++) {
+        int64_t offset = av_rescale_q(static_cast<int64_t>(index * options->interval * AV_TIME_BASE),
+                                      AV_TIME_BASE_Q, stream->time_base);
+        if (duration != AV_NOPTS_VALUE && offset >= duration) {
+            break;
+        }
+
+        int64_t held = session->budget != nullptr ? session->budget->acquire(frames_held(session->decoder, stream->codecpar)) : 0;
+        response = grab_frame(&thumbnailer, start_time + offset, packet, frame);
+        if (response >= 0 && !options->accurate && frame->best_effort_timestamp != AV_NOPTS_VALUE &&
+            frame->best_effort_timestamp == last_pts) {
+            // 间隔比 GOP 短, 这个时间点和上一个落在同一个关键帧上; 后面没有关键帧的时候就结束了
+            stats->duplicates++;
+            av_frame_unref(frame);
+            response = probe_next_keyframe(&thumbnailer, last_pts, packet);
+            if (response >= 0) {
+                response = AVERROR(EAGAIN);
+            }
+        } else if (response >= 0) {
+            last_pts = frame->best_effort_timestamp;
+
+            char filename[4096];
+            snprintf(filename, sizeof(filename), "%s/%sthumb-%06lld.pgm", options->output_dir, prefix,
+                     (long long) index);
+            const AVFrame *image = gray_converter_apply(&session->converter, frame, &response);
+            if (image != nullptr) {
+                image = gray_scaler_apply(&session->scaler, image, &response);
+            }
+            if (image != nullptr && PROFILE(PROFILE_WRITE, save_gray_image(filename, image)) < 0) {
+                response = AVERROR(EIO);
+            }
+            av_frame_unref(frame);
+            if (response >= 0) {
+                stats->thumbnails++;
+            }
+        }
+        if (session->budget != nullptr) {
+            session->budget->release(held);
+        }
+
+        if (response == AVERROR(EAGAIN)) {
+            continue;
+        }
+        if (response == AVERROR_EOF) {
+            break;
+        }
+        if (response < 0) {
+            ret = response;
+            error("failed to make thumbnail %lld of %s: %d.", (long long) index, options->input, response);
+            goto end;
+        }
+    }
+
+    end:
+    stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (format_context != nullptr) {
+        avformat_close_input(&format_context);
+    }
+    return ret;
+}
+
+void thumbnail_session_free(ThumbnailSession *session) {
+    gray_converter_free(&session->converter);
+    gray_scaler_free(&session->scaler);
+    avcodec_free_context(&session->decoder);
+    avcodec_parameters_free(&session->decoder_parameters);
+    av_packet_free(&session->packet);
+    av_frame_free(&session->frame);
+}
+
+int extract_thumbnails(const ThumbnailOptions *options, ThumbnailStats *stats) {
+    info("thumbnail every %.3f s of %s (%s).", options->interval, options->input,
+         options->accurate ? "accurate" : "keyframes only");
+    ThumbnailSession session = {};
+    int ret = thumbnail_file(&session, options, stats);
+    thumbnail_session_free(&session);
+    return ret;
+}
+
+int run_thumbnails(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: SimpleGrayImage -thumbnails <input> [-interval <seconds>] [-o <dir>] [-max N] [-accurate] "
+              "[-decode-threads N] [-decode-thread-type <frame|slice|auto>] [-width N] [-scaler <swscale|area>] "
+              "[-profile] [-profile-interval <seconds>] [-profile-json <file>]");
+        return -1;
+    }
+
+    ThumbnailOptions options = {};
+    options.input = argv[2];
+    options.output_dir = ".";
+    options.interval = 10;
+    options.max_thumbnails = 0;
+    options.accurate = false;
+    options.decoder_threading.thread_type = FF_THREAD_SLICE;
+    double profile_interval = 0;
+
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &options.decoder_threading);
+        }
+        if (consumed == 0) {
+            consumed = parse_gray_scaler_option(argc, argv, i, &options.scale_width, &options.scale_method);
+        }
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-interval") == 0 && i + 1 < argc) {
+            options.interval = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) {
+            options.max_thumbnails = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-accurate") == 0) {
+            options.accurate = true;
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (options.interval <= 0) {
+        error("interval must be positive.");
+        return -1;
+    }
+
+    profiler_run_start(profile_interval);
+    ThumbnailStats stats = {};
+    int ret = extract_thumbnails(&options, &stats);
+    profiler_run_report();
+
+    info("wrote %lld thumbnails (%lld duplicates skipped) in %.3f s: %lld seeks, %lld packets decoded into %lld frames.",
+         (long long) stats.thumbnails, (long long) stats.duplicates, stats.seconds, (long long) stats.seeks,
+         (long long) stats.packets_read, (long long) stats.frames_decoded);
+    return ret;
+}
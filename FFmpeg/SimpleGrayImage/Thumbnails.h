@@ -0,0 +1,87 @@
+//
+// Created by PingZi on 2020/9/13.
+//
+
+#ifndef SIMPLEGRAYIMAGE_THUMBNAILS_H
+#define SIMPLEGRAYIMAGE_THUMBNAILS_H
+
+#include <cstdint>
+
+#include "DecoderThreads.h"
+#include "FrameBudget.h"
+#include "GrayConverter.h"
+#include "GrayScaler.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+typedef struct ThumbnailOptions {
+    const char *input;
+    // 输出目录, 图片命名为 thumb-000000.pgm (按时间点的序号)
+    const char *output_dir;
+    // 加在图片文件名前面, 多个文件输出到同一个目录的时候用来区分, nullptr 表示没有
+    const char *name_prefix;
+    // 两张缩略图之间的间隔 (秒)
+    double interval;
+    // 最多生成多少张, 0 表示不限制
+    int max_thumbnails;
+    // false: 直接使用目标时间之前最近的关键帧, 只解码关键帧;
+    // true:  从关键帧开始解码到目标时间的那一帧
+    bool accurate;
+    // 默认只用片级多线程: 每次 seek 都要 flush, 帧级多线程攒下的延迟会让每张图多解码好几帧
+    DecoderThreading decoder_threading;
+    // 缩略图宽度, 0 表示原始分辨率
+    int scale_width;
+    GrayScaleMethod scale_method;
+} ThumbnailOptions;
+
+typedef struct ThumbnailStats {
+    int64_t thumbnails;
+    // 多个时间点落在同一个关键帧上的时候只写一次
+    int64_t duplicates;
+    int64_t seeks;
+    int64_t packets_read;
+    int64_t frames_decoded;
+    double seconds;
+} ThumbnailStats;
+
+/**
+ * 处理多个文件的时候每个线程一个 session, 解码器和各种缓冲区在文件之间复用.
+ * 下一个文件视频流的解码参数 (编码格式, 分辨率, 像素格式, extradata) 和上一个完全一样的时候,
+ * 解码器只 flush 不重新打开.
+ */
+typedef struct ThumbnailSession {
+    AVCodecContext *decoder;
+    // 打开 decoder 时用的参数, 用来判断能不能复用
+    AVCodecParameters *decoder_parameters;
+    AVPacket *packet;
+    AVFrame *frame;
+    GrayConverter converter;
+    GrayScaler scaler;
+    // 不为 nullptr 的时候每解码一张缩略图之前先占用额度, 写完之后归还
+    FrameBudget *budget;
+    int64_t decoder_opens;
+    int64_t decoder_reuses;
+} ThumbnailSession;
+
+/**
+ * 用 session 里的解码器和缓冲区给 options->input 生成缩略图, stats 在原来的基础上累加 (seconds 除外).
+ */
+int thumbnail_file(ThumbnailSession *session, const ThumbnailOptions *options, ThumbnailStats *stats);
+
+void thumbnail_session_free(ThumbnailSession *session);
+
+/**
+ * 每隔 interval 秒生成一张灰度缩略图.
+ * 每个时间点先 seek 到它之前最近的关键帧, 只解码需要的部分, 不用从头线性解码整个文件.
+ */
+int extract_thumbnails(const ThumbnailOptions *options, ThumbnailStats *stats);
+
+/**
+ * SimpleGrayImage -thumbnails <input> [-interval <seconds>] [-o <dir>] [-max N] [-accurate] [-decode-threads N]
+ *                 [-width N] [-scaler <swscale|area>] [profile options]
+ */
+int run_thumbnails(int argc, char *argv[]);
+
+#endif //SIMPLEGRAYIMAGE_THUMBNAILS_H
@@ -1,8 +1,28 @@
 
+#include <cstring>
+
 #include "GrayImage0826.h"
+#include "FrameExtraction.h"
+#include "Thumbnails.h"
+#include "FrameHash.h"
+#include "SceneDetect.h"
+#include "BatchThumbnails.h"
 
 int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-extract") == 0) {
+        return run_extract(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-thumbnails") == 0) {
+        return run_thumbnails(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-hash") == 0) {
+        return run_hash(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-scenes") == 0) {
+        return run_scenes(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-batch") == 0) {
+        return run_batch(argc, argv);
+    }
     return run0826(argc, argv);
 }
-
-
@@ -0,0 +1,573 @@
+//
+// Created by PingZi on 2020/9/23.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LadderTranscoding.h"
+#include "ScalerCascade.h"
+#include "transcoding_0826.h"
+#include "MediaQueue.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+typedef struct Ladder Ladder;
+
+// 阶梯里的一档: 一个编码线程, 一个输出文件
+typedef struct LadderRung {
+    Ladder *ladder;
+    int width;
+    int height;
+    int64_t bit_rate;
+    std::string filename;
+    StreamingContext output;
+    // 来源 (解码线程或者上一级) -> 这一档的编码线程, 里面是和其它档位共享像素数据的帧引用
+    SpscFrameQueue *frames;
+    std::thread encoder;
+    // 缩放的来源, -1 表示解码出来的原始帧
+    int parent;
+    // 以这一档的帧为来源的档位, 缩放完之后把帧转交给它们
+    std::vector<int> children;
+    // 帧的尺寸或者像素格式和编码器不同的时候才使用, 输出的帧来自它的缓冲池
+    ScaleNode scale;
+    AVFrame *scaled;
+    int64_t frames_encoded;
+    int64_t bytes;
+    // 编码线程处理帧的时间, 不包括等待队列
+    double seconds;
+    int result;
+} LadderRung;
+
+struct Ladder {
+    StreamingContext input;
+    AVRational framerate;
+    ScaleOptions scale_options;
+    std::vector<LadderRung> rungs;
+    // 直接从解码线程拿帧的档位
+    std::vector<int> roots;
+    std::atomic<int> error{0};
+};
+
+static const RungPreset default_rungs[] = {
+        {0, 1080, 5000000},
+        {0, 720,  3000000},
+        {0, 540,  2000000},
+        {0, 360,  1000000},
+        {0, 240,  500000},
+};
+
+// 任何一档出错都让解码线程和其它档位尽快结束
+static void ladder_fail(Ladder *ladder, int response) {
+    int expected = 0;
+    ladder->error.compare_exchange_strong(expected, response < 0 ? response : AVERROR_UNKNOWN);
+    for (LadderRung &rung : ladder->rungs) {
+        if (rung.frames != nullptr) {
+            rung.frames->abort(response);
+        }
+    }
+}
+
+static int encode_rung_frame(LadderRung *rung, AVFrame *frame, AVPacket *packet) {
+    AVCodecContext *encoder = rung->output.video_codec_context;
+    AVStream *stream = rung->output.video_stream;
+
+    int response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, frame));
+    if (response < 0 && response != AVERROR_EOF) {
+        error("error while sending frame to %dp encoder.", rung->height);
+        return response;
+    }
+
+    while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, packet))) >= 0) {
+        packet->stream_index = stream->index;
+        av_packet_rescale_ts(packet, encoder->time_base, stream->time_base);
+        rung->bytes += packet->size;
+        response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(rung->output.format_context, packet));
+        if (response < 0) {
+            error("cannot write packet to %s.", rung->filename.c_str());
+            return response;
+        }
+    }
+
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+        return 0;
+    }
+    return response;
+}
+
+/**
+ * 把帧的引用交给 targets 里的每一档, 只增加引用计数, 不拷贝像素. frame 本身不变.
+ */
+static int forward_frame(Ladder *ladder, const std::vector<int> &targets, const AVFrame *frame, AVFrame *reference) {
+    for (int target : targets) {
+        int response = av_frame_ref(reference, frame);
+        if (response >= 0) {
+            // push 把引用移进队列, reference 变回空的
+            response = ladder->rungs[target].frames->push(reference);
+        }
+        if (response < 0) {
+            av_frame_unref(reference);
+            return response;
+        }
+    }
+    return 0;
+}
+
+static void rung_worker(LadderRung *rung) {
+    Ladder *ladder = rung->ladder;
+    AVCodecContext *encoder = rung->output.video_codec_context;
+    AVRational input_time_base = ladder->input.video_stream->time_base;
+    AVFrame *frame = av_frame_alloc();
+    AVFrame *reference = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    int64_t last_pts = AV_NOPTS_VALUE;
+
+    int response = frame != nullptr && reference != nullptr && packet != nullptr ? 0 : AVERROR(ENOMEM);
+    while (response >= 0 && (response = rung->frames->pop(frame)) >= 0) {
+        auto begin = std::chrono::steady_clock::now();
+        int64_t pts = frame->pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+                      av_rescale_q(frame->pts, input_time_base, encoder->time_base);
+        // 可变帧率的输入换算到 1/帧率 之后可能重复, 编码器要求严格递增. 所有档位的 time_base 一样,
+        // 在这里丢掉的帧下一级也会丢, 所以不用再往下传
+        if (pts != AV_NOPTS_VALUE && last_pts != AV_NOPTS_VALUE && pts <= last_pts) {
+            av_frame_unref(frame);
+            continue;
+        }
+
+        // frame 的像素和其它档位共享, 只能读; 尺寸和格式都一样的时候直接交给编码器, 不拷贝
+        AVFrame *source = frame;
+        if (frame->width != encoder->width || frame->height != encoder->height || frame->format != encoder->pix_fmt) {
+            response = scale_node_apply(&rung->scale, frame, rung->scaled);
+            source = rung->scaled;
+            source->sample_aspect_ratio = encoder->sample_aspect_ratio;
+        }
+        // 先交给下一级 (时间戳还是输入的 time_base), 下一级缩放和这一档编码同时进行
+        if (response >= 0) {
+            response = forward_frame(ladder, rung->children, source, reference);
+        }
+        if (response >= 0) {
+            source->pts = pts;
+            source->pict_type = AV_PICTURE_TYPE_NONE;
+            response = encode_rung_frame(rung, source, packet);
+        }
+        // 缩放出来的缓冲区等编码器和下一级都释放之后回到缓冲池
+        av_frame_unref(rung->scaled);
+        av_frame_unref(frame);
+        last_pts = pts;
+        rung->frames_encoded++;
+        rung->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    // 队列正常关闭: flush 编码器
+    if (response == AVERROR_EOF) {
+        response = encode_rung_frame(rung, nullptr, packet);
+    }
+    if (response < 0) {
+        error("%dp rendition failed: %d.", rung->height, response);
+        ladder_fail(ladder, response);
+    }
+    // 不管成功与否, 下一级都不会再收到帧了
+    for (int child : rung->children) {
+        ladder->rungs[child].frames->close();
+    }
+    rung->result = response;
+    av_frame_free(&frame);
+    av_frame_free(&reference);
+    av_packet_free(&packet);
+}
+
+// 解码一个 packet (nullptr 表示 flush), 取出来的帧全部交给级联最上面的几档
+static int decode_ladder_packet(Ladder *ladder, AVPacket *packet, AVFrame *frame, AVFrame *reference,
+                                int64_t *decoded) {
+    AVCodecContext *decoder = ladder->input.video_codec_context;
+    int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
+    if (response < 0 && response != AVERROR_EOF) {
+        error("error while sending packet to decoder.");
+        return response;
+    }
+
+    while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
+        (*decoded)++;
+        frame->pts = frame->best_effort_timestamp;
+        response = forward_frame(ladder, ladder->roots, frame, reference);
+        av_frame_unref(frame);
+        if (response < 0) {
+            return response;
+        }
+    }
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+        return 0;
+    }
+    return response;
+}
+
+static bool parse_bit_rate(const char *text, int64_t *bit_rate) {
+    char *end = nullptr;
+    double value = strtod(text, &end);
+    if (end == text || value <= 0) {
+        return false;
+    }
+    if (*end == 'k' || *end == 'K') {
+        value *= 1000;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        value *= 1000 * 1000;
+        end++;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    *bit_rate = llround(value);
+    return true;
+}
+
+bool parse_rung(const char *text, RungPreset *preset) {
+    const char *colon = strchr(text, ':');
+    if (colon == nullptr || !parse_bit_rate(colon + 1, &preset->bit_rate)) {
+        return false;
+    }
+    std::string size(text, colon - text);
+    preset->width = 0;
+    size_t separator = size.find('x');
+    if (separator != std::string::npos) {
+        preset->width = atoi(size.substr(0, separator).c_str());
+        preset->height = atoi(size.substr(separator + 1).c_str());
+    } else {
+        preset->height = atoi(size.c_str());
+    }
+    return preset->height > 0 && preset->width >= 0;
+}
+
+std::vector<RungPreset> default_ladder(int source_height) {
+    std::vector<RungPreset> presets;
+    for (const RungPreset &preset : default_rungs) {
+        if (preset.height <= source_height) {
+            presets.push_back(preset);
+        }
+    }
+    if (presets.empty()) {
+        RungPreset preset = default_rungs[4];
+        preset.height = source_height;
+        presets.push_back(preset);
+    }
+    return presets;
+}
+
+void resolve_rung_size(const RungPreset *preset, int source_width, int source_height, int *width, int *height) {
+    *height = preset->height & ~1;
+    *width = preset->width > 0 ? preset->width & ~1 :
+             static_cast<int>(llround(static_cast<double>(source_width) * preset->height / source_height / 2)) * 2;
+}
+
+static void add_rung(Ladder *ladder, const RungPreset *preset, const std::string &prefix,
+                     const std::string &extension) {
+    AVCodecContext *decoder = ladder->input.video_codec_context;
+    LadderRung rung = {};
+    rung.ladder = ladder;
+    resolve_rung_size(preset, decoder->width, decoder->height, &rung.width, &rung.height);
+    rung.bit_rate = preset->bit_rate;
+    rung.filename = prefix + "_" + std::to_string(rung.height) + "p." + extension;
+    ladder->rungs.push_back(std::move(rung));
+}
+
+// 按缩放级联给每一档找来源, 建好父子关系
+static void link_rungs(Ladder *ladder) {
+    int count = static_cast<int>(ladder->rungs.size());
+    std::vector<int> widths(count);
+    std::vector<int> heights(count);
+    std::vector<int> parents(count);
+    for (int i = 0; i < count; i++) {
+        widths[i] = ladder->rungs[i].width;
+        heights[i] = ladder->rungs[i].height;
+    }
+    build_scale_parents(widths.data(), heights.data(), count, ladder->scale_options.direct, parents.data());
+    for (int i = 0; i < count; i++) {
+        ladder->rungs[i].parent = parents[i];
+        if (parents[i] < 0) {
+            ladder->roots.push_back(i);
+        } else {
+            ladder->rungs[parents[i]].children.push_back(i);
+        }
+    }
+}
+
+static int open_rung(Ladder *ladder, LadderRung *rung, const char *video_codec, int gop_size, int queue_size) {
+    StreamingParams params = {};
+    params.video_codec = const_cast<char *>(video_codec);
+    params.gop_size = gop_size;
+    // 关键帧间隔已经通过 gop_size 设置, 私有参数只用来关掉按场景插入的关键帧
+    if (strcmp(video_codec, "libx264") == 0) {
+        params.codec_priv_key = const_cast<char *>("x264-params");
+        params.codec_priv_value = const_cast<char *>("scenecut=0");
+    } else if (strcmp(video_codec, "libx265") == 0) {
+        params.codec_priv_key = const_cast<char *>("x265-params");
+        params.codec_priv_value = const_cast<char *>("scenecut=0");
+    }
+    params.width = rung->width;
+    params.height = rung->height;
+    params.bit_rate = rung->bit_rate;
+
+    const char *filename = rung->filename.c_str();
+    int response = avformat_alloc_output_context2(&rung->output.format_context, nullptr, nullptr, filename);
+    if (response < 0) {
+        error("cannot alloc output context for %s.", filename);
+        return response;
+    }
+    response = prepare_video_encoder(&rung->output, ladder->input.video_codec_context, ladder->framerate, params);
+    if (response < 0) {
+        error("failed to prepare encoder for %s.", filename);
+        return response;
+    }
+    if ((rung->output.format_context->oformat->flags & AVFMT_NOFILE) == 0) {
+        response = avio_open(&rung->output.format_context->pb, filename, AVIO_FLAG_WRITE);
+        if (response < 0) {
+            error("cannot open output file(%s).", filename);
+            return response;
+        }
+    }
+    response = avformat_write_header(rung->output.format_context, nullptr);
+    if (response < 0) {
+        error("cannot write header for %s.", filename);
+        return response;
+    }
+
+    AVCodecContext *encoder = rung->output.video_codec_context;
+    scale_node_init(&rung->scale, encoder->width, encoder->height, encoder->pix_fmt, ladder->scale_options.quality);
+    rung->scaled = av_frame_alloc();
+    rung->frames = new SpscFrameQueue(queue_size);
+    if (rung->scaled == nullptr || !rung->frames->valid()) {
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+static void close_rung(LadderRung *rung) {
+    delete rung->frames;
+    rung->frames = nullptr;
+    av_frame_free(&rung->scaled);
+    scale_node_free(&rung->scale);
+    avcodec_free_context(&rung->output.video_codec_context);
+    if (rung->output.format_context != nullptr) {
+        if ((rung->output.format_context->oformat->flags & AVFMT_NOFILE) == 0) {
+            avio_closep(&rung->output.format_context->pb);
+        }
+        avformat_free_context(rung->output.format_context);
+        rung->output.format_context = nullptr;
+    }
+}
+
+int run_ladder(int argc, char *argv[]) {
+    if (argc < 4) {
+        error("usage: Transcoding -ladder <input> <output-prefix> [-rung <[WxH|H]:bitrate>]... [-codec <encoder>] "
+              "[-ext <extension>] [-queue N] [-scale-quality <fast|balanced|high>] [-scale-mode <cascade|direct>] "
+              "[-decode-threads N] [-decode-thread-type <frame|slice|auto>] "
+              "[-profile] [-profile-interval <seconds>] [-profile-json <file>]");
+        return -1;
+    }
+
+    const char *input = argv[2];
+    std::string prefix = argv[3];
+    std::string extension = "mp4";
+    const char *video_codec = "libx264";
+    int queue_size = 8;
+    double profile_interval = 0;
+    DecoderThreading threading = {};
+    ScaleOptions scale_options = {};
+    scale_options.quality = SCALE_HIGH;
+    std::vector<RungPreset> presets;
+    for (int i = 4; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &threading);
+        }
+        if (consumed == 0) {
+            consumed = parse_scale_option(argc, argv, i, &scale_options);
+        }
+        if (consumed < 0) {
+            return -1;
+        } else if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-rung") == 0 && i + 1 < argc) {
+            RungPreset preset = {};
+            if (!parse_rung(argv[++i], &preset)) {
+                error("invalid rung: %s (expected WxH:bitrate or H:bitrate).", argv[i]);
+                return -1;
+            }
+            presets.push_back(preset);
+        } else if (strcmp(argv[i], "-codec") == 0 && i + 1 < argc) {
+            video_codec = argv[++i];
+        } else if (strcmp(argv[i], "-ext") == 0 && i + 1 < argc) {
+            extension = argv[++i];
+        } else if (strcmp(argv[i], "-queue") == 0 && i + 1 < argc) {
+            queue_size = atoi(argv[++i]);
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (queue_size <= 0) {
+        queue_size = 1;
+    }
+
+    int ret = 0;
+    int response = 0;
+    int64_t decoded = 0;
+    bool started = false;
+    int gop_size = 1;
+    AVPacket *packet = nullptr;
+    AVFrame *frame = nullptr;
+    AVFrame *reference = nullptr;
+    auto begin = std::chrono::steady_clock::now();
+    Ladder ladder;
+    ladder.input = {};
+    ladder.input.filename = const_cast<char *>(input);
+    ladder.scale_options = scale_options;
+
+    response = open_media(&ladder.input);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = prepare_decoder(&ladder.input, &threading);
+    if (response < 0 || ladder.input.video_stream == nullptr) {
+        error("failed to prepare video decoder for %s.", input);
+        ret = response < 0 ? response : AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    for (unsigned int i = 0; i < ladder.input.format_context->nb_streams; i++) {
+        if (static_cast<int>(i) != ladder.input.video_index) {
+            ladder.input.format_context->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    ladder.framerate = av_guess_frame_rate(ladder.input.format_context, ladder.input.video_stream, nullptr);
+    if (ladder.framerate.num <= 0 || ladder.framerate.den <= 0) {
+        ladder.framerate = AVRational{25, 1};
+    }
+
+    if (presets.empty()) {
+        presets = default_ladder(ladder.input.video_codec_context->height);
+    }
+    for (const RungPreset &preset : presets) {
+        add_rung(&ladder, &preset, prefix, extension);
+    }
+    link_rungs(&ladder);
+
+    {
+        // 每档都是 2 秒一个关键帧并且不按场景插关键帧, 所有档位的 GOP 边界对齐
+        long keyint = lround(2 * av_q2d(ladder.framerate));
+        gop_size = keyint > 0 ? static_cast<int>(keyint) : 1;
+    }
+    for (LadderRung &rung : ladder.rungs) {
+        response = open_rung(&ladder, &rung, video_codec, gop_size, queue_size);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+        const char *source = rung.parent < 0 ? "decoded frame" : ladder.rungs[rung.parent].filename.c_str();
+        info("rendition %dx%d @ %lld kbit/s -> %s, scaled from %s.", rung.width, rung.height,
+             (long long) (rung.bit_rate / 1000), rung.filename.c_str(), source);
+    }
+
+    packet = av_packet_alloc();
+    frame = av_frame_alloc();
+    reference = av_frame_alloc();
+    if (packet == nullptr || frame == nullptr || reference == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    profiler_run_start(profile_interval);
+    begin = std::chrono::steady_clock::now();
+    for (LadderRung &rung : ladder.rungs) {
+        rung.encoder = std::thread(rung_worker, &rung);
+    }
+    started = true;
+
+    while (ladder.error.load() == 0 && PROFILE(PROFILE_DEMUX, av_read_frame(ladder.input.format_context, packet)) >= 0) {
+        if (packet->stream_index != ladder.input.video_index) {
+            av_packet_unref(packet);
+            continue;
+        }
+        response = decode_ladder_packet(&ladder, packet, frame, reference, &decoded);
+        av_packet_unref(packet);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    }
+    if (ladder.error.load() == 0) {
+        response = decode_ladder_packet(&ladder, nullptr, frame, reference, &decoded);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    }
+
+    end:
+    if (ret < 0) {
+        ladder_fail(&ladder, ret);
+    }
+    // 只关闭最上面几档的队列, 下面的档位由上一级处理完之后关闭
+    for (int root : ladder.roots) {
+        if (ladder.rungs[root].frames != nullptr) {
+            ladder.rungs[root].frames->close();
+        }
+    }
+    for (LadderRung &rung : ladder.rungs) {
+        if (rung.encoder.joinable()) {
+            rung.encoder.join();
+        }
+    }
+    if (ret == 0 && ladder.error.load() < 0) {
+        ret = ladder.error.load();
+    }
+    for (LadderRung &rung : ladder.rungs) {
+        if (ret == 0 && rung.output.format_context != nullptr) {
+            response = av_write_trailer(rung.output.format_context);
+            if (response < 0) {
+                error("cannot write trailer for %s.", rung.filename.c_str());
+                ret = response;
+            }
+        }
+    }
+
+    if (started) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        profiler_run_report();
+        int64_t pixels_read = 0;
+        for (const LadderRung &rung : ladder.rungs) {
+            double duration = rung.frames_encoded / av_q2d(ladder.framerate);
+            info("%dx%d: %lld frames (%lld scaled), %.1f kbit/s, encoder busy %.3f s.", rung.width, rung.height,
+                 (long long) rung.frames_encoded, (long long) rung.scale.frames,
+                 duration > 0 ? rung.bytes * 8 / duration / 1000 : 0.0, rung.seconds);
+            pixels_read += rung.scale.input_pixels;
+        }
+        info("scaling (%s, %s) read %.1f Mpixel in total.", ladder.scale_options.direct ? "direct" : "cascade",
+             scale_quality_name(ladder.scale_options.quality), pixels_read / 1e6);
+        info("decoded %lld frames once for %d rendition(s) in %.3f s, %.1f fps.", (long long) decoded,
+             static_cast<int>(ladder.rungs.size()), seconds, seconds > 0 ? decoded / seconds : 0.0);
+    }
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    av_frame_free(&reference);
+    for (LadderRung &rung : ladder.rungs) {
+        close_rung(&rung);
+    }
+    avcodec_free_context(&ladder.input.video_codec_context);
+    avcodec_free_context(&ladder.input.audio_codec_context);
+    avformat_close_input(&ladder.input.format_context);
+
+    if (ret == 0) {
+        info("success!");
+    } else {
+        error("something happened!");
+    }
+    return ret;
+}
@@ -0,0 +1,46 @@
+//
+// Created by PingZi on 2020/9/23.
+//
+
+#ifndef TRANSCODING_LADDERTRANSCODING_H
+#define TRANSCODING_LADDERTRANSCODING_H
+
+#include <cstdint>
+#include <vector>
+
+typedef struct RungPreset {
+    // 0 表示按输入的比例从高度算
+    int width;
+    int height;
+    int64_t bit_rate;
+} RungPreset;
+
+// -rung 的写法: 1280x720:3M 或者 720:3M, 码率可以带 k/M
+bool parse_rung(const char *text, RungPreset *preset);
+
+// 默认阶梯里不超过 source_height 的档位, 输入比最小的一档还小的时候只有一档原始高度
+std::vector<RungPreset> default_ladder(int source_height);
+
+// 算出一档实际的宽高: 没给宽度的时候按输入的比例算, 4:2:0 要求宽高都是偶数
+void resolve_rung_size(const RungPreset *preset, int source_width, int source_height, int *width, int *height);
+
+/**
+ * 多码率阶梯转码: Transcoding -ladder <input> <output-prefix> [-rung <[WxH|H]:bitrate>]... [-codec <encoder>]
+ *                                   [-ext <mp4|mkv|ts...>] [-queue N] [-scale-quality <fast|balanced|high>]
+ *                                   [-scale-mode <cascade|direct>] [-decode-threads N] [profile options]
+ *
+ * 输入的视频只解码一次, 每一帧以引用 (av_frame_ref, 不拷贝像素) 分发给每一档各自的编码线程,
+ * 每一档缩放到自己的分辨率 (和来源一样大并且像素格式相同的一档直接编码来源的帧), 按自己的码率编码,
+ * 写到 <output-prefix>_<height>p.<ext>. 编码参数来自 prepare_video_encoder.
+ *
+ * 默认按缩放级联 (见 ScalerCascade.h) 分发: 解码线程只把帧交给最大的一档, 每一档缩放完之后把自己的帧
+ * 再交给下一档 (1080p -> 720p -> 540p ...), 小的档位不用再读整张原始帧. -scale-mode direct 恢复成
+ * 每一档都从原始帧缩放.
+ *
+ * 没有 -rung 的时候用默认的 1080p/720p/540p/360p/240p 五档, 比输入高的档位跳过 (不放大).
+ * 所有档位的 GOP 固定为 2 秒并且关闭场景切换, 关键帧对齐, 方便之后打包成 HLS/DASH 的同一组切换.
+ * 只输出视频, 音频用 Remuxing 单独处理.
+ */
+int run_ladder(int argc, char *argv[]);
+
+#endif //TRANSCODING_LADDERTRANSCODING_H
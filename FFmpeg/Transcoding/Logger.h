@@ -1,12 +0,0 @@
-//
-// Created by PingZi on 2020/8/26.
-//
-
-#ifndef TRANSCODING_LOGGER_H
-#define TRANSCODING_LOGGER_H
-
-#endif //TRANSCODING_LOGGER_H
-
-void info(const char* format, ...) ;
-
-void error(const char *format, ...);
\ No newline at end of file
@@ -0,0 +1,249 @@
+//
+// Created by PingZi on 2020/9/24.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ScaleBenchmark.h"
+#include "LadderTranscoding.h"
+#include "ScalerCascade.h"
+#include "transcoding_0826.h"
+#include "Logger.h"
+
+extern "C" {
+#include "libavutil/pixdesc.h"
+}
+
+typedef struct ScaleRun {
+    double seconds;
+    int64_t input_pixels;
+    int64_t output_pixels;
+    int64_t source_frames;
+} ScaleRun;
+
+// 解码输入视频的前 count 帧
+static int decode_frames(const char *input, int count, std::vector<AVFrame *> *frames) {
+    StreamingContext context = {};
+    context.filename = const_cast<char *>(input);
+    AVPacket *packet = nullptr;
+    AVFrame *frame = nullptr;
+    int response = open_media(&context);
+    if (response < 0) {
+        goto end;
+    }
+    response = prepare_decoder(&context, nullptr);
+    if (response < 0 || context.video_stream == nullptr) {
+        error("failed to prepare video decoder for %s.", input);
+        response = response < 0 ? response : AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+
+    packet = av_packet_alloc();
+    if (packet == nullptr) {
+        response = AVERROR(ENOMEM);
+        goto end;
+    }
+    // 读到文件结尾之后送一个空 packet 把解码器里剩下的帧取出来
+    while (static_cast<int>(frames->size()) < count) {
+        response = av_read_frame(context.format_context, packet);
+        bool flush = response < 0;
+        if (!flush && packet->stream_index != context.video_index) {
+            av_packet_unref(packet);
+            continue;
+        }
+        response = avcodec_send_packet(context.video_codec_context, flush ? nullptr : packet);
+        av_packet_unref(packet);
+        if (response < 0 && response != AVERROR_EOF) {
+            error("error while sending packet to decoder.");
+            goto end;
+        }
+        while (static_cast<int>(frames->size()) < count) {
+            frame = av_frame_alloc();
+            if (frame == nullptr) {
+                response = AVERROR(ENOMEM);
+                goto end;
+            }
+            response = avcodec_receive_frame(context.video_codec_context, frame);
+            if (response < 0) {
+                av_frame_free(&frame);
+                break;
+            }
+            frames->push_back(frame);
+        }
+        if (flush) {
+            break;
+        }
+    }
+    response = frames->empty() ? AVERROR_INVALIDDATA : 0;
+
+    end:
+    av_packet_free(&packet);
+    avcodec_free_context(&context.video_codec_context);
+    avcodec_free_context(&context.audio_codec_context);
+    avformat_close_input(&context.format_context);
+    return response;
+}
+
+/**
+ * 把所有帧缩放到每一档一遍. 档位按面积从大到小处理, 来源总是在它之前处理完.
+ */
+static int scale_all(const std::vector<AVFrame *> &frames, const std::vector<int> &widths,
+                     const std::vector<int> &heights, ScaleQuality quality, bool direct, ScaleRun *run) {
+    int count = static_cast<int>(widths.size());
+    std::vector<int> parents(count);
+    std::vector<int> order(count);
+    std::vector<ScaleNode> nodes(count);
+    std::vector<AVFrame *> outputs(count, nullptr);
+    build_scale_parents(widths.data(), heights.data(), count, direct, parents.data());
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+        scale_node_init(&nodes[i], widths[i], heights[i], AV_PIX_FMT_YUV420P, quality);
+        outputs[i] = av_frame_alloc();
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int left, int right) {
+        return static_cast<int64_t>(widths[left]) * heights[left] > static_cast<int64_t>(widths[right]) * heights[right];
+    });
+
+    int response = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (const AVFrame *frame : frames) {
+        for (int index : order) {
+            if (outputs[index] == nullptr) {
+                response = AVERROR(ENOMEM);
+                break;
+            }
+            const AVFrame *source = parents[index] < 0 ? frame : outputs[parents[index]];
+            response = scale_node_apply(&nodes[index], source, outputs[index]);
+            if (response < 0) {
+                break;
+            }
+        }
+        // 和阶梯转码一样, 一帧的所有档位用完之后缓冲区回到各自的池子里
+        for (AVFrame *output : outputs) {
+            av_frame_unref(output);
+        }
+        if (response < 0) {
+            break;
+        }
+        run->source_frames++;
+    }
+    run->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    for (int i = 0; i < count; i++) {
+        run->input_pixels += nodes[i].input_pixels;
+        run->output_pixels += nodes[i].output_pixels;
+        scale_node_free(&nodes[i]);
+        av_frame_free(&outputs[i]);
+    }
+    return response;
+}
+
+int run_scale_benchmark(int argc, char *argv[]) {
+    if (argc < 3) {
+        error("usage: Transcoding -bench-scale <input> [-rung <[WxH|H]:bitrate>]... [-frames N] [-repeat N] "
+              "[-scale-quality <fast|balanced|high>]");
+        return -1;
+    }
+
+    const char *input = argv[2];
+    int frame_count = 100;
+    int repeat = 3;
+    bool all_qualities = true;
+    ScaleOptions scale_options = {};
+    std::vector<RungPreset> presets;
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_scale_option(argc, argv, i, &scale_options);
+        if (consumed < 0) {
+            return -1;
+        } else if (consumed > 0) {
+            // 这里两种方式都要测, 只有质量选项有意义
+            all_qualities = all_qualities && strcmp(argv[i], "-scale-quality") != 0;
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-rung") == 0 && i + 1 < argc) {
+            RungPreset preset = {};
+            if (!parse_rung(argv[++i], &preset)) {
+                error("invalid rung: %s (expected WxH:bitrate or H:bitrate).", argv[i]);
+                return -1;
+            }
+            presets.push_back(preset);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            frame_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    frame_count = std::max(frame_count, 1);
+    repeat = std::max(repeat, 1);
+
+    std::vector<AVFrame *> frames;
+    int response = decode_frames(input, frame_count, &frames);
+    if (response < 0) {
+        for (AVFrame *frame : frames) {
+            av_frame_free(&frame);
+        }
+        return response;
+    }
+
+    int source_width = frames.front()->width;
+    int source_height = frames.front()->height;
+    if (presets.empty()) {
+        presets = default_ladder(source_height);
+    }
+    std::vector<int> widths;
+    std::vector<int> heights;
+    for (const RungPreset &preset : presets) {
+        int width = 0;
+        int height = 0;
+        resolve_rung_size(&preset, source_width, source_height, &width, &height);
+        widths.push_back(width);
+        heights.push_back(height);
+    }
+    info("%d frame(s) of %dx%d %s, %d rung(s), %d round(s).", static_cast<int>(frames.size()), source_width,
+         source_height, av_get_pix_fmt_name(static_cast<AVPixelFormat>(frames.front()->format)),
+         static_cast<int>(widths.size()), repeat);
+
+    std::vector<ScaleQuality> qualities;
+    if (all_qualities) {
+        qualities = {SCALE_FAST, SCALE_BALANCED, SCALE_HIGH};
+    } else {
+        qualities = {scale_options.quality};
+    }
+
+    for (ScaleQuality quality : qualities) {
+        ScaleRun runs[2] = {};
+        // 两种方式交替, 避免缓存和频率的变化只对其中一种有利
+        for (int round = 0; round < repeat && response >= 0; round++) {
+            for (int mode = 0; mode < 2 && response >= 0; mode++) {
+                response = scale_all(frames, widths, heights, quality, mode == 0, &runs[mode]);
+            }
+        }
+        if (response < 0) {
+            error("scaling failed: %d.", response);
+            break;
+        }
+
+        const char *names[2] = {"direct", "cascade"};
+        for (int mode = 0; mode < 2; mode++) {
+            const ScaleRun &run = runs[mode];
+            double seconds = run.seconds > 0 ? run.seconds : 1e-9;
+            info("%-8s %-7s %8.3f s  %8.1f Mpixel/s written  %8.1f Mpixel read  %6.2f ms/frame",
+                 scale_quality_name(quality), names[mode], run.seconds, run.output_pixels / seconds / 1e6,
+                 run.input_pixels / 1e6, run.source_frames > 0 ? run.seconds * 1e3 / run.source_frames : 0.0);
+        }
+        if (runs[1].seconds > 0) {
+            info("%-8s cascade speedup: %.2fx", scale_quality_name(quality), runs[0].seconds / runs[1].seconds);
+        }
+    }
+
+    for (AVFrame *frame : frames) {
+        av_frame_free(&frame);
+    }
+    return response;
+}
@@ -0,0 +1,19 @@
+//
+// Created by PingZi on 2020/9/24.
+//
+
+#ifndef TRANSCODING_SCALEBENCHMARK_H
+#define TRANSCODING_SCALEBENCHMARK_H
+
+/**
+ * 比较阶梯缩放的两种方式: Transcoding -bench-scale <input> [-rung <[WxH|H]:bitrate>]... [-frames N] [-repeat N]
+ *                                                   [-scale-quality <fast|balanced|high>]
+ *
+ * 先解码输入的前 N 帧放在内存里, 然后在单个线程里分别用 direct (每一档都从原始帧缩放) 和 cascade
+ * (每一档从比它大的最近一档缩放) 把这些帧缩放到阶梯的所有档位 (yuv420p), 两种方式交替进行.
+ * 输出每种方式每秒写出的像素, 读进的像素总量和每帧耗时. 没有 -scale-quality 的时候三种质量都测.
+ * 只测缩放, 不编码.
+ */
+int run_scale_benchmark(int argc, char *argv[]);
+
+#endif //TRANSCODING_SCALEBENCHMARK_H
@@ -0,0 +1,161 @@
+//
+// Created by PingZi on 2020/9/24.
+//
+
+#include <cstring>
+
+#include "ScalerCascade.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+}
+
+// 每行对齐到 32 字节, swscale 的 SIMD 路径和编码器都可以直接使用
+#define SCALE_LINE_ALIGN 32
+// 和 av_frame_get_buffer 一样在缓冲区末尾留一点余量, 有的 SIMD 代码会多读几个字节
+#define SCALE_BUFFER_PADDING 64
+
+int scale_quality_flags(ScaleQuality quality) {
+    switch (quality) {
+        case SCALE_FAST:
+            return SWS_FAST_BILINEAR;
+        case SCALE_BALANCED:
+            return SWS_BILINEAR;
+        case SCALE_HIGH:
+        default:
+            return SWS_BICUBIC;
+    }
+}
+
+const char *scale_quality_name(ScaleQuality quality) {
+    switch (quality) {
+        case SCALE_FAST:
+            return "fast";
+        case SCALE_BALANCED:
+            return "balanced";
+        case SCALE_HIGH:
+        default:
+            return "high";
+    }
+}
+
+int parse_scale_option(int argc, char *argv[], int index, ScaleOptions *options) {
+    if (strcmp(argv[index], "-scale-quality") == 0 && index + 1 < argc) {
+        const char *value = argv[index + 1];
+        if (strcmp(value, "fast") == 0) {
+            options->quality = SCALE_FAST;
+        } else if (strcmp(value, "balanced") == 0) {
+            options->quality = SCALE_BALANCED;
+        } else if (strcmp(value, "high") == 0) {
+            options->quality = SCALE_HIGH;
+        } else {
+            error("unknown scale quality: %s (fast, balanced, high).", value);
+            return -1;
+        }
+        return 2;
+    }
+    if (strcmp(argv[index], "-scale-mode") == 0 && index + 1 < argc) {
+        const char *value = argv[index + 1];
+        if (strcmp(value, "cascade") == 0) {
+            options->direct = false;
+        } else if (strcmp(value, "direct") == 0) {
+            options->direct = true;
+        } else {
+            error("unknown scale mode: %s (cascade, direct).", value);
+            return -1;
+        }
+        return 2;
+    }
+    return 0;
+}
+
+void build_scale_parents(const int *widths, const int *heights, int count, bool direct, int *parents) {
+    for (int i = 0; i < count; i++) {
+        parents[i] = -1;
+        if (direct) {
+            continue;
+        }
+        int64_t area = static_cast<int64_t>(widths[i]) * heights[i];
+        int64_t best_area = INT64_MAX;
+        for (int j = 0; j < count; j++) {
+            if (j == i || widths[j] < widths[i] || heights[j] < heights[i]) {
+                continue;
+            }
+            int64_t candidate = static_cast<int64_t>(widths[j]) * heights[j];
+            // 一样大的两档只让后面的依赖前面的, 不会出现环
+            if (candidate == area && j > i) {
+                continue;
+            }
+            if (candidate < best_area) {
+                best_area = candidate;
+                parents[i] = j;
+            }
+        }
+    }
+}
+
+void scale_node_init(ScaleNode *node, int width, int height, AVPixelFormat format, ScaleQuality quality) {
+    memset(node, 0, sizeof(*node));
+    node->width = width;
+    node->height = height;
+    node->format = format;
+    node->flags = scale_quality_flags(quality);
+}
+
+int scale_node_apply(ScaleNode *node, const AVFrame *source, AVFrame *output) {
+    node->context = sws_getCachedContext(node->context, source->width, source->height,
+                                         static_cast<AVPixelFormat>(source->format), node->width, node->height,
+                                         node->format, node->flags, nullptr, nullptr, nullptr);
+    if (node->context == nullptr) {
+        error("cannot create scaler %dx%d -> %dx%d.", source->width, source->height, node->width, node->height);
+        return AVERROR(EINVAL);
+    }
+
+    if (node->pool == nullptr) {
+        int aligned_width = FFALIGN(node->width, SCALE_LINE_ALIGN);
+        int response = av_image_fill_linesizes(node->linesize, node->format, aligned_width);
+        int size = av_image_get_buffer_size(node->format, aligned_width, node->height, 1);
+        if (response < 0 || size < 0) {
+            return response < 0 ? response : size;
+        }
+        node->pool_size = size + SCALE_BUFFER_PADDING;
+        node->pool = av_buffer_pool_init(node->pool_size, nullptr);
+        if (node->pool == nullptr) {
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    // 所有平面放在同一块池化的缓冲区里, 和 av_frame_get_buffer 的布局一样
+    output->buf[0] = av_buffer_pool_get(node->pool);
+    if (output->buf[0] == nullptr) {
+        return AVERROR(ENOMEM);
+    }
+    int response = av_image_fill_pointers(output->data, node->format, node->height, output->buf[0]->data,
+                                          node->linesize);
+    if (response < 0) {
+        av_frame_unref(output);
+        return response;
+    }
+    memcpy(output->linesize, node->linesize, sizeof(node->linesize));
+    output->extended_data = output->data;
+    output->format = node->format;
+    output->width = node->width;
+    output->height = node->height;
+    av_frame_copy_props(output, source);
+
+    PROFILE(PROFILE_SCALE, sws_scale(node->context, source->data, source->linesize, 0, source->height, output->data,
+                                     output->linesize));
+    node->frames++;
+    node->input_pixels += static_cast<int64_t>(source->width) * source->height;
+    node->output_pixels += static_cast<int64_t>(node->width) * node->height;
+    return 0;
+}
+
+void scale_node_free(ScaleNode *node) {
+    sws_freeContext(node->context);
+    node->context = nullptr;
+    // 还有帧引用着池里的缓冲区的时候, 池子等它们都释放之后才真正销毁
+    av_buffer_pool_uninit(&node->pool);
+}
@@ -0,0 +1,75 @@
+//
+// Created by PingZi on 2020/9/24.
+//
+
+#ifndef TRANSCODING_SCALERCASCADE_H
+#define TRANSCODING_SCALERCASCADE_H
+
+#include <cstdint>
+
+extern "C" {
+#include "libavutil/buffer.h"
+#include "libavutil/frame.h"
+#include "libswscale/swscale.h"
+}
+
+typedef enum ScaleQuality {
+    // SWS_FAST_BILINEAR
+    SCALE_FAST = 0,
+    // SWS_BILINEAR
+    SCALE_BALANCED,
+    // SWS_BICUBIC, 之前阶梯转码一直用的
+    SCALE_HIGH,
+} ScaleQuality;
+
+typedef struct ScaleOptions {
+    ScaleQuality quality;
+    // true: 每一档从比它大的最近一档缩放 (4K -> 1080p -> 720p -> 480p);
+    // false: 每一档都从解码出来的原始帧缩放
+    bool direct;
+} ScaleOptions;
+
+int scale_quality_flags(ScaleQuality quality);
+
+const char *scale_quality_name(ScaleQuality quality);
+
+/**
+ * 解析 argv[index] 处的缩放选项: -scale-quality <fast|balanced|high>, -scale-mode <cascade|direct>.
+ * 返回消耗的参数个数, 不是缩放选项返回 0, 值不对返回 -1.
+ */
+int parse_scale_option(int argc, char *argv[], int index, ScaleOptions *options);
+
+/**
+ * 给每一档选缩放的来源: parents[i] 是宽高都不小于第 i 档的档位里面积最小的那一档, 没有的时候是 -1 (原始帧).
+ * 一样大的档位之间, 后面的以前面的为来源. direct 的时候全部是 -1.
+ */
+void build_scale_parents(const int *widths, const int *heights, int count, bool direct, int *parents);
+
+/**
+ * 缩放图里的一个节点: 固定的输出尺寸和像素格式, 自己的 SwsContext 和输出缓冲池.
+ * 输出的帧从缓冲池里取, 可以同时交给编码器和下一级节点引用, 所有引用释放之后缓冲区回到池子里复用.
+ * 一个节点只在一个线程里使用.
+ */
+typedef struct ScaleNode {
+    int width;
+    int height;
+    AVPixelFormat format;
+    int flags;
+    SwsContext *context;
+    AVBufferPool *pool;
+    int pool_size;
+    int linesize[4];
+    int64_t frames;
+    // 读进来的像素和写出去的像素, 用来算缩放的吞吐
+    int64_t input_pixels;
+    int64_t output_pixels;
+} ScaleNode;
+
+void scale_node_init(ScaleNode *node, int width, int height, AVPixelFormat format, ScaleQuality quality);
+
+// 把 source 缩放到 output (output 必须是空的), 时间戳等属性从 source 复制
+int scale_node_apply(ScaleNode *node, const AVFrame *source, AVFrame *output);
+
+void scale_node_free(ScaleNode *node);
+
+#endif //TRANSCODING_SCALERCASCADE_H
@@ -0,0 +1,760 @@
+//
+// Created by PingZi on 2020/9/6.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SegmentTranscoding.h"
+#include "transcoding_0826.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+typedef struct Segment {
+    int index;
+    // 输入视频流 time_base 下的 pts, 这一段负责 [start, end) 的帧
+    int64_t start;
+    int64_t end;
+    std::string filename;
+    int result;
+    int64_t frames;
+    double seconds;
+} Segment;
+
+typedef struct SegmentOptions {
+    const char *input;
+    const char *output;
+    // 临时文件和最终输出使用同一种封装格式, 拼接的时候 codecpar 可以直接拷贝
+    AVOutputFormat *format;
+    std::string codec_priv_value;
+    // 每个 worker 的解码线程, 自动的时候和 x265 一样按 worker 数平分核数
+    DecoderThreading decoder_threading;
+} SegmentOptions;
+
+// 拼接时按顺序读取每一段的临时文件
+typedef struct SegmentReader {
+    std::vector<Segment> *segments;
+    size_t current;
+    AVFormatContext *context;
+    // 原始输入视频流的 time_base 和第一段的起点, 用来换算每一段在输出里的偏移
+    AVRational input_time_base;
+    int64_t first_start;
+} SegmentReader;
+
+// 和 prepare_decoder 选同一个视频流 (最后一个)
+static int find_video_index(AVFormatContext *context) {
+    int video_index = -1;
+    for (unsigned int i = 0; i < context->nb_streams; i++) {
+        if (context->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video_index = i;
+        }
+    }
+    return video_index;
+}
+
+static void discard_other_streams(AVFormatContext *context, int keep_index) {
+    for (unsigned int i = 0; i < context->nb_streams; i++) {
+        if (static_cast<int>(i) != keep_index) {
+            context->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+}
+
+/**
+ * 只读 packet 不解码, 收集视频流所有关键帧的 pts.
+ */
+static int scan_keyframes(const char *input, std::vector<int64_t> *keyframes, int64_t *end_pts) {
+    AVFormatContext *context = nullptr;
+    AVPacket *packet = nullptr;
+    int video_index = -1;
+
+    int response = avformat_open_input(&context, input, nullptr, nullptr);
+    if (response < 0) {
+        error("cannot open input file(%s).", input);
+        return response;
+    }
+
+    response = avformat_find_stream_info(context, nullptr);
+    if (response < 0) {
+        error("cannot find stream info for input file.");
+        goto end;
+    }
+
+    video_index = find_video_index(context);
+    if (video_index < 0) {
+        error("input file has no video stream.");
+        response = AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    discard_other_streams(context, video_index);
+
+    packet = av_packet_alloc();
+    if (packet == nullptr) {
+        response = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    *end_pts = AV_NOPTS_VALUE;
+    while ((response = PROFILE(PROFILE_DEMUX, av_read_frame(context, packet))) >= 0) {
+        if (packet->stream_index == video_index) {
+            int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if (pts != AV_NOPTS_VALUE) {
+                if (packet->flags & AV_PKT_FLAG_KEY) {
+                    keyframes->push_back(pts);
+                }
+                if (*end_pts == AV_NOPTS_VALUE || pts + packet->duration > *end_pts) {
+                    *end_pts = pts + packet->duration;
+                }
+            }
+        }
+        av_packet_unref(packet);
+    }
+    if (response == AVERROR_EOF) {
+        response = 0;
+    }
+    std::sort(keyframes->begin(), keyframes->end());
+
+    end:
+    av_packet_free(&packet);
+    avformat_close_input(&context);
+    return response;
+}
+
+/**
+ * 按时长均分, 每个分界点取它之后的第一个关键帧. 关键帧太少的时候段数会比 count 少.
+ */
+static std::vector<Segment> split_segments(const std::vector<int64_t> &keyframes, int64_t end_pts, int count,
+                                           const char *output) {
+    std::vector<int64_t> starts;
+    int64_t first = keyframes.front();
+    starts.push_back(first);
+    for (int i = 1; i < count; i++) {
+        int64_t target = first + av_rescale(end_pts - first, i, count);
+        auto keyframe = std::lower_bound(keyframes.begin(), keyframes.end(), target);
+        if (keyframe != keyframes.end() && *keyframe > starts.back()) {
+            starts.push_back(*keyframe);
+        }
+    }
+
+    std::vector<Segment> segments;
+    for (size_t i = 0; i < starts.size(); i++) {
+        Segment segment = {};
+        segment.index = static_cast<int>(i);
+        segment.start = starts[i];
+        segment.end = i + 1 < starts.size() ? starts[i + 1] : INT64_MAX;
+        segment.filename = std::string(output) + ".part" + std::to_string(i);
+        segments.push_back(segment);
+    }
+    return segments;
+}
+
+/**
+ * 判断这一段是不是已经读完了. 下一段的起点 K 是 open GOP 的关键帧 (比如 x265 的 CRA) 的时候,
+ * 解码顺序里 K 后面还跟着显示时间在 K 之前的前导帧, 它们属于这一段, 下一段从 K 开始解码是拿不到的.
+ * 所以 dts 到了 end 不能马上停: 第一个 pts >= end 的包是 K, 要送进解码器 (前导帧参考它),
+ * 读到 K 之后的下一个 pts >= end 的包才算结束. 中间的前导帧照常解码, pts >= end 的帧由 decode_segment_packet 丢掉.
+ */
+static bool after_segment(const AVPacket *packet, int64_t end, bool *boundary_seen) {
+    if (end == INT64_MAX) {
+        return false;
+    }
+    if (packet->pts == AV_NOPTS_VALUE) {
+        // 没有 pts 分辨不出前导帧, 只能按 dts: dts 单调递增并且 pts >= dts
+        return packet->dts != AV_NOPTS_VALUE && packet->dts >= end;
+    }
+    if (packet->pts < end) {
+        return false;
+    }
+    if (!*boundary_seen) {
+        *boundary_seen = true;
+        return false;
+    }
+    return true;
+}
+
+static int encode_segment_frame(StreamingContext *output, AVFrame *frame, AVPacket *packet) {
+    AVCodecContext *encoder = output->video_codec_context;
+
+    int response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, frame));
+    if (response < 0 && response != AVERROR_EOF) {
+        error("error while sending frame to segment encoder.");
+        return response;
+    }
+
+    while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, packet))) >= 0) {
+        packet->stream_index = output->video_stream->index;
+        av_packet_rescale_ts(packet, encoder->time_base, output->video_stream->time_base);
+        response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output->format_context, packet));
+        if (response < 0) {
+            error("cannot write packet to segment file.");
+            return response;
+        }
+    }
+
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+        return 0;
+    }
+    return response;
+}
+
+/**
+ * 解码一个 packet (nullptr 表示 flush), 只把 pts 落在 [start, end) 里的帧送去编码.
+ * 起点之前的前导帧由上一段负责 (见 after_segment), 下一段的帧也在这里丢掉.
+ */
+static int decode_segment_packet(StreamingContext *input, StreamingContext *output, Segment *segment,
+                                 AVPacket *packet, AVFrame *frame, AVPacket *encoded) {
+    AVCodecContext *decoder = input->video_codec_context;
+
+    int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
+    if (response < 0 && response != AVERROR_EOF) {
+        error("error while sending packet to segment decoder.");
+        return response;
+    }
+
+    while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
+        int64_t pts = frame->best_effort_timestamp;
+        if (pts == AV_NOPTS_VALUE || pts < segment->start || pts >= segment->end) {
+            av_frame_unref(frame);
+            continue;
+        }
+
+        // 编码器里的时间戳从这一段的起点开始算, 拼接的时候再整体平移
+        frame->pts = av_rescale_q(pts - segment->start, input->video_stream->time_base,
+                                  output->video_codec_context->time_base);
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+        response = encode_segment_frame(output, frame, encoded);
+        av_frame_unref(frame);
+        if (response < 0) {
+            return response;
+        }
+        segment->frames++;
+    }
+
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+        return 0;
+    }
+    return response;
+}
+
+/**
+ * 转码一段, 在 worker 线程里运行. 每一段有自己的 format context 和编解码器, 互不共享.
+ */
+static void transcode_segment(const SegmentOptions *options, Segment *segment) {
+    auto begin = std::chrono::steady_clock::now();
+
+    int ret = 0;
+    int response = 0;
+    StreamingContext input = {};
+    StreamingContext output = {};
+    StreamingParams params = {};
+    AVPacket *packet = nullptr;
+    AVPacket *encoded = nullptr;
+    AVFrame *frame = nullptr;
+    AVRational framerate;
+    bool boundary_seen = false;
+
+    input.filename = const_cast<char *>(options->input);
+    output.filename = const_cast<char *>(segment->filename.c_str());
+
+    params.video_codec = const_cast<char *>("libx265");
+    params.codec_priv_key = const_cast<char *>("x265-params");
+    params.codec_priv_value = const_cast<char *>(options->codec_priv_value.c_str());
+
+    response = open_media(&input);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = prepare_decoder(&input, &options->decoder_threading);
+    if (response < 0 || input.video_stream == nullptr) {
+        error("failed to prepare decoder for segment %d.", segment->index);
+        ret = response < 0 ? response : AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    discard_other_streams(input.format_context, input.video_index);
+    framerate = av_guess_frame_rate(input.format_context, input.video_stream, nullptr);
+
+    response = avformat_alloc_output_context2(&output.format_context, options->format, nullptr, output.filename);
+    if (response < 0) {
+        error("cannot alloc output context for segment %d.", segment->index);
+        ret = response;
+        goto end;
+    }
+
+    response = prepare_video_encoder(&output, input.video_codec_context, framerate, params);
+    if (response < 0) {
+        error("failed to prepare encoder for segment %d.", segment->index);
+        ret = response;
+        goto end;
+    }
+
+    if ((output.format_context->oformat->flags & AVFMT_NOFILE) == 0) {
+        response = avio_open(&output.format_context->pb, output.filename, AVIO_FLAG_WRITE);
+        if (response < 0) {
+            error("cannot open segment file(%s).", output.filename);
+            ret = response;
+            goto end;
+        }
+    }
+
+    response = avformat_write_header(output.format_context, nullptr);
+    if (response < 0) {
+        error("cannot write header for segment %d.", segment->index);
+        ret = response;
+        goto end;
+    }
+
+    // 第一段从头开始读, 其它段跳到起点之前最近的关键帧
+    if (segment->index > 0) {
+        response = av_seek_frame(input.format_context, input.video_index, segment->start, AVSEEK_FLAG_BACKWARD);
+        if (response < 0) {
+            error("cannot seek to start of segment %d.", segment->index);
+            ret = response;
+            goto end;
+        }
+    }
+
+    packet = av_packet_alloc();
+    encoded = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (packet == nullptr || encoded == nullptr || frame == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while (PROFILE(PROFILE_DEMUX, av_read_frame(input.format_context, packet)) >= 0) {
+        if (packet->stream_index != input.video_index) {
+            av_packet_unref(packet);
+            continue;
+        }
+        if (after_segment(packet, segment->end, &boundary_seen)) {
+            av_packet_unref(packet);
+            break;
+        }
+
+        response = decode_segment_packet(&input, &output, segment, packet, frame, encoded);
+        av_packet_unref(packet);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    }
+
+    // flush 解码器和编码器
+    response = decode_segment_packet(&input, &output, segment, nullptr, frame, encoded);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    response = encode_segment_frame(&output, nullptr, encoded);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    response = av_write_trailer(output.format_context);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    end:
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    av_packet_free(&encoded);
+
+    avcodec_free_context(&input.video_codec_context);
+    avcodec_free_context(&input.audio_codec_context);
+    avformat_close_input(&input.format_context);
+
+    avcodec_free_context(&output.video_codec_context);
+    if (output.format_context != nullptr) {
+        if ((output.format_context->oformat->flags & AVFMT_NOFILE) == 0) {
+            avio_closep(&output.format_context->pb);
+        }
+        avformat_free_context(output.format_context);
+        output.format_context = nullptr;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    segment->seconds = elapsed.count();
+    segment->result = ret;
+}
+
+static int open_segment(SegmentReader *reader) {
+    Segment &segment = (*reader->segments)[reader->current];
+    int response = avformat_open_input(&reader->context, segment.filename.c_str(), nullptr, nullptr);
+    if (response < 0) {
+        error("cannot open segment file(%s).", segment.filename.c_str());
+        return response;
+    }
+    return avformat_find_stream_info(reader->context, nullptr);
+}
+
+/**
+ * 读取下一个视频 packet, 一段读完之后自动打开下一段. 时间戳转换成 time_base 并加上这一段的偏移.
+ */
+static int read_segment_packet(SegmentReader *reader, AVPacket *packet, AVRational time_base) {
+    while (reader->current < reader->segments->size()) {
+        if (reader->context == nullptr) {
+            int response = open_segment(reader);
+            if (response < 0) {
+                return response;
+            }
+        }
+
+        int response = PROFILE(PROFILE_DEMUX, av_read_frame(reader->context, packet));
+        if (response == AVERROR_EOF) {
+            avformat_close_input(&reader->context);
+            reader->current++;
+            continue;
+        }
+        if (response < 0) {
+            return response;
+        }
+
+        Segment &segment = (*reader->segments)[reader->current];
+        int64_t offset = av_rescale_q(segment.start - reader->first_start, reader->input_time_base, time_base);
+        av_packet_rescale_ts(packet, reader->context->streams[packet->stream_index]->time_base, time_base);
+        if (packet->pts != AV_NOPTS_VALUE) {
+            packet->pts += offset;
+        }
+        if (packet->dts != AV_NOPTS_VALUE) {
+            packet->dts += offset;
+        }
+        return 0;
+    }
+    return AVERROR_EOF;
+}
+
+// 读下一个音频 packet, 换算到输出的 time_base 并减去 offset, 这样才能和视频比较 dts
+static int read_audio_packet(AVFormatContext *context, int audio_index, AVPacket *packet, AVRational time_base,
+                             int64_t offset) {
+    int response;
+    while ((response = PROFILE(PROFILE_DEMUX, av_read_frame(context, packet))) >= 0) {
+        if (packet->stream_index == audio_index) {
+            av_packet_rescale_ts(packet, context->streams[audio_index]->time_base, time_base);
+            packet->pts -= offset;
+            packet->dts -= offset;
+            return 0;
+        }
+        av_packet_unref(packet);
+    }
+    return response;
+}
+
+/**
+ * 按顺序拼接所有段的视频, 同时从输入 copy 音频, 两路按 dts 交错写入最终输出.
+ */
+static int stitch_segments(const SegmentOptions *options, std::vector<Segment> *segments) {
+    int ret = 0;
+    int response = 0;
+    int audio_index = -1;
+    int video_response = AVERROR_EOF;
+    int audio_response = AVERROR_EOF;
+    int64_t audio_offset = 0;
+    AVFormatContext *input_context = nullptr;
+    AVFormatContext *output_context = nullptr;
+    AVStream *video_stream = nullptr;
+    AVStream *audio_stream = nullptr;
+    AVPacket *video_packet = nullptr;
+    AVPacket *audio_packet = nullptr;
+    SegmentReader reader = {};
+
+    reader.segments = segments;
+    reader.current = 0;
+    reader.first_start = segments->front().start;
+
+    // 原始输入只用来 copy 音频和提供视频流的 time_base
+    response = avformat_open_input(&input_context, options->input, nullptr, nullptr);
+    if (response < 0) {
+        error("cannot open input file(%s).", options->input);
+        ret = response;
+        goto end;
+    }
+    response = avformat_find_stream_info(input_context, nullptr);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    if (find_video_index(input_context) < 0) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+    reader.input_time_base = input_context->streams[find_video_index(input_context)]->time_base;
+    audio_index = av_find_best_stream(input_context, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    discard_other_streams(input_context, audio_index);
+
+    response = open_segment(&reader);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    response = avformat_alloc_output_context2(&output_context, options->format, nullptr, options->output);
+    if (response < 0) {
+        error("cannot alloc output context.");
+        ret = response;
+        goto end;
+    }
+
+    // 每一段的编码参数完全一样, 用第一段的 codecpar 就可以
+    video_stream = avformat_new_stream(output_context, nullptr);
+    if (video_stream == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    response = avcodec_parameters_copy(video_stream->codecpar, reader.context->streams[0]->codecpar);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+    video_stream->time_base = reader.context->streams[0]->time_base;
+    video_stream->avg_frame_rate = reader.context->streams[0]->avg_frame_rate;
+
+    if (audio_index >= 0) {
+        audio_stream = avformat_new_stream(output_context, nullptr);
+        if (audio_stream == nullptr) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        response = avcodec_parameters_copy(audio_stream->codecpar, input_context->streams[audio_index]->codecpar);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+        audio_stream->codecpar->codec_tag = 0;
+        audio_stream->time_base = input_context->streams[audio_index]->time_base;
+    }
+
+    if ((output_context->oformat->flags & AVFMT_NOFILE) == 0) {
+        response = avio_open(&output_context->pb, options->output, AVIO_FLAG_WRITE);
+        if (response < 0) {
+            error("cannot open output file(%s).", options->output);
+            ret = response;
+            goto end;
+        }
+    }
+
+    response = avformat_write_header(output_context, nullptr);
+    if (response < 0) {
+        error("cannot write header for output file.");
+        ret = response;
+        goto end;
+    }
+
+    video_packet = av_packet_alloc();
+    audio_packet = av_packet_alloc();
+    if (video_packet == nullptr || audio_packet == nullptr) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    // 音频和视频一起平移, 第一段的起点对应输出的 0
+    if (audio_stream != nullptr) {
+        audio_offset = av_rescale_q(reader.first_start, reader.input_time_base, audio_stream->time_base);
+        audio_response = read_audio_packet(input_context, audio_index, audio_packet, audio_stream->time_base,
+                                           audio_offset);
+    }
+    video_response = read_segment_packet(&reader, video_packet, video_stream->time_base);
+
+    while (video_response >= 0 || audio_response >= 0) {
+        bool write_video = audio_response < 0 ||
+                           (video_response >= 0 && av_compare_ts(video_packet->dts, video_stream->time_base,
+                                                                 audio_packet->dts, audio_stream->time_base) <= 0);
+        if (write_video) {
+            video_packet->stream_index = video_stream->index;
+            response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output_context, video_packet));
+            if (response < 0) {
+                error("cannot write video packet to output file.");
+                ret = response;
+                goto end;
+            }
+            video_response = read_segment_packet(&reader, video_packet, video_stream->time_base);
+            if (video_response < 0 && video_response != AVERROR_EOF) {
+                ret = video_response;
+                goto end;
+            }
+            continue;
+        }
+
+        audio_packet->stream_index = audio_stream->index;
+        if (audio_packet->pts < 0) {
+            // 第一个视频关键帧之前的音频
+            av_packet_unref(audio_packet);
+        } else {
+            response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output_context, audio_packet));
+            if (response < 0) {
+                error("cannot write audio packet to output file.");
+                ret = response;
+                goto end;
+            }
+        }
+        audio_response = read_audio_packet(input_context, audio_index, audio_packet, audio_stream->time_base,
+                                           audio_offset);
+        if (audio_response < 0 && audio_response != AVERROR_EOF) {
+            ret = audio_response;
+            goto end;
+        }
+    }
+
+    response = av_write_trailer(output_context);
+    if (response < 0) {
+        ret = response;
+        goto end;
+    }
+
+    end:
+    av_packet_free(&video_packet);
+    av_packet_free(&audio_packet);
+    avformat_close_input(&reader.context);
+    avformat_close_input(&input_context);
+    if (output_context != nullptr) {
+        if ((output_context->oformat->flags & AVFMT_NOFILE) == 0) {
+            avio_closep(&output_context->pb);
+        }
+        avformat_free_context(output_context);
+    }
+    return ret;
+}
+
+int run_segments(int argc, char *argv[]) {
+    if (argc < 4) {
+        error("usage: Transcoding -segmented <input> <output> [-segments N] [-jobs N] [-keep] [-profile] "
+              "[-decode-threads N]");
+        return -1;
+    }
+
+    SegmentOptions options;
+    options.input = argv[2];
+    options.output = argv[3];
+
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    if (cores <= 0) {
+        cores = 1;
+    }
+    int jobs_count = cores;
+    int segment_count = 0;
+    bool keep = false;
+    double profile_interval = 0;
+    options.decoder_threading = {};
+    for (int i = 4; i < argc; i++) {
+        int consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &options.decoder_threading);
+        }
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-segments") == 0 && i + 1 < argc) {
+            segment_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) {
+            jobs_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-keep") == 0) {
+            keep = true;
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+    if (jobs_count <= 0) {
+        jobs_count = 1;
+    }
+    if (segment_count <= 0) {
+        segment_count = jobs_count;
+    }
+
+    options.format = av_guess_format(nullptr, options.output, nullptr);
+    if (options.format == nullptr) {
+        error("cannot guess output format from %s.", options.output);
+        return -1;
+    }
+
+    // 同时跑多个 x265, 每个实例默认都会按全部核数建线程池, 这里把核平均分给每个 worker
+    int pools = cores / jobs_count > 0 ? cores / jobs_count : 1;
+    options.codec_priv_value = "keyint=60:min-keyint=60:scenecut=0:pools=" + std::to_string(pools);
+
+    std::vector<int64_t> keyframes;
+    int64_t end_pts = AV_NOPTS_VALUE;
+    int response = scan_keyframes(options.input, &keyframes, &end_pts);
+    if (response < 0) {
+        return response;
+    }
+    if (keyframes.empty()) {
+        error("no keyframe found in input video stream.");
+        return -1;
+    }
+
+    std::vector<Segment> segments = split_segments(keyframes, end_pts, segment_count, options.output);
+    if (jobs_count > static_cast<int>(segments.size())) {
+        jobs_count = static_cast<int>(segments.size());
+    }
+    options.decoder_threading.jobs = jobs_count;
+    info("%d keyframes, split into %d segments, %d threads.", static_cast<int>(keyframes.size()),
+         static_cast<int>(segments.size()), jobs_count);
+
+    profiler_run_start(profile_interval);
+    auto begin = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> next_segment(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < jobs_count; i++) {
+        workers.emplace_back([&options, &segments, &next_segment] {
+            size_t index;
+            while ((index = next_segment.fetch_add(1)) < segments.size()) {
+                transcode_segment(&options, &segments[index]);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    std::chrono::duration<double> encode_elapsed = std::chrono::steady_clock::now() - begin;
+    profiler_run_report();
+
+    int ret = 0;
+    int64_t frames = 0;
+    double busy = 0;
+    for (const Segment &segment : segments) {
+        info("segment %d: pts [%lld, %lld), %lld frames, %.3f s.", segment.index, (long long) segment.start,
+             (long long) (segment.end == INT64_MAX ? end_pts : segment.end), (long long) segment.frames,
+             segment.seconds);
+        if (segment.result < 0) {
+            error("segment %d failed: %d.", segment.index, segment.result);
+            ret = segment.result;
+        }
+        frames += segment.frames;
+        busy += segment.seconds;
+    }
+
+    if (ret == 0) {
+        ret = stitch_segments(&options, &segments);
+    }
+
+    if (!keep) {
+        for (const Segment &segment : segments) {
+            remove(segment.filename.c_str());
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    double seconds = elapsed.count() > 0 ? elapsed.count() : 1e-9;
+    info("%lld frames in %.3f s (encode %.3f s, stitch %.3f s), %.1f fps.", (long long) frames, elapsed.count(),
+         encode_elapsed.count(), elapsed.count() - encode_elapsed.count(), frames / seconds);
+    info("parallel speedup: %.2fx over the sum of segment times.",
+         encode_elapsed.count() > 0 ? busy / encode_elapsed.count() : 0.0);
+
+    if (ret == 0) {
+        info("success!");
+    } else {
+        error("something happened!");
+    }
+    return ret;
+}
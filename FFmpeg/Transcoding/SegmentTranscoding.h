@@ -0,0 +1,21 @@
+//
+// Created by PingZi on 2020/9/6.
+//
+
+#ifndef TRANSCODING_SEGMENTTRANSCODING_H
+#define TRANSCODING_SEGMENTTRANSCODING_H
+
+/**
+ * 分段并行转码: Transcoding -segmented <input> <output> [-segments N] [-jobs N] [-keep]
+ *
+ * 1. 扫描输入视频流的关键帧, 按时长把输入切成 N 段, 每段的起点都是一个关键帧.
+ * 2. 每段由一个线程独立解码/编码 (编码参数和 run_0826 的 prepare_video_encoder 一样, keyint=60 scenecut=0),
+ *    写到和输出同格式的临时文件 <output>.partN 里.
+ * 3. 所有段按顺序拼接成最终输出, 视频时间戳按每段在输入里的起点平移, 保证连续; 音频直接从输入 copy.
+ *
+ * 一帧属于 pts 落在 [段起点, 下一段起点) 的那一段, 即使输入是 open GOP 也不会重复或丢帧.
+ * -keep 保留临时文件, 方便排查.
+ */
+int run_segments(int argc, char *argv[]);
+
+#endif //TRANSCODING_SEGMENTTRANSCODING_H
@@ -0,0 +1,350 @@
+//
+// Created by PingZi on 2020/9/1.
+//
+
+#include <atomic>
+#include <thread>
+
+#include "TranscodingPipeline.h"
+#include "MediaQueue.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+typedef struct Pipeline Pipeline;
+
+// 一个需要处理的流 (video 或者 audio)
+typedef struct StreamPipeline {
+    Pipeline *pipeline;
+    const char *name;
+    bool enabled;
+    bool copy;
+    StreamContext *input;
+    StreamContext *output;
+    SpscPacketQueue *packets; // demux -> decode
+    SpscFrameQueue *frames;   // decode -> encode
+    std::thread decoder;
+    std::thread encoder;
+} StreamPipeline;
+
+struct Pipeline {
+    MediaFormat *input;
+    MediaFormat *output;
+    MpmcPacketQueue *mux_queue; // encode/demux -> mux, 多个生产者
+    std::atomic<int> mux_producers;
+    std::atomic<int> error;
+    StreamPipeline video;
+    StreamPipeline audio;
+};
+
+// 任何一个线程出错, 都要让其它线程尽快退出
+static void pipeline_fail(Pipeline *pipeline, int response) {
+    int expected = 0;
+    pipeline->error.compare_exchange_strong(expected, response < 0 ? response : AVERROR_UNKNOWN);
+
+    pipeline->mux_queue->abort(response);
+    StreamPipeline *streams[] = {&pipeline->video, &pipeline->audio};
+    for (StreamPipeline *stream : streams) {
+        if (stream->packets != nullptr) {
+            stream->packets->abort(response);
+        }
+        if (stream->frames != nullptr) {
+            stream->frames->abort(response);
+        }
+    }
+}
+
+// 每个往 mux 队列写数据的线程结束时调用, 最后一个结束的负责关闭 mux 队列
+static void mux_producer_done(Pipeline *pipeline) {
+    if (pipeline->mux_producers.fetch_sub(1) == 1) {
+        pipeline->mux_queue->close();
+    }
+}
+
+static StreamPipeline *find_stream(Pipeline *pipeline, int stream_index) {
+    if (pipeline->video.enabled && pipeline->video.input->stream_index == stream_index) {
+        return &pipeline->video;
+    }
+    if (pipeline->audio.enabled && pipeline->audio.input->stream_index == stream_index) {
+        return &pipeline->audio;
+    }
+    return nullptr;
+}
+
+static void demux_worker(Pipeline *pipeline) {
+    AVFormatContext *input_format = pipeline->input->format_context;
+    AVPacket *packet = av_packet_alloc();
+    if (packet == nullptr) {
+        error("cannot alloc memory for demux packet.");
+        pipeline_fail(pipeline, AVERROR(ENOMEM));
+        mux_producer_done(pipeline);
+        return;
+    }
+
+    int response = 0;
+    while (pipeline->error.load() == 0) {
+        response = PROFILE(PROFILE_DEMUX, av_read_frame(input_format, packet));
+        if (response < 0) {
+            if (response != AVERROR_EOF) {
+                error("error while reading input packet: %d.", response);
+                pipeline_fail(pipeline, response);
+            }
+            break;
+        }
+
+        StreamPipeline *stream = find_stream(pipeline, packet->stream_index);
+        if (stream == nullptr) {
+            av_packet_unref(packet);
+            continue;
+        }
+
+        // push 会把 packet 的引用移进队列, packet 自己变成空的, 下一次 av_read_frame 接着用
+        if (stream->copy) {
+            av_packet_rescale_ts(packet, stream->input->stream->time_base, stream->output->stream->time_base);
+            packet->stream_index = stream->output->stream_index;
+            packet->pos = -1;
+            response = pipeline->mux_queue->push(packet);
+        } else {
+            response = stream->packets->push(packet);
+        }
+
+        if (response < 0) {
+            av_packet_unref(packet);
+            break;
+        }
+    }
+
+    av_packet_free(&packet);
+
+    if (pipeline->video.packets != nullptr) {
+        pipeline->video.packets->close();
+    }
+    if (pipeline->audio.packets != nullptr) {
+        pipeline->audio.packets->close();
+    }
+    mux_producer_done(pipeline);
+}
+
+// 把解码器里能取出来的 frame 都取出来交给 encode 线程
+static int drain_decoder(StreamPipeline *stream, AVFrame *frame) {
+    AVCodecContext *decoder = stream->input->codec_context;
+    int response = 0;
+    while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
+        frame->pts = frame->best_effort_timestamp;
+
+        response = stream->frames->push(frame);
+        if (response < 0) {
+            av_frame_unref(frame);
+            return response;
+        }
+    }
+
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+        return 0;
+    }
+    return response;
+}
+
+static void decode_worker(StreamPipeline *stream) {
+    Pipeline *pipeline = stream->pipeline;
+    AVCodecContext *decoder = stream->input->codec_context;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    int response = frame == nullptr || packet == nullptr ? AVERROR(ENOMEM) : 0;
+
+    while (response >= 0 && (response = stream->packets->pop(packet)) == 0) {
+        response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
+        av_packet_unref(packet);
+        if (response < 0 && response != AVERROR(EAGAIN)) {
+            error("cannot send %s packet to decoder: %d.", stream->name, response);
+            break;
+        }
+
+        response = drain_decoder(stream, frame);
+    }
+
+    if (response == AVERROR_EOF) {
+        // flush decoder
+        PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, nullptr));
+        response = drain_decoder(stream, frame);
+    }
+
+    if (response < 0 && response != AVERROR_EOF && pipeline->error.load() == 0) {
+        error("error while decoding %s stream: %d.", stream->name, response);
+        pipeline_fail(pipeline, response);
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    stream->frames->close();
+}
+
+// 把编码器里能取出来的 packet 都取出来交给 mux 线程
+static int drain_encoder(StreamPipeline *stream, AVPacket *packet) {
+    AVCodecContext *encoder = stream->output->codec_context;
+    int response = 0;
+    while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, packet))) >= 0) {
+        av_packet_rescale_ts(packet, encoder->time_base, stream->output->stream->time_base);
+        packet->stream_index = stream->output->stream_index;
+
+        response = stream->pipeline->mux_queue->push(packet);
+        if (response < 0) {
+            av_packet_unref(packet);
+            return response;
+        }
+    }
+
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+        return 0;
+    }
+    return response;
+}
+
+static void encode_worker(StreamPipeline *stream) {
+    Pipeline *pipeline = stream->pipeline;
+    AVCodecContext *encoder = stream->output->codec_context;
+    AVRational input_time_base = stream->input->stream->time_base;
+    AVFrame *frame = av_frame_alloc();
+    // 输出流的 packet 池只有这个 encode 线程在用
+    AVPacket *packet = stream->output->packet_pool->acquire();
+    int response = frame == nullptr || packet == nullptr ? AVERROR(ENOMEM) : 0;
+
+    while (response >= 0 && (response = stream->frames->pop(frame)) == 0) {
+        frame->pts = av_rescale_q(frame->pts, input_time_base, encoder->time_base);
+        frame->pict_type = AV_PICTURE_TYPE_NONE;
+
+        response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, frame));
+        av_frame_unref(frame);
+        if (response < 0 && response != AVERROR(EAGAIN)) {
+            error("cannot send %s frame to encoder: %d.", stream->name, response);
+            break;
+        }
+
+        response = drain_encoder(stream, packet);
+    }
+
+    if (response == AVERROR_EOF) {
+        // flush encoder
+        PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, nullptr));
+        response = drain_encoder(stream, packet);
+    }
+
+    if (response < 0 && response != AVERROR_EOF && pipeline->error.load() == 0) {
+        error("error while encoding %s stream: %d.", stream->name, response);
+        pipeline_fail(pipeline, response);
+    }
+
+    av_frame_free(&frame);
+    stream->output->packet_pool->release(packet);
+    mux_producer_done(pipeline);
+}
+
+// 只有这一个线程会调用 av_interleaved_write_frame
+static void mux_worker(Pipeline *pipeline) {
+    AVFormatContext *output_format = pipeline->output->format_context;
+    AVPacket *packet = av_packet_alloc();
+    if (packet == nullptr) {
+        pipeline_fail(pipeline, AVERROR(ENOMEM));
+        return;
+    }
+
+    int response = 0;
+    while ((response = pipeline->mux_queue->pop(packet)) == 0) {
+        // av_interleaved_write_frame 会接管 packet 的引用
+        response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output_format, packet));
+        if (response < 0) {
+            error("cannot write packet to output file: %d.", response);
+            av_packet_unref(packet);
+            pipeline_fail(pipeline, response);
+            break;
+        }
+    }
+    av_packet_free(&packet);
+}
+
+static void init_stream(Pipeline *pipeline, StreamPipeline *stream, const char *name, bool copy,
+                        StreamContext *input, StreamContext *output, int queue_size) {
+    stream->pipeline = pipeline;
+    stream->name = name;
+    stream->copy = copy;
+    stream->input = input;
+    stream->output = output;
+    stream->enabled = input->stream != nullptr && output->stream != nullptr;
+    stream->packets = nullptr;
+    stream->frames = nullptr;
+
+    if (stream->enabled && !copy) {
+        stream->packets = new SpscPacketQueue(queue_size);
+        stream->frames = new SpscFrameQueue(queue_size);
+        pipeline->mux_producers++;
+    }
+}
+
+int run_pipeline(MediaFormat *input, MediaFormat *output, TranscodingParameters *parameters) {
+    int queue_size = parameters->queue_size > 0 ? parameters->queue_size : 8;
+
+    Pipeline pipeline;
+    pipeline.input = input;
+    pipeline.output = output;
+    pipeline.error = 0;
+    pipeline.mux_producers = 1; // demux 线程
+    // mux 队列是所有流共用的, 给它大一点
+    pipeline.mux_queue = new MpmcPacketQueue(queue_size * 4);
+
+    init_stream(&pipeline, &pipeline.video, "video", parameters->copy_video,
+                &input->video_stream, &output->video_stream, queue_size);
+    init_stream(&pipeline, &pipeline.audio, "audio", parameters->copy_audio,
+                &input->audio_stream, &output->audio_stream, queue_size);
+
+    StreamPipeline *streams[] = {&pipeline.video, &pipeline.audio};
+    bool allocated = pipeline.mux_queue->valid();
+    for (StreamPipeline *stream : streams) {
+        if (stream->packets != nullptr) {
+            allocated = allocated && stream->packets->valid() && stream->frames->valid();
+        }
+    }
+    if (!allocated) {
+        error("cannot alloc memory for pipeline queues.");
+        pipeline.error = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    info("start transcoding pipeline, queue size: %d.", queue_size);
+
+    {
+        std::thread muxer(mux_worker, &pipeline);
+        for (StreamPipeline *stream : streams) {
+            if (stream->enabled && !stream->copy) {
+                stream->encoder = std::thread(encode_worker, stream);
+                stream->decoder = std::thread(decode_worker, stream);
+            }
+        }
+        std::thread demuxer(demux_worker, &pipeline);
+
+        demuxer.join();
+        for (StreamPipeline *stream : streams) {
+            if (stream->decoder.joinable()) {
+                stream->decoder.join();
+            }
+            if (stream->encoder.joinable()) {
+                stream->encoder.join();
+            }
+        }
+        muxer.join();
+    }
+
+    end:
+    // 队列析构的时候会释放槽位里剩下的 packet/frame
+    for (StreamPipeline *stream : streams) {
+        delete stream->packets;
+        delete stream->frames;
+    }
+    delete pipeline.mux_queue;
+
+    int ret = pipeline.error.load();
+    if (ret < 0) {
+        error("transcoding pipeline failed: %d.", ret);
+    } else {
+        info("transcoding pipeline finished.");
+    }
+    return ret;
+}
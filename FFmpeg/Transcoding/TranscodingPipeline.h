@@ -0,0 +1,23 @@
+//
+// Created by PingZi on 2020/9/1.
+//
+
+#ifndef TRANSCODING_TRANSCODINGPIPELINE_H
+#define TRANSCODING_TRANSCODINGPIPELINE_H
+
+#include "transcoding0828.h"
+
+/**
+ * 多线程版本的转码循环.
+ *
+ * demux 线程 --packet--> 每个流的 decode 线程 --frame--> 每个流的 encode 线程 --packet--> mux 线程
+ *
+ * 直接拷贝的流 (copy) 不经过 decode/encode, 由 demux 线程转换 timebase 之后直接交给 mux 线程.
+ * 线程之间使用有界队列连接, 队列满的时候上游会阻塞, 所以内存占用是有上限的.
+ *
+ * input/output 需要已经打开 (open_input, new_output_xxx_stream, avformat_write_header 都做完了),
+ * 返回之后由调用方写 trailer.
+ */
+int run_pipeline(MediaFormat *input, MediaFormat *output, TranscodingParameters *parameters);
+
+#endif //TRANSCODING_TRANSCODINGPIPELINE_H
@@ -1,6 +1,20 @@
 #include <iostream>
+#include <cstring>
+
 #include "transcoding0828.h"
+#include "SegmentTranscoding.h"
+#include "LadderTranscoding.h"
+#include "ScaleBenchmark.h"
 
 int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "-segmented") == 0) {
+        return run_segments(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-ladder") == 0) {
+        return run_ladder(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-bench-scale") == 0) {
+        return run_scale_benchmark(argc, argv);
+    }
     return run0828(argc, argv);
 }
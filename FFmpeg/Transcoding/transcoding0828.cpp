@@ -2,67 +2,30 @@
 // Created by PingZi on 2020/8/28.
 //
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
 #include "transcoding0828.h"
+#include "TranscodingPipeline.h"
 #include "Logger.h"
+#include "Profiler.h"
 
-extern "C" {
-#include "libavformat/avformat.h"
-}
-
-typedef struct TranscodingParameters {
-    bool copy_audio;
-    bool copy_video;
-    char *video_codec;
-    char *audio_codec;
-    // 参数什么的不记得了
-} TranscodingParameters;
-
-typedef struct StreamContext {
-    int stream_index;
-    AVStream *stream;
-    AVCodecContext *codec_context;
-    AVCodec *codec;
-} StreamContext;
-
-// 对应示例项目的 StreamingContext
-typedef struct MediaFormat {
-    char *filename;
-    AVFormatContext *format_context;
-    StreamContext video_stream;
-    StreamContext audio_stream;
-
-} MediaFormat;
-
-int open_decoder(AVCodecParameters *parameters, AVCodec **codec, AVCodecContext **codec_context) {
-    *codec = avcodec_find_decoder(parameters->codec_id);
-    if ((*codec) == nullptr) {
-        error("cannot find decoder for codec_id: %d.", parameters->codec_id);
-        return -1;
-    }
-
-    *codec_context = avcodec_alloc_context3(*codec);
-    if ((*codec_context) == nullptr) {
-        error("cannot alloc memory for codec_context.");
-        return -1;
-    }
-
-    int response = avcodec_parameters_to_context(*codec_context, parameters);
+int open_decoder(AVCodecParameters *parameters, const DecoderThreading *threading,
+                 AVCodec **codec, AVCodecContext **codec_context) {
+    int response = open_decoder_context(parameters, threading, codec, codec_context);
     if (response < 0) {
-        error("cannot copy parameters to context.");
+        error("cannot open decoder for codec_id: %d, error code: %d.", parameters->codec_id, response);
         return response;
     }
 
-
-    response = avcodec_open2(*codec_context, *codec, nullptr);
-    if (response < 0) {
-        error("cannot open codec for decoder.");
-        return response;
+    if (parameters->codec_type == AVMEDIA_TYPE_VIDEO) {
+        info("video decoder %s uses %d thread(s).", (*codec)->name, (*codec_context)->thread_count);
     }
-
     return 0;
 }
 
-int open_input(MediaFormat *media) {
+int open_input(MediaFormat *media, const DecoderThreading *threading) {
     if (media->filename == nullptr) {
         error("cannot open file, file name is null");
         return -1;
@@ -85,12 +48,12 @@ int open_input(MediaFormat *media) {
         AVCodecParameters *parameters = current_stream->codecpar;
 
         if (parameters->codec_type == AVMEDIA_TYPE_VIDEO) {
-            info("find video stream index: %d in input file.");
+            info("find video stream index: %d in input file.", current_stream->index);
             AVCodec *codec = nullptr;
             AVCodecContext *decoder = nullptr;
 
             // open codec
-            response = open_decoder(parameters, &codec, &decoder);
+            response = open_decoder(parameters, threading, &codec, &decoder);
             if (response < 0) {
                 error("cannot open video decoder for input file: %d.", response);
                 return response;
@@ -108,7 +71,7 @@ int open_input(MediaFormat *media) {
             AVCodec *codec = nullptr;
             AVCodecContext *decoder = nullptr;
 
-            response = open_decoder(parameters, &codec, &decoder);
+            response = open_decoder(parameters, threading, &codec, &decoder);
             if (response < 0) {
                 error("cannot open audio decoder for input file: %d", response);
                 return response;
@@ -251,7 +214,7 @@ int new_output_audio_stream(bool copy_audio, const char *audio_codec,
 int remuxing(AVFormatContext *output, AVPacket *packet, AVRational src_ts, AVRational dest_ts) {
 
     av_packet_rescale_ts(packet, src_ts, dest_ts);
-    return av_interleaved_write_frame(output, packet);
+    return PROFILE(PROFILE_MUX, av_interleaved_write_frame(output, packet));
 }
 
 int write_audio_stream(MediaFormat input, MediaFormat output, AVPacket *packet, AVFrame *frame, bool copy) {
@@ -268,31 +231,33 @@ int write_audio_stream(MediaFormat input, MediaFormat output, AVPacket *packet,
         AVCodecContext *encoder = output.audio_stream.codec_context;
         AVCodecContext *decoder = input.audio_stream.codec_context;
 
-        int response = avcodec_send_packet(decoder, packet);
+        int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
+        av_packet_unref(packet);
         if (response < 0 && response != AVERROR(EAGAIN)) {
             error("cannot send packet to decoder.");
             return response;
         }
 
-        AVPacket *encoder_packet = av_packet_alloc();
+        PacketPool *pool = output.audio_stream.packet_pool;
+        AVPacket *encoder_packet = pool->acquire();
         if (encoder_packet == nullptr) {
             error("cannot alloc memory for encoder packet.");
             return -1;
         }
-        while ((response = avcodec_receive_frame(decoder, frame)) >= 0) {
+        while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
             // uncompress frame
-            response = avcodec_send_frame(encoder, frame);
+            response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, frame));
             if (response < 0 && response != AVERROR(EAGAIN)) {
                 error("cannot send frame to encoder.");
                 av_frame_unref(frame);
                 break;
             }
 
-            while ((response = avcodec_receive_packet(encoder, encoder_packet))) {
+            while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, encoder_packet))) >= 0) {
                 encoder_packet->stream_index = output.audio_stream.stream_index;
-                response = av_interleaved_write_frame(output.format_context, encoder_packet);
+                response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output.format_context, encoder_packet));
                 if (response < 0) {
-                    av_packet_unref(packet);
+                    av_packet_unref(encoder_packet);
                     break;
                 }
                 av_packet_unref(encoder_packet);
@@ -300,6 +265,7 @@ int write_audio_stream(MediaFormat input, MediaFormat output, AVPacket *packet,
 
             av_frame_unref(frame);
         }
+        pool->release(encoder_packet);
 
         if (response < 0 && response != AVERROR(EAGAIN)) {
             error("error while receive frame from decoder.");
@@ -326,28 +292,30 @@ int write_video_stream(MediaFormat input, MediaFormat output, AVPacket *packet,
         AVCodecContext *encoder = output.video_stream.codec_context;
         AVCodecContext *decoder = input.video_stream.codec_context;
 
-        int response = avcodec_send_packet(decoder, packet);
+        int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
+        av_packet_unref(packet);
         if (response < 0 && response != AVERROR(EAGAIN)) {
             error("error while send packet to decoder.");
             return response;
         }
 
-        AVPacket *encoder_packet = av_packet_alloc();
+        PacketPool *pool = output.video_stream.packet_pool;
+        AVPacket *encoder_packet = pool->acquire();
         if (encoder_packet == nullptr) {
             error("cannot alloc memory for encoder.");
             return -1;
         }
-        while ((response = avcodec_receive_frame(decoder, frame)) >= 0) {
+        while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
 
-            response = avcodec_send_frame(encoder, frame);
+            response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, frame));
             if (response < 0 && response != AVERROR(EAGAIN)) {
                 error("cannot send frame to video encoder.");
                 av_frame_unref(frame);
                 break;
             }
 
-            while ((response = avcodec_receive_packet(encoder, encoder_packet)) >= 0) {
-                response = av_interleaved_write_frame(output.format_context, encoder_packet);
+            while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, encoder_packet))) >= 0) {
+                response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output.format_context, encoder_packet));
                 if (response < 0) {
                     av_packet_unref(encoder_packet);
                     break;
@@ -357,6 +325,7 @@ int write_video_stream(MediaFormat input, MediaFormat output, AVPacket *packet,
 
             av_frame_unref(frame);
         }
+        pool->release(encoder_packet);
 
         if (response < 0 && response != AVERROR(EAGAIN)) {
             error("error while write packet to output file.");
@@ -367,22 +336,189 @@ int write_video_stream(MediaFormat input, MediaFormat output, AVPacket *packet,
     }
 }
 
+// 后台写线程的统计, blocked 是编码/复用线程因为磁盘跟不上而等待的时间, 理想情况下接近 0
+static void log_writer_stats(const AsyncWriterStats *stats) {
+    info("async writer: %.1f MB in %lld buffers (%lld direct), write %.3f s, blocked %.3f s, drain %.3f s.",
+         stats->bytes / (1024.0 * 1024), (long long) stats->buffers, (long long) stats->direct_buffers,
+         stats->write_seconds, stats->blocked_seconds, stats->drain_seconds);
+}
+
+/**
+ * 输入读完之后给解码器送空 packet, 把攒着的帧 (帧级多线程最多 thread_count - 1 帧) 都编码写出,
+ * 然后再给编码器送空帧, 写出编码器里剩下的 packet.
+ */
+static int flush_stream(StreamContext *input_stream, StreamContext *output_stream, AVFormatContext *output,
+                        AVFrame *frame) {
+    AVCodecContext *decoder = input_stream->codec_context;
+    AVCodecContext *encoder = output_stream->codec_context;
+    PacketPool *pool = output_stream->packet_pool;
+    AVPacket *encoder_packet = pool->acquire();
+    if (encoder_packet == nullptr) {
+        error("cannot alloc memory for encoder packet.");
+        return AVERROR(ENOMEM);
+    }
+
+    int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, nullptr));
+    while (response >= 0) {
+        response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame));
+        // 解码器里没有帧了, 接着 flush 编码器
+        AVFrame *input = response == AVERROR_EOF ? nullptr : frame;
+        if (response < 0 && response != AVERROR_EOF) {
+            error("error while draining decoder.");
+            break;
+        }
+
+        response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, input));
+        av_frame_unref(frame);
+        if (response < 0) {
+            error("cannot send frame to encoder while flushing.");
+            break;
+        }
+        while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, encoder_packet))) >= 0) {
+            encoder_packet->stream_index = output_stream->stream_index;
+            response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output, encoder_packet));
+            av_packet_unref(encoder_packet);
+            if (response < 0) {
+                error("cannot write flushed packet to output file.");
+                break;
+            }
+        }
+        if (response != AVERROR(EAGAIN) && response != AVERROR_EOF) {
+            break;
+        }
+        response = 0;
+        if (input == nullptr) {
+            break;
+        }
+    }
+    pool->release(encoder_packet);
+    return response;
+}
+
+static int run_serial(MediaFormat *input, MediaFormat *output, TranscodingParameters *parameters) {
+    MediaFormat &input_media = *input;
+    MediaFormat &output_media = *output;
+    AVStream **input_streams = input_media.format_context->streams;
+    int response = 0;
+    int ret = 0;
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    if (packet == nullptr || frame == nullptr) {
+        error("Failed to alloc memory for packet or frame.");
+        ret = -1;
+        goto end;
+    }
+    info("write packet or frame to output file.");
+    while ((PROFILE(PROFILE_DEMUX, av_read_frame(input_media.format_context, packet))) >= 0) {
+
+        AVStream *current_stream = input_streams[packet->stream_index];
+        AVCodecParameters *codec_params = current_stream->codecpar;
+
+        if (codec_params->codec_type == AVMEDIA_TYPE_AUDIO) {
+            response = write_audio_stream(input_media, output_media, packet, frame, parameters->copy_audio);
+            if (response < 0) {
+                error("Error while write stream to audio.");
+                ret = response;
+                av_packet_unref(packet);
+                goto end;
+            }
+            continue;
+        }
+
+        if (codec_params->codec_type == AVMEDIA_TYPE_VIDEO) {
+            response = write_video_stream(input_media, output_media, packet, frame, parameters->copy_video);
+            if (response < 0) {
+                error("Error while write stream to video.");
+                ret = response;
+                av_packet_unref(packet);
+                goto end;
+            }
+            continue;
+        }
+
+        av_packet_unref(packet);
+        debug("Ignore types other than audio and video.");
+    }
+
+    if (!parameters->copy_video) {
+        response = flush_stream(&input_media.video_stream, &output_media.video_stream, output_media.format_context,
+                                frame);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    }
+    if (!parameters->copy_audio) {
+        response = flush_stream(&input_media.audio_stream, &output_media.audio_stream, output_media.format_context,
+                                frame);
+        if (response < 0) {
+            ret = response;
+            goto end;
+        }
+    }
+
+    end:
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    return ret;
+}
+
 int run0828(int argc, char **argv) {
 
+    if (argc < 3) {
+        error("usage: Transcoding <input> <output> [-vcodec <encoder>] [-pipeline] [-queue <size>] [-async-write] "
+              "[-write-buffer <KB>] [-write-queue <N>] [-direct-io] [-prealloc <MB>] [-profile] "
+              "[-profile-interval <seconds>] [-profile-json <file>] [-decode-threads <N>] "
+              "[-decode-thread-type <frame|slice|auto>]");
+        return -1;
+    }
+
     int ret = 0;
 
     TranscodingParameters parameters = {};
     parameters.copy_video = false;
     parameters.copy_audio = true;
     parameters.video_codec = "libx265";
+    parameters.pipeline = false;
+    parameters.queue_size = 8;
+    double profile_interval = 0;
+
+    for (int i = 3; i < argc; i++) {
+        int consumed = parse_async_writer_option(argc, argv, i, &parameters.async_output, &parameters.writer_options);
+        if (consumed == 0) {
+            consumed = parse_profiler_option(argc, argv, i, &profile_interval);
+        }
+        if (consumed == 0) {
+            consumed = parse_decoder_threading_option(argc, argv, i, &parameters.decoder_threading);
+        }
+        if (consumed > 0) {
+            i += consumed - 1;
+        } else if (strcmp(argv[i], "-pipeline") == 0) {
+            parameters.pipeline = true;
+        } else if (strcmp(argv[i], "-serial") == 0) {
+            parameters.pipeline = false;
+        } else if (strcmp(argv[i], "-queue") == 0 && i + 1 < argc) {
+            parameters.queue_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-vcodec") == 0 && i + 1 < argc) {
+            parameters.video_codec = argv[++i];
+        } else {
+            error("unknown option: %s", argv[i]);
+            return -1;
+        }
+    }
+
+    profiler_run_start(profile_interval);
 
     MediaFormat input_media = {};
     MediaFormat output_media = {};
 
     input_media.filename = argv[1];
     output_media.filename = argv[2];
+    output_media.video_stream.packet_pool = new PacketPool();
+    output_media.audio_stream.packet_pool = new PacketPool();
 
-    int response = open_input(&input_media);
+    int response = open_input(&input_media, &parameters.decoder_threading);
     if (response < 0) {
         error("cannot open input file: %d.", response);
         ret = response;
@@ -424,7 +560,12 @@ int run0828(int argc, char **argv) {
 
     info("open output media file.");
     // open output and copy file
-    response = avio_open(&output_media.format_context->pb, output_media.filename, AVIO_FLAG_WRITE);
+    if (parameters.async_output) {
+        response = async_writer_open(&output_media.format_context->pb, output_media.filename,
+                                     &parameters.writer_options);
+    } else {
+        response = avio_open(&output_media.format_context->pb, output_media.filename, AVIO_FLAG_WRITE);
+    }
     if (response < 0) {
         error("cannot open media file named: %s", output_media.filename);
         ret = response;
@@ -441,44 +582,19 @@ int run0828(int argc, char **argv) {
         goto end;
     }
 
-    AVPacket *packet = av_packet_alloc();
-    AVFrame *frame = av_frame_alloc();
-    if (packet == nullptr || frame == nullptr) {
-        error("Failed to alloc memory for packet or frame.");
-        ret = -1;
-        goto end;
-    }
-    info("write packet or frame to output file.");
-    AVStream **input_streams = input_media.format_context->streams;
-    while ((av_read_frame(input_media.format_context, packet)) >= 0) {
-
-        AVStream *current_stream = input_streams[packet->stream_index];
-        AVCodecParameters *codec_params = current_stream->codecpar;
-
-        if (codec_params->codec_type == AVMEDIA_TYPE_AUDIO) {
-            response = write_audio_stream(input_media, output_media, packet, frame, parameters.copy_audio);
-            if (response < 0) {
-                error("Error while write stream to audio.");
-                ret = response;
-                av_packet_unref(packet);
-                goto end;
-            }
-            continue;
+    {
+        auto begin = std::chrono::steady_clock::now();
+        if (parameters.pipeline) {
+            response = run_pipeline(&input_media, &output_media, &parameters);
+        } else {
+            response = run_serial(&input_media, &output_media, &parameters);
         }
-
-        if (codec_params->codec_type == AVMEDIA_TYPE_VIDEO) {
-            response = write_video_stream(input_media, output_media, packet, frame, parameters.copy_video);
-            if (response < 0) {
-                error("Error while write stream to video.");
-                ret = response;
-                av_packet_unref(packet);
-                goto end;
-            }
-            continue;
+        if (response < 0) {
+            ret = response;
+            goto end;
         }
-
-        av_packet_unref(packet);
-        info("Ignore types other than audio and video.");
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        info("transcoding finished in %.3f s (%s).", elapsed.count(), parameters.pipeline ? "pipeline" : "serial");
     }
 
     response = av_write_trailer(output_media.format_context);
@@ -489,6 +605,30 @@ int run0828(int argc, char **argv) {
     }
     info("success!");
     end:
+    if (output_media.format_context != nullptr) {
+        if (parameters.async_output) {
+            AsyncWriterStats writer_stats = {};
+            response = async_writer_close(&output_media.format_context->pb, &writer_stats);
+            if (response < 0) {
+                error("error while writing output file: %d.", response);
+            }
+            log_writer_stats(&writer_stats);
+        } else {
+            avio_closep(&output_media.format_context->pb);
+        }
+    }
 
-    return 0;
+    profiler_run_report();
+
+    // 稳定之后每一帧不应该再 alloc packet, 否则算作失败
+    if (!check_media_pool("video packet pool", *output_media.video_stream.packet_pool) && ret == 0) {
+        ret = AVERROR_BUG;
+    }
+    if (!check_media_pool("audio packet pool", *output_media.audio_stream.packet_pool) && ret == 0) {
+        ret = AVERROR_BUG;
+    }
+    delete output_media.video_stream.packet_pool;
+    delete output_media.audio_stream.packet_pool;
+
+    return ret;
 }
\ No newline at end of file
@@ -5,6 +5,54 @@
 #ifndef TRANSCODING_TRANSCODING0828_H
 #define TRANSCODING_TRANSCODING0828_H
 
-#endif //TRANSCODING_TRANSCODING0828_H
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include "AsyncWriter.h"
+#include "DecoderThreads.h"
+#include "MediaPool.h"
+
+typedef struct TranscodingParameters {
+    bool copy_audio;
+    bool copy_video;
+    char *video_codec;
+    char *audio_codec;
+    // 参数什么的不记得了
+
+    // 使用多线程流水线 (demux -> decode -> encode -> mux), 否则走原来的单线程循环
+    bool pipeline;
+    // 流水线中每个队列的容量
+    int queue_size;
+
+    // 输出文件使用后台写线程 (AsyncWriter), 而不是 avio_open
+    bool async_output;
+    AsyncWriterOptions writer_options;
+
+    // 输入解码器的线程设置, 默认按核数自动
+    DecoderThreading decoder_threading;
+} TranscodingParameters;
 
-int run0828(int argc, char** argv);
\ No newline at end of file
+typedef struct StreamContext {
+    int stream_index;
+    AVStream *stream;
+    AVCodecContext *codec_context;
+    AVCodec *codec;
+    // 这个流编码输出用的 packet 池, 只在输出的 StreamContext 上使用
+    PacketPool *packet_pool;
+} StreamContext;
+
+// 对应示例项目的 StreamingContext
+typedef struct MediaFormat {
+    char *filename;
+    AVFormatContext *format_context;
+    StreamContext video_stream;
+    StreamContext audio_stream;
+
+} MediaFormat;
+
+int remuxing(AVFormatContext *output, AVPacket *packet, AVRational src_ts, AVRational dest_ts);
+
+int run0828(int argc, char** argv);
+
+#endif //TRANSCODING_TRANSCODING0828_H
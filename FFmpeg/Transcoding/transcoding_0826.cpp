@@ -2,38 +2,11 @@
 // Created by PingZi on 2020/8/26.
 //
 
+#include <algorithm>
+
 #include "transcoding_0826.h"
 #include "Logger.h"
-
-extern "C" {
-#include "libavformat/avformat.h"
-#include "libavdevice/avdevice.h"
-}
-
-typedef struct StreamingParams {
-    bool copy_video;
-    bool copy_audio;
-    char *output_extension;
-    char *muxer_opt_key;
-    char *muxer_opt_value;
-    char *video_codec;
-    char *audio_codec;
-    char *codec_priv_key;
-    char *codec_priv_value;
-} StreamingParams;
-
-typedef struct StreamingContext {
-    AVFormatContext *format_context;
-    AVCodec *video_codec;
-    AVCodec *audio_codec;
-    AVStream *video_stream;
-    AVStream *audio_stream;
-    AVCodecContext *video_codec_context;
-    AVCodecContext *audio_codec_context;
-    int video_index;
-    int audio_index;
-    char *filename;
-} StreamingContext;
+#include "Profiler.h"
 
 /**
  * 使用读取方式打开 streaming context
@@ -66,35 +39,17 @@ int open_media(StreamingContext *streaming_context) {
     return 0;
 }
 
-int fill_stream_info(AVStream *stream, AVCodec **codec, AVCodecContext **codec_context) {
+int fill_stream_info(AVStream *stream, const DecoderThreading *threading, AVCodec **codec, AVCodecContext **codec_context) {
     AVCodecParameters *parameters = stream->codecpar;
-    *codec = avcodec_find_decoder(parameters->codec_id);
-    if (*codec == nullptr) {
-        error("cannot find decoder for codec id: %d", parameters->codec_id);
-        return -1;
-    }
-
-    *codec_context = avcodec_alloc_context3(*codec);
-    if (*codec_context == nullptr) {
-        error("cannot alloc memory for codec context.");
-        return -1;
-    }
-
-    int response = avcodec_parameters_to_context(*codec_context, parameters);
-    if (response < 0) {
-        error("Error while copying parameters to context.");
-        return response;
-    }
-
-    response = avcodec_open2(*codec_context, *codec, nullptr);
+    int response = open_decoder_context(parameters, threading, codec, codec_context);
     if (response < 0) {
-        error("failed to open codec.");
+        error("failed to open decoder for codec id: %d, error code: %d", parameters->codec_id, response);
         return response;
     }
     return 0;
 }
 
-int prepare_decoder(StreamingContext *streaming_context) {
+int prepare_decoder(StreamingContext *streaming_context, const DecoderThreading *threading) {
     AVFormatContext *format_context = streaming_context->format_context;
     uint8_t number = format_context->nb_streams;
     AVStream **streams = format_context->streams;
@@ -109,6 +64,7 @@ int prepare_decoder(StreamingContext *streaming_context) {
             streaming_context->video_index = i;
             int response = fill_stream_info(
                     streaming_context->video_stream,
+                    threading,
                     &streaming_context->video_codec,
                     &streaming_context->video_codec_context
             );
@@ -125,6 +81,7 @@ int prepare_decoder(StreamingContext *streaming_context) {
             streaming_context->audio_stream = current_stream;
             int response = fill_stream_info(
                     current_stream,
+                    threading,
                     &streaming_context->audio_codec,
                     &streaming_context->audio_codec_context
             );
@@ -168,10 +125,18 @@ int prepare_video_encoder(StreamingContext *output_context, AVCodecContext *deco
         av_opt_set(output_context->video_codec_context->priv_data, params.codec_priv_key, params.codec_priv_value, 0);
     }
 
-    output_context->video_codec_context->height = decoder->height;
-    output_context->video_codec_context->width = decoder->width;
+    AVCodecContext *encoder = output_context->video_codec_context;
+    encoder->width = params.width > 0 ? params.width : decoder->width;
+    encoder->height = params.height > 0 ? params.height : decoder->height;
 
-    output_context->video_codec_context->sample_aspect_ratio = decoder->sample_aspect_ratio;
+    encoder->sample_aspect_ratio = decoder->sample_aspect_ratio;
+    if (encoder->width != decoder->width || encoder->height != decoder->height) {
+        // 缩放之后宽高比变了, 用 sample_aspect_ratio 补回来, 显示比例保持和输入一样
+        AVRational sar = decoder->sample_aspect_ratio.num > 0 ? decoder->sample_aspect_ratio : AVRational{1, 1};
+        av_reduce(&encoder->sample_aspect_ratio.num, &encoder->sample_aspect_ratio.den,
+                  static_cast<int64_t>(sar.num) * decoder->width * encoder->height,
+                  static_cast<int64_t>(sar.den) * decoder->height * encoder->width, INT_MAX);
+    }
     // TODO 这是在做什么
     if (output_context->video_codec->pix_fmts != nullptr) {
         output_context->video_codec_context->pix_fmt = output_context->video_codec->pix_fmts[0];
@@ -184,10 +149,28 @@ int prepare_video_encoder(StreamingContext *output_context, AVCodecContext *deco
     output_context->video_codec_context->rc_buffer_size = 4 * 1000 * 1000;
     output_context->video_codec_context->rc_max_rate = 2 * 1000 * 1000;
     output_context->video_codec_context->rc_min_rate = 2.5 * 1000 * 1000;
+    if (params.bit_rate > 0) {
+        encoder->bit_rate = params.bit_rate;
+        encoder->rc_max_rate = params.bit_rate;
+        encoder->rc_buffer_size = static_cast<int>(std::min<int64_t>(params.bit_rate * 2, INT_MAX));
+        encoder->rc_min_rate = 0;
+    }
+    if (params.gop_size > 0) {
+        // 通用字段对所有编码器都有效, 不依赖 x264-params 之类的私有参数
+        encoder->gop_size = params.gop_size;
+        encoder->keyint_min = params.gop_size;
+        encoder->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+    }
 
     output_context->video_codec_context->time_base = av_inv_q(input_framerate); // TODO 新函数
     output_context->video_stream->time_base = output_context->video_codec_context->time_base;
 
+    // 需要全局头的封装格式 (mp4/mkv...), 让编码器把 VPS/SPS/PPS 放进 extradata 而不是每个关键帧里.
+    // 分段转码拼接的时候直接拷贝第一段的 codecpar, 依赖每段的 extradata 完全一致
+    if ((output_context->format_context->oformat->flags & AVFMT_GLOBALHEADER) != 0) {
+        output_context->video_codec_context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
     int response = avcodec_open2(output_context->video_codec_context, output_context->video_codec, nullptr);
     if (response < 0) {
         error("cannot open codec for output context");
@@ -258,11 +241,12 @@ int64_t av_rational_division(AVRational left, AVRational right) {
 }
 
 int encode_video(StreamingContext *input_context, StreamingContext *output_context, AVFrame *frame) {
-    info("run video encoding.");
+    debug("run video encoding.");
     if (frame != nullptr) { // frame 有可能为空, 在最后一部分 flush 的时候
-        frame->pict_type = AV_PICTURE_TYPE_NONE; // TODO 是什么\
+        frame->pict_type = AV_PICTURE_TYPE_NONE; // TODO 是什么
     }
-    AVPacket *packet = av_packet_alloc();
+    PacketPool *pool = output_context->video_packet_pool;
+    AVPacket *packet = pool->acquire();
     if (packet == nullptr) {
         error("cannot alloc memory for video output packet.");
         return -1;
@@ -271,52 +255,51 @@ int encode_video(StreamingContext *input_context, StreamingContext *output_conte
     AVCodecContext *encoder = output_context->video_codec_context;
     AVCodecContext *decoder = input_context->video_codec_context;
 
-    int response = avcodec_send_frame(encoder, frame);
+    int response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, frame));
     if (response < 0) {
         error("error while sending frame to video encoder.");
-        av_packet_unref(packet);
         av_frame_unref(frame);
-        av_packet_free(&packet);
+        pool->release(packet);
         return response;
     }
 
-    while ((response = avcodec_receive_packet(encoder, packet)) >= 0) {
+    while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, packet))) >= 0) {
         packet->stream_index = output_context->video_index;
         packet->duration = av_rational_division(input_context->video_stream->avg_frame_rate,
                                                 output_context->video_stream->time_base);
         av_packet_rescale_ts(packet, input_context->video_stream->time_base, output_context->video_stream->time_base);
-        response = av_interleaved_write_frame(output_context->format_context, packet);
+        response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output_context->format_context, packet));
         if (response < 0) {
             error("cannot write frame for output video.");
-            av_packet_unref(packet);
             av_frame_unref(frame);
-            av_packet_free(&packet);
+            pool->release(packet);
             return response;
         }
     }
-    av_packet_unref(packet);
     av_frame_unref(frame);
-    av_packet_free(&packet);
+    pool->release(packet);
 
     return 0;
 }
 
 int encode_audio(StreamingContext *input_context, StreamingContext *output_context,
                  AVFrame *frame) {
-    info("run audio encoding...");
+    debug("run audio encoding...");
     AVCodecContext *encoder = output_context->audio_codec_context;
     AVCodecContext *decoder = input_context->audio_codec_context;
 
-    AVPacket *packet = av_packet_alloc();
+    PacketPool *pool = output_context->audio_packet_pool;
+    AVPacket *packet = pool->acquire();
     if (packet == nullptr) {
         error("Cannot alloc packet for audio encoder.");
         return -1;
     }
 
-    int response = avcodec_send_frame(encoder, frame);
+    int response = PROFILE(PROFILE_SEND_FRAME, avcodec_send_frame(encoder, frame));
     if (response < 0) {
         if (response == AVERROR_EOF) {
-            info("send frame to encoder catch eof.");
+            debug("send frame to encoder catch eof.");
+            pool->release(packet);
             return 0;
         }
 
@@ -324,22 +307,22 @@ int encode_audio(StreamingContext *input_context, StreamingContext *output_conte
             response = 0;
         } else {
             error("Failed to send frame to audio encoder.");
+            pool->release(packet);
             return -1;
         }
     }
 
-    while ((response = avcodec_receive_packet(encoder, packet)) >= 0) {
+    while ((response = PROFILE(PROFILE_RECEIVE_PACKET, avcodec_receive_packet(encoder, packet))) >= 0) {
         packet->stream_index = output_context->audio_index;
-        response = av_interleaved_write_frame(output_context->format_context, packet);
+        response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(output_context->format_context, packet));
         if (response < 0) {
             error("Failed to write frame to output audio stream");
-            av_packet_unref(packet);
             av_frame_unref(frame);
-            av_packet_free(&packet);
+            pool->release(packet);
             return response;
         }
     }
-    av_packet_free(&packet);
+    pool->release(packet);
 
     if (response < 0 && response != AVERROR_EOF && response != AVERROR(EAGAIN)) {
         error("Failed to receive packet from audio encoder.");
@@ -347,7 +330,7 @@ int encode_audio(StreamingContext *input_context, StreamingContext *output_conte
     }
 
     if (response == AVERROR_EOF) {
-        info("receiving frame from audio encoder catch EOF.");
+        debug("receiving frame from audio encoder catch EOF.");
     }
 
     return 0;
@@ -359,14 +342,14 @@ int transcode_video(StreamingContext *input_context, StreamingContext *output_co
     AVCodecContext *encoder = output_context->video_codec_context;
     AVCodecContext *decoder = input_context->video_codec_context;
 
-    int response = avcodec_send_packet(decoder, packet);
+    int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
     if (response < 0 && response != AVERROR_EOF && response != AVERROR(EAGAIN)) {
         error("failed to send packet to decoder");
         return response;
     }
 
     if (response == AVERROR_EOF) {
-        info("decoder EOF");
+        debug("decoder EOF");
         return 0;
     }
 
@@ -374,7 +357,7 @@ int transcode_video(StreamingContext *input_context, StreamingContext *output_co
         response = 0;
     }
 
-    while ((response = avcodec_receive_frame(decoder, frame)) >= 0) {
+    while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
         response = encode_video(input_context, output_context, frame);
         if (response < 0) {
             error("Failed to encode video");
@@ -383,7 +366,7 @@ int transcode_video(StreamingContext *input_context, StreamingContext *output_co
     }
 
     if (response == AVERROR_EOF) {
-        info("receive EOF.");
+        debug("receive EOF.");
         return 0;
     }
 
@@ -399,9 +382,9 @@ int transcode_audio(StreamingContext *input_context, StreamingContext *output_co
     AVCodecContext *encoder = output_context->audio_codec_context;
     AVCodecContext *decoder = input_context->audio_codec_context;
 
-    int response = avcodec_send_packet(decoder, packet);
+    int response = PROFILE(PROFILE_SEND_PACKET, avcodec_send_packet(decoder, packet));
     if (response == AVERROR_EOF) {
-        info("send audio packet catch eof.");
+        debug("send audio packet catch eof.");
         return 0;
     }
 
@@ -414,7 +397,7 @@ int transcode_audio(StreamingContext *input_context, StreamingContext *output_co
         return response;
     }
 
-    while ((response = avcodec_receive_frame(decoder, frame)) >= 0) {
+    while ((response = PROFILE(PROFILE_RECEIVE_FRAME, avcodec_receive_frame(decoder, frame))) >= 0) {
         response = encode_audio(input_context, output_context, frame);
         if (response < 0) {
             error("Failed to decoder audio.");
@@ -422,7 +405,7 @@ int transcode_audio(StreamingContext *input_context, StreamingContext *output_co
         }
     }
     if (response == AVERROR_EOF) {
-        info("receiving audio packet catch eof,");
+        debug("receiving audio packet catch eof,");
         return 0;
     }
 
@@ -439,10 +422,10 @@ int transcode_audio(StreamingContext *input_context, StreamingContext *output_co
 }
 
 int remux(AVPacket **packet, AVFormatContext **output_context, AVRational input_timebase, AVRational output_timebase) {
-    info("remux...");
+    debug("remux...");
     // TODO ssm
     av_packet_rescale_ts(*packet, input_timebase, output_timebase);
-    int response = av_interleaved_write_frame(*output_context, *packet);
+    int response = PROFILE(PROFILE_MUX, av_interleaved_write_frame(*output_context, *packet));
     if (response < 0) {
         error("error while copying stream packet.");
         return response;
@@ -474,6 +457,8 @@ int run_0826(int argc, char **argv) {
 
     StreamingContext *output_context = static_cast<StreamingContext *>(calloc(1, sizeof(StreamingContext)));
     output_context->filename = argv[2];
+    output_context->video_packet_pool = new PacketPool();
+    output_context->audio_packet_pool = new PacketPool();
 
     if (params.output_extension != nullptr) {
         strcat(output_context->filename, params.output_extension);
@@ -485,7 +470,7 @@ int run_0826(int argc, char **argv) {
         ret = response;
         goto end;
     }
-    response = prepare_decoder(input_context);
+    response = prepare_decoder(input_context, nullptr);
     if (response < 0) {
         error("Failed to prepare decoder.");
         ret = response;
@@ -579,12 +564,12 @@ int run_0826(int argc, char **argv) {
 
     response = avformat_write_header(output_context->format_context, &muxer_opts);
     AVStream **input_streams = input_context->format_context->streams;
-    while (av_read_frame(input_context->format_context, packet) >= 0) {
+    while (PROFILE(PROFILE_DEMUX, av_read_frame(input_context->format_context, packet)) >= 0) {
         int stream_index = packet->stream_index;
         AVMediaType current_type = input_streams[stream_index]->codecpar->codec_type;
 
         if (current_type == AVMEDIA_TYPE_AUDIO) {
-            info("precessing encode/copy audio stream.");
+            debug("precessing encode/copy audio stream.");
             if (!params.copy_audio) {
                 response = transcode_audio(input_context, output_context, packet, frame);
                 av_packet_unref(packet);
@@ -608,7 +593,7 @@ int run_0826(int argc, char **argv) {
         }
 
         if (current_type == AVMEDIA_TYPE_VIDEO) {
-            info("precessing encode/copy video stream.");
+            debug("precessing encode/copy video stream.");
             if (!params.copy_video) {
                 response = transcode_video(input_context, output_context, packet, frame);
                 if (response < 0) {
@@ -627,10 +612,28 @@ int run_0826(int argc, char **argv) {
         av_packet_unref(packet);
     }
 
-    response = encode_video(input_context, output_context, nullptr);
-    if (response < 0) {
-        ret = response;
-        goto end;
+    // 先给解码器送空 packet, 把帧级多线程攒着的帧都编码掉, 然后再 flush 编码器
+    if (!params.copy_video) {
+        response = transcode_video(input_context, output_context, nullptr, frame);
+        if (response >= 0) {
+            response = encode_video(input_context, output_context, nullptr);
+        }
+        if (response < 0) {
+            error("failed to flush video.");
+            ret = response;
+            goto end;
+        }
+    }
+    if (!params.copy_audio) {
+        response = transcode_audio(input_context, output_context, nullptr, frame);
+        if (response >= 0) {
+            response = encode_audio(input_context, output_context, nullptr);
+        }
+        if (response < 0) {
+            error("failed to flush audio.");
+            ret = response;
+            goto end;
+        }
     }
     av_write_trailer(output_context->format_context);
 
@@ -657,6 +660,16 @@ int run_0826(int argc, char **argv) {
     input_context->format_context = nullptr;
     output_context->format_context = nullptr;
 
+    // 稳定之后每一帧不应该再 alloc packet, 否则算作失败
+    if (!check_media_pool("video packet pool", *output_context->video_packet_pool) && ret == 0) {
+        ret = AVERROR_BUG;
+    }
+    if (!check_media_pool("audio packet pool", *output_context->audio_packet_pool) && ret == 0) {
+        ret = AVERROR_BUG;
+    }
+    delete output_context->video_packet_pool;
+    delete output_context->audio_packet_pool;
+
     free(input_context);
     free(output_context);
     input_context = nullptr;
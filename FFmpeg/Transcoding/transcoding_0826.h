@@ -5,6 +5,57 @@
 #ifndef TRANSCODING_TRANSCODING_0826_H
 #define TRANSCODING_TRANSCODING_0826_H
 
-#endif //TRANSCODING_TRANSCODING_0826_H
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavdevice/avdevice.h"
+}
+
+#include "DecoderThreads.h"
+#include "MediaPool.h"
+
+typedef struct StreamingParams {
+    bool copy_video;
+    bool copy_audio;
+    char *output_extension;
+    char *muxer_opt_key;
+    char *muxer_opt_value;
+    char *video_codec;
+    char *audio_codec;
+    char *codec_priv_key;
+    char *codec_priv_value;
+    // 输出的分辨率, 0 表示和解码器一样. 和输入的宽高比不同的时候调整 sample_aspect_ratio, 显示比例不变
+    int width;
+    int height;
+    // 目标码率 (bit/s), 同时作为 VBV 的 maxrate, buffer 是两倍. 0 表示原来的固定设置
+    int64_t bit_rate;
+    // 固定的关键帧间隔 (帧数), 同时作为最小间隔并且使用 closed GOP. 0 表示编码器默认
+    int gop_size;
+} StreamingParams;
+
+typedef struct StreamingContext {
+    AVFormatContext *format_context;
+    AVCodec *video_codec;
+    AVCodec *audio_codec;
+    AVStream *video_stream;
+    AVStream *audio_stream;
+    AVCodecContext *video_codec_context;
+    AVCodecContext *audio_codec_context;
+    int video_index;
+    int audio_index;
+    char *filename;
+    // 编码输出用的 packet 池, 每个流一个, 避免每一帧都 av_packet_alloc/av_packet_free
+    PacketPool *video_packet_pool;
+    PacketPool *audio_packet_pool;
+} StreamingContext;
+
+int open_media(StreamingContext *streaming_context);
 
-int run_0826(int argc, char *argv[]);
\ No newline at end of file
+// 打开输入里所有音视频流的解码器, threading 为 nullptr 的时候视频解码线程数按核数自动选择
+int prepare_decoder(StreamingContext *streaming_context, const DecoderThreading *threading);
+
+int prepare_video_encoder(StreamingContext *output_context, AVCodecContext *decoder, AVRational input_framerate,
+                          StreamingParams params);
+
+int run_0826(int argc, char *argv[]);
+
+#endif //TRANSCODING_TRANSCODING_0826_H